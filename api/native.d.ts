@@ -96,6 +96,28 @@ declare module NativeInterface
          */
         onLicenseChanged: (callback: (data: ILicenseData) => void) => void;
 
+        /**
+         * The callback function will be called when a process started with
+         * "spawnProcess" has written output or has terminated.
+         *
+         * @param callback
+         *   Function called with an array of IProcessEvent objects. Output is
+         *   collected for a short time and delivered in batches; the "exit"
+         *   event of a process is always the last event reported for it.
+         */
+        onProcessEvent: (callback: (events: IProcessEvent[]) => void) => void;
+
+        /**
+         * The callback function will be called when a download started with
+         * "download" has made progress or has finished.
+         *
+         * @param callback
+         *   Function called with an array of IDownloadEvent objects. Progress
+         *   events are sent at most every "progressInterval" milliseconds;
+         *   the "finished" event is always the last event of a download.
+         */
+        onDownloadEvent: (callback: (events: IDownloadEvent[]) => void) => void;
+
         /**
          * The callback function will be invoked when the app is about to
          * terminate.
@@ -558,10 +580,18 @@ declare module NativeInterface
          *   Read options.
          *
          * @param callback
-         *   Callback invoked with an error object and the contents of the file as a string.
+         *   Callback invoked with an error object, the contents of the file as a string,
+         *   and the encoding the file was decoded from (e.g., "utf-8", "utf-16le",
+         *   "utf-16be", "latin1", or "image/png;base64" for images).
          *   If no error occurred, "err" is null.
+         *
+         * Large or binary files can be streamed without converting them to a
+         * string (CEF only):
+         *   fetch("zephyros://api/readFile?path=" + encodeURIComponent(JSON.stringify(path)))
+         * resolves to a Response with the raw file contents; on failure, the
+         * status is 400/500 and the body is the JSON error object.
          */
-        readFile: (path: IPath, options: IReadFileOptions, callback: (err: Error, contents: string) => void) => void;
+        readFile: (path: IPath, options: IReadFileOptions, callback: (err: Error, contents: string, encoding: string) => void) => void;
 
         /**
          * Writes "contents" to a file located at "path".
@@ -579,6 +609,12 @@ declare module NativeInterface
          *   Callback invoked when the operation has completed and providing
          *   an error object in case an error occurred.
          *   If no error occurred, "err" is null.
+         *
+         * Large or binary contents (e.g., a Blob) can be written without
+         * converting them to a string (CEF only):
+         *   fetch("zephyros://api/writeFile?path=" + encodeURIComponent(JSON.stringify(path)),
+         *       { method: "POST", body: blob })
+         * responds with status 204 on success.
          */
         writeFile: (path: IPath, contents: string, options: IWriteFileOptions, callback: (err: Error) => void) => void;
 
@@ -644,9 +680,9 @@ declare module NativeInterface
          * in the "extensions" array are reported. The extensions in the
          * array have to start with a dot ".".
          *
-         * Only one directory can be watched at a time.
-         * If this function is called while file watching is already active,
-         * the previous directory will no longer be watched.
+         * Several directories can be watched at the same time, each with
+         * its own extensions and delay. The changes reported to
+         * "onFileChanged" carry the handle of the watch which detected them.
          *
          * @param path
          *   The path to the directory to be watched for file changes.
@@ -661,14 +697,45 @@ declare module NativeInterface
          *   the "onFileChanged" event. If delay is > 0, the event isn't fired
          *   until there haven't been any file changes for the amount of time
          *   specified by "delay" (i.e., emitting the event is debounced).
+         *
+         * @param options
+         *   Optional gitignore-style glob patterns restricting the watched
+         *   files (see IFileWatcherOptions). Directories matched by the
+         *   "ignore" patterns, e.g. "node_modules/" or ".git/", aren't
+         *   watched at all (on Linux).
+         *
+         * @param callback
+         *   Optional callback called with the handle of the watch, which can
+         *   be passed to "stopWatchingFiles".
          */
-        startWatchingFiles: (path: IPath, extensions: string[], delay: number) => void;
+        startWatchingFiles: (path: IPath, extensions: string[], delay: number, options?: IFileWatcherOptions, callback?: (handle: number) => void) => void;
 
         /**
          * Stops file watching which was previously started by calling
          * "startWatchingFiles".
+         *
+         * @param handle
+         *   The handle of the watch to stop. If omitted, all watches are
+         *   stopped.
+         */
+        stopWatchingFiles: (handle?: number) => void;
+
+        /**
+         * Retrieves how a directory watched by "startWatchingFiles" is covered.
+         *
+         * On Linux, each directory in the tree needs an inotify watch. When
+         * the system's watch limit is reached, the remaining directories are
+         * polled every few seconds instead. On Mac and Windows, the entire
+         * tree is watched with a single watch.
+         *
+         * @param handle
+         *   The handle of the watch returned by "startWatchingFiles".
+         *
+         * @param callback
+         *   Callback called with the status, or null if there is no watch
+         *   with the handle.
          */
-        stopWatchingFiles: () => void;
+        getFileWatcherStatus: (handle: number, callback: (status: IFileWatcherStatus) => void) => void;
 
         /**
          * Retrieves the path to the temporary directory on the system.
@@ -709,17 +776,124 @@ declare module NativeInterface
          * @param cwd
          *   The current working directory for the executable.
          *
+         * @param options
+         *   Optional limits: a timeout, the signal the process is killed with,
+         *   and the maximum number of bytes of output. Only supported on Linux.
+         *
          * @param callback
          *   Callback called when the process launched has terminated. The
          *   callback is passed an error object, the exit code of the process,
-         *   and an array of IOutputStreamData objects containing the contents
-         *   of stdout and stderr.
+         *   an array of IOutputStreamData objects containing the contents
+         *   of stdout and stderr, and the resources the process has used
+         *   (only on Linux).
          */
         startProcess: (
             executablePath: string, 
             args: string[], 
             cwd: string, 
-            callback: (err: Error, exitCode: number, output: IOutputStreamData[]) => void) => void;
+            options?: IProcessOptions,
+            callback?: (err: Error, exitCode: number, output: IOutputStreamData[], usage: IProcessUsage) => void) => void;
+
+        /**
+         * Starts the process with path "executablePath" and arguments "args"
+         * in the directory "cwd" like "startProcess", but reports its output
+         * while it is running: the output and the exit code are delivered to
+         * the "onProcessEvent" callbacks, tagged with the handle of the
+         * process. Only supported on Linux.
+         *
+         * @param executablePath
+         *   The path to the executable.
+         *
+         * @param args
+         *   The command line arguments to the executable.
+         *
+         * @param cwd
+         *   The current working directory for the executable.
+         *
+         * @param options
+         *   Optional limits like for "startProcess".
+         *
+         * @param callback
+         *   Callback called with an error object if the process couldn't be
+         *   started, or with the handle of the process, which can be passed to
+         *   "writeProcessInput", "closeProcessInput" and "killProcess".
+         */
+        spawnProcess: (
+            executablePath: string,
+            args: string[],
+            cwd: string,
+            options?: IProcessOptions,
+            callback?: (err: Error, handle: number) => void) => void;
+
+        /**
+         * Writes "data" to stdin of a process started with "spawnProcess".
+         * The data is written asynchronously; it is discarded if the process
+         * has terminated or doesn't read its input any more.
+         */
+        writeProcessInput: (handle: number, data: string) => void;
+
+        /**
+         * Closes stdin of a process started with "spawnProcess" once all of
+         * the input written has been delivered.
+         */
+        closeProcessInput: (handle: number) => void;
+
+        /**
+         * Sends the signal "signal" (e.g. "SIGINT", default: "SIGTERM") to a
+         * process started with "spawnProcess". Its exit is reported to the
+         * "onProcessEvent" callbacks as usual.
+         */
+        killProcess: (handle: number, signal?: string) => void;
+
+        /**
+         * Starts a pool of "numWorkers" long-lived workers running the
+         * executable, so repeated invocations of the same tool don't pay for
+         * starting a process each time. Only supported on Linux.
+         *
+         * Requests are passed to idle workers on stdin, and the workers
+         * respond on stdout. Both are framed as messages: the length of the
+         * UTF-8 encoded payload in bytes as a 4 byte big-endian integer,
+         * followed by the payload. A worker has to respond to each request
+         * with exactly one message, and has to terminate when its stdin is
+         * closed. Workers which terminate are restarted; output on stderr is
+         * written to the log.
+         *
+         * The executable path and the working directory are globbed like in
+         * "startProcess".
+         *
+         * @param callback
+         *   Callback called with an error object if the workers couldn't be
+         *   started, or with the handle of the pool.
+         */
+        createProcessPool: (
+            executablePath: string,
+            args: string[],
+            cwd: string,
+            numWorkers: number,
+            callback: (err: Error, handle: number) => void) => void;
+
+        /**
+         * Sends "data" to the next idle worker of a process pool. Requests are
+         * queued while all workers are busy.
+         *
+         * @param callback
+         *   Callback called with the response of the worker, or with an error
+         *   object if the worker has terminated before responding or the pool
+         *   has been destroyed.
+         */
+        sendToProcessPool: (handle: number, data: string, callback: (err: Error, response: string) => void) => void;
+
+        /**
+         * Retrieves queueing and latency metrics of a process pool, or null
+         * if there is no pool with this handle.
+         */
+        getProcessPoolStatus: (handle: number, callback: (status: IProcessPoolStatus) => void) => void;
+
+        /**
+         * Closes stdin of the workers of a process pool and fails the
+         * requests which haven't been responded to.
+         */
+        destroyProcessPool: (handle: number) => void;
 
 
         ///////////////////////////////////////////////////////////////////////
@@ -747,7 +921,9 @@ declare module NativeInterface
         /**
          * jQuery-compatible ajax method that can be used for cross-domain
          * requests (only available in the Mac OS X WebView version of
-         * Zephyros since no XHR requests are supported there).
+         * Zephyros since no XHR requests are supported there, and on Linux,
+         * where the requests are made natively, bypassing CORS and the
+         * browser's proxy settings).
          *
          * @param options
          *   Cf. http://api.jquery.com/jquery.ajax/
@@ -766,6 +942,42 @@ declare module NativeInterface
          */
         getProxyForURL: (url: string, callback: (proxyConfig: IProxyConfig) => void) => void;
 
+        /**
+         * Downloads a file straight to disk. Only supported on Linux.
+         *
+         * Large files are split into segments which are downloaded in
+         * parallel if the server supports range requests. The data are
+         * written to "<destPath>.part", and the file is renamed to
+         * "destPath" once its size and hash have been verified. If a
+         * download is interrupted (cancelled, failed, or the app quit), it is
+         * resumed by downloading the same URL to the same path again.
+         *
+         * @param url
+         *   The URL of the file.
+         *
+         * @param destPath
+         *   The path to store the file at.
+         *
+         * @param options
+         *   The expected size and hash of the file, the number of parallel
+         *   connections, and the interval of the progress events.
+         *
+         * @param callback
+         *   Called with an error if the download couldn't be started, or
+         *   with the handle of the download, which is passed to the
+         *   "onDownloadEvent" callbacks.
+         */
+        download: (url: string, destPath: string, options?: IDownloadOptions, callback?: (err: Error, handle: number) => void) => void;
+
+        /**
+         * Cancels a download. The data received so far are kept, so the
+         * download can be resumed later. Only supported on Linux.
+         *
+         * @param handle
+         *   The handle of the download.
+         */
+        cancelDownload: (handle: number) => void;
+
 
         ///////////////////////////////////////////////////////////////////////
         // Windows, Notifications
@@ -829,7 +1041,8 @@ declare module NativeInterface
          * convert any image format known to Mac to a PNG (displayable in the
          * web content of the app).
          *
-         * Available only on Mac OS X.
+         * Available only on Mac OS X and Linux. On Linux, a data URL is
+         * accepted as well.
          *
          * @param base64ImageData
          *   The image as a base64-encoded string to convert to the PNG format.
@@ -839,6 +1052,26 @@ declare module NativeInterface
          */
         convertImage: (base64ImageData: string, callback: (base64PNG: string) => void) => void;
 
+        /**
+         * Converts a batch of image files to PNG or JPEG, optionally scaling
+         * them down. The images are converted in parallel.
+         *
+         * Available only on Linux.
+         *
+         * @param paths
+         *   The paths of the images to convert.
+         *
+         * @param options
+         *   The target format and size, and the directory to write the
+         *   converted images to. If no output directory is given, the images
+         *   are returned as data URLs.
+         *
+         * @param callback
+         *   Callback called with the results, in the order of "paths", when
+         *   all images have been converted.
+         */
+        convertImages: (paths: string[], options?: IImageConversionOptions, callback?: (results: IConvertedImage[]) => void) => void;
+
         /**
          * Retrieves an image (screenshot) for the webpage at the URL "url"
          * and returns the image as a base64-encoded PNG.
@@ -850,10 +1083,49 @@ declare module NativeInterface
          *   The width of the image. The height will be adjusted automatically
          *   to create an image with a 4:3 aspect ratio.
          *
+         * @param options
+         *   Optionally, the version of the page's content. On Linux, the
+         *   images are cached on disk by URL, width and version, so repeated
+         *   requests don't render the page again.
+         *
          * @param callback
-         *   Callback called with a data URI of the web page's image.
+         *   Callback called with a data URI of the web page's image, or an
+         *   empty string if the page couldn't be loaded.
+         */
+        getPageImageForURL: (url: string, width: number, options?: IPageImageRequestOptions, callback?: (imageData: string) => void) => void;
+
+        /**
+         * Returns how many page images have been requested and how many of
+         * them succeeded, failed, or timed out (in which case the image is
+         * taken as the page was rendered by then), and the latency of the
+         * requests. Only supported on Linux.
+         */
+        getPageImageStatistics: (callback: (stats: IPageImageStatistics) => void) => void;
+
+        /**
+         * Configures the windowless browsers rendering the page images.
+         * Only supported on Linux.
+         *
+         * @param options
+         *   The number of browsers rendering pages in parallel, the number of
+         *   pages after which a browser is replaced by a new one, and the
+         *   timeout of the requests made afterwards.
+         */
+        setPageImageOptions: (options: IPageImageOptions) => void;
+
+        /**
+         * Cancels the page image requests for the URL "url", or all pending
+         * requests if no URL is given. The callbacks of the cancelled
+         * requests are invoked with an empty string.
+         * Only supported on Linux.
+         */
+        cancelPageImages: (url?: string) => void;
+
+        /**
+         * Removes the cached page images for the URL "url", or all cached
+         * page images if no URL is given. Only supported on Linux.
          */
-        getPageImageForURL: (url: string, width: number, callback: (imageData: string) => void) => void;
+        invalidatePageImageCache: (url?: string) => void;
 
 
         ///////////////////////////////////////////////////////////////////////
@@ -906,6 +1178,35 @@ declare module NativeInterface
     {
         path: string;
         action: EFileChangeAction;
+        handle: number;
+    }
+
+    export interface IFileWatcherOptions
+    {
+        // gitignore-style patterns relative to the watched directory; if
+        // there are any, only matching files are reported
+        include?: string[];
+
+        // gitignore-style patterns of files and directories not to report;
+        // "!pattern" re-includes files excluded by a previous pattern
+        ignore?: string[];
+    }
+
+    export interface IFileWatcherStatus
+    {
+        // true while the directory tree is scanned after starting the watch
+        isScanning: boolean;
+
+        // the number of directories with a native watch
+        watchedDirectories: number;
+
+        // the number of directories polled because the watch limit was reached
+        polledDirectories: number;
+
+        // the number of watches used by all watches of the app, and the
+        // system's limit (-1 if there is no limit)
+        watches: number;
+        maxWatches: number;
     }
 
     export enum EFileChangeAction
@@ -1117,14 +1418,28 @@ declare module NativeInterface
          * "encoding" can be one of
          * - "utf-8"
          * - "text/plain;utf-8"
+         * - "utf-16le", "utf-16be" (Linux only)
+         * - "latin1" (Linux only)
          * - "image/png;base64".
          *
          * If not provided, the file is read as plain text UTF-8 file.
+         * On Linux, the encoding is detected from the byte order mark or the
+         * contents of the file instead, and the text is converted to UTF-8.
          * If "image/png;base64" is used as encoding, the file is interpreted
          * as image file, converted to PNG, and returned as base-64 encoded
          * data URL.
          */
         encoding?: string;
+
+        /**
+         * The compression of the file; can be one of
+         * - "gzip"
+         * - "deflate" (zlib format).
+         *
+         * If provided, the file is decompressed while it is read and the
+         * decompressed contents are returned as text.
+         */
+        compression?: string;
     }
     
     export interface IWriteFileOptions
@@ -1137,6 +1452,22 @@ declare module NativeInterface
          * The contents will be decoded (if needed) before it is written to file.
          */
         encoding?: string;
+
+        /**
+         * The compression to apply to the contents; can be one of
+         * - "gzip"
+         * - "deflate" (zlib format).
+         *
+         * If not provided, the contents are written uncompressed.
+         */
+        compression?: string;
+
+        /**
+         * The compression level between 0 (no compression) and 9 (best
+         * compression). Only used if "compression" is set.
+         * Defaults to zlib's default level (6).
+         */
+        compressionLevel?: number;
     }
 
     export interface IAJAXOptions
@@ -1198,6 +1529,191 @@ declare module NativeInterface
         text: string;
     }
 
+    export interface IDownloadOptions
+    {
+        // the expected size of the file in bytes
+        size?: number;
+
+        // the expected hash of the file as a hex string, and the name of the
+        // hash algorithm (e.g. "sha256" (default), "sha1" or "md5")
+        hash?: string;
+        hashAlgorithm?: string;
+
+        // the maximum number of parallel connections (default: 4, maximum: 6)
+        connections?: number;
+
+        // the minimum time in milliseconds between progress events (default: 250)
+        progressInterval?: number;
+    }
+
+    export interface IDownloadEvent
+    {
+        // the handle passed to the callback of "download"
+        handle: number;
+
+        // "progress" or "finished"
+        type: string;
+
+        // the progress of "progress" events; "totalBytes" is -1 if the size
+        // of the file isn't known
+        bytesReceived?: number;
+        totalBytes?: number;
+        bytesPerSecond?: number;
+
+        // the result of "finished" events
+        error?: Error;
+        path?: string;
+        size?: number;
+    }
+
+    export interface IProcessEvent
+    {
+        // the handle returned by spawnProcess
+        handle: number;
+
+        // "output" or "exit"
+        type: string;
+
+        // the stream and the text of "output" events
+        fd?: EOutputStreamType;
+        text?: string;
+
+        // the exit code of "exit" events (128 + the signal number if the
+        // process was terminated by a signal, -1 if it isn't known)
+        exitCode?: number;
+
+        // the resources the process has used, reported with "exit" events
+        usage?: IProcessUsage;
+    }
+
+    export interface IProcessOptions
+    {
+        // the time in milliseconds after which the process is killed
+        timeout?: number;
+
+        // the signal the process is killed with (default: "SIGTERM"); if it
+        // is still running 5 seconds later, it is sent SIGKILL
+        killSignal?: string;
+
+        // the number of bytes of output (stdout and stderr together) after
+        // which the rest of the output is discarded and the process is killed
+        maxOutputBytes?: number;
+    }
+
+    export interface IProcessUsage
+    {
+        // the CPU time spent in user and kernel mode, and the time from
+        // starting the process until it has terminated, in milliseconds
+        userTime: number;
+        systemTime: number;
+        wallTime: number;
+
+        // the maximum resident set size in bytes
+        maxResidentSetSize: number;
+
+        // whether the process has been killed because of the options
+        timedOut: boolean;
+        outputTruncated: boolean;
+    }
+
+    export interface IProcessPoolStatus
+    {
+        workers: number;
+        runningWorkers: number;
+        busyWorkers: number;
+
+        queuedRequests: number;
+        maxQueuedRequests: number;
+
+        completedRequests: number;
+        failedRequests: number;
+        restarts: number;
+
+        // in milliseconds; the latency is measured from queueing a request
+        // until its response has been received
+        averageQueueTime: number;
+        averageLatency: number;
+        maxLatency: number;
+    }
+
+    export interface IPageImageStatistics
+    {
+        requests: number;
+        pending: number;
+        succeeded: number;
+        failed: number;
+        timedOut: number;
+        cancelled: number;
+
+        // the requests answered from the cache
+        cacheHits: number;
+
+        // the number of windowless browsers rendering pages
+        renderers: number;
+
+        // in milliseconds, from the request until the image has been returned
+        averageLatency: number;
+        maxLatency: number;
+    }
+
+    export interface IPageImageOptions
+    {
+        // the maximum number of pages rendered in parallel
+        // (default: the number of processors, but at most 4)
+        maxRenderers?: number;
+
+        // the number of pages after which a browser is closed and replaced (default: 50)
+        jobsPerRenderer?: number;
+
+        // the time in milliseconds after which a page is captured even if
+        // it is still loading or painting (default: 15000)
+        timeout?: number;
+
+        // the maximum size in bytes of the cached images; 0 disables the
+        // cache (default: 64 MB)
+        maxCacheSize?: number;
+    }
+
+    export interface IPageImageRequestOptions
+    {
+        // identifies the content of the page; an image cached for another
+        // version isn't used
+        version?: string;
+    }
+
+    export interface IImageConversionOptions
+    {
+        // the format of the converted images, "png" (default) or "jpeg"
+        format?: string;
+
+        // the maximum size of the converted images; images are scaled down
+        // preserving their aspect ratio. 0 means no limit
+        maxWidth?: number;
+        maxHeight?: number;
+
+        // the JPEG quality, 0 to 100 (default: 90)
+        quality?: number;
+
+        // if set, the converted images are written to this directory
+        outputDirectory?: string;
+    }
+
+    export interface IConvertedImage
+    {
+        path: string;
+        error: Error;
+
+        // the size of the converted image
+        width: number;
+        height: number;
+
+        // the data URL of the converted image, if no output directory was given
+        data: string;
+
+        // the path of the converted image, if an output directory was given
+        outputPath: string;
+    }
+
     export interface ILicenseData
     {
         mac: string;
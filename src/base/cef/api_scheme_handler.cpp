@@ -0,0 +1,515 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#include <algorithm>
+#include <vector>
+
+#ifdef OS_WIN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "lib/cef/include/base/cef_bind.h"
+#include "lib/cef/include/cef_browser.h"
+#include "lib/cef/include/cef_callback.h"
+#include "lib/cef/include/cef_frame.h"
+#include "lib/cef/include/cef_origin_whitelist.h"
+#include "lib/cef/include/cef_parser.h"
+#include "lib/cef/include/cef_request.h"
+#include "lib/cef/include/cef_response.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
+#include "lib/cef/include/wrapper/cef_helpers.h"
+
+#include "base/cef/api_scheme_handler.h"
+#include "base/cef/mime_types.h"
+
+#include "native_extensions/error.h"
+#include "native_extensions/file_util.h"
+
+#include "util/string_util.h"
+
+
+#define API_URL_PREFIX TEXT("zephyros://api/")
+#define COPY_BUFFER_SIZE 65536
+
+
+namespace Zephyros {
+
+//////////////////////////////////////////////////////////////////////////
+// File helpers
+
+#ifdef OS_WIN
+
+static void SetSystemError(Error& err)
+{
+    err.FromLastError();
+}
+
+static bool WriteAll(HANDLE hFile, const void* buf, size_t size, Error& err)
+{
+    const char* p = (const char*) buf;
+    while (size > 0)
+    {
+        DWORD numBytesWritten = 0;
+        if (!::WriteFile(hFile, p, (DWORD) std::min(size, (size_t) 0x40000000), &numBytesWritten, NULL))
+        {
+            err.FromLastError();
+            return false;
+        }
+
+        p += numBytesWritten;
+        size -= numBytesWritten;
+    }
+
+    return true;
+}
+
+#else
+
+static void SetSystemError(Error& err)
+{
+    err.FromErrno();
+}
+
+static bool WriteAll(int fd, const void* buf, size_t size, Error& err)
+{
+    const char* p = (const char*) buf;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            err.FromErrno();
+            return false;
+        }
+
+        p += n;
+        size -= (size_t) n;
+    }
+
+    return true;
+}
+
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////
+// FileDataStream Implementation
+
+FileDataStream::FileDataStream()
+    : m_length(-1),
+#ifdef OS_WIN
+    m_hFile(INVALID_HANDLE_VALUE)
+#else
+    m_fd(-1)
+#endif
+{
+}
+
+FileDataStream::~FileDataStream()
+{
+#ifdef OS_WIN
+    if (m_hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(m_hFile);
+#else
+    if (m_fd >= 0)
+        close(m_fd);
+#endif
+}
+
+bool FileDataStream::Open(const String& path, Error& err)
+{
+#ifdef OS_WIN
+    m_hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+#else
+    m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+#endif
+    {
+        SetSystemError(err);
+        return false;
+    }
+
+    FileUtil::StatInfo info;
+    if (FileUtil::Stat(path, &info))
+        m_length = (int64) info.fileSize;
+
+    m_mimeType = GetMIMETypeForFilename(path);
+    return true;
+}
+
+int FileDataStream::Read(void* buf, int size)
+{
+#ifdef OS_WIN
+    DWORD numBytesRead = 0;
+    if (!::ReadFile(m_hFile, buf, size, &numBytesRead, NULL))
+        return -1;
+    return (int) numBytesRead;
+#else
+    ssize_t n;
+    do
+    {
+        n = read(m_fd, buf, size);
+    } while (n < 0 && errno == EINTR);
+    return (int) n;
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// StringDataStream Implementation
+
+StringDataStream::StringDataStream(const std::string& data, const String& mimeType)
+    : m_data(data), m_mimeType(mimeType), m_offset(0)
+{
+}
+
+int StringDataStream::Read(void* buf, int size)
+{
+    int n = (int) std::min((size_t) size, m_data.size() - m_offset);
+    memcpy(buf, m_data.data() + m_offset, n);
+    m_offset += n;
+    return n;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Request Bodies
+
+bool WriteRequestBody(CefRefPtr<CefPostData> body, const String& path, Error& err)
+{
+    CefPostData::ElementVector elements;
+    if (body.get())
+        body->GetElements(elements);
+
+    // check the body before the file is truncated; dropping parts of it would corrupt the file
+    for (CefPostData::ElementVector::iterator it = elements.begin(); it != elements.end(); ++it)
+    {
+        cef_postdataelement_type_t type = (*it)->GetType();
+        if (type != PDE_TYPE_BYTES && type != PDE_TYPE_FILE)
+        {
+            err.SetError(ERR_INVALID_ARGUMENT, TEXT("Unsupported request body"));
+            return false;
+        }
+    }
+
+#ifdef OS_WIN
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+#else
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+#endif
+    {
+        SetSystemError(err);
+        return false;
+    }
+
+    bool ret = true;
+    std::vector<char> buf;
+    for (CefPostData::ElementVector::iterator it = elements.begin(); ret && it != elements.end(); ++it)
+    {
+        CefRefPtr<CefPostDataElement> element = *it;
+
+        if (element->GetType() == PDE_TYPE_BYTES)
+        {
+            size_t size = element->GetBytesCount();
+            buf.resize(size);
+            if (size > 0)
+            {
+                element->GetBytes(size, &buf[0]);
+#ifdef OS_WIN
+                ret = WriteAll(hFile, &buf[0], size, err);
+#else
+                ret = WriteAll(fd, &buf[0], size, err);
+#endif
+            }
+        }
+        else
+        {
+            // PDE_TYPE_FILE; copy uploaded files in blocks instead of loading them into memory
+            CefRefPtr<FileDataStream> file = new FileDataStream();
+            if (!file->Open(element->GetFile(), err))
+            {
+                ret = false;
+                break;
+            }
+
+            buf.resize(COPY_BUFFER_SIZE);
+            for ( ; ; )
+            {
+                int n = file->Read(&buf[0], COPY_BUFFER_SIZE);
+                if (n == 0)
+                    break;
+                if (n < 0)
+                {
+                    SetSystemError(err);
+                    ret = false;
+                    break;
+                }
+
+#ifdef OS_WIN
+                if (!WriteAll(hFile, &buf[0], n, err))
+#else
+                if (!WriteAll(fd, &buf[0], n, err))
+#endif
+                {
+                    ret = false;
+                    break;
+                }
+            }
+        }
+    }
+
+#ifdef OS_WIN
+    CloseHandle(hFile);
+#else
+    if (close(fd) != 0 && ret)
+    {
+        err.FromErrno();
+        ret = false;
+    }
+#endif
+
+    return ret;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ApiSchemeHandler Implementation
+
+ApiSchemeHandler::ApiSchemeHandler(CefRefPtr<CefBrowser> browser, bool isAllowed)
+    : m_isAllowed(isAllowed), m_browser(browser), m_status(404), m_bufferOffset(0), m_isEndOfStream(false)
+{
+}
+
+bool ApiSchemeHandler::ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<CefCallback> callback)
+{
+    CEF_REQUIRE_IO_THREAD();
+
+    m_origin = GetRequestHeader(request, TEXT("Origin"));
+
+    if (!m_isAllowed)
+    {
+        m_status = 403;
+        callback->Continue();
+        return true;
+    }
+
+    // CORS preflight requests for fetch() calls with a body
+    if (ToLower(request->GetMethod()) == TEXT("options"))
+    {
+        m_status = 204;
+        callback->Continue();
+        return true;
+    }
+
+    String url = request->GetURL();
+    String prefix(API_URL_PREFIX);
+    if (url.substr(0, prefix.length()) != prefix)
+    {
+        callback->Continue();
+        return true;
+    }
+
+    // split the URL into the function name and the query string
+    String name = url.substr(prefix.length());
+    String queryString;
+    size_t pos = name.find(TEXT('?'));
+    if (pos != String::npos)
+    {
+        queryString = name.substr(pos + 1);
+        name = name.substr(0, pos);
+    }
+
+    std::map<String, String> query;
+    std::vector<String> params = Split(queryString, TEXT('&'));
+    for (std::vector<String>::iterator it = params.begin(); it != params.end(); ++it)
+    {
+        pos = it->find(TEXT('='));
+        if (pos == String::npos)
+            continue;
+
+        String value = CefURIDecode(it->substr(pos + 1), true, static_cast<cef_uri_unescape_rule_t>(
+            UU_SPACES | UU_URL_SPECIAL_CHARS_EXCEPT_PATH_SEPARATORS | UU_PATH_SEPARATORS | UU_REPLACE_PLUS_WITH_SPACE));
+        query[CefURIDecode(it->substr(0, pos), true, UU_SPACES)] = value;
+    }
+
+    ClientExtensionHandlerPtr e = Zephyros::GetNativeExtensions()->GetClientExtensionHandler();
+    NativeFunction* fnx = e.get() ? e->GetNativeDataFunction(name) : NULL;
+    if (fnx == NULL)
+    {
+        // no such function, or the function can't be called through the api scheme
+        callback->Continue();
+        return true;
+    }
+
+    // the function does blocking I/O, so don't call it on the IO thread
+    CefPostTask(TID_FILE, base::Bind(&ApiSchemeHandler::CallFunction, this, fnx, m_browser, query, request->GetPostData(), callback));
+    return true;
+}
+
+void ApiSchemeHandler::CallFunction(
+    NativeFunction* fnx, CefRefPtr<CefBrowser> browser, std::map<String, String> query,
+    CefRefPtr<CefPostData> body, CefRefPtr<CefCallback> callback)
+{
+    CEF_REQUIRE_FILE_THREAD();
+
+    Error err;
+    CefRefPtr<DataStream> response;
+
+    if (fnx->CallDataFunction(browser, query, body, response, err))
+    {
+        m_stream = response;
+        m_status = response.get() ? 200 : 204;
+    }
+    else
+        SetError(err.GetCode() == ERR_INVALID_ARGUMENT ? 400 : 500, err);
+
+    callback->Continue();
+}
+
+void ApiSchemeHandler::SetError(int status, Error& err)
+{
+    // the response body is the JSON representation of the error
+    CefRefPtr<CefValue> value = CefValue::Create();
+    value->SetDictionary(err.CreateJSRepresentation());
+
+    m_status = status;
+    m_stream = new StringDataStream(CefWriteJSON(value, JSON_WRITER_DEFAULT).ToString(), TEXT("application/json"));
+}
+
+void ApiSchemeHandler::GetResponseHeaders(CefRefPtr<CefResponse> response, int64& responseLength, CefString& redirectUrl)
+{
+    CEF_REQUIRE_IO_THREAD();
+
+    response->SetMimeType(m_stream.get() ? m_stream->GetMimeType() : String(TEXT("text/plain")));
+    response->SetStatus(m_status);
+
+    CefResponse::HeaderMap headers;
+    response->GetHeaderMap(headers);
+
+    headers.insert(std::make_pair(TEXT("Cache-Control"), TEXT("no-store")));
+
+    // the request has been checked to come from an app page (see ApiSchemeHandlerFactory::Create)
+    if (m_isAllowed && !m_origin.empty())
+    {
+        headers.insert(std::make_pair(TEXT("Access-Control-Allow-Origin"), m_origin));
+        headers.insert(std::make_pair(TEXT("Access-Control-Allow-Methods"), TEXT("GET, POST, PUT")));
+        headers.insert(std::make_pair(TEXT("Access-Control-Allow-Headers"), TEXT("Content-Type")));
+    }
+
+    response->SetHeaderMap(headers);
+
+    responseLength = m_stream.get() ? m_stream->GetLength() : 0;
+}
+
+void ApiSchemeHandler::Cancel()
+{
+    CEF_REQUIRE_IO_THREAD();
+    m_stream = NULL;
+}
+
+bool ApiSchemeHandler::ReadResponse(void* dataOut, int bytesToRead, int& bytesRead, CefRefPtr<CefCallback> callback)
+{
+    CEF_REQUIRE_IO_THREAD();
+
+    bytesRead = 0;
+    if (m_stream.get() == NULL || bytesToRead <= 0)
+        return false;
+
+    // return what has been read on the FILE thread
+    if (m_bufferOffset < m_buffer.size())
+    {
+        bytesRead = (int) std::min((size_t) bytesToRead, m_buffer.size() - m_bufferOffset);
+        memcpy(dataOut, &m_buffer[m_bufferOffset], bytesRead);
+        m_bufferOffset += bytesRead;
+        return true;
+    }
+
+    if (m_isEndOfStream)
+    {
+        m_stream = NULL;
+        return false;
+    }
+
+    // streams might do blocking I/O, so read the next block on the FILE thread
+    // and let CEF call ReadResponse again when it is available
+    CefPostTask(TID_FILE, base::Bind(&ApiSchemeHandler::ReadBlock, this, m_stream, bytesToRead, callback));
+    return true;
+}
+
+void ApiSchemeHandler::ReadBlock(CefRefPtr<DataStream> stream, int size, CefRefPtr<CefCallback> callback)
+{
+    CEF_REQUIRE_FILE_THREAD();
+
+    m_buffer.resize(size);
+    int n = stream->Read(&m_buffer[0], size);
+
+    m_buffer.resize(n > 0 ? n : 0);
+    m_bufferOffset = 0;
+    m_isEndOfStream = n <= 0;
+
+    callback->Continue();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ApiSchemeHandlerFactory Implementation
+
+void ApiSchemeHandlerFactory::AddCrossOriginWhitelistEntries()
+{
+    // fetch() from the app's pages is a cross-origin request;
+    // Create checks the requesting frame again
+    CefAddCrossOriginWhitelistEntry(TEXT("app://"), TEXT("zephyros"), TEXT("api"), false);
+    CefAddCrossOriginWhitelistEntry(TEXT("local://"), TEXT("zephyros"), TEXT("api"), false);
+}
+
+/**
+ * Return a new scheme handler instance to handle the request.
+ * Native functions are only exposed to the app's own pages.
+ */
+CefRefPtr<CefResourceHandler> ApiSchemeHandlerFactory::Create(
+    CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame, const CefString& schemeName, CefRefPtr<CefRequest> request)
+{
+    CEF_REQUIRE_IO_THREAD();
+
+    String frameURL = frame.get() ? String(frame->GetURL()) : String();
+    bool isAllowed = browser.get() != NULL &&
+        (frameURL.substr(0, 6) == TEXT("app://") || frameURL.substr(0, 8) == TEXT("local://"));
+
+    return new ApiSchemeHandler(browser, isAllowed);
+}
+
+} // namespace Zephyros
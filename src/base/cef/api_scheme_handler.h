@@ -0,0 +1,156 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#ifndef Zephyros_ApiSchemeHandler_h
+#define Zephyros_ApiSchemeHandler_h
+#pragma once
+
+
+#include <map>
+#include <vector>
+
+#include "lib/cef/include/cef_resource_handler.h"
+#include "lib/cef/include/cef_scheme.h"
+#include "base/types.h"
+#include "base/cef/client_handler.h"
+
+
+namespace Zephyros {
+
+/**
+ * Streams a file as the response of a data function.
+ */
+class FileDataStream : public DataStream
+{
+public:
+    FileDataStream();
+    virtual ~FileDataStream();
+
+    bool Open(const String& path, Error& err);
+
+    virtual String GetMimeType() OVERRIDE { return m_mimeType; }
+    virtual int64 GetLength() OVERRIDE { return m_length; }
+    virtual int Read(void* buf, int size) OVERRIDE;
+
+private:
+    String m_mimeType;
+    int64 m_length;
+
+#ifdef OS_WIN
+    HANDLE m_hFile;
+#else
+    int m_fd;
+#endif
+
+    IMPLEMENT_REFCOUNTING(FileDataStream);
+};
+
+/**
+ * A response of a data function held in memory.
+ */
+class StringDataStream : public DataStream
+{
+public:
+    StringDataStream(const std::string& data, const String& mimeType);
+
+    virtual String GetMimeType() OVERRIDE { return m_mimeType; }
+    virtual int64 GetLength() OVERRIDE { return (int64) m_data.size(); }
+    virtual int Read(void* buf, int size) OVERRIDE;
+
+private:
+    std::string m_data;
+    String m_mimeType;
+    size_t m_offset;
+
+    IMPLEMENT_REFCOUNTING(StringDataStream);
+};
+
+/**
+ * Writes the request body "body" to the file "path", replacing its contents.
+ * Byte elements are written directly, file elements are copied in blocks.
+ */
+bool WriteRequestBody(CefRefPtr<CefPostData> body, const String& path, Error& err);
+
+
+/**
+ * Handles "zephyros://api/<function>?<arg name>=<JSON value>&..." requests
+ * by calling the data function registered for <function> with the request
+ * body (see ClientExtensionHandler::AddNativeDataFunction). The function is
+ * called on the FILE thread; its response is streamed to the renderer.
+ */
+class ApiSchemeHandler : public CefResourceHandler
+{
+public:
+    ApiSchemeHandler(CefRefPtr<CefBrowser> browser, bool isAllowed);
+
+    virtual bool ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<CefCallback> callback) OVERRIDE;
+    virtual void GetResponseHeaders(CefRefPtr<CefResponse> response, int64& responseLength, CefString& redirectUrl) OVERRIDE;
+    virtual void Cancel() OVERRIDE;
+    virtual bool ReadResponse(void* dataOut, int bytesToRead, int& bytesRead, CefRefPtr<CefCallback> callback) OVERRIDE;
+
+private:
+    void CallFunction(
+        NativeFunction* fnx, CefRefPtr<CefBrowser> browser, std::map<String, String> query,
+        CefRefPtr<CefPostData> body, CefRefPtr<CefCallback> callback);
+    void SetError(int status, Error& err);
+    void ReadBlock(CefRefPtr<DataStream> stream, int size, CefRefPtr<CefCallback> callback);
+
+private:
+    bool m_isAllowed;
+    CefRefPtr<CefBrowser> m_browser;
+
+    int m_status;
+    String m_origin;
+    CefRefPtr<DataStream> m_stream;
+
+    // the block of the response last read from the stream
+    std::vector<char> m_buffer;
+    size_t m_bufferOffset;
+    bool m_isEndOfStream;
+
+    IMPLEMENT_REFCOUNTING(ApiSchemeHandler);
+};
+
+class ApiSchemeHandlerFactory : public CefSchemeHandlerFactory
+{
+public:
+    /**
+     * Allows the app's pages to request "zephyros://api/...". Call after
+     * registering the factory.
+     */
+    static void AddCrossOriginWhitelistEntries();
+
+    virtual CefRefPtr<CefResourceHandler> Create(
+        CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame, const CefString& schemeName, CefRefPtr<CefRequest> request) OVERRIDE;
+
+    IMPLEMENT_REFCOUNTING(ApiSchemeHandlerFactory);
+};
+
+} // namespace Zephyros
+
+
+#endif // Zephyros_ApiSchemeHandler_h
@@ -26,7 +26,9 @@
 
 
 #include <algorithm>
+#include <map>
 
+#include "lib/cef/include/base/cef_lock.h"
 #include "lib/cef/include/cef_browser.h"
 #include "lib/cef/include/cef_callback.h"
 #include "lib/cef/include/cef_frame.h"
@@ -40,19 +42,96 @@
 #include "base/cef/mime_types.h"
 #include "base/cef/resource_util.h"
 
+#include "util/MurmurHash3.h"
 #include "util/string_util.h"
 
 
 namespace Zephyros {
 
+#ifndef OS_MACOSX
+// ETags of the resources served so far; the resource memory doesn't change
+// while the app is running, so each resource is hashed only once
+static std::map<String, String> g_etags;
+static base::Lock g_etagLock;
+#endif
+
+//
+// Returns a strong validator derived from the contents of the resource, so
+// resources changed without a new app version aren't served from the cache.
+//
+static String GetResourceETag(const String& resourceName, const uint8_t* pData, size_t size)
+{
+#ifndef OS_MACOSX
+    base::AutoLock lock(g_etagLock);
+
+    std::map<String, String>::iterator it = g_etags.find(resourceName);
+    if (it != g_etags.end())
+        return it->second;
+#endif
+
+    uint64_t hash[2] = { 0, 0 };
+    MurmurHash3_x64_128(pData, (int) size, 0, hash);
+
+    StringStream ss;
+    ss << TEXT("\"") << std::hex << hash[0] << hash[1] << TEXT("\"");
+
+#ifndef OS_MACOSX
+    g_etags[resourceName] = ss.str();
+#endif
+
+    return ss.str();
+}
+
 AppSchemeHandler::AppSchemeHandler()
-    : m_offset(0)
+    : m_pData(NULL), m_size(0), m_offset(0), m_status(0)
 {
 }
 
+bool AppSchemeHandler::LoadResource(const String& resourceName, CefRefPtr<CefRequest> request)
+{
+    m_mimeType = GetMIMETypeForFilename(resourceName);
+    m_offset = 0;
+
+    if (!GetResourceData(resourceName))
+    {
+        m_status = 404;
+        return false;
+    }
+
+    m_etag = GetResourceETag(resourceName, m_pData, m_size);
+
+    String ifNoneMatch = GetRequestHeader(request, TEXT("If-None-Match"));
+    m_status = !ifNoneMatch.empty() && MatchesETag(ifNoneMatch, m_etag) ? 304 : 200;
+
+    return true;
+}
+
+bool AppSchemeHandler::GetResourceData(const String& resourceName)
+{
+#ifdef OS_MACOSX
+    // resources are files in the application bundle
+    if (!LoadBinaryResource(resourceName.c_str(), m_data))
+        return false;
+
+    m_pData = (const uint8_t*) m_data.c_str();
+    m_size = m_data.length();
+    return true;
+#else
+    // serve the resource directly from the memory of the executable
+    return GetBinaryResource(resourceName.c_str(), m_pData, m_size);
+#endif
+}
+
 bool AppSchemeHandler::ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<CefCallback> callback)
 {
     CEF_REQUIRE_IO_THREAD();
+
+    // the resource has been resolved already by ClientHandler::GetResourceHandler
+    if (m_status != 0)
+    {
+        callback->Continue();
+        return true;
+    }
         
     String url = request->GetURL();
     if (url.substr(0, 6) != TEXT("app://"))
@@ -71,8 +150,7 @@ bool AppSchemeHandler::ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<C
         len = posHash;
     
     // the URL is prefixed with "app://"
-    m_status = LoadBinaryResource(DecodeURL(url.substr(6, len - 6)).c_str(), m_data) ? 200 : 404;
-    m_mimeType = GetMIMETypeForFilename(url);
+    LoadResource(DecodeURL(url.substr(6, len - 6)), request);
 
     // indicate the headers are available
     callback->Continue();
@@ -86,7 +164,19 @@ void AppSchemeHandler::GetResponseHeaders(CefRefPtr<CefResponse> response, int64
     response->SetMimeType(m_mimeType);
     response->SetStatus(m_status);
 
-    responseLength = m_data.length();
+    if (m_status == 200 || m_status == 304)
+    {
+        CefResponse::HeaderMap headers;
+        response->GetHeaderMap(headers);
+
+        // app:// URLs aren't versioned, so the cached copy is revalidated
+        // with the content hash, which is answered with a 304 if it matches
+        headers.insert(std::make_pair(TEXT("Cache-Control"), TEXT("no-cache")));
+        headers.insert(std::make_pair(TEXT("ETag"), m_etag));
+        response->SetHeaderMap(headers);
+    }
+
+    responseLength = m_status == 200 ? (int64) m_size : 0;
 }
     
 void AppSchemeHandler::Cancel()
@@ -97,13 +187,16 @@ void AppSchemeHandler::Cancel()
 bool AppSchemeHandler::ReadResponse(void* dataOut, int bytesToRead, int& bytesRead, CefRefPtr<CefCallback> callback)
 {
     CEF_REQUIRE_IO_THREAD();
+
+    bytesRead = 0;
     
-    if (m_offset < m_data.length())
+    if (m_pData != NULL && m_offset < m_size)
     {
-        // copy the next block of data into the buffer
-        int transferSize = std::min(bytesToRead, (int) (m_data.length() - m_offset));
-        memcpy(dataOut, m_data.c_str() + m_offset, transferSize);
+        // copy the next block of data from the resource memory into the buffer
+        int transferSize = (int) std::min((size_t) bytesToRead, m_size - m_offset);
+        memcpy(dataOut, m_pData + m_offset, transferSize);
         m_offset += transferSize;
+        bytesRead = transferSize;
 
         return true;
     }
@@ -26,24 +26,44 @@
 
 
 #include "lib/cef/include/cef_resource_handler.h"
+#include "lib/cef/include/cef_scheme.h"
 #include "base/types.h"
 
 
 namespace Zephyros {
 
+/**
+ * Serves resources embedded in the application.
+ * The data is read directly from the resource memory. Responses may be
+ * cached, but are revalidated with a hash of the resource as ETag.
+ */
 class AppSchemeHandler : public CefResourceHandler
 {
 public:
     AppSchemeHandler();
 
+    /**
+     * Resolves the resource to serve before the request is processed.
+     * Returns false if there is no resource with the name "resourceName".
+     */
+    bool LoadResource(const String& resourceName, CefRefPtr<CefRequest> request);
+
     virtual bool ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<CefCallback> callback) OVERRIDE;
     virtual void GetResponseHeaders(CefRefPtr<CefResponse> response, int64& responseLength, CefString& redirectUrl) OVERRIDE;
     virtual void Cancel() OVERRIDE;
     virtual bool ReadResponse(void* dataOut, int bytesToRead, int& bytesRead, CefRefPtr<CefCallback> callback) OVERRIDE;
     
 private:
+    bool GetResourceData(const String& resourceName);
+
+private:
+    // resource memory; owned by the executable or the resource pack (or by m_data on Mac)
+    const uint8_t* m_pData;
+    size_t m_size;
     String m_data;
+
     String m_mimeType;
+    String m_etag;
     size_t m_offset;
     int m_status;
     
@@ -98,7 +98,10 @@ void GetSettings(CefSettings& settings)
     settings.multi_threaded_message_loop = false;
 #endif
 
-    // CefString(&settings.cache_path) = g_command_line->GetSwitchValue(cefclient::kCachePath);
+    // use a persistent cache if the app configured a cache directory
+    const TCHAR* szCachePath = Zephyros::GetCachePath();
+    if (szCachePath != NULL && szCachePath[0] != 0)
+        CefString(&settings.cache_path) = szCachePath;
 
 #if !defined(NDEBUG) && !defined(ZEPHYROS_NDEBUG)
     // Specify a port to enable DevTools if one isn't already specified.
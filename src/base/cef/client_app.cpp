@@ -29,6 +29,7 @@
 
 #include "lib/cef/include/cef_cookie.h"
 #include "lib/cef/include/cef_process_message.h"
+#include "lib/cef/include/cef_scheme.h"
 #include "lib/cef/include/cef_task.h"
 #include "lib/cef/include/cef_v8.h"
 
@@ -63,6 +64,20 @@ void ClientApp::OnBeforeCommandLineProcessing(const CefString& process_type, Cef
     
     // ignore certificate errors (e.g., in case the app makes requests to HTTPS services with self-signed certificates)
     command_line->AppendSwitch(TEXT("ignore-certificate-errors"));
+
+    // limit the size of the disk cache if the app configured one
+    if (Zephyros::GetCacheSize() > 0 && !command_line->HasSwitch(TEXT("disk-cache-size")))
+    {
+        StringStream ss;
+        ss << Zephyros::GetCacheSize();
+        command_line->AppendSwitchWithValue(TEXT("disk-cache-size"), ss.str());
+    }
+}
+
+void ClientApp::OnRegisterCustomSchemes(CefRefPtr<CefSchemeRegistrar> registrar)
+{
+    // "zephyros://api/<function>" is requested with fetch(), which requires a standard scheme
+    registrar->AddCustomScheme(TEXT("zephyros"), true, false, false);
 }
 
 void ClientApp::OnContextInitialized()
@@ -123,6 +123,7 @@ private:
     }
 
     virtual void OnBeforeCommandLineProcessing(const CefString& process_type, CefRefPtr<CefCommandLine> command_line) OVERRIDE;
+    virtual void OnRegisterCustomSchemes(CefRefPtr<CefSchemeRegistrar> registrar) OVERRIDE;
 
     // CefBrowserProcessHandler methods
     virtual void OnContextInitialized() OVERRIDE;
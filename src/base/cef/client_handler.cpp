@@ -45,6 +45,7 @@
 #include "zephyros.h"
 #include "base/app.h"
 
+#include "base/cef/app_scheme_handler.h"
 #include "base/cef/client_handler.h"
 #include "base/cef/extension_handler.h"
 #include "base/cef/mime_types.h"
@@ -406,10 +407,10 @@ CefRefPtr<CefResourceHandler> ClientHandler::GetResourceHandler(CefRefPtr<CefBro
         url = url.substr(6);
     }
 
-    // load the data
-    CefRefPtr<CefStreamReader> stream = GetBinaryResourceReader(url.c_str());
-    if (stream.get())
-        return new CefStreamResourceHandler(GetMIMETypeForFilename(url), stream);
+    // serve the resource from memory
+    CefRefPtr<AppSchemeHandler> handler = new AppSchemeHandler();
+    if (handler->LoadResource(url, request))
+        return handler.get();
 
     return NULL;
 }
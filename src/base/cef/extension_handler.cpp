@@ -38,6 +38,9 @@
 #include "base/cef/extension_handler.h"
 #include "base/cef/v8_util.h"
 
+#include "lib/cef/include/cef_parser.h"
+
+#include "native_extensions/error.h"
 #include "native_extensions/path.h"
 
 #include "jsbridge.h"
@@ -74,7 +77,7 @@ void ClientCallback::Invoke(String functionName, CefRefPtr<CefListValue> args)
 // NativeFunction Implementation
 
 NativeFunction::NativeFunction(Function fnx, ...)
-    : m_fnxAllCallbacksCompleted(NULL)
+    : m_fnxAllCallbacksCompleted(NULL), m_fnxData(NULL)
 {
     m_fnx = fnx;
 
@@ -119,6 +122,47 @@ int NativeFunction::Call(CefRefPtr<ClientHandler> handler, CefRefPtr<CefBrowser>
     return m_fnx(handler, browser, fnArgs, ret, messageId);
 }
 
+//
+// Calls the data function with the arguments from the query string of an
+// "api" URL; the values are JSON encoded.
+//
+bool NativeFunction::CallDataFunction(
+    CefRefPtr<CefBrowser> browser, const std::map<String, String>& query, CefRefPtr<CefPostData> body,
+    CefRefPtr<DataStream>& response, Error& err)
+{
+    DEBUG_LOG(m_name);
+
+    if (m_fnxData == NULL)
+    {
+        err.SetError(ERR_INVALID_ARGUMENT, TEXT("The function ") + m_name + TEXT(" can't be called through the api scheme"));
+        return false;
+    }
+
+    CefRefPtr<CefListValue> fnArgs = CefListValue::Create();
+    for (size_t i = 0; i < m_argNames.size(); ++i)
+    {
+        // arguments not in the query are null; the data function decides which ones it needs
+        std::map<String, String>::const_iterator it = query.find(m_argNames.at(i));
+        if (it == query.end())
+        {
+            fnArgs->SetNull(i);
+            continue;
+        }
+
+        CefRefPtr<CefValue> value = CefParseJSON(it->second, JSON_PARSER_ALLOW_TRAILING_COMMAS);
+        if (value.get() == NULL ||
+            (m_argTypes.at(i) != VTYPE_INVALID && !Zephyros::JavaScript::HasType(value->GetType(), m_argTypes.at(i))))
+        {
+            err.SetError(ERR_INVALID_ARGUMENT, TEXT("Invalid value for argument ") + m_argNames.at(i));
+            return false;
+        }
+
+        fnArgs->SetValue(i, value);
+    }
+
+    return m_fnxData(browser, fnArgs, body, response, err);
+}
+
 void NativeFunction::AddCallback(int messageId, CefBrowser* browser)
 {
     m_callbacks.push_back(new ClientCallback(messageId, browser));
@@ -183,6 +227,25 @@ void ClientExtensionHandler::AddNativeJavaScriptFunction(String name, NativeFunc
     m_mapFunctions[name] = fnx;
 }
 
+//
+// Makes a native function callable through the "api" scheme.
+//
+void ClientExtensionHandler::AddNativeDataFunction(String name, DataFunction fnx)
+{
+    std::map<String, NativeFunction*>::iterator it = m_mapFunctions.find(name);
+    if (it != m_mapFunctions.end())
+        it->second->m_fnxData = fnx;
+}
+
+NativeFunction* ClientExtensionHandler::GetNativeDataFunction(String name)
+{
+    std::map<String, NativeFunction*>::iterator it = m_mapFunctions.find(name);
+    if (it == m_mapFunctions.end() || it->second->m_fnxData == NULL)
+        return NULL;
+
+    return it->second;
+}
+
 //
 // Invokes the registred callback functions of the function named functionName
 // with arguments args.
@@ -25,8 +25,20 @@
  *******************************************************************************/
 
 
+
 #include <algorithm>
+#include <time.h>
+
+#ifdef OS_WIN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
+#include "lib/cef/include/base/cef_bind.h"
 #include "lib/cef/include/cef_browser.h"
 #include "lib/cef/include/cef_callback.h"
 #include "lib/cef/include/cef_frame.h"
@@ -34,6 +46,7 @@
 #include "lib/cef/include/cef_response.h"
 #include "lib/cef/include/cef_request.h"
 #include "lib/cef/include/cef_scheme.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
 #include "lib/cef/include/wrapper/cef_helpers.h"
 #include "lib/cef/include/cef_parser.h"
 #include "base/cef/local_scheme_handler.h"
@@ -41,13 +54,214 @@
 
 #include "util/string_util.h"
 
-#include "native_extensions/file_util.h"
-
 
 namespace Zephyros {
 
+/**
+ * Formats a timestamp (in milliseconds since the epoch) as HTTP date,
+ * e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+static String FormatHTTPDate(uint64_t timestamp)
+{
+    static const TCHAR* days[] = { TEXT("Sun"), TEXT("Mon"), TEXT("Tue"), TEXT("Wed"), TEXT("Thu"), TEXT("Fri"), TEXT("Sat") };
+    static const TCHAR* months[] = {
+        TEXT("Jan"), TEXT("Feb"), TEXT("Mar"), TEXT("Apr"), TEXT("May"), TEXT("Jun"),
+        TEXT("Jul"), TEXT("Aug"), TEXT("Sep"), TEXT("Oct"), TEXT("Nov"), TEXT("Dec")
+    };
+
+    time_t t = (time_t) (timestamp / 1000);
+    struct tm tm;
+#ifdef OS_WIN
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+
+    TCHAR buf[32];
+#ifdef OS_WIN
+    swprintf_s(buf, 32, TEXT("%s, %02d %s %04d %02d:%02d:%02d GMT"),
+#else
+    snprintf(buf, 32, TEXT("%s, %02d %s %04d %02d:%02d:%02d GMT"),
+#endif
+        days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+    return String(buf);
+}
+
+/**
+ * Parses a non-negative decimal number starting at "pos".
+ * Advances "pos" past the digits; returns -1 if there are no digits.
+ */
+static int64 ParseNumber(const String& str, size_t& pos)
+{
+    int64 value = -1;
+    for ( ; pos < str.length() && str[pos] >= TEXT('0') && str[pos] <= TEXT('9'); ++pos)
+        value = (value < 0 ? 0 : value * 10) + (str[pos] - TEXT('0'));
+    return value;
+}
+
+/**
+ * Parses a single "bytes=first-last" range (cf. RFC 7233) for a resource
+ * with "size" bytes into the half-open interval [start, end).
+ * Returns false if the header can't be parsed or contains multiple ranges,
+ * in which case the header is ignored. "isSatisfiable" is set to false if
+ * the range lies outside the resource.
+ */
+static bool ParseRange(String range, int64 size, int64& start, int64& end, bool& isSatisfiable)
+{
+    range.erase(std::remove(range.begin(), range.end(), TEXT(' ')), range.end());
+    if (ToLower(range.substr(0, 6)) != TEXT("bytes=") || range.find(TEXT(',')) != String::npos)
+        return false;
+
+    size_t pos = 6;
+    int64 first = ParseNumber(range, pos);
+    if (pos >= range.length() || range[pos] != TEXT('-'))
+        return false;
+    ++pos;
+    int64 last = ParseNumber(range, pos);
+    if (pos != range.length() || (first < 0 && last < 0))
+        return false;
+
+    isSatisfiable = true;
+    if (first < 0)
+    {
+        // suffix range: the last "last" bytes
+        if (last == 0 || size == 0)
+            isSatisfiable = false;
+        start = std::max((int64) 0, size - last);
+        end = size;
+    }
+    else
+    {
+        if (last >= 0 && last < first)
+            return false;
+        if (first >= size)
+            isSatisfiable = false;
+        start = first;
+        end = last < 0 ? size : std::min(last + 1, size);
+    }
+
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// LocalFile Implementation
+
+/**
+ * A file opened for reading. Blocks are read on the FILE thread, which holds
+ * a reference, so the handler can drop its own when the request is canceled.
+ */
+class LocalFile : public virtual CefBase
+{
+public:
+    static CefRefPtr<LocalFile> Open(const String& path)
+    {
+#ifdef OS_WIN
+        HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        return hFile == INVALID_HANDLE_VALUE ? NULL : new LocalFile(hFile);
+#else
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        return fd < 0 ? NULL : new LocalFile(fd);
+#endif
+    }
+
+    ~LocalFile()
+    {
+#ifdef OS_WIN
+        CloseHandle(m_hFile);
+#else
+        close(m_fd);
+#endif
+    }
+
+    /**
+     * Retrieves the size and the modification time (in milliseconds since the
+     * epoch) of a regular file and its entity tag, which changes whenever the
+     * file is modified or replaced.
+     */
+    bool GetInfo(int64& size, uint64_t& modificationDate, String& etag)
+    {
+        StringStream ss;
+
+#ifdef OS_WIN
+        BY_HANDLE_FILE_INFORMATION info;
+        if (!GetFileInformationByHandle(m_hFile, &info) || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            return false;
+
+        // the last write time is in 100 ns intervals since January 1, 1601
+        ULARGE_INTEGER lastWriteTime;
+        lastWriteTime.LowPart = info.ftLastWriteTime.dwLowDateTime;
+        lastWriteTime.HighPart = info.ftLastWriteTime.dwHighDateTime;
+
+        size = ((int64) info.nFileSizeHigh << 32) | info.nFileSizeLow;
+        modificationDate = (lastWriteTime.QuadPart - 116444736000000000ULL) / 10000;
+        ss << TEXT("\"") << std::hex << size << TEXT("-") << lastWriteTime.QuadPart << TEXT("-") <<
+            (((uint64_t) info.nFileIndexHigh << 32) | info.nFileIndexLow) << TEXT("\"");
+#else
+        struct stat st;
+        if (fstat(m_fd, &st) != 0 || !S_ISREG(st.st_mode))
+            return false;
+
+#ifdef OS_MACOSX
+        const struct timespec& mtime = st.st_mtimespec;
+#else
+        const struct timespec& mtime = st.st_mtim;
+#endif
+
+        size = (int64) st.st_size;
+        modificationDate = (uint64_t) mtime.tv_sec * 1000 + mtime.tv_nsec / 1000000;
+        ss << TEXT("\"") << std::hex << size << TEXT("-") << mtime.tv_sec << TEXT(".") << mtime.tv_nsec <<
+            TEXT("-") << st.st_ino << TEXT("\"");
+#endif
+
+        etag = ss.str();
+        return true;
+    }
+
+    int ReadAt(void* buf, int size, int64 offset)
+    {
+#ifdef OS_WIN
+        OVERLAPPED overlapped = { 0 };
+        overlapped.Offset = (DWORD) (offset & 0xffffffff);
+        overlapped.OffsetHigh = (DWORD) (offset >> 32);
+
+        DWORD numBytesRead = 0;
+        if (!::ReadFile(m_hFile, buf, size, &numBytesRead, &overlapped))
+            return -1;
+        return (int) numBytesRead;
+#else
+        ssize_t n;
+        do
+        {
+            n = pread(m_fd, buf, size, offset);
+        } while (n < 0 && errno == EINTR);
+        return (int) n;
+#endif
+    }
+
+private:
+#ifdef OS_WIN
+    LocalFile(HANDLE hFile) : m_hFile(hFile) {}
+    HANDLE m_hFile;
+#else
+    LocalFile(int fd) : m_fd(fd) {}
+    int m_fd;
+#endif
+
+    IMPLEMENT_REFCOUNTING(LocalFile);
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// LocalSchemeHandler Implementation
+
 LocalSchemeHandler::LocalSchemeHandler()
-    : m_size(0), m_offset(0)
+    : m_status(404), m_start(0), m_end(0), m_offset(0), m_fileSize(0), m_bufferOffset(0), m_isEndOfFile(false)
+{
+}
+
+LocalSchemeHandler::~LocalSchemeHandler()
 {
 }
 
@@ -59,40 +273,82 @@ bool LocalSchemeHandler::ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr
     if (url.substr(0, 8) != TEXT("local://"))
         return NULL;
 
-    Error err;
-    m_pData = NULL;
-    
+    // the URL is prefixed with "local://"
     String path = url.substr(8);
-//     CefURLParts parts;
-//     CefParseURL(request->GetURL(), parts);
-//     String path = CefString(&parts.path);
     path = CefURIDecode(path, true, cef_uri_unescape_rule_t::UU_SPACES);
     path = CefURIDecode(
         path, true,
         cef_uri_unescape_rule_t::
         UU_URL_SPECIAL_CHARS_EXCEPT_PATH_SEPARATORS);
 
-    // the URL is prefixed with "local://"
-    FileUtil::ReadFileBinary(path, &m_pData, m_size, err);
-//     MessageBox(NULL, path.c_str(), TEXT("LocalSchemeHandler::ProcessRequest"), MB_OK);
     m_mimeType = GetMIMETypeForFilename(path);
 
-    // remove query and hash parts
-//     String::size_type posQuery = url.find(TEXT("?"));
-//     String::size_type posHash = url.find(TEXT("#"));
-//     String::size_type len = String::npos;
-// 
-//     if (posQuery != String::npos && posHash != String::npos)
-//         len = std::min(posQuery, posHash);
-//     else if (posQuery != String::npos)
-//         len = posQuery;
-//     else if (posHash != String::npos)
-//         len = posHash;
-//     
-//     // the URL is prefixed with "local://"
-//     FileUtil::ReadFileBinary(DecodeURL(url.substr(8, len - 8)), &m_pData, m_size, err);
-//     MessageBox(NULL, DecodeURL(url.substr(8, len - 8)).c_str(), TEXT("LocalSchemeHandler::ProcessRequest"), MB_OK);
-//     m_mimeType = GetMIMETypeForFilename(url);
+    // CEF doesn't decode a Content-Encoding of custom scheme responses,
+    // so files are always served as they are;
+    // the validators are taken from the opened file, so they describe the
+    // version that is actually sent
+    uint64_t modificationDate = 0;
+    m_file = LocalFile::Open(path);
+    if (m_file.get() == NULL || !m_file->GetInfo(m_fileSize, modificationDate, m_etag))
+    {
+        // no file, nothing to allocate; respond with a 404
+        m_status = 404;
+        m_file = NULL;
+        callback->Continue();
+        return true;
+    }
+
+    m_start = 0;
+    m_end = m_fileSize;
+    m_lastModified = FormatHTTPDate(modificationDate);
+
+    // conditional requests; If-None-Match takes precedence over If-Modified-Since
+    String ifNoneMatch = GetRequestHeader(request, TEXT("If-None-Match"));
+    String ifModifiedSince = GetRequestHeader(request, TEXT("If-Modified-Since"));
+    bool isNotModified = !ifNoneMatch.empty() ?
+        MatchesETag(ifNoneMatch, m_etag) :
+        !ifModifiedSince.empty() && ifModifiedSince == m_lastModified;
+
+    if (isNotModified)
+    {
+        m_status = 304;
+        m_file = NULL;
+        callback->Continue();
+        return true;
+    }
+
+    m_status = 200;
+
+    // range requests; an If-Range that doesn't match the current file
+    // version means the whole file is sent. If-Range requires the strong
+    // comparison (RFC 7233), so a weak tag never matches
+    String range = GetRequestHeader(request, TEXT("Range"));
+    String ifRange = GetRequestHeader(request, TEXT("If-Range"));
+    bool isRangeValid = ifRange.empty() || ifRange == m_lastModified || ifRange == m_etag;
+
+    int64 start = 0;
+    int64 end = 0;
+    bool isSatisfiable = true;
+    if (!range.empty() && isRangeValid && ParseRange(range, m_fileSize, start, end, isSatisfiable))
+    {
+        if (isSatisfiable)
+        {
+            m_status = 206;
+            m_start = start;
+            m_end = end;
+        }
+        else
+        {
+            m_status = 416;
+            m_file = NULL;
+        }
+    }
+
+    // don't send a body for HEAD requests
+    if (ToLower(request->GetMethod()) == TEXT("head"))
+        m_file = NULL;
+
+    m_offset = m_start;
 
     // indicate the headers are available
     callback->Continue();
@@ -104,44 +360,90 @@ void LocalSchemeHandler::GetResponseHeaders(CefRefPtr<CefResponse> response, int
     CEF_REQUIRE_IO_THREAD();
         
     response->SetMimeType(m_mimeType);
-    response->SetStatus(m_pData == NULL ? 404 : 200);
+    response->SetStatus(m_status);
 
-    responseLength = m_size;
+    CefResponse::HeaderMap headers;
+    response->GetHeaderMap(headers);
+
+    if (m_status != 404)
+    {
+        // files can change at any time; allow caching, but revalidate with the validators
+        headers.insert(std::make_pair(TEXT("Cache-Control"), TEXT("no-cache")));
+        headers.insert(std::make_pair(TEXT("ETag"), m_etag));
+        headers.insert(std::make_pair(TEXT("Last-Modified"), m_lastModified));
+        headers.insert(std::make_pair(TEXT("Accept-Ranges"), TEXT("bytes")));
+    }
+
+    if (m_status == 206)
+    {
+        StringStream ss;
+        ss << TEXT("bytes ") << m_start << TEXT("-") << (m_end - 1) << TEXT("/") << m_fileSize;
+        headers.insert(std::make_pair(TEXT("Content-Range"), ss.str()));
+    }
+    else if (m_status == 416)
+    {
+        StringStream ss;
+        ss << TEXT("bytes */") << m_fileSize;
+        headers.insert(std::make_pair(TEXT("Content-Range"), ss.str()));
+    }
+
+    response->SetHeaderMap(headers);
+
+    responseLength = (m_status == 200 || m_status == 206) ? m_end - m_start : 0;
 }
     
 void LocalSchemeHandler::Cancel()
 {
     CEF_REQUIRE_IO_THREAD();
+
+    // a block still being read keeps the file open until it is done
+    m_file = NULL;
 }
     
 bool LocalSchemeHandler::ReadResponse(void* dataOut, int bytesToRead, int& bytesRead, CefRefPtr<CefCallback> callback)
 {
     CEF_REQUIRE_IO_THREAD();
-        
-    bool hasData = false;
+
     bytesRead = 0;
-    
-    if (m_pData != NULL)
+    if (m_file.get() == NULL || bytesToRead <= 0)
+        return false;
+
+    // return what has been read on the FILE thread
+    if (m_bufferOffset < m_buffer.size())
     {
-        if (m_offset < m_size)
-        {
-            // copy the next block of data into the buffer
-            int transferSize = std::min(bytesToRead, m_size - m_offset);
-            memcpy(dataOut, m_pData + m_offset, transferSize);
-            m_offset += transferSize;
-            
-            bytesRead = transferSize;
-            hasData = true;
-        }
-        
-        if (m_offset >= m_size)
-        {
-            delete[] m_pData;
-            m_pData = NULL;
-        }
+        bytesRead = (int) std::min((size_t) bytesToRead, m_buffer.size() - m_bufferOffset);
+        memcpy(dataOut, &m_buffer[m_bufferOffset], bytesRead);
+        m_bufferOffset += bytesRead;
+        return true;
     }
-    
-    return hasData;
+
+    if (m_isEndOfFile || m_offset >= m_end)
+    {
+        // done, or a read error or the file was truncated
+        m_file = NULL;
+        return false;
+    }
+
+    // reading large ranges would block the IO thread, so read the next block
+    // on the FILE thread and let CEF call ReadResponse again when it is available
+    int size = (int) std::min((int64) bytesToRead, m_end - m_offset);
+    CefPostTask(TID_FILE, base::Bind(&LocalSchemeHandler::ReadBlock, this, m_file, size, m_offset, callback));
+    return true;
+}
+
+void LocalSchemeHandler::ReadBlock(CefRefPtr<LocalFile> file, int size, int64 offset, CefRefPtr<CefCallback> callback)
+{
+    CEF_REQUIRE_FILE_THREAD();
+
+    m_buffer.resize(size);
+    int n = file->ReadAt(&m_buffer[0], size, offset);
+
+    m_buffer.resize(n > 0 ? n : 0);
+    m_bufferOffset = 0;
+    m_offset = offset + m_buffer.size();
+    m_isEndOfFile = n <= 0;
+
+    callback->Continue();
 }
 
 
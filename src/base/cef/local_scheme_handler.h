@@ -25,16 +25,26 @@
  *******************************************************************************/
 
 
+#include <vector>
+
 #include "lib/cef/include/cef_resource_handler.h"
 #include "base/types.h"
 
 
 namespace Zephyros {
 
+class LocalFile;
+
+/**
+ * Serves files from the local file system.
+ * The file is streamed in blocks of the size requested by CEF, which are
+ * read on the FILE thread; supports range requests and conditional requests.
+ */
 class LocalSchemeHandler : public CefResourceHandler
 {
 public:
     LocalSchemeHandler();
+    virtual ~LocalSchemeHandler();
 
     virtual bool ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<CefCallback> callback) OVERRIDE;
     virtual void GetResponseHeaders(CefRefPtr<CefResponse> response, int64& responseLength, CefString& redirectUrl) OVERRIDE;
@@ -42,10 +52,27 @@ public:
     virtual bool ReadResponse(void* dataOut, int bytesToRead, int& bytesRead, CefRefPtr<CefCallback> callback) OVERRIDE;
     
 private:
-    uint8_t* m_pData;
+    void ReadBlock(CefRefPtr<LocalFile> file, int size, int64 offset, CefRefPtr<CefCallback> callback);
+
+private:
     String m_mimeType;
-    int m_size;
-    int m_offset;
+    String m_etag;
+    String m_lastModified;
+    int m_status;
+
+    // the byte range [m_start, m_end) of the response; m_offset is the
+    // offset of the next block to read
+    int64 m_start;
+    int64 m_end;
+    int64 m_offset;
+    int64 m_fileSize;
+
+    CefRefPtr<LocalFile> m_file;
+
+    // the block of the file last read on the FILE thread
+    std::vector<char> m_buffer;
+    size_t m_bufferOffset;
+    bool m_isEndOfFile;
     
     IMPLEMENT_REFCOUNTING(LocalSchemeHandler);
 };
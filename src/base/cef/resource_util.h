@@ -45,6 +45,17 @@ bool GetResourceDir(String& dir);
 #endif
 
 
+#if defined(OS_WIN) || defined(OS_LINUX)
+
+/**
+ * Retrieve a pointer to the data of a resource embedded in the executable.
+ * The data is owned by the executable or the resource pack and stays valid
+ * while the app is running; it must not be freed.
+ */
+bool GetBinaryResource(const TCHAR* resource_name, const uint8_t*& data, size_t& size);
+
+#endif
+
 /**
  * Retrieve a resource as a string.
  */
@@ -11,6 +11,31 @@
 #include "base/cef/resource_util.h"
 
 
+bool GetBinaryResource(const TCHAR* szResourceName, const uint8_t*& pData, size_t& size)
+{
+    char* pResourceData = NULL;
+    int nLen = 0;
+
+    if (!Zephyros::GetResource(szResourceName, pResourceData, nLen))
+        return false;
+
+    pData = (const uint8_t*) pResourceData;
+    size = (size_t) nLen;
+    return true;
+}
+
+bool LoadBinaryResource(const TCHAR* szResourceName, String& resourceData)
+{
+    const uint8_t* pData = NULL;
+    size_t size = 0;
+
+    if (!GetBinaryResource(szResourceName, pData, size))
+        return false;
+
+    resourceData = String((const char*) pData, size);
+    return true;
+}
+
 CefRefPtr<CefStreamReader> GetBinaryResourceReader(const TCHAR* szResourceName)
 {
     char* pData = NULL;
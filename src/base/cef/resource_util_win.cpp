@@ -52,6 +52,24 @@ bool LoadBinaryResource(int binaryId, DWORD &dwSize, LPBYTE &pBytes)
     return false;
 }
 
+bool GetBinaryResource(const TCHAR* szResourceName, const uint8_t*& pData, size_t& size)
+{
+    int resourceId = Zephyros::GetResourceID(szResourceName);
+    if (resourceId <= 0)
+        return false;
+
+    DWORD dwSize;
+    LPBYTE pBytes;
+
+    if (!LoadBinaryResource(resourceId, dwSize, pBytes))
+        return false;
+
+    // the locked resource stays mapped as long as the module is loaded
+    pData = pBytes;
+    size = dwSize;
+    return true;
+}
+
 bool LoadBinaryResource(const TCHAR* szResourceName, String& resourceData)
 {
     int resourceId = Zephyros::GetResourceID(szResourceName);
@@ -46,6 +46,7 @@
 #include "base/cef/client_app.h"
 #include "base/cef/client_handler.h"
 #include "base/cef/extension_handler.h"
+#include "base/cef/api_scheme_handler.h"
 #include "base/cef/app_scheme_handler.h"
 #include "base/cef/local_scheme_handler.h"
 
@@ -167,6 +168,10 @@ int RunApplication(int argc, char* argv[])
 
     // register the "local" scheme (for loading resources from the local file system)
     CefRegisterSchemeHandlerFactory("local", "", new LocalSchemeHandlerFactory());
+
+    // register the "zephyros" scheme (for calling native functions with fetch())
+    CefRegisterSchemeHandlerFactory("zephyros", "api", new ApiSchemeHandlerFactory());
+    ApiSchemeHandlerFactory::AddCrossOriginWhitelistEntries();
     
     std::vector<CefString> schemes;
     schemes.push_back("app");
@@ -35,6 +35,7 @@
 
 #import "base/app.h"
 #import "base/cef/client_app.h"
+#import "base/cef/api_scheme_handler.h"
 #import "base/cef/app_scheme_handler.h"
 #import "base/cef/local_scheme_handler.h"
 #import "base/cef/ZPYCEFAppDelegate.h"
@@ -137,6 +138,10 @@ int RunApplication(int argc, char* argv[])
 
     // register the "local" scheme (for loading resources from the local file system)
     CefRegisterSchemeHandlerFactory("local", "", new LocalSchemeHandlerFactory());
+
+    // register the "zephyros" scheme (for calling native functions with fetch())
+    CefRegisterSchemeHandlerFactory("zephyros", "api", new ApiSchemeHandlerFactory());
+    ApiSchemeHandlerFactory::AddCrossOriginWhitelistEntries();
     
     std::vector<CefString> schemes;
     schemes.push_back("app");
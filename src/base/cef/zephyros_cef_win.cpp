@@ -52,6 +52,7 @@
 #include "base/cef/client_app.h"
 #include "base/cef/client_handler.h"
 #include "base/cef/extension_handler.h"
+#include "base/cef/api_scheme_handler.h"
 #include "base/cef/app_scheme_handler.h"
 #include "base/cef/local_scheme_handler.h"
 #include "base/cef/zephyros_cef_win.h"
@@ -220,6 +221,10 @@ int RunApplication(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCmdLin
 
     // register the "local" scheme (for loading resources from the local file system)
     CefRegisterSchemeHandlerFactory("local", "", new LocalSchemeHandlerFactory());
+
+    // register the "zephyros" scheme (for calling native functions with fetch())
+    CefRegisterSchemeHandlerFactory("zephyros", "api", new ApiSchemeHandlerFactory());
+    ApiSchemeHandlerFactory::AddCrossOriginWhitelistEntries();
     
     std::vector<CefString> schemes;
     schemes.push_back("app");
@@ -0,0 +1,209 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "base/resource_pack.h"
+#include "util/MurmurHash3.h"
+
+
+namespace Zephyros {
+
+ResourcePack::ResourcePack()
+    : m_pData(NULL), m_size(0), m_pHeader(NULL), m_pDisplacements(NULL), m_pEntries(NULL)
+{
+}
+
+ResourcePack::~ResourcePack()
+{
+    Close();
+}
+
+bool ResourcePack::Open(const String& path)
+{
+    Close();
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(ResourcePackHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* pData = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (pData == MAP_FAILED)
+        return false;
+
+    m_pData = (uint8_t*) pData;
+    m_size = st.st_size;
+    m_pHeader = (const ResourcePackHeader*) m_pData;
+
+    // validate the header and the table of contents bounds
+    size_t displacementsSize = ((m_pHeader->numBuckets + 1) & ~1) * sizeof(uint32_t);
+    size_t tocSize = sizeof(ResourcePackHeader) + displacementsSize + (size_t) m_pHeader->numEntries * sizeof(ResourcePackEntry);
+
+    if (memcmp(m_pHeader->magic, RESOURCE_PACK_MAGIC, 4) != 0 ||
+        m_pHeader->version != RESOURCE_PACK_VERSION ||
+        (m_pHeader->numEntries > 0 && m_pHeader->numBuckets == 0) ||
+        tocSize > m_size)
+    {
+        Close();
+        return false;
+    }
+
+    m_pDisplacements = (const uint32_t*) (m_pData + sizeof(ResourcePackHeader));
+    m_pEntries = (const ResourcePackEntry*) (m_pData + sizeof(ResourcePackHeader) + displacementsSize);
+
+    // the table of contents is accessed on every lookup; the data is mostly read sequentially
+    madvise(m_pData, tocSize, MADV_WILLNEED);
+
+    return true;
+}
+
+void ResourcePack::Close()
+{
+    base::AutoLock lock(m_lock);
+
+    if (m_pData != NULL)
+        munmap(m_pData, m_size);
+
+    m_pData = NULL;
+    m_size = 0;
+    m_pHeader = NULL;
+    m_pDisplacements = NULL;
+    m_pEntries = NULL;
+    m_decompressed.clear();
+}
+
+bool ResourcePack::IsOpen()
+{
+    return m_pData != NULL;
+}
+
+const ResourcePackEntry* ResourcePack::FindEntry(const String& name)
+{
+    if (m_pData == NULL || m_pHeader->numEntries == 0)
+        return NULL;
+
+    uint32_t hash = 0;
+    MurmurHash3_x86_32(name.c_str(), (int) name.length(), m_pHeader->seed, &hash);
+    uint32_t d = m_pDisplacements[hash % m_pHeader->numBuckets];
+
+    uint32_t index;
+    if (d & RESOURCE_PACK_DIRECT)
+        index = d & ~RESOURCE_PACK_DIRECT;
+    else
+    {
+        MurmurHash3_x86_32(name.c_str(), (int) name.length(), d, &hash);
+        index = hash % m_pHeader->numEntries;
+    }
+
+    if (index >= m_pHeader->numEntries)
+        return NULL;
+
+    // the perfect hash maps any key to some entry; make sure it's the right one
+    const ResourcePackEntry* pEntry = m_pEntries + index;
+    if (pEntry->nameLength != name.length() ||
+        (uint64_t) pEntry->nameOffset + pEntry->nameLength > m_size ||
+        memcmp(m_pData + pEntry->nameOffset, name.c_str(), name.length()) != 0 ||
+        pEntry->dataOffset + pEntry->storedSize > m_size)
+    {
+        return NULL;
+    }
+
+    return pEntry;
+}
+
+uint64_t ResourcePack::GetContentHash()
+{
+    return m_pHeader != NULL ? m_pHeader->contentHash : 0;
+}
+
+bool ResourcePack::GetResource(const String& name, const uint8_t*& data, size_t& size)
+{
+    const ResourcePackEntry* pEntry = FindEntry(name);
+    if (pEntry == NULL)
+        return false;
+
+    if (pEntry->compression == RESOURCE_PACK_COMPRESSION_NONE)
+    {
+        data = m_pData + pEntry->dataOffset;
+        size = (size_t) pEntry->storedSize;
+        return true;
+    }
+
+    if (pEntry->compression != RESOURCE_PACK_COMPRESSION_GZIP)
+        return false;
+
+    base::AutoLock lock(m_lock);
+
+    uint32_t index = (uint32_t) (pEntry - m_pEntries);
+    std::map<uint32_t, std::vector<uint8_t> >::iterator it = m_decompressed.find(index);
+
+    if (it == m_decompressed.end())
+    {
+        // decompress the whole entry at once; the uncompressed size is known
+        std::vector<uint8_t> buf((size_t) pEntry->size);
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, MAX_WBITS + 16) != Z_OK)
+            return false;
+
+        stream.next_in = (Bytef*) (m_pData + pEntry->dataOffset);
+        stream.avail_in = (uInt) pEntry->storedSize;
+        stream.next_out = buf.empty() ? NULL : (Bytef*) &buf[0];
+        stream.avail_out = (uInt) buf.size();
+
+        int ret = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+
+        if (ret != Z_STREAM_END || stream.total_out != pEntry->size)
+            return false;
+
+        it = m_decompressed.insert(std::make_pair(index, std::vector<uint8_t>())).first;
+        it->second.swap(buf);
+    }
+
+    // the vector isn't modified any more, so the pointer stays valid
+    data = it->second.empty() ? m_pData + pEntry->dataOffset : &it->second[0];
+    size = it->second.size();
+    return true;
+}
+
+} // namespace Zephyros
@@ -0,0 +1,141 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#ifndef Zephyros_ResourcePack_h
+#define Zephyros_ResourcePack_h
+#pragma once
+
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+#include "lib/cef/include/base/cef_lock.h"
+
+#include "base/types.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// Resource Pack File Format
+//
+// A resource pack bundles all app resources into a single file, which is
+// built by tools/make_resource_pack.py. All integers are little endian.
+//
+//   ResourcePackHeader                       (contentHash: first 8 bytes of the SHA-1
+//                                             of all names, sizes and contents)
+//   uint32_t displacements[numBuckets]       (padded to 8 bytes)
+//   ResourcePackEntry entries[numEntries]
+//   char names[]                             (not NUL-terminated)
+//   data                                     (each entry aligned to "alignment")
+//
+// The table of contents is a perfect hash ("hash and displace"):
+//   bucket = MurmurHash3_x86_32(name, seed) % numBuckets
+//   d = displacements[bucket]
+//   index = (d & RESOURCE_PACK_DIRECT) ? (d & ~RESOURCE_PACK_DIRECT) : MurmurHash3_x86_32(name, d) % numEntries
+// The name stored in entries[index] is compared to verify a match.
+
+#define RESOURCE_PACK_MAGIC "ZPAK"
+#define RESOURCE_PACK_VERSION 1
+#define RESOURCE_PACK_DIRECT 0x80000000
+
+#define RESOURCE_PACK_COMPRESSION_NONE 0
+#define RESOURCE_PACK_COMPRESSION_GZIP 1
+
+
+namespace Zephyros {
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t numEntries;
+    uint32_t numBuckets;
+    uint32_t seed;
+    uint32_t alignment;
+    uint64_t contentHash;
+} ResourcePackHeader;
+
+typedef struct
+{
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint64_t dataOffset;
+    uint64_t storedSize;
+    uint64_t size;
+    uint32_t compression;
+    uint32_t reserved;
+} ResourcePackEntry;
+
+
+class ResourcePack
+{
+public:
+    ResourcePack();
+    ~ResourcePack();
+
+    /**
+     * Memory-maps the resource pack at "path" and validates its header.
+     * Only the table of contents is touched; resource data is paged in
+     * by the OS when it is accessed.
+     */
+    bool Open(const String& path);
+    void Close();
+    bool IsOpen();
+
+    /**
+     * Returns the uncompressed data of the resource "name".
+     * Uncompressed resources are returned directly from the mapped file;
+     * compressed resources are decompressed on first access and cached.
+     */
+    bool GetResource(const String& name, const uint8_t*& data, size_t& size);
+
+    /**
+     * Returns the hash of the names and contents of all resources computed
+     * when the pack was built; it identifies the build of the app resources.
+     */
+    uint64_t GetContentHash();
+
+private:
+    const ResourcePackEntry* FindEntry(const String& name);
+
+private:
+    uint8_t* m_pData;
+    size_t m_size;
+
+    const ResourcePackHeader* m_pHeader;
+    const uint32_t* m_pDisplacements;
+    const ResourcePackEntry* m_pEntries;
+
+    // decompressed data of compressed entries, keyed by entry index
+    std::map<uint32_t, std::vector<uint8_t> > m_decompressed;
+    base::Lock m_lock;
+};
+
+} // namespace Zephyros
+
+
+#endif // Zephyros_ResourcePack_h
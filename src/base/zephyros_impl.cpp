@@ -33,6 +33,7 @@
 
 #ifdef OS_LINUX
 #include <X11/Xlib.h>
+#include "lib/cef/include/base/cef_lock.h"
 #endif
 
 #include "base/types.h"
@@ -42,7 +43,13 @@
 ///
 #include "native_extensions/path.h"
 #include "util/string_util.h"
+#include "util/MurmurHash3.h"
 #include "native_extensions/os_util.h"
+#include "native_extensions/file_util.h"
+
+#ifdef OS_LINUX
+#include "base/resource_pack.h"
+#endif
 
 #ifdef USE_CEF
 #include "base/cef/client_handler.h"
@@ -71,6 +78,9 @@ TCHAR* g_szAppURL = NULL;
 TCHAR* g_szUpdaterURL = NULL;
 TCHAR* g_szCrashReportingURL = NULL;
 TCHAR* g_szCrashReportingPrivacyPolicyURL = NULL;
+TCHAR* g_szCachePath = NULL;
+uint64_t g_nCacheSize = 0;
+TCHAR* g_szBuildHash = NULL;
 Size g_defaultWindowSize = { 660, 640 };
 WindowsInfo g_windowsInfo = { 0 };
 OSXInfo g_osxInfo = { 0 };
@@ -92,6 +102,13 @@ typedef struct {
     int nLength;
 } Resource;
 std::map<String, Resource> g_mapResources;
+
+String g_strResourcePackPath;
+ResourcePack g_resourcePack;
+bool g_bResourcePackLoaded = false;
+base::Lock g_resourcePackLock;
+
+ResourcePack* GetResourcePack();
 #endif
 
 bool g_bUseLogging = false;
@@ -256,6 +273,12 @@ void Shutdown()
     if (g_szCrashReportingPrivacyPolicyURL != NULL)
         delete[] g_szCrashReportingPrivacyPolicyURL;
 
+    if (g_szCachePath != NULL)
+        delete[] g_szCachePath;
+
+    if (g_szBuildHash != NULL)
+        delete[] g_szBuildHash;
+
     if (g_pLicenseManager != NULL)
         delete g_pLicenseManager;
 
@@ -271,6 +294,8 @@ void Shutdown()
     g_szUpdaterURL = NULL;
     g_szCrashReportingURL = NULL;
     g_szCrashReportingPrivacyPolicyURL = NULL;
+    g_szCachePath = NULL;
+    g_szBuildHash = NULL;
     g_pLicenseManager = NULL;
     g_pNativeExtensions = NULL;
 }
@@ -486,6 +511,61 @@ void SetUpdaterURL(const TCHAR* szURL)
     _tcscpy(g_szUpdaterURL, szURL);
 }
 
+const TCHAR* GetCachePath()
+{
+    return g_szCachePath;
+}
+
+uint64_t GetCacheSize()
+{
+    return g_nCacheSize;
+}
+
+void SetCachePath(const TCHAR* szCachePath, uint64_t nMaxSize)
+{
+    if (g_szCachePath)
+        delete[] g_szCachePath;
+    g_szCachePath = new TCHAR[_tcslen(szCachePath) + 1];
+    _tcscpy(g_szCachePath, szCachePath);
+
+    g_nCacheSize = nMaxSize;
+}
+
+const TCHAR* GetBuildHash()
+{
+    if (g_szBuildHash == NULL)
+    {
+        StringStream ss;
+        ss << std::hex;
+
+#ifdef OS_LINUX
+        ResourcePack* pPack = GetResourcePack();
+        if (pPack != NULL)
+            ss << pPack->GetContentHash();
+        else
+#endif
+        {
+            // no resource pack; derive the hash from the app name and version
+            String str = String(g_szAppName ? g_szAppName : TEXT("")) + TEXT("/") + String(g_szAppVersion ? g_szAppVersion : TEXT(""));
+            uint32_t hash = 0;
+            MurmurHash3_x86_32(str.c_str(), (int) (str.length() * sizeof(TCHAR)), 0, &hash);
+            ss << hash;
+        }
+
+        SetBuildHash(ss.str().c_str());
+    }
+
+    return g_szBuildHash;
+}
+
+void SetBuildHash(const TCHAR* szBuildHash)
+{
+    if (g_szBuildHash)
+        delete[] g_szBuildHash;
+    g_szBuildHash = new TCHAR[_tcslen(szBuildHash) + 1];
+    _tcscpy(g_szBuildHash, szBuildHash);
+}
+
 AbstractLicenseManager* GetLicenseManager()
 {
     return g_pLicenseManager;
@@ -542,8 +622,61 @@ void SetResourceID(const TCHAR* szResourceName, int nID)
 #endif // OS_WIN
 
 #ifdef OS_LINUX
+/**
+ * Maps the resource pack on first use. Only the header is validated, so
+ * this doesn't depend on the number of resources.
+ */
+ResourcePack* GetResourcePack()
+{
+    base::AutoLock lock(g_resourcePackLock);
+
+    if (!g_bResourcePackLoaded)
+    {
+        g_bResourcePackLoaded = true;
+
+        String path = g_strResourcePackPath;
+        if (path.empty())
+            path = FileUtil::GetApplicationPath() + TEXT("resources.pak");
+
+        g_resourcePack.Open(path);
+    }
+
+    return g_resourcePack.IsOpen() ? &g_resourcePack : NULL;
+}
+
+void SetResourcePackPath(const TCHAR* szPath)
+{
+    base::AutoLock lock(g_resourcePackLock);
+
+    // resource data is handed out as pointers into the mapped pack,
+    // so the pack can't be replaced once it has been opened
+    if (g_bResourcePackLoaded)
+    {
+        App::Log(TEXT("The resource pack is in use already; not switching to ") + String(szPath));
+        return;
+    }
+
+    g_strResourcePackPath = szPath;
+}
+
 bool GetResource(const TCHAR* szResourceName, char*& pData, int& nLen)
 {
+    // look in the resource pack first
+    ResourcePack* pPack = GetResourcePack();
+    if (pPack != NULL)
+    {
+        const uint8_t* pResourceData = NULL;
+        size_t size = 0;
+
+        if (pPack->GetResource(szResourceName, pResourceData, size))
+        {
+            pData = (char*) pResourceData;
+            nLen = (int) size;
+            return true;
+        }
+    }
+
+    // resources linked into the executable
     std::map<String, Resource>::iterator it = g_mapResources.find(szResourceName);
     if (it == g_mapResources.end())
         return false;
@@ -71,6 +71,7 @@ class ClientExtensionHandler;
 #ifdef USE_CEF
 
 class CefBrowser;
+class CefPostData;
 class CefProcessMessage;
 
 typedef int CallbackId;
@@ -110,6 +111,10 @@ typedef JSObjectRef CallbackId;
 
 #define CALLBACK_HANDLER(code) [](CefRefPtr<Zephyros::ClientHandler> handler, CefRefPtr<CefBrowser> browser, bool retVal) code
 
+#define DATA_FUNC(code) \
+    [](CefRefPtr<CefBrowser> browser, CefRefPtr<CefListValue> args, CefRefPtr<CefPostData> body, CefRefPtr<Zephyros::DataStream>& response, Zephyros::Error& err) -> bool \
+    code
+
 #endif
 
 
@@ -167,6 +172,8 @@ namespace Zephyros {
 
 class ClientCallback;
 class FileWatcher;
+class ChildProcess;
+class ProcessPool;
 class CustomURLManager;
 class Browser;
 
@@ -200,6 +207,11 @@ public:
     void FromErrno();
 #endif
 
+    inline int GetCode() const
+    {
+        return m_code;
+    }
+
     JavaScript::Object CreateJSRepresentation();
 
 private:
@@ -408,6 +420,41 @@ private:
 };
 
 
+/**
+ * The body of a response of a data function (see DataFunction).
+ * Read is called on the FILE thread, so it may block, until it returns 0
+ * (end of data) or a negative value (error).
+ */
+class DataStream : public virtual CefBase
+{
+public:
+    virtual ~DataStream() {}
+
+    virtual String GetMimeType() { return TEXT("application/octet-stream"); }
+
+    /**
+     * Returns the length of the data in bytes or -1 if unknown.
+     */
+    virtual int64 GetLength() { return -1; }
+
+    virtual int Read(void* buf, int size) = 0;
+};
+
+/**
+ * A native function called through the "zephyros://api/<function>" scheme.
+ * "args" contains the arguments declared for the NativeFunction with the same
+ * name, "body" the request body (or NULL). The function can set "response"
+ * to stream a response body. Called on the FILE thread.
+ */
+typedef bool (*DataFunction)(
+    CefRefPtr<CefBrowser> browser,
+    CefRefPtr<CefListValue> args,
+    CefRefPtr<CefPostData> body,
+    CefRefPtr<DataStream>& response,
+    Error& err
+);
+
+
 class NativeFunction
 {
 public:
@@ -430,6 +477,15 @@ public:
         m_fnxAllCallbacksCompleted = fnxAllCallbacksCompleted;
     }
 
+    /**
+     * Calls the data function with arguments parsed from the query string of
+     * an "api" URL, "?<arg name>=<JSON value>&..."; missing arguments are null.
+     * Returns false and sets "err" if an argument is invalid or the call fails.
+     */
+    bool CallDataFunction(
+        CefRefPtr<CefBrowser> browser, const std::map<String, String>& query, CefRefPtr<CefPostData> body,
+        CefRefPtr<DataStream>& response, Error& err);
+
 private:
     // A function pointer to the native implementation
     Function m_fnx;
@@ -444,6 +500,9 @@ public:
 
     // Function to invoke when all JavaScript callbacks have completed
     CallbacksCompleteHandler m_fnxAllCallbacksCompleted;
+
+    // Function to invoke for requests to "zephyros://api/<m_name>" (optional)
+    DataFunction m_fnxData;
 };
 
 #endif
@@ -515,6 +574,13 @@ public:
     virtual void AddNativeJavaScriptFunction(String name, NativeFunction* fnx, bool hasReturnValue = true, bool hasPersistentCallback = false, String customJavaScriptImplementation = TEXT("")) = 0;
 
 #ifdef USE_CEF
+    /**
+     * Makes the function "name" (which must have been added before) callable
+     * with fetch() through "zephyros://api/<name>", which passes request and
+     * response bodies without converting them to JavaScript values.
+     */
+    virtual void AddNativeDataFunction(String name, DataFunction fnx) {}
+
 protected:
     String CreateArgList(NativeFunction* fnx, bool hasReturnValue, bool hasPersistentCallback)
     {
@@ -543,6 +609,13 @@ public:
     virtual void ReleaseCefObjects() override;
 
     virtual void AddNativeJavaScriptFunction(String name, NativeFunction* fnx, bool hasReturnValue = true, bool hasPersistentCallback = false, String customJavaScriptImplementation = TEXT("")) override;
+    virtual void AddNativeDataFunction(String name, DataFunction fnx) override;
+
+    /**
+     * Returns the function "name" if it can be called through the "api"
+     * scheme, or NULL otherwise.
+     */
+    NativeFunction* GetNativeDataFunction(String name);
 
     void InvokeCallbacks(String functionName, CefRefPtr<CefListValue> args);
     void InvokeCallback(CallbackId callbackId, CefRefPtr<CefListValue> args);
@@ -619,7 +692,17 @@ public:
     virtual void SetClientExtensionHandler(ClientExtensionHandlerPtr e);
 
 public:
-    Zephyros::FileWatcher* m_fileWatcher;
+    // the running file watchers by handle
+    std::map<int, Zephyros::FileWatcher*> m_fileWatchers;
+    int m_nextFileWatcherHandle;
+
+    // the processes started with spawnProcess which haven't terminated yet, by handle
+    std::map<int, Zephyros::ChildProcess*> m_processes;
+    int m_nextProcessHandle;
+
+    // the process pools by handle
+    std::map<int, Zephyros::ProcessPool*> m_processPools;
+    int m_nextProcessPoolHandle;
     std::vector<Zephyros::Browser*>* m_pBrowsers;
 };
 
@@ -33,9 +33,25 @@
 namespace Zephyros {
 namespace BrowserUtil {
 
-Browser* GetDefaultBrowser(std::vector<Browser*>* pBrowsers)
+//
+// Returns the browsers, finding them if necessary. On Linux, finding the
+// browsers blocks while their versions are probed, so they are only found
+// by FindBrowsersAsync; until then, the list is empty.
+//
+static std::vector<Browser*>* GetBrowsers(std::vector<Browser*>* pBrowsers)
 {
+#ifdef OS_LINUX
+    static std::vector<Browser*> noBrowsers;
+    return pBrowsers != NULL ? pBrowsers : &noBrowsers;
+#else
     FindBrowsers(&pBrowsers);
+    return pBrowsers;
+#endif
+}
+
+Browser* GetDefaultBrowser(std::vector<Browser*>* pBrowsers)
+{
+    pBrowsers = GetBrowsers(pBrowsers);
 
     Browser* firstBrowser = NULL;
     for (std::vector<Browser*>::iterator it = pBrowsers->begin(); it != pBrowsers->end(); ++it)
@@ -51,7 +67,7 @@ Browser* GetDefaultBrowser(std::vector<Browser*>* pBrowsers)
 
 Browser* GetBrowserForIdentifier(std::vector<Browser*>* pBrowsers, String identifier)
 {
-    FindBrowsers(&pBrowsers);
+    pBrowsers = GetBrowsers(pBrowsers);
 
     for (std::vector<Browser*>::iterator it = pBrowsers->begin(); it != pBrowsers->end(); ++it)
         if ((*it)->GetIdentifier() == identifier)
@@ -61,7 +77,7 @@ Browser* GetBrowserForIdentifier(std::vector<Browser*>* pBrowsers, String identi
 
 Browser* GetBrowserForUserAgent(std::vector<Browser*>* pBrowsers, JavaScript::Object userAgent)
 {
-    FindBrowsers(&pBrowsers);
+    pBrowsers = GetBrowsers(pBrowsers);
 
     String strUserAgent = userAgent->GetString("name");
     String strUserAgentLc = ToLower(strUserAgent);
@@ -102,7 +118,7 @@ Browser* GetBrowserForUserAgent(std::vector<Browser*>* pBrowsers, JavaScript::Ob
 
 Browser* GetBrowserFromJSRepresentation(std::vector<Browser*>* pBrowsers, JavaScript::Object obj)
 {
-    FindBrowsers(&pBrowsers);
+    pBrowsers = GetBrowsers(pBrowsers);
 
     String identifier = obj->GetString("id");
     Browser* browser = GetBrowserForIdentifier(pBrowsers, identifier);
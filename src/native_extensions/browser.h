@@ -113,7 +113,11 @@ private:
 
 namespace BrowserUtil {
 
+#ifdef OS_LINUX
+void FindBrowsersAsync(std::vector<Browser*>** ppBrowsers, CallbackId callback, bool isDefaultBrowserOnly);
+#else
 void FindBrowsers(std::vector<Browser*>** ppBrowsers);
+#endif
 
 Browser* GetDefaultBrowser(std::vector<Browser*>* pBrowsers);
 Browser* GetBrowserForIdentifier(std::vector<Browser*>* pBrowsers, String identifier);
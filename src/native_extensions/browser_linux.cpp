@@ -24,69 +24,766 @@
  * Matthias Christen, Vanamco AG
  *******************************************************************************/
 
-#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "lib/cef/include/base/cef_bind.h"
+#include "lib/cef/include/base/cef_lock.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
+
+#include "base/cef/client_handler.h"
+#include "base/cef/extension_handler.h"
+
 #include "native_extensions/browser.h"
+#include "native_extensions/image_util_linux.h"
 #include "native_extensions/os_util.h"
 
+#include "util/picojson.h"
 #include "util/string_util.h"
 
 #include "zephyros.h"
 
 
-namespace Zephyros {
-namespace BrowserUtil {
+extern CefRefPtr<Zephyros::ClientHandler> g_handler;
 
-/**
- * Returns an array of all browsers available on the system.
- */
-void FindBrowsers(std::vector<Browser*>** ppBrowsers)
+
+// the name of the file in the config directory the browsers are cached in,
+// and the version of its format
+#define BROWSER_CACHE_FILENAME TEXT("browsers.json")
+#define BROWSER_CACHE_VERSION 2
+
+// the mime type handled by browsers
+#define BROWSER_MIME_TYPE TEXT("x-scheme-handler/http")
+
+// the maximum time "<browser> --version" may take
+#define BROWSER_VERSION_TIMEOUT_MS 2000
+
+#define MAX_BROWSER_DISCOVERY_THREADS 8
+
+
+//////////////////////////////////////////////////////////////////////////
+// Desktop Entries
+
+// A desktop entry (a ".desktop" file) in one of the XDG data directories
+typedef struct {
+    // the desktop file ID, e.g. "firefox.desktop" or "kde4-konqueror.desktop"
+    String id;
+    String path;
+
+    String name;
+    std::vector<String> command;
+    String icon;
+    bool isBrowser;
+
+    String executablePath;
+    String version;
+    String image;
+} DesktopEntry;
+
+typedef void (*DesktopEntryJob)(DesktopEntry* entry);
+
+// The entries processed by the discovery threads
+typedef struct {
+    std::vector<DesktopEntry*>* entries;
+    DesktopEntryJob job;
+    base::Lock lock;
+    size_t next;
+} DesktopEntryQueue;
+
+// the commands the browsers are started with, by identifier
+typedef std::map<String, std::vector<String> > BrowserCommands;
+static BrowserCommands g_browserCommands;
+
+// guards g_browserCommands, which is replaced once the browsers have been discovered
+static base::Lock g_browserLock;
+
+// the callbacks waiting for the browsers to be discovered on the file thread,
+// and whether they only want the default browser; only used on the UI thread
+static std::vector<std::pair<CallbackId, bool> > g_browserCallbacks;
+
+
+//
+// Returns the directories in $name (separated by colons), or in
+// defaultValue if the variable isn't set.
+//
+static std::vector<String> GetXDGDirectories(const char* name, String defaultValue)
 {
-    if (*ppBrowsers != NULL)
+    const char* value = getenv(name);
+    std::vector<String> dirs;
+
+    for (String dir : Split(value != NULL && value[0] != '\0' ? String(value) : defaultValue, TEXT(':')))
+        if (dir.length() > 0)
+            dirs.push_back(dir);
+
+    return dirs;
+}
+
+//
+// Returns the XDG data directories, the user's first.
+//
+static std::vector<String> GetDataDirectories()
+{
+    String home = Zephyros::OSUtil::GetHomeDirectory();
+    std::vector<String> dirs = GetXDGDirectories("XDG_DATA_HOME", home + TEXT("/.local/share"));
+    for (String dir : GetXDGDirectories("XDG_DATA_DIRS", TEXT("/usr/local/share:/usr/share")))
+        dirs.push_back(dir);
+
+    return dirs;
+}
+
+//
+// Returns the files which might define the default browser, most important first.
+//
+static std::vector<String> GetMimeAppsFiles(std::vector<String>& dataDirs)
+{
+    String home = Zephyros::OSUtil::GetHomeDirectory();
+    std::vector<String> files;
+
+    for (String dir : GetXDGDirectories("XDG_CONFIG_HOME", home + TEXT("/.config")))
+        files.push_back(dir + TEXT("/mimeapps.list"));
+    for (String dir : GetXDGDirectories("XDG_CONFIG_DIRS", TEXT("/etc/xdg")))
+        files.push_back(dir + TEXT("/mimeapps.list"));
+    for (String dir : dataDirs)
+        files.push_back(dir + TEXT("/applications/mimeapps.list"));
+    for (String dir : dataDirs)
+        files.push_back(dir + TEXT("/applications/defaults.list"));
+
+    return files;
+}
+
+//
+// Returns the modification time of a file or directory as a string
+// (nanoseconds don't fit into a JSON number), or an empty string if it doesn't exist.
+//
+static String GetModificationTime(const String& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return TEXT("");
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%lld.%09ld", (long long) st.st_mtim.tv_sec, (long) st.st_mtim.tv_nsec);
+    return buf;
+}
+
+static bool ReadTextFile(const String& path, String& contents)
+{
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    std::stringstream ss;
+    ss << file.rdbuf();
+    contents = ss.str();
+    return true;
+}
+
+//
+// Parses the key/value pairs in the group "group" of a desktop entry or
+// mimeapps.list file. Localized keys (e.g. "Name[de]") are skipped.
+//
+static std::map<String, String> ParseKeyFileGroup(const String& contents, const String& group)
+{
+    std::map<String, String> values;
+    bool isInGroup = false;
+
+    for (String line : Split(contents, TEXT('\n')))
+    {
+        Trim(line);
+        if (line.length() == 0 || line[0] == TEXT('#'))
+            continue;
+
+        if (line[0] == TEXT('['))
+        {
+            isInGroup = line == TEXT("[") + group + TEXT("]");
+            continue;
+        }
+
+        if (!isInGroup)
+            continue;
+
+        size_t pos = line.find(TEXT('='));
+        if (pos == String::npos)
+            continue;
+
+        String key = line.substr(0, pos);
+        Trim(key);
+        if (key.find(TEXT('[')) != String::npos || values.find(key) != values.end())
+            continue;
+
+        String value = line.substr(pos + 1);
+        values[key] = Trim(value);
+    }
+
+    return values;
+}
+
+//
+// Splits the "Exec" key of a desktop entry into the program and its arguments.
+//
+static std::vector<String> SplitCommand(const String& exec)
+{
+    std::vector<String> args;
+    String arg;
+    bool isQuoted = false;
+    bool hasArg = false;
+
+    for (size_t i = 0; i < exec.length(); ++i)
+    {
+        TCHAR c = exec[i];
+
+        if (c == TEXT('"'))
+        {
+            isQuoted = !isQuoted;
+            hasArg = true;
+        }
+        else if (c == TEXT('\\') && isQuoted && i + 1 < exec.length())
+            arg.push_back(exec[++i]);
+        else if ((c == TEXT(' ') || c == TEXT('\t')) && !isQuoted)
+        {
+            if (hasArg)
+                args.push_back(arg);
+            arg.clear();
+            hasArg = false;
+        }
+        else
+        {
+            arg.push_back(c);
+            hasArg = true;
+        }
+    }
+
+    if (hasArg)
+        args.push_back(arg);
+
+    return args;
+}
+
+//
+// Returns the index of the program in a command, skipping "env" and the
+// variables it sets.
+//
+static size_t GetProgramIndex(const std::vector<String>& command)
+{
+    size_t index = 0;
+    if (command.size() > 0 && command[0] == TEXT("env"))
+        for (index = 1; index < command.size() && command[index].find(TEXT('=')) != String::npos; ++index)
+            ;
+
+    return index;
+}
+
+//
+// Adds the desktop entries in the directory "dir" and its subdirectories,
+// unless an entry with the same ID has been found in a more important data
+// directory before. All directories are added to "dirs", since their
+// modification times decide whether the cache is still valid; this includes
+// missing directories, in which browsers might be installed later.
+//
+static void ListDesktopEntries(const String& dir, const String& idPrefix,
+    std::vector<DesktopEntry*>& entries, std::set<String>& ids, std::vector<String>& dirs)
+{
+    dirs.push_back(dir);
+
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL)
         return;
 
-    *ppBrowsers = new std::vector<Browser*>();
+    for (dirent* entry = readdir(d); entry != NULL; entry = readdir(d))
+    {
+        String name = entry->d_name;
+        if (name[0] == TEXT('.'))
+            continue;
+
+        String path = dir + TEXT("/") + name;
+
+        if (entry->d_type == DT_DIR)
+            ListDesktopEntries(path, idPrefix + name + TEXT("-"), entries, ids, dirs);
+        else if (StringEndsWith(name, TEXT(".desktop")))
+        {
+            String id = idPrefix + name;
+            if (ids.find(id) != ids.end())
+                continue;
 
-    String strRet = OSUtil::Exec(TEXT("apropos \"web browser\""));
-    std::vector<String> vecRet = Split(strRet, TEXT('\n'));
-    for (String strLine : vecRet)
+            ids.insert(id);
+
+            DesktopEntry* desktopEntry = new DesktopEntry();
+            desktopEntry->id = id;
+            desktopEntry->path = path;
+            desktopEntry->isBrowser = false;
+            entries.push_back(desktopEntry);
+        }
+    }
+
+    closedir(d);
+}
+
+//
+// Parses a desktop entry and checks whether it is a browser.
+//
+static void ParseDesktopEntry(DesktopEntry* entry)
+{
+    String contents;
+    if (!ReadTextFile(entry->path, contents))
+        return;
+
+    std::map<String, String> values = ParseKeyFileGroup(contents, TEXT("Desktop Entry"));
+    if (values[TEXT("Type")] != TEXT("Application") || values[TEXT("Hidden")] == TEXT("true") || values[TEXT("NoDisplay")] == TEXT("true"))
+        return;
+
+    std::vector<String> mimeTypes = Split(values[TEXT("MimeType")], TEXT(';'));
+    if (std::find(mimeTypes.begin(), mimeTypes.end(), BROWSER_MIME_TYPE) == mimeTypes.end())
+        return;
+
+    entry->command = SplitCommand(values[TEXT("Exec")]);
+
+    size_t programIndex = GetProgramIndex(entry->command);
+    if (programIndex >= entry->command.size())
+        return;
+
+    entry->executablePath = Zephyros::OSUtil::FindExecutable(entry->command[programIndex]);
+    if (entry->executablePath.length() == 0)
+        return;
+
+    entry->name = values[TEXT("Name")];
+    entry->icon = values[TEXT("Icon")];
+    entry->isBrowser = entry->name.length() > 0;
+}
+
+//
+// Returns the path of the PNG file of the icon "icon" (an icon name or an
+// absolute path), or an empty string if there is none.
+//
+static String FindIconFile(const String& icon, std::vector<String>& dataDirs)
+{
+    if (icon.length() == 0)
+        return TEXT("");
+
+    if (icon[0] == TEXT('/'))
+        return StringEndsWith(icon, TEXT(".png")) && access(icon.c_str(), R_OK) == 0 ? icon : TEXT("");
+
+    static const char* sizes[] = { "128x128", "256x256", "64x64", "48x48", "32x32" };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
     {
-        size_t pos = strLine.find(TEXT(' '));
-        if (pos != String::npos)
+        for (String dir : dataDirs)
         {
-            String strBrowserName = strLine.substr(0, pos);
+            String path = dir + TEXT("/icons/hicolor/") + sizes[i] + TEXT("/apps/") + icon + TEXT(".png");
+            if (access(path.c_str(), R_OK) == 0)
+                return path;
+        }
+    }
 
-            String strWhichCmd = TEXT("which ");
-            strWhichCmd.append(strBrowserName);
-            String strPath = OSUtil::Exec(strWhichCmd);
-            Trim(strPath);
+    String path = TEXT("/usr/share/pixmaps/") + icon + TEXT(".png");
+    return access(path.c_str(), R_OK) == 0 ? path : TEXT("");
+}
+
+//
+// Determines the version (from "<browser> --version") and the icon of a browser.
+//
+static void LoadBrowserDetails(DesktopEntry* entry)
+{
+    // sandboxed apps are started through a launcher, which would report its own version
+    String program = entry->executablePath.substr(entry->executablePath.rfind(TEXT('/')) + 1);
+    if (program != TEXT("flatpak") && program != TEXT("snap"))
+    {
+        std::vector<String> args;
+        args.push_back(entry->executablePath);
+        args.push_back(TEXT("--version"));
 
-            // TODO: version (2nd arg) and icon (4th arg) would be added here
-            if (strPath.length() > 0)
-                (*ppBrowsers)->push_back(new Browser(strBrowserName, TEXT(""), strPath, TEXT(""), false));
+        // e.g. "Mozilla Firefox 118.0" or "Chromium 117.0.5938.92 built on Debian"
+        String output = Zephyros::OSUtil::RunProcess(args, BROWSER_VERSION_TIMEOUT_MS);
+        for (String token : Split(output.substr(0, output.find(TEXT('\n'))), TEXT(' ')))
+        {
+            if (token.length() > 0 && isdigit(token[0]) && token.find(TEXT('.')) != String::npos)
+            {
+                entry->version = token;
+                break;
+            }
         }
     }
+
+    std::vector<String> dataDirs = GetDataDirectories();
+    String iconPath = FindIconFile(entry->icon, dataDirs);
+    String data;
+    if (iconPath.length() > 0 && ReadTextFile(iconPath, data))
+        entry->image = TEXT("data:image/png;base64,") + ImageUtil::Base64Encode(const_cast<char*>(data.c_str()), data.length());
 }
 
+static void* RunDesktopEntryJobs(void* arg)
+{
+    DesktopEntryQueue* queue = (DesktopEntryQueue*) arg;
 
-bool OpenURLInBrowser(String url, Browser* browser)
+    for ( ; ; )
+    {
+        DesktopEntry* entry = NULL;
+
+        {
+            base::AutoLock lock(queue->lock);
+            if (queue->next < queue->entries->size())
+                entry = (*queue->entries)[queue->next++];
+        }
+
+        if (entry == NULL)
+            break;
+
+        queue->job(entry);
+    }
+
+    return NULL;
+}
+
+//
+// Runs "job" for all entries on several threads.
+//
+static void RunInParallel(std::vector<DesktopEntry*>& entries, DesktopEntryJob job)
+{
+    DesktopEntryQueue queue;
+    queue.entries = &entries;
+    queue.job = job;
+    queue.next = 0;
+
+    long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t numThreads = std::min(entries.size(), (size_t) std::max(1L, std::min(numProcessors, (long) MAX_BROWSER_DISCOVERY_THREADS)));
+
+    // the calling thread is one of the workers
+    std::vector<pthread_t> threads;
+    for (size_t i = 1; i < numThreads; ++i)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, RunDesktopEntryJobs, &queue) == 0)
+            threads.push_back(thread);
+    }
+
+    RunDesktopEntryJobs(&queue);
+
+    for (pthread_t thread : threads)
+        pthread_join(thread, NULL);
+}
+
+//
+// Returns the ID of the desktop entry of the default browser, or an empty
+// string if none of the mimeapps.list files defines one.
+//
+static String FindDefaultBrowserId(std::vector<String>& mimeAppsFiles, std::vector<DesktopEntry*>& browsers)
+{
+    for (String file : mimeAppsFiles)
+    {
+        String contents;
+        if (!ReadTextFile(file, contents))
+            continue;
+
+        std::map<String, String> values = ParseKeyFileGroup(contents, TEXT("Default Applications"));
+        for (String id : Split(values[BROWSER_MIME_TYPE], TEXT(';')))
+            for (DesktopEntry* browser : browsers)
+                if (browser->id == id)
+                    return id;
+    }
+
+    return TEXT("");
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Browser Cache
+
+static String GetBrowserCacheFile()
+{
+    return Zephyros::OSUtil::GetConfigDirectory() + TEXT("/") + BROWSER_CACHE_FILENAME;
+}
+
+//
+// Returns the files and directories whose modification times decide whether
+// the cached browsers are still valid.
+//
+static std::vector<String> GetCacheDependencies(std::vector<String>& dirs, std::vector<String>& mimeAppsFiles, std::vector<Zephyros::Browser*>& browsers, BrowserCommands& commands)
+{
+    std::vector<String> dependencies(dirs);
+    dependencies.insert(dependencies.end(), mimeAppsFiles.begin(), mimeAppsFiles.end());
+
+    // updates of the browsers change their versions
+    for (Zephyros::Browser* browser : browsers)
+    {
+        std::vector<String>& command = commands[browser->GetIdentifier()];
+        size_t programIndex = GetProgramIndex(command);
+        if (programIndex < command.size())
+            dependencies.push_back(Zephyros::OSUtil::FindExecutable(command[programIndex]));
+    }
+
+    return dependencies;
+}
+
+//
+// Loads the browsers from the cache if none of the directories and files
+// they have been found in has changed since.
+//
+static bool LoadBrowserCache(std::vector<Zephyros::Browser*>& browsers, BrowserCommands& commands)
+{
+    std::ifstream file(GetBrowserCacheFile().c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    picojson::value value;
+    String err = picojson::parse(value, file);
+    if (err.length() > 0 || !value.is<picojson::object>())
+        return false;
+
+    picojson::object cache = value.get<picojson::object>();
+    if (!cache["version"].is<double>() || cache["version"].get<double>() != BROWSER_CACHE_VERSION ||
+        !cache["dependencies"].is<picojson::object>() || !cache["browsers"].is<picojson::array>())
+    {
+        return false;
+    }
+
+    picojson::object dependencies = cache["dependencies"].get<picojson::object>();
+    for (picojson::object::iterator it = dependencies.begin(); it != dependencies.end(); ++it)
+        if (!it->second.is<std::string>() || GetModificationTime(it->first) != it->second.get<std::string>())
+            return false;
+
+    for (picojson::value item : cache["browsers"].get<picojson::array>())
+    {
+        if (!item.is<picojson::object>())
+            continue;
+
+        picojson::object browser = item.get<picojson::object>();
+        std::vector<String> command;
+        if (browser["command"].is<picojson::array>())
+            for (picojson::value arg : browser["command"].get<picojson::array>())
+                command.push_back(arg.to_str());
+
+        String id = browser["id"].to_str();
+        commands[id] = command;
+        browsers.push_back(new Zephyros::Browser(
+            browser["name"].to_str(), browser["version"].to_str(), id, browser["image"].to_str(),
+            browser["isDefaultBrowser"].is<bool>() && browser["isDefaultBrowser"].get<bool>()));
+    }
+
+    return true;
+}
+
+static void SaveBrowserCache(std::vector<Zephyros::Browser*>& browsers, BrowserCommands& commands, std::vector<String>& dependencies)
+{
+    picojson::object cache;
+    cache["version"] = picojson::value((double) BROWSER_CACHE_VERSION);
+
+    picojson::object mtimes;
+    for (String dependency : dependencies)
+        mtimes[dependency] = picojson::value(GetModificationTime(dependency));
+    cache["dependencies"] = picojson::value(mtimes);
+
+    picojson::array items;
+    for (Zephyros::Browser* browser : browsers)
+    {
+        picojson::array command;
+        for (String arg : commands[browser->GetIdentifier()])
+            command.push_back(picojson::value(arg));
+
+        picojson::object item;
+        item["name"] = picojson::value(browser->GetName());
+        item["version"] = picojson::value(browser->GetVersion());
+        item["id"] = picojson::value(browser->GetIdentifier());
+        item["image"] = picojson::value(browser->GetImage());
+        item["isDefaultBrowser"] = picojson::value(browser->IsDefaultBrowser());
+        item["command"] = picojson::value(command);
+        items.push_back(picojson::value(item));
+    }
+    cache["browsers"] = picojson::value(items);
+
+    // replace the cache atomically, so another instance never reads a partial file
+    String filename = GetBrowserCacheFile();
+    String tmpFilename = filename + TEXT(".tmp");
+    std::ofstream file(tmpFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return;
+
+    file << picojson::value(cache).serialize();
+    file.close();
+
+    if (file.fail() || rename(tmpFilename.c_str(), filename.c_str()) != 0)
+        unlink(tmpFilename.c_str());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Browser Discovery
+
+//
+// Finds the desktop entries in the XDG data directories handling http URLs,
+// runs the browsers to determine their versions, and caches the result.
+//
+static void FindBrowserEntries(std::vector<Zephyros::Browser*>& result, BrowserCommands& commands)
+{
+    std::vector<String> dataDirs = GetDataDirectories();
+    std::vector<String> mimeAppsFiles = GetMimeAppsFiles(dataDirs);
+
+    std::vector<DesktopEntry*> entries;
+    std::set<String> ids;
+    std::vector<String> dirs;
+    for (String dir : dataDirs)
+        ListDesktopEntries(dir + TEXT("/applications"), TEXT(""), entries, ids, dirs);
+
+    RunInParallel(entries, ParseDesktopEntry);
+
+    std::vector<DesktopEntry*> browsers;
+    for (DesktopEntry* entry : entries)
+        if (entry->isBrowser)
+            browsers.push_back(entry);
+
+    RunInParallel(browsers, LoadBrowserDetails);
+
+    String defaultBrowserId = FindDefaultBrowserId(mimeAppsFiles, browsers);
+    for (DesktopEntry* browser : browsers)
+    {
+        commands[browser->id] = browser->command;
+        result.push_back(new Zephyros::Browser(browser->name, browser->version, browser->id, browser->image, browser->id == defaultBrowserId));
+    }
+
+    for (DesktopEntry* entry : entries)
+        delete entry;
+
+    std::vector<String> dependencies = GetCacheDependencies(dirs, mimeAppsFiles, result, commands);
+    SaveBrowserCache(result, commands, dependencies);
+}
+
+//
+// Loads the browsers from the cache, or finds them if the cache isn't valid
+// anymore. This might run the browsers, so it shouldn't be called on the UI
+// thread. g_browserLock is only held to install the commands found.
+//
+static std::vector<Zephyros::Browser*>* DiscoverBrowsers()
 {
-    String cmd;
+    std::vector<Zephyros::Browser*>* pBrowsers = new std::vector<Zephyros::Browser*>();
+    BrowserCommands commands;
+    if (!LoadBrowserCache(*pBrowsers, commands))
+        FindBrowserEntries(*pBrowsers, commands);
+
+    base::AutoLock lock(g_browserLock);
+    g_browserCommands.swap(commands);
 
-    if (!browser)
-        cmd = TEXT("xdg-open ");
+    return pBrowsers;
+}
+
+static void FireBrowsersCallback(std::vector<Zephyros::Browser*>* pBrowsers, CallbackId callback, bool isDefaultBrowserOnly)
+{
+    Zephyros::JavaScript::Array args = Zephyros::JavaScript::CreateArray();
+
+    if (isDefaultBrowserOnly)
+    {
+        Zephyros::Browser* defaultBrowser = Zephyros::BrowserUtil::GetDefaultBrowser(pBrowsers);
+        if (defaultBrowser != NULL)
+            args->SetDictionary(0, defaultBrowser->CreateJSRepresentation());
+        else
+            args->SetNull(0);
+    }
     else
     {
-        cmd = browser->GetIdentifier();
-        cmd.append(TEXT(" "));
+        Zephyros::JavaScript::Array browsers = Zephyros::JavaScript::CreateArray();
+        int i = 0;
+        for (Zephyros::Browser* browser : *pBrowsers)
+            browsers->SetDictionary(i++, browser->CreateJSRepresentation());
+        args->SetList(0, browsers);
     }
 
-    cmd.append(url);
+    g_handler->GetClientExtensionHandler()->InvokeCallback(callback, args);
+}
+
+//
+// Stores the browsers found on the file thread and invokes the callbacks
+// waiting for them. Called on the UI thread.
+//
+static void OnBrowsersDiscovered(std::vector<Zephyros::Browser*>** ppBrowsers, std::vector<Zephyros::Browser*>* pBrowsers)
+{
+    *ppBrowsers = pBrowsers;
+
+    std::vector<std::pair<CallbackId, bool> > callbacks;
+    callbacks.swap(g_browserCallbacks);
+    for (std::pair<CallbackId, bool>& item : callbacks)
+        FireBrowsersCallback(*ppBrowsers, item.first, item.second);
+}
+
+static void DiscoverBrowsersOnFileThread(std::vector<Zephyros::Browser*>** ppBrowsers)
+{
+    CefPostTask(TID_UI, base::Bind(&OnBrowsersDiscovered, ppBrowsers, DiscoverBrowsers()));
+}
+
 
+//////////////////////////////////////////////////////////////////////////
+// BrowserUtil Implementation
+
+namespace Zephyros {
+namespace BrowserUtil {
+
+/**
+ * Finds all browsers available on the system on the file thread, unless
+ * they have been found before, and passes them, or only the default
+ * browser, to the callback. The browsers are the desktop entries in the
+ * XDG data directories handling http URLs; they are cached in the config
+ * directory as long as the directories don't change.
+ */
+void FindBrowsersAsync(std::vector<Browser*>** ppBrowsers, CallbackId callback, bool isDefaultBrowserOnly)
+{
+    if (*ppBrowsers != NULL)
+    {
+        FireBrowsersCallback(*ppBrowsers, callback, isDefaultBrowserOnly);
+        return;
+    }
+
+    g_browserCallbacks.push_back(std::make_pair(callback, isDefaultBrowserOnly));
+    if (g_browserCallbacks.size() == 1)
+        CefPostTask(TID_FILE, base::Bind(&DiscoverBrowsersOnFileThread, ppBrowsers));
+}
+
+
+bool OpenURLInBrowser(String url, Browser* browser)
+{
+    // no shell is involved, so the URL doesn't need to be quoted
+    std::vector<String> args;
+
+    std::vector<String> command;
     if (browser)
-        cmd.append(TEXT(" &"));
+    {
+        base::AutoLock lock(g_browserLock);
+        BrowserCommands::iterator it = g_browserCommands.find(browser->GetIdentifier());
+        if (it != g_browserCommands.end())
+            command = it->second;
+    }
 
-    system(cmd.c_str());
-    return true;
+    if (!command.empty())
+    {
+        // expand the field codes of the "Exec" key of the desktop entry
+        bool hasURL = false;
+        for (String arg : command)
+        {
+            if (arg == TEXT("%u") || arg == TEXT("%U") || arg == TEXT("%f") || arg == TEXT("%F"))
+            {
+                args.push_back(url);
+                hasURL = true;
+            }
+            else if (arg.length() != 2 || arg[0] != TEXT('%'))
+                args.push_back(StringReplace(arg, TEXT("%%"), TEXT("%")));
+        }
+
+        if (!hasURL)
+            args.push_back(url);
+    }
+    else
+    {
+        args.push_back(TEXT("xdg-open"));
+        args.push_back(url);
+    }
+
+    return OSUtil::LaunchProcess(args);
 }
 
 
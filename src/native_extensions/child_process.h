@@ -0,0 +1,255 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#ifndef Zephyros_ChildProcess_h
+#define Zephyros_ChildProcess_h
+#pragma once
+
+
+#include <vector>
+#include <string>
+
+#ifdef OS_LINUX
+#include <sys/types.h>
+
+#include "lib/cef/include/base/cef_lock.h"
+#include "lib/cef/include/base/cef_ref_counted.h"
+#endif
+
+#include "base/types.h"
+#include "native_extensions/error.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// Constants
+
+// The streams reported in the output events (cf. EOutputStreamType)
+#define STREAM_STDOUT 0
+#define STREAM_STDERR 2
+
+// Output is collected for this many milliseconds before it is delivered,
+// so processes writing many small chunks don't flood the renderer with events
+#define PROCESS_OUTPUT_LATENCY_MS 50
+
+// Output is delivered immediately once this many bytes are pending
+#define PROCESS_OUTPUT_FLUSH_SIZE (64 * 1024)
+
+// The pipes of a process aren't read any more while this many bytes are
+// pending, so the process blocks until JavaScript has caught up
+#define PROCESS_OUTPUT_MAX_PENDING (1024 * 1024)
+
+// How the output of a process is delivered: streamed to the "onProcessEvent"
+// callbacks while the process is running (spawnProcess), collected and passed
+// to a callback when the process has terminated (startProcess), or handed to
+// the process pool the process is a worker of as soon as it has been read
+#define PROCESS_OUTPUT_STREAM 0
+#define PROCESS_OUTPUT_COLLECT 1
+#define PROCESS_OUTPUT_WORKER 2
+
+// A process which doesn't terminate within this many milliseconds after it
+// has been sent the kill signal because of its timeout or output limit gets SIGKILL
+#define PROCESS_KILL_GRACE_PERIOD_MS 5000
+
+// A process which doesn't terminate within this many milliseconds after it
+// has been shut down (its stdin has been closed) is killed like a process
+// which has timed out
+#define PROCESS_SHUTDOWN_GRACE_PERIOD_MS 5000
+
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+
+// A piece of output of a process; consecutive chunks of the same stream are
+// merged before they are delivered
+typedef struct {
+    int stream;
+    std::string text;
+} ProcessOutputChunk;
+
+// The resources a process has used (cf. IProcessUsage); times are in
+// milliseconds, the maximum resident set size is in bytes
+typedef struct {
+    double userTime;
+    double systemTime;
+    double wallTime;
+    double maxResidentSetSize;
+
+    // whether the process has been killed because of its timeout or its output limit
+    bool isTimedOut;
+    bool isOutputTruncated;
+} ProcessUsage;
+
+// The limits of a child process (cf. IProcessOptions)
+class ProcessOptions
+{
+public:
+    ProcessOptions()
+      : m_timeout(0), m_killSignal(TEXT("SIGTERM")), m_maxOutputBytes(0)
+    {
+    }
+
+    ProcessOptions(Zephyros::JavaScript::Object options)
+      : m_timeout(0), m_killSignal(TEXT("SIGTERM")), m_maxOutputBytes(0)
+    {
+        if (options->HasKey(TEXT("timeout")))
+            m_timeout = options->GetDouble(TEXT("timeout"));
+        if (options->HasKey(TEXT("killSignal")))
+            m_killSignal = options->GetString(TEXT("killSignal"));
+        if (options->HasKey(TEXT("maxOutputBytes")))
+            m_maxOutputBytes = options->GetDouble(TEXT("maxOutputBytes"));
+    }
+
+public:
+    // the time in milliseconds after which the process is killed, or 0
+    double m_timeout;
+
+    // the name of the signal sent when the process is killed, e.g. "SIGTERM"
+    String m_killSignal;
+
+    // the number of bytes of output (stdout and stderr together) after which
+    // the rest of the output is discarded and the process is killed, or 0
+    double m_maxOutputBytes;
+};
+
+#ifdef OS_LINUX
+
+// The state shared by a child process and the reactor serving its pipes:
+// the output which hasn't been delivered to JavaScript yet, and the input
+// which hasn't been written to the process yet. The reactor keeps it alive
+// until the process has terminated.
+class ProcessPipes : public base::RefCountedThreadSafe<ProcessPipes>
+{
+public:
+    ProcessPipes(int handle, int outputMode, CallbackId callback);
+
+    // called on the reactor thread
+    void AppendOutput(int stream, const char* data, size_t len);
+    void SetExited(int exitCode, const ProcessUsage& usage);
+    bool IsOutputFull();
+    bool TakeInput(std::string& input, bool& isClosed);
+    int TakeKillSignal();
+    bool TakeShutdown();
+
+    // called on the UI thread
+    bool TakeOutput(std::vector<ProcessOutputChunk>& chunks, int& exitCode);
+    bool WriteInput(const std::string& data);
+    void CloseInput();
+    void Shutdown();
+    void Kill(int signal);
+    void GetUsage(ProcessUsage& usage);
+
+private:
+    friend class base::RefCountedThreadSafe<ProcessPipes>;
+    ~ProcessPipes();
+
+public:
+    // the handle of the process, or of the pool if the process is a worker
+    int m_handle;
+    pid_t m_pid;
+
+    int m_outputMode;
+
+    // the callback of startProcess
+    CallbackId m_callback;
+
+private:
+    base::Lock m_lock;
+
+    std::vector<ProcessOutputChunk> m_output;
+    size_t m_outputSize;
+    bool m_isFlushScheduled;
+    bool m_isFlushPosted;
+
+    std::string m_input;
+    bool m_isInputClosed;
+
+    // the signal JavaScript has asked to send to the process, or 0
+    int m_killSignal;
+
+    // whether the process is to be killed if it doesn't terminate in the grace period
+    bool m_isShutdownRequested;
+
+    bool m_hasExited;
+    int m_exitCode;
+    ProcessUsage m_usage;
+};
+
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////
+// ChildProcess Definition
+
+namespace Zephyros {
+
+class ChildProcess
+{
+    //////////////////////////////////////////////////////////////////////
+    // Public Methods
+
+public:
+    ChildProcess();
+    ~ChildProcess();
+
+    bool Start(String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err);
+
+#ifdef OS_LINUX
+    // Starts a process whose output is collected and passed to "callback"
+    // together with the exit code when the process has terminated (startProcess).
+    static bool StartCollectingOutput(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err);
+
+    // Starts a worker of the process pool with the handle "poolHandle".
+    static bool StartWorker(int poolHandle, String executableFileName, std::vector<String> arguments, String cwd, scoped_refptr<ProcessPipes>& pipes, Error& err);
+#endif
+
+    bool WriteInput(const String& data);
+    void CloseInput();
+
+    // Sends the signal with the given name (e.g. "SIGTERM") to the process.
+    void Kill(const String& signal);
+
+    // Delivers the pending output to the "onProcessEvent" callbacks.
+    // Returns true if the process has terminated and the exit has been reported.
+    bool FireProcessEvents();
+
+
+    //////////////////////////////////////////////////////////////////////
+    // Member Variables
+
+public:
+    // the handle reported with the events to JavaScript
+    int m_handle;
+
+#ifdef OS_LINUX
+    scoped_refptr<ProcessPipes> m_pipes;
+#endif
+};
+
+} // namespace Zephyros
+
+
+#endif // Zephyros_ChildProcess_h
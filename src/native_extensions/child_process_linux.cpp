@@ -0,0 +1,1361 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#include <vector>
+#include <map>
+#include <set>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "lib/cef/include/base/cef_bind.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
+
+#include "base/cef/client_handler.h"
+#include "base/cef/extension_handler.h"
+
+#include "util/time_util.h"
+
+#include "native_extensions/child_process.h"
+#include "native_extensions/process_pool.h"
+
+
+// the size of the buffer the pipes are read into (the default capacity of a pipe)
+#define PIPE_READ_BUF_LEN 65536
+
+// the maximum number of reads to empty the pipes of a process which has
+// terminated; a process it has started might still be writing to them
+#define MAX_DRAIN_READS 16
+
+// the interval in which processes are reaped if there are no pidfds
+#define REAP_INTERVAL_MS 50
+
+#define MAX_EPOLL_EVENTS 64
+
+// the descriptors of a process in the epoll set are identified by the id of
+// the process and their kind; the wakeup eventfd has the id 0
+#define KIND_STDIN 0
+#define KIND_STDOUT 1
+#define KIND_STDERR 2
+#define KIND_PIDFD 3
+
+// pidfd_open (Linux 5.3) isn't wrapped by older C libraries
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+
+//
+// Returns the length of the prefix of data which doesn't end in the middle
+// of a UTF-8 sequence, so the rest can be held back until the next read.
+//
+static size_t GetCompleteUTF8Length(const char* data, size_t len)
+{
+    // a sequence is at most 4 bytes long, so only the last 3 bytes can be
+    // part of an incomplete sequence
+    for (size_t i = len; i > 0 && len - i < 4; --i)
+    {
+        unsigned char c = (unsigned char) data[i - 1];
+        if ((c & 0xc0) == 0x80)
+            continue;
+
+        size_t seqLen = 1;
+        if ((c & 0xe0) == 0xc0)
+            seqLen = 2;
+        else if ((c & 0xf0) == 0xe0)
+            seqLen = 3;
+        else if ((c & 0xf8) == 0xf0)
+            seqLen = 4;
+
+        return len - (i - 1) >= seqLen ? len : i - 1;
+    }
+
+    return len;
+}
+
+static double GetMilliseconds(const timeval& tv)
+{
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+//
+// Returns the number of the signal with the given name ("SIGTERM" or "TERM"),
+// or 0 if the name is unknown.
+//
+static int GetSignalNumber(String name)
+{
+    static const struct {
+        const char* name;
+        int signal;
+    } signals[] = {
+        { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+        { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "TERM", SIGTERM },
+        { "STOP", SIGSTOP }, { "CONT", SIGCONT }
+    };
+
+    if (name.compare(0, 3, "SIG") == 0)
+        name = name.substr(3);
+
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i)
+        if (name == signals[i].name)
+            return signals[i].signal;
+
+    return 0;
+}
+
+static Zephyros::JavaScript::Object CreateUsageJSRepresentation(const ProcessUsage& usage)
+{
+    Zephyros::JavaScript::Object obj = Zephyros::JavaScript::CreateObject();
+    obj->SetDouble(TEXT("userTime"), usage.userTime);
+    obj->SetDouble(TEXT("systemTime"), usage.systemTime);
+    obj->SetDouble(TEXT("wallTime"), usage.wallTime);
+    obj->SetDouble(TEXT("maxResidentSetSize"), usage.maxResidentSetSize);
+    obj->SetBool(TEXT("timedOut"), usage.isTimedOut);
+    obj->SetBool(TEXT("outputTruncated"), usage.isOutputTruncated);
+    return obj;
+}
+
+//
+// Delivers the pending output of the process with the given handle.
+//
+static void FireProcessEventsOnUIThread(int handle)
+{
+    Zephyros::DefaultNativeExtensions* extensions = (Zephyros::DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+    std::map<int, Zephyros::ChildProcess*>::iterator it = extensions->m_processes.find(handle);
+    if (it == extensions->m_processes.end())
+        return;
+
+    // the process is forgotten once its exit has been reported
+    if (it->second->FireProcessEvents())
+    {
+        delete it->second;
+        extensions->m_processes.erase(it);
+    }
+}
+
+//
+// Passes the collected output of a process started with startProcess to its callback.
+//
+static void FireStartProcessCallbackOnUIThread(scoped_refptr<ProcessPipes> pipes)
+{
+    std::vector<ProcessOutputChunk> chunks;
+    int exitCode = -1;
+    pipes->TakeOutput(chunks, exitCode);
+
+    ProcessUsage usage;
+    pipes->GetUsage(usage);
+
+    Zephyros::JavaScript::Array stream = Zephyros::JavaScript::CreateArray();
+    int i = 0;
+
+    for (ProcessOutputChunk& chunk : chunks)
+    {
+        Zephyros::JavaScript::Object streamEntry = Zephyros::JavaScript::CreateObject();
+        streamEntry->SetString(TEXT("text"), chunk.text);
+        streamEntry->SetInt(TEXT("fd"), chunk.stream);
+        stream->SetDictionary(i++, streamEntry);
+    }
+
+    Zephyros::JavaScript::Array callbackArgs = Zephyros::JavaScript::CreateArray();
+    callbackArgs->SetNull(0);
+    callbackArgs->SetInt(1, exitCode);
+    callbackArgs->SetList(2, stream);
+    callbackArgs->SetDictionary(3, CreateUsageJSRepresentation(usage));
+    Zephyros::GetNativeExtensions()->GetClientExtensionHandler()->InvokeCallback(pipes->m_callback, callbackArgs);
+}
+
+//
+// Spawns the process with its standard streams connected to the pipes.
+// The executable path and the working directory are globbed
+// (e.g., '~/.gem/ruby/*/bin/sass' will be resolved to something like
+// '/home/christen/.gem/ruby/2.0.0/bin/sass').
+//
+static bool SpawnProcess(String executableFileName, std::vector<String>& arguments, String cwd,
+    int stdinFd, int stdoutFd, int stderrFd, pid_t* pPid, Zephyros::Error& err)
+{
+    glob_t g;
+    String executablePath = executableFileName;
+    if (glob(executableFileName.c_str(), GLOB_TILDE, NULL, &g) == 0 && g.gl_pathc > 0)
+        executablePath = g.gl_pathv[0];
+    globfree(&g);
+
+    std::vector<char*> args;
+    args.push_back(const_cast<char*>(executablePath.c_str()));
+    for (String& arg : arguments)
+        args.push_back(const_cast<char*>(arg.c_str()));
+    args.push_back(NULL);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, stdinFd, 0);
+    posix_spawn_file_actions_adddup2(&actions, stdoutFd, 1);
+    posix_spawn_file_actions_adddup2(&actions, stderrFd, 2);
+
+    // change to the working directory in the child only;
+    // changing the directory of the app would affect all of its threads
+    if (cwd.length() > 0)
+    {
+        String workingDirectory = cwd;
+        if (glob(cwd.c_str(), GLOB_TILDE, NULL, &g) == 0 && g.gl_pathc > 0)
+            workingDirectory = g.gl_pathv[0];
+        globfree(&g);
+
+        posix_spawn_file_actions_addchdir_np(&actions, workingDirectory.c_str());
+    }
+
+    // the app ignores SIGPIPE (writing to a process which has closed its
+    // stdin must not terminate the app); the child gets the default handlers
+    // and an empty signal mask
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    int ret = posix_spawnp(pPid, args[0], &actions, &attr, &args[0], environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (ret != 0)
+    {
+        errno = ret;
+        err.FromErrno();
+        return false;
+    }
+
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ProcessReactor Definition
+
+namespace Zephyros {
+
+// A child process served by the reactor; only used on the reactor thread
+typedef struct {
+    int id;
+    scoped_refptr<ProcessPipes> pipes;
+
+    // the parent's ends of the pipes and the pidfd, or -1 if closed
+    int stdinFd;
+    int outputFds[2];
+    int pidFd;
+
+    // the tails of the output held back to not split UTF-8 sequences
+    std::string incompleteOutput[2];
+
+    // the input being written
+    std::string input;
+    size_t inputOffset;
+    bool isWritingInput;
+
+    bool isReadingPaused;
+
+    // the limits of the process
+    int killSignal;
+    size_t maxOutputBytes;
+    size_t numOutputBytes;
+
+    // the time (of the monotonic clock) the process has been started, and the
+    // time at which it times out or gets SIGKILL after it has been killed, or 0
+    double startTime;
+    double deadline;
+
+    bool isTerminating;
+    bool isTimedOut;
+    bool isOutputTruncated;
+
+    bool hasExited;
+
+    // false if the process has been reaped by somebody else, in which case
+    // the status and the resource usage aren't known
+    bool hasStatus;
+    int status;
+    rusage usage;
+    double exitTime;
+} ServedProcess;
+
+// Serves the pipes of all child processes on a single thread, and reaps the
+// processes when their pidfds become readable.
+class ProcessReactor
+{
+public:
+    static ProcessReactor* GetInstance();
+
+    ProcessReactor();
+
+    bool Start(Error& err);
+    void AddProcess(ProcessPipes* pipes, int stdinFd, int stdoutFd, int stderrFd, const ProcessOptions& options, int killSignal);
+    void Wakeup();
+
+    void Run();
+
+private:
+    bool StartThread();
+    void AddNewProcesses();
+    void Watch(ServedProcess* process, int fd, int kind, uint32_t events);
+    void Unwatch(int fd);
+    void ReadOutput(ServedProcess* process, int index);
+    void AppendOutput(ServedProcess* process, int index, const char* data, size_t len);
+    void DrainOutput(ServedProcess* process);
+    void CloseOutput(ServedProcess* process, int index);
+    void UpdateReading(ServedProcess* process);
+    void UpdateInput(ServedProcess* process);
+    void WriteInput(ServedProcess* process);
+    void CloseInput(ServedProcess* process);
+    void SetDeadline(ServedProcess* process, double deadline);
+    void ExpireDeadlines();
+    void Shutdown(ServedProcess* process);
+    void Terminate(ServedProcess* process);
+    void SendSignal(ServedProcess* process, int signal);
+    bool Reap(ServedProcess* process);
+    void Finish(ServedProcess* process);
+
+private:
+    // protects the processes which haven't been picked up by the thread yet
+    base::Lock m_lock;
+
+    pthread_t m_thread;
+    bool m_isRunning;
+
+    int m_epollFd;
+    int m_wakeupFd;
+
+    std::vector<ServedProcess*> m_newProcesses;
+
+    // the served processes by id
+    std::map<int, ServedProcess*> m_processes;
+    int m_nextId;
+
+    // processes which have closed their output, but can't be reaped through a pidfd
+    std::set<int> m_unreapedProcesses;
+
+    // the pending deadlines and the ids of their processes, ordered by time
+    std::set<std::pair<double, int> > m_deadlines;
+
+    char* m_buffer;
+};
+
+} // namespace Zephyros
+
+
+static void* StartReactorThread(void* arg)
+{
+    ((Zephyros::ProcessReactor*) arg)->Run();
+    return NULL;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ProcessReactor Implementation
+
+namespace Zephyros {
+
+ProcessReactor* ProcessReactor::GetInstance()
+{
+    // never destroyed; the thread keeps running once it has been started
+    static ProcessReactor* reactor = new ProcessReactor();
+    return reactor;
+}
+
+ProcessReactor::ProcessReactor()
+    : m_isRunning(false), m_epollFd(-1), m_wakeupFd(-1), m_nextId(0), m_buffer(NULL)
+{
+}
+
+//
+// Starts the thread if it isn't running yet.
+//
+bool ProcessReactor::Start(Error& err)
+{
+    base::AutoLock lock(m_lock);
+
+    if (!m_isRunning && !StartThread())
+    {
+        err.FromErrno();
+        return false;
+    }
+
+    return true;
+}
+
+//
+// Hands the pipes of a spawned process to the reactor thread.
+//
+void ProcessReactor::AddProcess(ProcessPipes* pipes, int stdinFd, int stdoutFd, int stderrFd, const ProcessOptions& options, int killSignal)
+{
+    ServedProcess* process = new ServedProcess();
+    process->id = 0;
+    process->pipes = pipes;
+    process->stdinFd = stdinFd;
+    process->outputFds[0] = stdoutFd;
+    process->outputFds[1] = stderrFd;
+    process->inputOffset = 0;
+    process->isWritingInput = false;
+    process->isReadingPaused = false;
+    process->killSignal = killSignal;
+    process->maxOutputBytes = options.m_maxOutputBytes > 0 ? (size_t) options.m_maxOutputBytes : 0;
+    process->numOutputBytes = 0;
+    process->startTime = TimeUtil::GetMonotonicTime();
+    process->deadline = options.m_timeout > 0 ? process->startTime + options.m_timeout : 0;
+    process->isTerminating = false;
+    process->isTimedOut = false;
+    process->isOutputTruncated = false;
+    process->hasExited = false;
+    process->hasStatus = false;
+    process->status = 0;
+    memset(&process->usage, 0, sizeof(process->usage));
+    process->exitTime = 0;
+
+    // without a pidfd, the process is reaped once it has closed its output
+    process->pidFd = (int) syscall(__NR_pidfd_open, pipes->m_pid, 0);
+
+    // the pipes must never block the thread
+    fcntl(stdinFd, F_SETFL, fcntl(stdinFd, F_GETFL) | O_NONBLOCK);
+    fcntl(stdoutFd, F_SETFL, fcntl(stdoutFd, F_GETFL) | O_NONBLOCK);
+    fcntl(stderrFd, F_SETFL, fcntl(stderrFd, F_GETFL) | O_NONBLOCK);
+
+    {
+        base::AutoLock lock(m_lock);
+        m_newProcesses.push_back(process);
+    }
+
+    Wakeup();
+}
+
+void ProcessReactor::Wakeup()
+{
+    eventfd_write(m_wakeupFd, 1);
+}
+
+bool ProcessReactor::StartThread()
+{
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (m_epollFd >= 0 && m_wakeupFd >= 0)
+    {
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0;
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeupFd, &ev) == 0 &&
+            pthread_create(&m_thread, &attr, StartReactorThread, this) == 0)
+        {
+            pthread_attr_destroy(&attr);
+            m_isRunning = true;
+            return true;
+        }
+
+        pthread_attr_destroy(&attr);
+    }
+
+    if (m_epollFd >= 0)
+        close(m_epollFd);
+    if (m_wakeupFd >= 0)
+        close(m_wakeupFd);
+    m_epollFd = -1;
+    m_wakeupFd = -1;
+
+    return false;
+}
+
+void ProcessReactor::Run()
+{
+    epoll_event events[MAX_EPOLL_EVENTS];
+    m_buffer = new char[PIPE_READ_BUF_LEN];
+
+    for ( ; ; )
+    {
+        int timeout = m_unreapedProcesses.size() > 0 ? REAP_INTERVAL_MS : -1;
+        if (m_deadlines.size() > 0)
+        {
+            double timeUntilDeadline = m_deadlines.begin()->first - TimeUtil::GetMonotonicTime();
+            int deadlineTimeout = timeUntilDeadline > 0 ? (int) ceil(timeUntilDeadline) : 0;
+            if (timeout < 0 || deadlineTimeout < timeout)
+                timeout = deadlineTimeout;
+        }
+
+        int numEvents = epoll_wait(m_epollFd, events, MAX_EPOLL_EVENTS, timeout);
+        if (numEvents < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        bool isWokenUp = false;
+
+        for (int i = 0; i < numEvents; ++i)
+        {
+            int id = (int) (events[i].data.u64 >> 2);
+            int kind = (int) (events[i].data.u64 & 3);
+
+            if (id == 0)
+            {
+                eventfd_t value;
+                eventfd_read(m_wakeupFd, &value);
+                isWokenUp = true;
+                continue;
+            }
+
+            // the process might have been finished by an earlier event
+            std::map<int, ServedProcess*>::iterator it = m_processes.find(id);
+            if (it == m_processes.end())
+                continue;
+
+            ServedProcess* process = it->second;
+            if (kind == KIND_STDIN)
+                WriteInput(process);
+            else if (kind == KIND_PIDFD)
+            {
+                if (Reap(process))
+                {
+                    // read what the process has written before it has terminated
+                    DrainOutput(process);
+                    Finish(process);
+                }
+            }
+            else
+                ReadOutput(process, kind - KIND_STDOUT);
+        }
+
+        if (isWokenUp)
+        {
+            AddNewProcesses();
+
+            // pick up new input and kill requests, and resume reading output which has been delivered
+            for (std::map<int, ServedProcess*>::iterator it = m_processes.begin(); it != m_processes.end(); ++it)
+            {
+                int signal = it->second->pipes->TakeKillSignal();
+                if (signal != 0)
+                    SendSignal(it->second, signal);
+                if (it->second->pipes->TakeShutdown())
+                    Shutdown(it->second);
+
+                UpdateInput(it->second);
+                UpdateReading(it->second);
+            }
+        }
+
+        ExpireDeadlines();
+
+        for (std::set<int>::iterator it = m_unreapedProcesses.begin(); it != m_unreapedProcesses.end(); )
+        {
+            ServedProcess* process = m_processes[*it++];
+            if (Reap(process))
+                Finish(process);
+        }
+    }
+
+    delete[] m_buffer;
+}
+
+void ProcessReactor::AddNewProcesses()
+{
+    std::vector<ServedProcess*> processes;
+
+    {
+        base::AutoLock lock(m_lock);
+        processes.swap(m_newProcesses);
+    }
+
+    for (ServedProcess* process : processes)
+    {
+        process->id = ++m_nextId;
+        m_processes[process->id] = process;
+
+        if (process->deadline > 0)
+            m_deadlines.insert(std::make_pair(process->deadline, process->id));
+
+        Watch(process, process->outputFds[0], KIND_STDOUT, EPOLLIN);
+        Watch(process, process->outputFds[1], KIND_STDERR, EPOLLIN);
+        if (process->pidFd >= 0)
+            Watch(process, process->pidFd, KIND_PIDFD, EPOLLIN);
+
+        UpdateInput(process);
+    }
+}
+
+void ProcessReactor::Watch(ServedProcess* process, int fd, int kind, uint32_t events)
+{
+    epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = ((uint64_t) process->id << 2) | (uint64_t) kind;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void ProcessReactor::Unwatch(int fd)
+{
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+//
+// Reads a chunk of output from stdout (index 0) or stderr (index 1).
+// Only one read per event, so a chatty process can't starve the others.
+//
+void ProcessReactor::ReadOutput(ServedProcess* process, int index)
+{
+    int fd = process->outputFds[index];
+    if (fd < 0)
+        return;
+
+    ssize_t bytesRead = read(fd, m_buffer, PIPE_READ_BUF_LEN);
+    if (bytesRead < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+
+    if (bytesRead <= 0)
+    {
+        CloseOutput(process, index);
+        return;
+    }
+
+    AppendOutput(process, index, m_buffer, (size_t) bytesRead);
+    UpdateReading(process);
+}
+
+void ProcessReactor::AppendOutput(ServedProcess* process, int index, const char* data, size_t len)
+{
+    // the output of workers is split into messages by length
+    if (process->pipes->m_outputMode == PROCESS_OUTPUT_WORKER)
+    {
+        process->pipes->AppendOutput(index == 0 ? STREAM_STDOUT : STREAM_STDERR, data, len);
+        return;
+    }
+
+    // discard the output beyond the limit
+    bool isLimitExceeded = process->maxOutputBytes > 0 && process->numOutputBytes + len > process->maxOutputBytes;
+    if (isLimitExceeded)
+        len = process->maxOutputBytes - process->numOutputBytes;
+    process->numOutputBytes += len;
+
+    // don't split UTF-8 sequences between two chunks
+    std::string& incomplete = process->incompleteOutput[index];
+    if (incomplete.length() > 0)
+    {
+        incomplete.append(data, len);
+        data = incomplete.c_str();
+        len = incomplete.length();
+    }
+
+    size_t completeLen = GetCompleteUTF8Length(data, len);
+    if (completeLen > 0)
+        process->pipes->AppendOutput(index == 0 ? STREAM_STDOUT : STREAM_STDERR, data, completeLen);
+
+    std::string rest(data + completeLen, len - completeLen);
+    incomplete.swap(rest);
+
+    if (isLimitExceeded)
+    {
+        // the process can't write any more output, and is killed;
+        // an incomplete UTF-8 sequence at the end of the output is dropped
+        process->isOutputTruncated = true;
+        for (int i = 0; i < 2; ++i)
+        {
+            process->incompleteOutput[i].clear();
+            CloseOutput(process, i);
+        }
+
+        Terminate(process);
+    }
+}
+
+//
+// Reads the output left in the pipes of a process which has terminated.
+//
+void ProcessReactor::DrainOutput(ServedProcess* process)
+{
+    for (int index = 0; index < 2; ++index)
+    {
+        for (int i = 0; i < MAX_DRAIN_READS && process->outputFds[index] >= 0; ++i)
+        {
+            ssize_t bytesRead = read(process->outputFds[index], m_buffer, PIPE_READ_BUF_LEN);
+            if (bytesRead <= 0)
+                break;
+
+            AppendOutput(process, index, m_buffer, (size_t) bytesRead);
+        }
+    }
+}
+
+void ProcessReactor::CloseOutput(ServedProcess* process, int index)
+{
+    int fd = process->outputFds[index];
+    if (fd < 0)
+        return;
+
+    // deliver what has been held back
+    std::string& incomplete = process->incompleteOutput[index];
+    if (incomplete.length() > 0)
+    {
+        process->pipes->AppendOutput(index == 0 ? STREAM_STDOUT : STREAM_STDERR, incomplete.c_str(), incomplete.length());
+        incomplete.clear();
+    }
+
+    if (!process->isReadingPaused)
+        Unwatch(fd);
+    close(fd);
+    process->outputFds[index] = -1;
+
+    // wait for the pidfd, or reap the process in the loop if there is none
+    if (process->outputFds[0] < 0 && process->outputFds[1] < 0 && process->pidFd < 0 && !process->hasExited)
+        m_unreapedProcesses.insert(process->id);
+}
+
+//
+// Stops reading the output of a process while too much of it is pending
+// (so the process blocks until JavaScript has caught up), and resumes when
+// it has been delivered.
+//
+void ProcessReactor::UpdateReading(ServedProcess* process)
+{
+    bool isFull = process->pipes->IsOutputFull();
+    if (isFull == process->isReadingPaused)
+        return;
+
+    for (int index = 0; index < 2; ++index)
+    {
+        if (process->outputFds[index] < 0)
+            continue;
+
+        // the descriptors are removed from the set, since closed pipes are
+        // reported even if no events are requested
+        if (isFull)
+            Unwatch(process->outputFds[index]);
+        else
+            Watch(process, process->outputFds[index], index == 0 ? KIND_STDOUT : KIND_STDERR, EPOLLIN);
+    }
+
+    process->isReadingPaused = isFull;
+}
+
+//
+// Picks up new input once the previous input has been written, and watches
+// stdin only while there is something to write.
+//
+void ProcessReactor::UpdateInput(ServedProcess* process)
+{
+    if (process->stdinFd < 0)
+        return;
+
+    if (process->inputOffset == process->input.length())
+    {
+        process->input.clear();
+        process->inputOffset = 0;
+
+        bool isClosed = false;
+        if (!process->pipes->TakeInput(process->input, isClosed) && isClosed)
+        {
+            CloseInput(process);
+            return;
+        }
+    }
+
+    bool hasInput = process->inputOffset < process->input.length();
+    if (hasInput == process->isWritingInput)
+        return;
+
+    if (hasInput)
+        Watch(process, process->stdinFd, KIND_STDIN, EPOLLOUT);
+    else
+        Unwatch(process->stdinFd);
+
+    process->isWritingInput = hasInput;
+}
+
+void ProcessReactor::WriteInput(ServedProcess* process)
+{
+    if (process->stdinFd < 0)
+        return;
+
+    ssize_t bytesWritten = write(process->stdinFd, process->input.c_str() + process->inputOffset, process->input.length() - process->inputOffset);
+    if (bytesWritten > 0)
+        process->inputOffset += (size_t) bytesWritten;
+    else if (bytesWritten < 0 && errno != EINTR && errno != EAGAIN)
+    {
+        // the process doesn't read its input any more
+        process->pipes->CloseInput();
+        process->input.clear();
+        process->inputOffset = 0;
+    }
+
+    UpdateInput(process);
+}
+
+void ProcessReactor::CloseInput(ServedProcess* process)
+{
+    if (process->stdinFd < 0)
+        return;
+
+    if (process->isWritingInput)
+        Unwatch(process->stdinFd);
+    close(process->stdinFd);
+
+    process->stdinFd = -1;
+    process->isWritingInput = false;
+}
+
+void ProcessReactor::SetDeadline(ServedProcess* process, double deadline)
+{
+    if (process->deadline > 0)
+        m_deadlines.erase(std::make_pair(process->deadline, process->id));
+
+    process->deadline = deadline;
+    if (deadline > 0)
+        m_deadlines.insert(std::make_pair(deadline, process->id));
+}
+
+//
+// Kills the processes which have timed out, and the processes which haven't
+// terminated in the grace period after they have been killed.
+//
+void ProcessReactor::ExpireDeadlines()
+{
+    double now = TimeUtil::GetMonotonicTime();
+
+    while (m_deadlines.size() > 0 && m_deadlines.begin()->first <= now)
+    {
+        ServedProcess* process = m_processes[m_deadlines.begin()->second];
+        SetDeadline(process, 0);
+
+        if (process->isTerminating)
+            SendSignal(process, SIGKILL);
+        else
+        {
+            process->isTimedOut = true;
+            Terminate(process);
+        }
+    }
+}
+
+//
+// Gives a process whose stdin has been closed the grace period to terminate,
+// after which it is killed like a process which has timed out.
+//
+void ProcessReactor::Shutdown(ServedProcess* process)
+{
+    double deadline = TimeUtil::GetMonotonicTime() + PROCESS_SHUTDOWN_GRACE_PERIOD_MS;
+    if (!process->isTerminating && (process->deadline == 0 || deadline < process->deadline))
+        SetDeadline(process, deadline);
+}
+
+//
+// Sends the kill signal to a process which has timed out or exceeded its
+// output limit, and SIGKILL if it's still running after the grace period.
+//
+void ProcessReactor::Terminate(ServedProcess* process)
+{
+    if (process->isTerminating)
+        return;
+
+    process->isTerminating = true;
+    SendSignal(process, process->killSignal);
+    SetDeadline(process, process->killSignal == SIGKILL ? 0 : TimeUtil::GetMonotonicTime() + PROCESS_KILL_GRACE_PERIOD_MS);
+}
+
+void ProcessReactor::SendSignal(ServedProcess* process, int signal)
+{
+    // the pid can't have been reused: the process is only reaped on this thread
+    if (!process->hasExited)
+        kill(process->pipes->m_pid, signal);
+}
+
+//
+// Collects the exit status and the resource usage if the process has terminated.
+//
+bool ProcessReactor::Reap(ServedProcess* process)
+{
+    if (!process->hasExited)
+    {
+        pid_t pid;
+        while ((pid = wait4(process->pipes->m_pid, &process->status, WNOHANG, &process->usage)) < 0 && errno == EINTR)
+            ;
+
+        // ECHILD if somebody else has reaped the process
+        if (pid != 0)
+        {
+            process->hasExited = true;
+            process->hasStatus = pid > 0;
+            process->exitTime = TimeUtil::GetMonotonicTime();
+        }
+    }
+
+    return process->hasExited;
+}
+
+//
+// Releases the descriptors of a process which has terminated and reports
+// its exit.
+//
+void ProcessReactor::Finish(ServedProcess* process)
+{
+    for (int index = 0; index < 2; ++index)
+        CloseOutput(process, index);
+    CloseInput(process);
+
+    if (process->pidFd >= 0)
+    {
+        Unwatch(process->pidFd);
+        close(process->pidFd);
+    }
+
+    // the exit code is -1 if it isn't known
+    int exitCode = -1;
+    if (process->hasStatus)
+    {
+        if (WIFEXITED(process->status))
+            exitCode = WEXITSTATUS(process->status);
+        else if (WIFSIGNALED(process->status))
+            exitCode = 128 + WTERMSIG(process->status);
+    }
+
+    ProcessUsage usage;
+    usage.userTime = GetMilliseconds(process->usage.ru_utime);
+    usage.systemTime = GetMilliseconds(process->usage.ru_stime);
+    usage.wallTime = process->exitTime - process->startTime;
+    usage.maxResidentSetSize = process->usage.ru_maxrss * 1024.0;
+    usage.isTimedOut = process->isTimedOut;
+    usage.isOutputTruncated = process->isOutputTruncated;
+
+    process->pipes->SetExited(exitCode, usage);
+
+    SetDeadline(process, 0);
+    m_unreapedProcesses.erase(process->id);
+    m_processes.erase(process->id);
+    delete process;
+}
+
+} // namespace Zephyros
+
+
+//////////////////////////////////////////////////////////////////////////
+// ProcessPipes Implementation
+
+ProcessPipes::ProcessPipes(int handle, int outputMode, CallbackId callback)
+  : m_handle(handle),
+    m_pid(0),
+    m_outputMode(outputMode),
+    m_callback(callback),
+    m_outputSize(0),
+    m_isFlushScheduled(false),
+    m_isFlushPosted(false),
+    m_isInputClosed(false),
+    m_killSignal(0),
+    m_isShutdownRequested(false),
+    m_hasExited(false),
+    m_exitCode(-1)
+{
+    memset(&m_usage, 0, sizeof(m_usage));
+}
+
+ProcessPipes::~ProcessPipes()
+{
+}
+
+void ProcessPipes::AppendOutput(int stream, const char* data, size_t len)
+{
+    base::AutoLock lock(m_lock);
+
+    if (m_output.size() > 0 && m_output.back().stream == stream)
+        m_output.back().text.append(data, len);
+    else
+    {
+        ProcessOutputChunk chunk;
+        chunk.stream = stream;
+        chunk.text.assign(data, len);
+        m_output.push_back(chunk);
+    }
+
+    m_outputSize += len;
+
+    // collected output is delivered when the process has terminated;
+    // workers are waiting for their responses, so their output isn't held back
+    if (m_outputMode == PROCESS_OUTPUT_COLLECT)
+        return;
+    if (m_outputMode == PROCESS_OUTPUT_WORKER)
+    {
+        if (!m_isFlushPosted)
+        {
+            m_isFlushPosted = true;
+            CefPostTask(TID_UI, base::Bind(&Zephyros::ProcessPool::FireWorkerOutputOnUIThread, m_handle, scoped_refptr<ProcessPipes>(this)));
+        }
+        return;
+    }
+
+    // deliver large amounts of output right away, otherwise wait for more
+    if (m_outputSize >= PROCESS_OUTPUT_FLUSH_SIZE)
+    {
+        if (!m_isFlushPosted)
+        {
+            m_isFlushPosted = true;
+            CefPostTask(TID_UI, base::Bind(&FireProcessEventsOnUIThread, m_handle));
+        }
+    }
+    else if (!m_isFlushScheduled)
+    {
+        m_isFlushScheduled = true;
+        CefPostDelayedTask(TID_UI, base::Bind(&FireProcessEventsOnUIThread, m_handle), PROCESS_OUTPUT_LATENCY_MS);
+    }
+}
+
+void ProcessPipes::SetExited(int exitCode, const ProcessUsage& usage)
+{
+    base::AutoLock lock(m_lock);
+
+    m_hasExited = true;
+    m_exitCode = exitCode;
+    m_usage = usage;
+    m_isInputClosed = true;
+    m_input.clear();
+
+    if (m_outputMode == PROCESS_OUTPUT_STREAM)
+        CefPostTask(TID_UI, base::Bind(&FireProcessEventsOnUIThread, m_handle));
+    else if (m_outputMode == PROCESS_OUTPUT_COLLECT)
+        CefPostTask(TID_UI, base::Bind(&FireStartProcessCallbackOnUIThread, scoped_refptr<ProcessPipes>(this)));
+    else
+        CefPostTask(TID_UI, base::Bind(&Zephyros::ProcessPool::FireWorkerOutputOnUIThread, m_handle, scoped_refptr<ProcessPipes>(this)));
+}
+
+bool ProcessPipes::IsOutputFull()
+{
+    base::AutoLock lock(m_lock);
+    return m_outputMode == PROCESS_OUTPUT_STREAM && m_outputSize >= PROCESS_OUTPUT_MAX_PENDING;
+}
+
+bool ProcessPipes::TakeInput(std::string& input, bool& isClosed)
+{
+    base::AutoLock lock(m_lock);
+
+    input.swap(m_input);
+    m_input.clear();
+    isClosed = m_isInputClosed;
+
+    return input.length() > 0;
+}
+
+int ProcessPipes::TakeKillSignal()
+{
+    base::AutoLock lock(m_lock);
+
+    int signal = m_killSignal;
+    m_killSignal = 0;
+    return signal;
+}
+
+bool ProcessPipes::TakeShutdown()
+{
+    base::AutoLock lock(m_lock);
+
+    bool isShutdownRequested = m_isShutdownRequested;
+    m_isShutdownRequested = false;
+    return isShutdownRequested;
+}
+
+bool ProcessPipes::TakeOutput(std::vector<ProcessOutputChunk>& chunks, int& exitCode)
+{
+    bool wasFull = false;
+    bool hasExited = false;
+
+    {
+        base::AutoLock lock(m_lock);
+
+        wasFull = m_outputMode == PROCESS_OUTPUT_STREAM && m_outputSize >= PROCESS_OUTPUT_MAX_PENDING;
+
+        chunks.swap(m_output);
+        m_output.clear();
+        m_outputSize = 0;
+        m_isFlushScheduled = false;
+        m_isFlushPosted = false;
+
+        hasExited = m_hasExited;
+        exitCode = m_exitCode;
+    }
+
+    // resume reading the pipes
+    if (wasFull && !hasExited)
+        Zephyros::ProcessReactor::GetInstance()->Wakeup();
+
+    return hasExited;
+}
+
+bool ProcessPipes::WriteInput(const std::string& data)
+{
+    {
+        base::AutoLock lock(m_lock);
+        if (m_isInputClosed)
+            return false;
+
+        m_input.append(data);
+    }
+
+    Zephyros::ProcessReactor::GetInstance()->Wakeup();
+    return true;
+}
+
+void ProcessPipes::CloseInput()
+{
+    {
+        base::AutoLock lock(m_lock);
+        if (m_isInputClosed)
+            return;
+
+        m_isInputClosed = true;
+    }
+
+    Zephyros::ProcessReactor::GetInstance()->Wakeup();
+}
+
+//
+// Closes stdin, and kills the process if it doesn't terminate by itself
+// within PROCESS_SHUTDOWN_GRACE_PERIOD_MS.
+//
+void ProcessPipes::Shutdown()
+{
+    {
+        base::AutoLock lock(m_lock);
+        if (m_hasExited)
+            return;
+
+        m_isInputClosed = true;
+        m_isShutdownRequested = true;
+    }
+
+    Zephyros::ProcessReactor::GetInstance()->Wakeup();
+}
+
+void ProcessPipes::Kill(int signal)
+{
+    {
+        base::AutoLock lock(m_lock);
+        if (m_hasExited)
+            return;
+
+        m_killSignal = signal;
+    }
+
+    // the signal is sent by the reactor, which knows whether the process has been reaped
+    Zephyros::ProcessReactor::GetInstance()->Wakeup();
+}
+
+void ProcessPipes::GetUsage(ProcessUsage& usage)
+{
+    base::AutoLock lock(m_lock);
+    usage = m_usage;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ChildProcess Implementation
+
+namespace Zephyros {
+
+//
+// Spawns a process and hands its pipes to the reactor.
+//
+static bool StartServedProcess(int handle, int outputMode, CallbackId callback,
+    String executableFileName, std::vector<String>& arguments, String cwd, const ProcessOptions& options,
+    scoped_refptr<ProcessPipes>& pipes, Error& err)
+{
+    int killSignal = GetSignalNumber(options.m_killSignal);
+    if (killSignal == 0)
+    {
+        err.SetError(ERR_INVALID_ARGUMENT, TEXT("Unknown kill signal ") + options.m_killSignal);
+        return false;
+    }
+
+    static bool isSigPipeIgnored = false;
+    if (!isSigPipeIgnored)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        isSigPipeIgnored = true;
+    }
+
+    if (!ProcessReactor::GetInstance()->Start(err))
+        return false;
+
+    int inPipe[2] = { -1, -1 };
+    int outPipe[2] = { -1, -1 };
+    int errPipe[2] = { -1, -1 };
+
+    // no other child process must inherit the pipes, or they will never be closed
+    if (pipe2(inPipe, O_CLOEXEC) || pipe2(outPipe, O_CLOEXEC) || pipe2(errPipe, O_CLOEXEC))
+    {
+        err.FromErrno();
+
+        int* fds[3] = { inPipe, outPipe, errPipe };
+        for (int i = 0; i < 3; ++i)
+        {
+            if (fds[i][0] >= 0)
+            {
+                close(fds[i][0]);
+                close(fds[i][1]);
+            }
+        }
+
+        return false;
+    }
+
+    pid_t pid;
+    bool success = SpawnProcess(executableFileName, arguments, cwd, inPipe[0], outPipe[1], errPipe[1], &pid, err);
+
+    // close the child's ends of the pipes
+    close(inPipe[0]);
+    close(outPipe[1]);
+    close(errPipe[1]);
+
+    if (!success)
+    {
+        close(inPipe[1]);
+        close(outPipe[0]);
+        close(errPipe[0]);
+        return false;
+    }
+
+    // the reference must be taken before the reactor can release the pipes
+    pipes = new ProcessPipes(handle, outputMode, callback);
+    pipes->m_pid = pid;
+    ProcessReactor::GetInstance()->AddProcess(pipes.get(), inPipe[1], outPipe[0], errPipe[0], options, killSignal);
+
+    return true;
+}
+
+ChildProcess::ChildProcess()
+  : m_handle(0)
+{
+}
+
+ChildProcess::~ChildProcess()
+{
+    // a process still running when the app shuts down gets EOF on its stdin
+    if (m_pipes.get())
+        m_pipes->CloseInput();
+}
+
+bool ChildProcess::Start(String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err)
+{
+    return StartServedProcess(m_handle, PROCESS_OUTPUT_STREAM, 0, executableFileName, arguments, cwd, options, m_pipes, err);
+}
+
+bool ChildProcess::StartCollectingOutput(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err)
+{
+    // the reactor keeps the pipes alive until the callback has been invoked
+    scoped_refptr<ProcessPipes> pipes;
+    return StartServedProcess(0, PROCESS_OUTPUT_COLLECT, callback, executableFileName, arguments, cwd, options, pipes, err);
+}
+
+bool ChildProcess::StartWorker(int poolHandle, String executableFileName, std::vector<String> arguments, String cwd, scoped_refptr<ProcessPipes>& pipes, Error& err)
+{
+    // workers run as long as the pool
+    return StartServedProcess(poolHandle, PROCESS_OUTPUT_WORKER, 0, executableFileName, arguments, cwd, ProcessOptions(), pipes, err);
+}
+
+bool ChildProcess::WriteInput(const String& data)
+{
+    return m_pipes->WriteInput(data);
+}
+
+void ChildProcess::CloseInput()
+{
+    m_pipes->CloseInput();
+}
+
+void ChildProcess::Kill(const String& signal)
+{
+    int signalNumber = GetSignalNumber(signal);
+    if (signalNumber != 0)
+        m_pipes->Kill(signalNumber);
+}
+
+bool ChildProcess::FireProcessEvents()
+{
+    std::vector<ProcessOutputChunk> chunks;
+    int exitCode = -1;
+    bool hasExited = m_pipes->TakeOutput(chunks, exitCode);
+
+    if (chunks.size() == 0 && !hasExited)
+        return false;
+
+    JavaScript::Array events = JavaScript::CreateArray();
+    int i = 0;
+
+    for (ProcessOutputChunk& chunk : chunks)
+    {
+        JavaScript::Object event = JavaScript::CreateObject();
+        event->SetInt(TEXT("handle"), m_handle);
+        event->SetString(TEXT("type"), TEXT("output"));
+        event->SetInt(TEXT("fd"), chunk.stream);
+        event->SetString(TEXT("text"), chunk.text);
+        events->SetDictionary(i++, event);
+    }
+
+    // the exit is always reported after all of the output
+    if (hasExited)
+    {
+        JavaScript::Object event = JavaScript::CreateObject();
+        event->SetInt(TEXT("handle"), m_handle);
+        event->SetString(TEXT("type"), TEXT("exit"));
+        event->SetInt(TEXT("exitCode"), exitCode);
+
+        ProcessUsage usage;
+        m_pipes->GetUsage(usage);
+        event->SetDictionary(TEXT("usage"), CreateUsageJSRepresentation(usage));
+        events->SetDictionary(i++, event);
+    }
+
+    JavaScript::Array args = JavaScript::CreateArray();
+    args->SetList(0, events);
+    Zephyros::GetNativeExtensions()->GetClientExtensionHandler()->InvokeCallbacks(TEXT("onProcessEvent"), args);
+
+    return hasExited;
+}
+
+} // namespace Zephyros
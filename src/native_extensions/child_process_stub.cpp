@@ -0,0 +1,72 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#include "native_extensions/child_process.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// ChildProcess Implementation
+//
+// Streaming processes are only implemented on Linux so far;
+// use startProcess on the other platforms.
+
+namespace Zephyros {
+
+ChildProcess::ChildProcess()
+  : m_handle(0)
+{
+}
+
+ChildProcess::~ChildProcess()
+{
+}
+
+bool ChildProcess::Start(String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err)
+{
+    err.SetError(ERR_UNKNOWN, TEXT("spawnProcess is not supported on this platform"));
+    return false;
+}
+
+bool ChildProcess::WriteInput(const String& data)
+{
+    return false;
+}
+
+void ChildProcess::CloseInput()
+{
+}
+
+void ChildProcess::Kill(const String& signal)
+{
+}
+
+bool ChildProcess::FireProcessEvents()
+{
+    return true;
+}
+
+} // namespace Zephyros
@@ -0,0 +1,1175 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+
+#include "lib/cef/include/base/cef_bind.h"
+#include "lib/cef/include/base/cef_lock.h"
+#include "lib/cef/include/base/cef_ref_counted.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
+
+#include "base/cef/client_handler.h"
+#include "base/cef/extension_handler.h"
+
+#include "util/picojson.h"
+#include "util/time_util.h"
+
+#include "native_extensions/download_linux.h"
+#include "native_extensions/error.h"
+#include "native_extensions/http_client_linux.h"
+
+
+// Files of at least twice DOWNLOAD_MIN_SEGMENT_SIZE bytes are split into
+// segments, which are downloaded in parallel using range requests
+#define DOWNLOAD_MIN_SEGMENT_SIZE (2 * 1024 * 1024)
+#define DOWNLOAD_DEFAULT_CONNECTIONS 4
+#define DOWNLOAD_MAX_CONNECTIONS 6
+
+#define DOWNLOAD_DEFAULT_PROGRESS_INTERVAL_MS 250
+
+// The data received are synced to disk and the state of the download is
+// saved at this interval, so the download can be resumed after a crash
+#define DOWNLOAD_CHECKPOINT_INTERVAL_MS 2000
+
+// The data received are written on the FILE thread. If the disk can't keep
+// up, the network thread waits once this many bytes are queued
+#define DOWNLOAD_MAX_QUEUED_BYTES (16 * 1024 * 1024)
+
+// A failed segment is retried at most this many times in a row; the count
+// is reset when the segment receives data. The delay before a retry doubles
+// with each retry. Downloads are restarted at most this many times if the
+// file has changed on the server
+#define DOWNLOAD_MAX_RETRIES 5
+#define DOWNLOAD_RETRY_DELAY_MS 500
+
+#define DOWNLOAD_STATE_VERSION 1
+
+#define DOWNLOAD_HASH_BUF_LEN (1024 * 1024)
+
+
+extern CefRefPtr<Zephyros::ClientHandler> g_handler;
+
+
+namespace Zephyros {
+
+class Download;
+
+static std::map<int, scoped_refptr<Download> > g_downloads;
+static int g_nextDownloadHandle = 0;
+
+
+static void FireDownloadProgress(int handle, double bytesReceived, double totalBytes, double bytesPerSecond)
+{
+    JavaScript::Object event = JavaScript::CreateObject();
+    event->SetInt(TEXT("handle"), handle);
+    event->SetString(TEXT("type"), TEXT("progress"));
+    event->SetDouble(TEXT("bytesReceived"), bytesReceived);
+    event->SetDouble(TEXT("totalBytes"), totalBytes);
+    event->SetDouble(TEXT("bytesPerSecond"), bytesPerSecond);
+
+    JavaScript::Array events = JavaScript::CreateArray();
+    events->SetDictionary(0, event);
+
+    JavaScript::Array args = JavaScript::CreateArray();
+    args->SetList(0, events);
+    g_handler->GetClientExtensionHandler()->InvokeCallbacks(TEXT("onDownloadEvent"), args);
+}
+
+static void FireDownloadFinished(int handle, Error error, String path, double size);
+
+static void SetHTTPError(Error& error, long status)
+{
+    int code = ERR_UNKNOWN;
+    if (status == 404 || status == 410)
+        code = ERR_FILE_NOT_FOUND;
+    else if (status == 401 || status == 403)
+        code = ERR_FILE_NO_READ_PERMISSION;
+
+    error.SetError(code, TEXT("The server responded with status ") + std::to_string(status));
+}
+
+
+typedef struct
+{
+    long long start;
+
+    // the offset of the last byte, or -1 if the size of the file isn't known yet
+    long long end;
+
+    // the number of bytes received, and the number of bytes written to
+    // the file; the rest is queued for the FILE thread
+    long long received;
+    long long written;
+
+    // the ID of the request downloading the segment, or 0
+    int requestId;
+
+    // the number of retries since the segment has last received data
+    int numRetries;
+} DownloadSegment;
+
+enum DownloadFileOpType
+{
+    DOWNLOAD_OP_WRITE,
+    DOWNLOAD_OP_TRUNCATE,
+    DOWNLOAD_OP_RESET,
+    DOWNLOAD_OP_CHECKPOINT,
+    DOWNLOAD_OP_FINISH
+};
+
+typedef struct
+{
+    DownloadFileOpType type;
+    size_t segment;
+    long long offset;
+    std::string data;
+
+    // write operations queued before the download was reset are dropped
+    int generation;
+} DownloadFileOp;
+
+//
+// Requests one segment of a download.
+//
+class DownloadSegmentRequest : public HttpRequest
+{
+public:
+    DownloadSegmentRequest(Download* download, size_t segment, String url)
+    : HttpRequest(TEXT("GET"), url), m_download(download), m_segment(segment)
+    {
+    }
+
+    virtual bool OnResponse(long status, const std::map<String, String>& headers);
+    virtual bool OnData(const char* data, size_t length);
+    virtual void OnFinished(const Error& error, long status);
+
+private:
+    scoped_refptr<Download> m_download;
+    size_t m_segment;
+};
+
+//
+// Downloads a file into "<path>.part", then verifies it and renames it to
+// "<path>". The state of the segments is saved to "<path>.part.state".
+// The requests' callbacks are invoked on the network thread; each request
+// holds a reference to the download. All file operations are queued and
+// executed in order on the FILE thread.
+//
+class Download : public base::RefCountedThreadSafe<Download>
+{
+public:
+    Download(int handle, String url, String path, const DownloadOptions& options);
+
+    bool Start(Error& err);
+    void Cancel();
+
+    String GetPath() { return m_path; }
+
+    bool OnResponse(size_t segment, long status, const std::map<String, String>& headers);
+    bool OnData(size_t segment, const char* data, size_t length);
+    void OnFinished(size_t segment, const Error& error, long status);
+
+private:
+    friend class base::RefCountedThreadSafe<Download>;
+    ~Download();
+
+    void Reset();
+    void StartSegment(size_t segment);
+    void RetrySegment(size_t segment);
+    void SplitSegments();
+    bool IsSegmentComplete(const DownloadSegment& segment);
+    void SetValidator(const std::map<String, String>& headers);
+
+    bool LoadState();
+    String GetState();
+    void SaveState(const String& state);
+    void Checkpoint(const String& state);
+    void RemoveFiles();
+
+    void QueueFileOp(DownloadFileOpType type, size_t segment = 0, long long offset = 0, const char* data = NULL, size_t length = 0);
+    void WaitForQueuedData();
+    void DropQueuedData();
+    void ProcessFileOps();
+    void ExecuteFileOp(const DownloadFileOp& op);
+    void OnFileError(const Error& error);
+
+    void FireProgress(double now);
+    void Finish();
+    void Complete();
+
+    static void* RunVerification(void* arg);
+    void Verify();
+
+private:
+    int m_handle;
+    String m_url;
+    String m_path;
+    String m_partPath;
+    String m_statePath;
+    DownloadOptions m_options;
+    int m_maxConnections;
+    double m_progressInterval;
+
+    base::Lock m_lock;
+    int m_fd;
+
+    std::vector<DownloadSegment> m_segments;
+    long long m_size;
+    bool m_acceptsRanges;
+
+    // the ETag or the modification date of the file, to make sure resumed
+    // segments belong to the same version of the file
+    String m_validator;
+
+    int m_numActiveRequests;
+    int m_numRestarts;
+    int m_generation;
+    bool m_isCancelled;
+    bool m_needsRestart;
+    Error m_error;
+
+    // whether the data received are kept if the download fails
+    bool m_isResumable;
+
+    long long m_bytesReceived;
+    long long m_lastProgressBytes;
+    double m_lastProgressTime;
+    double m_lastCheckpointTime;
+
+    // the file operations for the FILE thread; m_lock may be held when
+    // acquiring m_fileMutex, but not vice versa
+    pthread_mutex_t m_fileMutex;
+    pthread_cond_t m_fileCond;
+    std::deque<DownloadFileOp> m_fileOps;
+    size_t m_queuedBytes;
+    bool m_isFileTaskPending;
+    bool m_hasFileError;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// DownloadSegmentRequest Implementation
+
+bool DownloadSegmentRequest::OnResponse(long status, const std::map<String, String>& headers)
+{
+    if (m_download->OnResponse(m_segment, status, headers))
+        return true;
+
+    // report the status of a failed segment rather than ERR_CANCELLED
+    if (status >= 300)
+    {
+        Error error;
+        SetHTTPError(error, status);
+        SetError(error);
+    }
+
+    return false;
+}
+
+bool DownloadSegmentRequest::OnData(const char* data, size_t length)
+{
+    return m_download->OnData(m_segment, data, length);
+}
+
+void DownloadSegmentRequest::OnFinished(const Error& error, long status)
+{
+    m_download->OnFinished(m_segment, error, status);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Download Implementation
+
+Download::Download(int handle, String url, String path, const DownloadOptions& options)
+: m_handle(handle), m_url(url), m_path(path), m_options(options), m_fd(-1), m_size(-1), m_acceptsRanges(false),
+  m_numActiveRequests(0), m_numRestarts(0), m_generation(0), m_isCancelled(false), m_needsRestart(false), m_isResumable(true),
+  m_bytesReceived(0), m_lastProgressBytes(0), m_lastProgressTime(0), m_lastCheckpointTime(0),
+  m_queuedBytes(0), m_isFileTaskPending(false), m_hasFileError(false)
+{
+    pthread_mutex_init(&m_fileMutex, NULL);
+    pthread_cond_init(&m_fileCond, NULL);
+
+    m_partPath = path + TEXT(".part");
+    m_statePath = m_partPath + TEXT(".state");
+
+    m_maxConnections = options.m_maxConnections > 0 ? std::min(options.m_maxConnections, DOWNLOAD_MAX_CONNECTIONS) : DOWNLOAD_DEFAULT_CONNECTIONS;
+    m_progressInterval = options.m_progressInterval > 0 ? options.m_progressInterval : DOWNLOAD_DEFAULT_PROGRESS_INTERVAL_MS;
+}
+
+Download::~Download()
+{
+    if (m_fd >= 0)
+        close(m_fd);
+
+    pthread_cond_destroy(&m_fileCond);
+    pthread_mutex_destroy(&m_fileMutex);
+}
+
+bool Download::Start(Error& err)
+{
+    m_fd = open(m_partPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        err.FromErrno();
+        return false;
+    }
+
+    base::AutoLock lock(m_lock);
+
+    // resume the download if a previous one has been interrupted
+    if (!LoadState())
+        Reset();
+
+    m_lastProgressTime = m_lastCheckpointTime = TimeUtil::GetMonotonicTime();
+    m_lastProgressBytes = m_bytesReceived;
+
+    for (size_t i = 0; i < m_segments.size(); ++i)
+        if (!IsSegmentComplete(m_segments[i]))
+            StartSegment(i);
+
+    // all data might have been received before the app was quit
+    if (m_numActiveRequests == 0)
+        Finish();
+
+    return true;
+}
+
+void Download::Cancel()
+{
+    base::AutoLock lock(m_lock);
+
+    // once all data have been received, the download can't be cancelled anymore
+    if (m_numActiveRequests > 0)
+    {
+        m_isCancelled = true;
+        for (DownloadSegment& segment : m_segments)
+            if (segment.requestId != 0)
+                GetHttpClient()->Cancel(segment.requestId);
+    }
+}
+
+//
+// Restarts a failed segment after a delay. Called on the UI thread; the
+// pending retry counts as an active request.
+//
+void Download::RetrySegment(size_t segment)
+{
+    base::AutoLock lock(m_lock);
+
+    m_numActiveRequests--;
+    if (m_isCancelled || m_needsRestart || m_error.GetCode() != ERR_OK)
+    {
+        if (m_numActiveRequests == 0)
+            Finish();
+    }
+    else
+        StartSegment(segment);
+}
+
+void Download::Reset()
+{
+    DownloadSegment segment = { 0, -1, 0, 0, 0, 0 };
+    m_segments.clear();
+    m_segments.push_back(segment);
+
+    m_size = -1;
+    m_acceptsRanges = false;
+    m_validator = TEXT("");
+    m_bytesReceived = 0;
+    m_lastProgressBytes = 0;
+
+    // drop the data still queued for the old segments
+    m_generation++;
+    DropQueuedData();
+
+    QueueFileOp(DOWNLOAD_OP_RESET);
+}
+
+void Download::StartSegment(size_t segment)
+{
+    DownloadSegmentRequest* request = new DownloadSegmentRequest(this, segment, m_url);
+
+    // the byte ranges refer to the file, not to a compressed representation
+    request->AddHeader(TEXT("Accept-Encoding"), TEXT("identity"));
+
+    // the first request of a new download asks for the range "0-" to find
+    // out whether the server supports range requests
+    request->SetRange(m_segments[segment].start + m_segments[segment].received, m_segments[segment].end);
+    if (m_validator.length() > 0)
+        request->AddHeader(TEXT("If-Range"), m_validator);
+
+    m_numActiveRequests++;
+    m_segments[segment].requestId = GetHttpClient()->Start(request);
+}
+
+//
+// Splits the first segment, when the size of the file has become known,
+// and starts requests for the new segments.
+//
+void Download::SplitSegments()
+{
+    long long numSegments = std::min((long long) m_maxConnections, m_size / DOWNLOAD_MIN_SEGMENT_SIZE);
+    if (m_segments.size() != 1 || numSegments <= 1)
+        return;
+
+    long long segmentSize = m_size / numSegments;
+    m_segments[0].end = segmentSize - 1;
+
+    for (long long i = 1; i < numSegments; ++i)
+    {
+        DownloadSegment segment = { i * segmentSize, i == numSegments - 1 ? m_size - 1 : (i + 1) * segmentSize - 1, 0, 0, 0, 0 };
+        m_segments.push_back(segment);
+        StartSegment(m_segments.size() - 1);
+    }
+}
+
+bool Download::IsSegmentComplete(const DownloadSegment& segment)
+{
+    return (segment.end >= 0 || m_size == 0) && segment.start + segment.received > segment.end;
+}
+
+void Download::SetValidator(const std::map<String, String>& headers)
+{
+    // weak ETags can't be used for range requests
+    std::map<String, String>::const_iterator it = headers.find(TEXT("etag"));
+    if (it != headers.end() && it->second.compare(0, 2, TEXT("W/")) != 0)
+        m_validator = it->second;
+    else if ((it = headers.find(TEXT("last-modified"))) != headers.end())
+        m_validator = it->second;
+}
+
+bool Download::OnResponse(size_t segment, long status, const std::map<String, String>& headers)
+{
+    base::AutoLock lock(m_lock);
+
+    if (m_isCancelled || m_needsRestart || m_error.GetCode() != ERR_OK)
+        return false;
+
+    DownloadSegment& s = m_segments[segment];
+    long long offset = s.start + s.received;
+    bool isValid = true;
+
+    if (status == 206)
+    {
+        long long first = -1;
+        long long last = -1;
+        long long size = -1;
+
+        std::map<String, String>::const_iterator it = headers.find(TEXT("content-range"));
+        if (it != headers.end())
+            sscanf(it->second.c_str(), "bytes %lld-%lld/%lld", &first, &last, &size);
+
+        if (first != offset || (size >= 0 && m_size >= 0 && size != m_size))
+        {
+            // the file has changed on the server
+            m_needsRestart = true;
+            isValid = false;
+        }
+        else
+        {
+            m_acceptsRanges = true;
+            if (m_validator.length() == 0)
+                SetValidator(headers);
+
+            if (m_size < 0 && size >= 0)
+            {
+                m_size = size;
+                QueueFileOp(DOWNLOAD_OP_TRUNCATE, 0, m_size);
+            }
+
+            if (s.end < 0 && m_size >= 0)
+            {
+                s.end = m_size - 1;
+                SplitSegments();
+                QueueFileOp(DOWNLOAD_OP_CHECKPOINT);
+            }
+        }
+    }
+    else if (status >= 200 && status < 300)
+    {
+        if (offset > 0 || m_segments.size() > 1)
+        {
+            // the server sends the entire file: the file has changed, or
+            // the server doesn't support range requests anymore
+            m_needsRestart = true;
+            isValid = false;
+        }
+        else
+        {
+            m_acceptsRanges = false;
+            std::map<String, String>::const_iterator it = headers.find(TEXT("content-length"));
+            if (it != headers.end())
+            {
+                m_size = atoll(it->second.c_str());
+                s.end = m_size - 1;
+            }
+        }
+    }
+    else if (status == 416)
+    {
+        // the requested range is beyond the end of the file: the file has
+        // shrunk on the server
+        m_needsRestart = true;
+        isValid = false;
+    }
+    else if (status >= 500 || status == 408 || status == 429)
+    {
+        // a temporary failure; the segment is retried in OnFinished
+        isValid = false;
+    }
+    else
+    {
+        SetHTTPError(m_error, status);
+
+        // the data received so far are kept unless the file is gone
+        if (status == 404 || status == 410 || status == 401 || status == 403)
+            m_isResumable = false;
+        isValid = false;
+    }
+
+    if (isValid && m_options.m_size >= 0 && m_size >= 0 && m_size != (long long) m_options.m_size)
+    {
+        m_error.SetError(ERR_VERIFICATION_FAILED, TEXT("The size of the file doesn't match the expected size"));
+        m_isResumable = false;
+        isValid = false;
+    }
+
+    return isValid;
+}
+
+bool Download::OnData(size_t segment, const char* data, size_t length)
+{
+    size_t numBytes = length;
+
+    {
+        base::AutoLock lock(m_lock);
+
+        if (m_isCancelled || m_needsRestart || m_error.GetCode() != ERR_OK)
+            return false;
+
+        // the first request is open-ended, but only the data up to the end of
+        // its segment are used if the file has been split
+        DownloadSegment& s = m_segments[segment];
+        if (s.end >= 0)
+            numBytes = (size_t) std::max(0LL, std::min((long long) length, s.end + 1 - s.start - s.received));
+
+        if (numBytes > 0)
+        {
+            QueueFileOp(DOWNLOAD_OP_WRITE, segment, s.start + s.received, data, numBytes);
+            s.received += numBytes;
+            m_bytesReceived += numBytes;
+
+            // without range requests, the data are discarded when the download is retried
+            if (m_acceptsRanges)
+                s.numRetries = 0;
+        }
+
+        double now = TimeUtil::GetMonotonicTime();
+        if (now - m_lastProgressTime >= m_progressInterval)
+            FireProgress(now);
+    }
+
+    WaitForQueuedData();
+    return numBytes == length;
+}
+
+void Download::OnFinished(size_t segment, const Error& error, long status)
+{
+    base::AutoLock lock(m_lock);
+
+    m_numActiveRequests--;
+
+    DownloadSegment& s = m_segments[segment];
+    s.requestId = 0;
+
+    bool isOK = !m_isCancelled && !m_needsRestart && m_error.GetCode() == ERR_OK;
+
+    // the file had no Content-Length and has been received completely
+    if (isOK && s.end < 0 && error.GetCode() == ERR_OK && status >= 200 && status < 300)
+    {
+        m_size = s.received;
+        s.end = m_size - 1;
+    }
+
+    if (isOK && !IsSegmentComplete(s))
+    {
+        int numRetries = s.numRetries;
+        if (numRetries >= DOWNLOAD_MAX_RETRIES)
+        {
+            m_error = error;
+            if (m_error.GetCode() == ERR_OK)
+                m_error.SetError(ERR_CONNECTION_RESET, TEXT("The connection has been closed before all data have been received"));
+        }
+        else
+        {
+            // without range requests, the download has to start over
+            if (!m_acceptsRanges)
+                Reset();
+
+            m_segments[segment].numRetries = numRetries + 1;
+            m_numActiveRequests++;
+            CefPostDelayedTask(TID_UI, base::Bind(&Download::RetrySegment, this, segment), DOWNLOAD_RETRY_DELAY_MS << numRetries);
+        }
+    }
+
+    if (m_numActiveRequests == 0)
+        Finish();
+}
+
+//
+// Restores the segments of an interrupted download.
+//
+bool Download::LoadState()
+{
+    std::ifstream file(m_statePath.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    picojson::value value;
+    String err = picojson::parse(value, file);
+    if (err.length() > 0 || !value.is<picojson::object>())
+        return false;
+
+    picojson::object state = value.get<picojson::object>();
+    if (!state["version"].is<double>() || state["version"].get<double>() != DOWNLOAD_STATE_VERSION ||
+        state["url"].to_str() != m_url || !state["size"].is<double>() || !state["segments"].is<picojson::array>())
+    {
+        return false;
+    }
+
+    long long size = (long long) state["size"].get<double>();
+    struct stat st;
+    if (size <= 0 || fstat(m_fd, &st) != 0 || st.st_size != size)
+        return false;
+
+    std::vector<DownloadSegment> segments;
+    long long bytesReceived = 0;
+    for (picojson::value item : state["segments"].get<picojson::array>())
+    {
+        if (!item.is<picojson::array>() || item.get<picojson::array>().size() != 3)
+            return false;
+
+        picojson::array values = item.get<picojson::array>();
+        for (picojson::value v : values)
+            if (!v.is<double>())
+                return false;
+
+        long long received = (long long) values[2].get<double>();
+        DownloadSegment segment = { (long long) values[0].get<double>(), (long long) values[1].get<double>(), received, received, 0, 0 };
+        if (segment.start < 0 || segment.end >= size || segment.start > segment.end || segment.received < 0 || segment.received > segment.end - segment.start + 1)
+            return false;
+
+        segments.push_back(segment);
+        bytesReceived += segment.received;
+    }
+
+    if (segments.empty())
+        return false;
+
+    m_segments = segments;
+    m_size = size;
+    m_acceptsRanges = true;
+    m_validator = state["validator"].is<std::string>() ? state["validator"].get<std::string>() : TEXT("");
+    m_bytesReceived = bytesReceived;
+
+    return true;
+}
+
+//
+// Returns the state of the segments, or an empty string if the download
+// can't be resumed. Only the data written to the file are included.
+//
+String Download::GetState()
+{
+    // downloads can only be resumed if the server supports range requests
+    if (!m_acceptsRanges || m_size <= 0)
+        return TEXT("");
+
+    picojson::object state;
+    state["version"] = picojson::value((double) DOWNLOAD_STATE_VERSION);
+    state["url"] = picojson::value(m_url);
+    state["size"] = picojson::value((double) m_size);
+    state["validator"] = picojson::value(m_validator);
+
+    picojson::array segments;
+    for (DownloadSegment& segment : m_segments)
+    {
+        picojson::array item;
+        item.push_back(picojson::value((double) segment.start));
+        item.push_back(picojson::value((double) segment.end));
+        item.push_back(picojson::value((double) segment.written));
+        segments.push_back(picojson::value(item));
+    }
+    state["segments"] = picojson::value(segments);
+
+    return picojson::value(state).serialize();
+}
+
+void Download::SaveState(const String& state)
+{
+    if (state.length() == 0)
+        return;
+
+    String tmpFilename = m_statePath + TEXT(".tmp");
+    std::ofstream file(tmpFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return;
+
+    file << state;
+    file.close();
+
+    if (file.fail() || rename(tmpFilename.c_str(), m_statePath.c_str()) != 0)
+        unlink(tmpFilename.c_str());
+}
+
+//
+// Makes sure the data written before the state has been taken are on disk
+// before the state claims so. Called on the FILE thread.
+//
+void Download::Checkpoint(const String& state)
+{
+    fdatasync(m_fd);
+    SaveState(state);
+}
+
+void Download::RemoveFiles()
+{
+    unlink(m_partPath.c_str());
+    unlink(m_statePath.c_str());
+}
+
+//
+// Queues a file operation for the FILE thread. Called with m_lock held.
+//
+void Download::QueueFileOp(DownloadFileOpType type, size_t segment, long long offset, const char* data, size_t length)
+{
+    pthread_mutex_lock(&m_fileMutex);
+
+    // after a write has failed, the data received later can't be used anymore
+    if (!m_hasFileError || type != DOWNLOAD_OP_WRITE)
+    {
+        DownloadFileOp op;
+        op.type = type;
+        op.segment = segment;
+        op.offset = offset;
+        if (length > 0)
+            op.data.assign(data, length);
+        op.generation = m_generation;
+
+        m_fileOps.push_back(std::move(op));
+        m_queuedBytes += length;
+
+        if (!m_isFileTaskPending)
+        {
+            m_isFileTaskPending = true;
+            CefPostTask(TID_FILE, base::Bind(&Download::ProcessFileOps, this));
+        }
+    }
+
+    pthread_mutex_unlock(&m_fileMutex);
+}
+
+//
+// Blocks the network thread while too much data are queued, rather than
+// buffering an unbounded amount of data if the disk is slow.
+//
+void Download::WaitForQueuedData()
+{
+    pthread_mutex_lock(&m_fileMutex);
+    while (m_queuedBytes > DOWNLOAD_MAX_QUEUED_BYTES)
+        pthread_cond_wait(&m_fileCond, &m_fileMutex);
+    pthread_mutex_unlock(&m_fileMutex);
+}
+
+void Download::DropQueuedData()
+{
+    pthread_mutex_lock(&m_fileMutex);
+    for (std::deque<DownloadFileOp>::iterator it = m_fileOps.begin(); it != m_fileOps.end(); )
+    {
+        if (it->type == DOWNLOAD_OP_WRITE)
+        {
+            m_queuedBytes -= it->data.size();
+            it = m_fileOps.erase(it);
+        }
+        else
+            ++it;
+    }
+    pthread_cond_broadcast(&m_fileCond);
+    pthread_mutex_unlock(&m_fileMutex);
+}
+
+void Download::ProcessFileOps()
+{
+    pthread_mutex_lock(&m_fileMutex);
+
+    while (!m_fileOps.empty())
+    {
+        DownloadFileOp op = std::move(m_fileOps.front());
+        m_fileOps.pop_front();
+        pthread_mutex_unlock(&m_fileMutex);
+
+        ExecuteFileOp(op);
+
+        pthread_mutex_lock(&m_fileMutex);
+        m_queuedBytes -= op.data.size();
+        pthread_cond_broadcast(&m_fileCond);
+    }
+
+    m_isFileTaskPending = false;
+    pthread_mutex_unlock(&m_fileMutex);
+}
+
+void Download::ExecuteFileOp(const DownloadFileOp& op)
+{
+    Error error;
+    String state;
+
+    switch (op.type)
+    {
+    case DOWNLOAD_OP_WRITE:
+        for (size_t pos = 0; pos < op.data.size(); )
+        {
+            ssize_t numWritten = pwrite(m_fd, op.data.data() + pos, op.data.size() - pos, op.offset + pos);
+            if (numWritten < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                error.FromErrno();
+                OnFileError(error);
+                return;
+            }
+
+            pos += numWritten;
+        }
+
+        {
+            base::AutoLock lock(m_lock);
+
+            if (op.generation == m_generation)
+                m_segments[op.segment].written += op.data.size();
+
+            double now = TimeUtil::GetMonotonicTime();
+            if (now - m_lastCheckpointTime < DOWNLOAD_CHECKPOINT_INTERVAL_MS)
+                return;
+
+            m_lastCheckpointTime = now;
+            state = GetState();
+        }
+
+        Checkpoint(state);
+        break;
+
+    case DOWNLOAD_OP_TRUNCATE:
+        if (ftruncate(m_fd, op.offset) != 0)
+        {
+            error.FromErrno();
+            OnFileError(error);
+        }
+        break;
+
+    case DOWNLOAD_OP_RESET:
+        if (ftruncate(m_fd, 0) != 0)
+        {
+            error.FromErrno();
+            OnFileError(error);
+        }
+        unlink(m_statePath.c_str());
+        break;
+
+    case DOWNLOAD_OP_CHECKPOINT:
+        {
+            base::AutoLock lock(m_lock);
+            m_lastCheckpointTime = TimeUtil::GetMonotonicTime();
+            state = GetState();
+        }
+
+        Checkpoint(state);
+        break;
+
+    case DOWNLOAD_OP_FINISH:
+        Complete();
+        break;
+    }
+}
+
+//
+// Fails the download if a file operation has failed. The data still queued
+// are dropped, and the active requests are cancelled.
+//
+void Download::OnFileError(const Error& error)
+{
+    pthread_mutex_lock(&m_fileMutex);
+    m_hasFileError = true;
+    pthread_mutex_unlock(&m_fileMutex);
+
+    DropQueuedData();
+
+    base::AutoLock lock(m_lock);
+
+    if (m_error.GetCode() == ERR_OK)
+        m_error = error;
+
+    for (DownloadSegment& segment : m_segments)
+        if (segment.requestId != 0)
+            GetHttpClient()->Cancel(segment.requestId);
+}
+
+void Download::FireProgress(double now)
+{
+    double bytesPerSecond = now > m_lastProgressTime ? (m_bytesReceived - m_lastProgressBytes) * 1000.0 / (now - m_lastProgressTime) : 0;
+    CefPostTask(TID_UI, base::Bind(&FireDownloadProgress, m_handle, (double) m_bytesReceived, (double) m_size, bytesPerSecond));
+
+    m_lastProgressTime = now;
+    m_lastProgressBytes = m_bytesReceived;
+}
+
+//
+// Called when no requests are active anymore.
+//
+void Download::Finish()
+{
+    if (m_needsRestart && !m_isCancelled && m_error.GetCode() == ERR_OK)
+    {
+        m_needsRestart = false;
+
+        if (m_numRestarts < DOWNLOAD_MAX_RETRIES)
+        {
+            m_numRestarts++;
+            Reset();
+            StartSegment(0);
+            return;
+        }
+        else
+            m_error.SetError(ERR_CONNECTION_RESET, TEXT("The download couldn't be resumed"));
+    }
+
+    if (!m_isCancelled && m_error.GetCode() == ERR_OK)
+        FireProgress(TimeUtil::GetMonotonicTime());
+
+    // complete the download once the data still queued have been written
+    QueueFileOp(DOWNLOAD_OP_FINISH);
+}
+
+//
+// Saves or removes the data of a failed download, or verifies the file.
+// Called on the FILE thread.
+//
+void Download::Complete()
+{
+    Error error;
+    String state;
+    bool isResumable = false;
+    long long bytesReceived = 0;
+
+    {
+        base::AutoLock lock(m_lock);
+
+        error = m_error;
+        if (m_isCancelled)
+            error.SetError(ERR_CANCELLED, TEXT("The download has been cancelled"));
+
+        isResumable = m_isResumable && m_acceptsRanges && m_size > 0;
+        if (isResumable)
+            state = GetState();
+        bytesReceived = m_bytesReceived;
+    }
+
+    if (error.GetCode() != ERR_OK)
+    {
+        if (isResumable)
+            Checkpoint(state);
+        else
+            RemoveFiles();
+
+        CefPostTask(TID_UI, base::Bind(&FireDownloadFinished, m_handle, error, TEXT(""), (double) bytesReceived));
+        return;
+    }
+
+    // verifying the hash of a large file takes a while; do it on a separate
+    // thread, which keeps the download alive until it is done
+    AddRef();
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int ret = pthread_create(&thread, &attr, Download::RunVerification, this);
+    pthread_attr_destroy(&attr);
+
+    if (ret != 0)
+    {
+        Release();
+        Verify();
+    }
+}
+
+void* Download::RunVerification(void* arg)
+{
+    Download* download = (Download*) arg;
+    download->Verify();
+    download->Release();
+    return NULL;
+}
+
+void Download::Verify()
+{
+    Error error;
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    if (fsync(m_fd) != 0 || fstat(m_fd, &st) != 0)
+        error.FromErrno();
+    else if ((m_size >= 0 && st.st_size != m_size) || (m_options.m_size >= 0 && st.st_size != (long long) m_options.m_size))
+        error.SetError(ERR_VERIFICATION_FAILED, TEXT("The size of the file doesn't match the expected size"));
+    else if (m_options.m_hash.length() > 0)
+    {
+        const EVP_MD* md = EVP_get_digestbyname(m_options.m_hashAlgorithm.length() > 0 ? m_options.m_hashAlgorithm.c_str() : "sha256");
+        EVP_MD_CTX* ctx = EVP_MD_CTX_create();
+        EVP_DigestInit_ex(ctx, md, NULL);
+
+        std::vector<char> buf(DOWNLOAD_HASH_BUF_LEN);
+        for (off_t offset = 0; error.GetCode() == ERR_OK; )
+        {
+            ssize_t numRead = pread(m_fd, &buf[0], buf.size(), offset);
+            if (numRead < 0 && errno == EINTR)
+                continue;
+            if (numRead < 0)
+                error.FromErrno();
+            if (numRead <= 0)
+                break;
+
+            EVP_DigestUpdate(ctx, &buf[0], numRead);
+            offset += numRead;
+        }
+
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digestLength = 0;
+        EVP_DigestFinal_ex(ctx, digest, &digestLength);
+        EVP_MD_CTX_destroy(ctx);
+
+        String hash;
+        char hex[3];
+        for (unsigned int i = 0; i < digestLength; ++i)
+        {
+            snprintf(hex, sizeof(hex), "%02x", digest[i]);
+            hash += hex;
+        }
+
+        String expectedHash = m_options.m_hash;
+        std::transform(expectedHash.begin(), expectedHash.end(), expectedHash.begin(), ::tolower);
+        if (error.GetCode() == ERR_OK && hash != expectedHash)
+            error.SetError(ERR_VERIFICATION_FAILED, TEXT("The hash of the file doesn't match the expected hash"));
+    }
+
+    if (error.GetCode() == ERR_OK)
+    {
+        if (rename(m_partPath.c_str(), m_path.c_str()) != 0)
+            error.FromErrno();
+        unlink(m_statePath.c_str());
+    }
+    else if (error.GetCode() == ERR_VERIFICATION_FAILED)
+        RemoveFiles();
+
+    CefPostTask(TID_UI, base::Bind(&FireDownloadFinished, m_handle, error, error.GetCode() == ERR_OK ? m_path : TEXT(""), (double) st.st_size));
+}
+
+
+static void FireDownloadFinished(int handle, Error error, String path, double size)
+{
+    JavaScript::Object event = JavaScript::CreateObject();
+    event->SetInt(TEXT("handle"), handle);
+    event->SetString(TEXT("type"), TEXT("finished"));
+    if (error.GetCode() != ERR_OK)
+        event->SetDictionary(TEXT("error"), error.CreateJSRepresentation());
+    else
+        event->SetNull(TEXT("error"));
+    event->SetString(TEXT("path"), path);
+    event->SetDouble(TEXT("size"), size);
+
+    JavaScript::Array events = JavaScript::CreateArray();
+    events->SetDictionary(0, event);
+
+    JavaScript::Array args = JavaScript::CreateArray();
+    args->SetList(0, events);
+    g_handler->GetClientExtensionHandler()->InvokeCallbacks(TEXT("onDownloadEvent"), args);
+
+    g_downloads.erase(handle);
+}
+
+
+namespace DownloadManager {
+
+int Start(String url, String path, const DownloadOptions& options, Error& err)
+{
+    if (options.m_hash.length() > 0 && EVP_get_digestbyname(options.m_hashAlgorithm.length() > 0 ? options.m_hashAlgorithm.c_str() : "sha256") == NULL)
+    {
+        err.SetError(ERR_INVALID_ARGUMENT, TEXT("Unknown hash algorithm ") + options.m_hashAlgorithm);
+        return 0;
+    }
+
+    for (std::map<int, scoped_refptr<Download> >::iterator it = g_downloads.begin(); it != g_downloads.end(); ++it)
+    {
+        if (it->second->GetPath() == path)
+        {
+            err.SetError(ERR_INVALID_ARGUMENT, TEXT("The file is already being downloaded"));
+            return 0;
+        }
+    }
+
+    int handle = ++g_nextDownloadHandle;
+    scoped_refptr<Download> download = new Download(handle, url, path, options);
+    if (!download->Start(err))
+        return 0;
+
+    g_downloads[handle] = download;
+    return handle;
+}
+
+void Cancel(int handle)
+{
+    std::map<int, scoped_refptr<Download> >::iterator it = g_downloads.find(handle);
+    if (it != g_downloads.end())
+        it->second->Cancel();
+}
+
+} // namespace DownloadManager
+} // namespace Zephyros
@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+
+#ifndef Zephyros_DownloadLinux_h
+#define Zephyros_DownloadLinux_h
+#pragma once
+
+
+#include "base/types.h"
+#include "native_extensions/error.h"
+
+
+namespace Zephyros {
+
+// The options of a download (cf. IDownloadOptions)
+class DownloadOptions
+{
+public:
+    DownloadOptions()
+      : m_size(-1), m_maxConnections(0), m_progressInterval(0)
+    {
+    }
+
+    DownloadOptions(Zephyros::JavaScript::Object options)
+      : m_size(-1), m_maxConnections(0), m_progressInterval(0)
+    {
+        if (options->HasKey(TEXT("size")))
+            m_size = options->GetDouble(TEXT("size"));
+        if (options->HasKey(TEXT("hash")))
+            m_hash = options->GetString(TEXT("hash"));
+        if (options->HasKey(TEXT("hashAlgorithm")))
+            m_hashAlgorithm = options->GetString(TEXT("hashAlgorithm"));
+        if (options->HasKey(TEXT("connections")))
+            m_maxConnections = (int) options->GetDouble(TEXT("connections"));
+        if (options->HasKey(TEXT("progressInterval")))
+            m_progressInterval = options->GetDouble(TEXT("progressInterval"));
+    }
+
+public:
+    // the expected size of the file in bytes, or -1
+    double m_size;
+
+    // the expected hash of the file as a hex string, and the name of the
+    // hash algorithm ("sha256" if empty)
+    String m_hash;
+    String m_hashAlgorithm;
+
+    // the maximum number of parallel range requests, or 0 for the default
+    int m_maxConnections;
+
+    // the minimum time in milliseconds between two progress events, or 0 for the default
+    double m_progressInterval;
+};
+
+namespace DownloadManager {
+
+// Starts downloading |url| to |path| and returns the handle of the download,
+// or 0 if it couldn't be started. The progress and the completion are
+// reported to the "onDownloadEvent" callbacks.
+int Start(String url, String path, const DownloadOptions& options, Error& err);
+
+// Stops a download. The data received so far are kept, so starting a
+// download to the same path resumes it.
+void Cancel(int handle);
+
+} // namespace DownloadManager
+} // namespace Zephyros
+
+
+#endif // Zephyros_DownloadLinux_h
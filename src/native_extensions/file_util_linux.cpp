@@ -26,29 +26,38 @@
  *******************************************************************************/
 
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
+#include <vector>
 
 #include <glob.h>
 #include <pwd.h>
 #include <libgen.h>
 
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/sendfile.h>
 #include <gtk/gtk.h>
+#include <zlib.h>
 
 #include "base/app.h"
 
 #include "util/base64.h"
 #include "util/string_util.h"
+#include "util/text_encoding.h"
 
+#include "native_extensions/error.h"
 #include "native_extensions/image_util_linux.h"
 #include "native_extensions/os_util.h"
 #include "native_extensions/file_util.h"
 #include "zephyros_strings.h"
 
 
+#define COMPRESSION_CHUNK_SIZE 65536
+
+
 bool OpenFileDlg(GtkFileChooserAction action, int titleId, int okId, Zephyros::JavaScript::Object options, Zephyros::Path& path)
 {
     // TODO: options
@@ -87,10 +96,13 @@ String CheckForBinaryAndImage(String filename, bool& isBinary, bool& isImage)
     isBinary = false;
     isImage = false;
 
-    String strCmd = "file -bi ";
-    strCmd.append(filename);
+    std::vector<String> args;
+    args.push_back(TEXT("file"));
+    args.push_back(TEXT("-bi"));
+    args.push_back(TEXT("--"));
+    args.push_back(filename);
 
-    String guess = Zephyros::OSUtil::Exec(strCmd);
+    String guess = Zephyros::OSUtil::RunProcess(args);
     String mimeType = guess.substr(0, guess.find(";"));
 
     size_t foundBinaryCharset = guess.find("charset=binary");
@@ -117,6 +129,207 @@ String GetPreferencesFile()
     return strFilename;
 }
 
+/**
+ * Reads the "compression" option and returns the zlib window bits for it:
+ * 0 if no compression was requested, -1 if the compression is not supported.
+ */
+int GetCompressionWindowBits(Zephyros::JavaScript::Object options)
+{
+    if (!options || !options->HasKey("compression"))
+        return 0;
+
+    String compression = ToLower(options->GetString("compression"));
+    if (compression == TEXT(""))
+        return 0;
+    if (compression == TEXT("gzip"))
+        return MAX_WBITS + 16;
+    if (compression == TEXT("deflate"))
+        return MAX_WBITS;
+
+    return -1;
+}
+
+/**
+ * Compresses "data" chunk by chunk and writes the compressed stream to "file".
+ */
+bool WriteCompressed(std::ofstream& file, const char* data, size_t len, int windowBits, int level, Zephyros::Error& err)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    if (deflateInit2(&stream, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        err.SetError(ERR_UNKNOWN, stream.msg ? stream.msg : TEXT("Failed to initialize compression"));
+        return false;
+    }
+
+    std::vector<char> buf(COMPRESSION_CHUNK_SIZE);
+    size_t offset = 0;
+    int flush = Z_NO_FLUSH;
+    int ret = Z_OK;
+
+    do
+    {
+        size_t chunkLen = std::min(len - offset, (size_t) COMPRESSION_CHUNK_SIZE);
+        stream.next_in = (Bytef*) (data + offset);
+        stream.avail_in = (uInt) chunkLen;
+        offset += chunkLen;
+        flush = offset >= len ? Z_FINISH : Z_NO_FLUSH;
+
+        // drain the output buffer until deflate has consumed the whole chunk
+        do
+        {
+            stream.next_out = (Bytef*) &buf[0];
+            stream.avail_out = COMPRESSION_CHUNK_SIZE;
+            ret = deflate(&stream, flush);
+
+            file.write(&buf[0], COMPRESSION_CHUNK_SIZE - stream.avail_out);
+            if (file.fail())
+            {
+                deflateEnd(&stream);
+                err.FromErrno();
+                return false;
+            }
+        } while (stream.avail_out == 0);
+    } while (flush != Z_FINISH);
+
+    deflateEnd(&stream);
+
+    if (ret != Z_STREAM_END)
+    {
+        err.SetError(ERR_UNKNOWN, TEXT("Failed to compress the data"));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Reads the whole file "filename" into "data" with a single allocation.
+ */
+bool ReadFileToString(String filename, String& data, Zephyros::Error& err)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        err.FromErrno();
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        err.FromErrno();
+        close(fd);
+        return false;
+    }
+
+    data.resize(st.st_size);
+    size_t offset = 0;
+
+    while (offset < data.length())
+    {
+        ssize_t n = read(fd, &data[offset], data.length() - offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            err.FromErrno();
+            close(fd);
+            return false;
+        }
+
+        // the file was truncated while reading
+        if (n == 0)
+        {
+            data.resize(offset);
+            break;
+        }
+
+        offset += n;
+    }
+
+    close(fd);
+    return true;
+}
+
+/**
+ * Reads the compressed file "filename" chunk by chunk and appends the
+ * decompressed bytes to "result".
+ */
+bool ReadCompressed(String filename, int windowBits, String& result, Zephyros::Error& err)
+{
+    std::ifstream file;
+    file.open(filename, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+        err.FromErrno();
+        return false;
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    if (inflateInit2(&stream, windowBits) != Z_OK)
+    {
+        err.SetError(ERR_UNKNOWN, stream.msg ? stream.msg : TEXT("Failed to initialize decompression"));
+        return false;
+    }
+
+    std::vector<char> in(COMPRESSION_CHUNK_SIZE);
+    std::vector<char> out(COMPRESSION_CHUNK_SIZE);
+    int ret = Z_OK;
+
+    while (ret != Z_STREAM_END || stream.avail_in > 0)
+    {
+        if (stream.avail_in == 0)
+        {
+            file.read(&in[0], COMPRESSION_CHUNK_SIZE);
+            if (file.bad())
+            {
+                inflateEnd(&stream);
+                err.FromErrno();
+                return false;
+            }
+
+            stream.next_in = (Bytef*) &in[0];
+            stream.avail_in = (uInt) file.gcount();
+            if (stream.avail_in == 0)
+                break;
+        }
+
+        // gzip files can consist of several members; continue with the next one
+        if (ret == Z_STREAM_END)
+            inflateReset(&stream);
+
+        do
+        {
+            stream.next_out = (Bytef*) &out[0];
+            stream.avail_out = COMPRESSION_CHUNK_SIZE;
+            ret = inflate(&stream, Z_NO_FLUSH);
+
+            if (ret != Z_OK && ret != Z_STREAM_END)
+            {
+                err.SetError(ERR_DECODING_FAILED, stream.msg ? stream.msg : TEXT("Failed to decompress the file"));
+                inflateEnd(&stream);
+                return false;
+            }
+
+            result.append(&out[0], COMPRESSION_CHUNK_SIZE - stream.avail_out);
+        } while (stream.avail_out == 0 && ret != Z_STREAM_END);
+    }
+
+    inflateEnd(&stream);
+
+    if (ret != Z_STREAM_END)
+    {
+        err.SetError(ERR_DECODING_FAILED, TEXT("Unexpected end of the compressed file"));
+        return false;
+    }
+
+    return true;
+}
+
 
 namespace Zephyros {
 namespace FileUtil {
@@ -144,17 +357,10 @@ bool ShowOpenFileOrDirectoryDialog(JavaScript::Object options, Path& path)
 
 void ShowInFileManager(String path)
 {
-    String strWhichCmd = TEXT("which xdg-open");
-    String strCommand = OSUtil::Exec(strWhichCmd);
-    Trim(strCommand);
-
-    if (strCommand.length() > 0)
-    {
-        strCommand.append(" ");
-        strCommand.append(path);
-        strCommand.append(" &");
-        system(strCommand.c_str());
-    }
+    std::vector<String> args;
+    args.push_back(TEXT("xdg-open"));
+    args.push_back(path);
+    OSUtil::LaunchProcess(args);
 }
 
 bool ExistsFile(String filename)
@@ -305,33 +511,102 @@ bool ReadFileBinary(String filename, uint8_t** ppData, int& size, Error& err)
     return false;
 }
 
-bool ReadFile(String filename, JavaScript::Object options, String& result, Error& err)
+bool ReadFile(String filename, JavaScript::Object options, String& result, String& encoding, Error& err)
 {
-    bool isBinary;
-    bool isImage;
-    String mimeType = CheckForBinaryAndImage(filename, isBinary, isImage);
+    String requestedEncoding(TEXT(""));
+    if (options && options->HasKey("encoding"))
+        requestedEncoding = ToLower(options->GetString("encoding"));
+
+    int windowBits = GetCompressionWindowBits(options);
+    if (windowBits < 0)
+    {
+        err.SetError(ERR_UNKNOWN_ENCODING, TEXT("Unsupported compression"));
+        return false;
+    }
+
+    // read the raw bytes; compressed files are decompressed while reading
+    String data;
+    if (windowBits > 0 ? !ReadCompressed(filename, windowBits, data, err) : !ReadFileToString(filename, data, err))
+        return false;
 
-    uint8_t* contents = NULL;
-    int size = 0;
-    if (ReadFileBinary(filename, &contents, size, err))
+    const uint8_t* bytes = (const uint8_t*) data.data();
+    size_t length = data.length();
+    bool isDataURL = requestedEncoding.find(TEXT("base64")) != String::npos;
+    bool isValidated = false;
+    TextEncoding textEncoding = TEXT_ENCODING_UNKNOWN;
+    size_t bomLength = 0;
+
+    if (!isDataURL)
     {
-        if (isImage)
+        if (requestedEncoding == TEXT(""))
+        {
+            // guess the encoding; a UTF-8 result has been validated already
+            textEncoding = DetectTextEncoding(bytes, length, &bomLength);
+            isValidated = textEncoding == TEXT_ENCODING_UTF8 && bomLength == 0;
+        }
+        else
+        {
+            textEncoding = GetTextEncodingFromName(requestedEncoding);
+            if (textEncoding == TEXT_ENCODING_UNKNOWN)
+            {
+                err.SetError(ERR_UNKNOWN_ENCODING, TEXT("The encoding \"") + requestedEncoding + TEXT("\" is not supported."));
+                return false;
+            }
+
+            bomLength = GetByteOrderMarkLength(bytes, length, textEncoding);
+        }
+    }
+
+    if (isDataURL || textEncoding == TEXT_ENCODING_BINARY)
+    {
+        bool isBinary;
+        bool isImage;
+        String mimeType = CheckForBinaryAndImage(filename, isBinary, isImage);
+
+        if (isDataURL || isImage)
         {
             // TODO: convert .ico to .png
             // http://fossies.org/linux/xpaint/util/ico2png/create_icon.c ?
             result = "data:";
             result.append(mimeType);
             result.append(";base64,");
-            result.append(ImageUtil::Base64Encode((char*) contents, size));
+            result.append(ImageUtil::Base64Encode((char*) bytes, (int) length));
+
+            encoding = mimeType + TEXT(";base64");
+            return true;
+        }
+
+        // other binary data: map each byte to the code point with the same value
+        textEncoding = TEXT_ENCODING_LATIN1;
+    }
+
+    encoding = GetTextEncodingName(textEncoding);
+
+    if (textEncoding == TEXT_ENCODING_UTF8)
+    {
+        // UTF-8 is passed through without transcoding
+        if (!isValidated && !IsValidUTF8(bytes + bomLength, length - bomLength))
+        {
+            err.SetError(ERR_DECODING_FAILED, TEXT("The file is not valid UTF-8 text"));
+            return false;
         }
+
+        if (bomLength == 0)
+            result.swap(data);
         else
-            result = String((char*) contents);
+            result.assign(data, bomLength, String::npos);
 
-        delete[] contents;
         return true;
     }
 
-    return false;
+    result.clear();
+    if (!DecodeText(bytes + bomLength, length - bomLength, textEncoding, result))
+    {
+        err.SetError(ERR_DECODING_FAILED, TEXT("Failed to decode the file as ") + encoding);
+        return false;
+    }
+
+    return true;
 }
 
 bool WriteFile(String filename, String contents, JavaScript::Object options, Error& err)
@@ -340,6 +615,17 @@ bool WriteFile(String filename, String contents, JavaScript::Object options, Err
 	if (options && options->HasKey("encoding"))
 		encoding = options->GetString("encoding");
 
+    int windowBits = GetCompressionWindowBits(options);
+    if (windowBits < 0)
+    {
+        err.SetError(ERR_UNKNOWN_ENCODING, TEXT("Unsupported compression"));
+        return false;
+    }
+
+    int level = Z_DEFAULT_COMPRESSION;
+    if (options && options->HasKey("compressionLevel"))
+        level = std::max(0, std::min(9, options->GetInt("compressionLevel")));
+
     std::ofstream file;
     file.open(filename, std::ios::out | std::ios::binary);
 
@@ -349,18 +635,27 @@ bool WriteFile(String filename, String contents, JavaScript::Object options, Err
         return false;
     }
 
+    bool ret = true;
     if (encoding == "base64")
     {
         size_t len = 0;
         char* data = (char*) NewBase64Decode(contents.c_str(), contents.length(), &len);
-        file.write(data, len);
+
+        if (windowBits > 0)
+            ret = WriteCompressed(file, data, len, windowBits, level, err);
+        else
+            file.write(data, len);
+
+        free(data);
     }
+    else if (windowBits > 0)
+        ret = WriteCompressed(file, contents.c_str(), contents.length(), windowBits, level, err);
     else
         file << contents;
 
     file.close();
 
-    return true;
+    return ret;
 }
 
 bool MoveFile(String oldFilename, String newFilename, Error& err)
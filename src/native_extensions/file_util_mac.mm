@@ -379,7 +379,7 @@ bool ReadFileBinary(String filename, uint8_t** ppData, int& size, Error& err)
     return true;
 }
 
-bool ReadFile(String filename, JavaScript::Object options, String& result, Error& err)
+bool ReadFile(String filename, JavaScript::Object options, String& result, String& encoding, Error& err)
 {
     NSError *error = nil;
     NSData *data = [NSData dataWithContentsOfFile: [NSString stringWithUTF8String: filename.c_str()]
@@ -392,16 +392,20 @@ bool ReadFile(String filename, JavaScript::Object options, String& result, Error
         return false;
     }
 
-    String encoding = "";
+    String requestedEncoding = "";
     if (options->HasKey("encoding"))
-        encoding = options->GetString("encoding");
+        requestedEncoding = options->GetString("encoding");
         
-    if (encoding == "" || encoding == "utf-8" || encoding == "text/plain;utf-8")
+    if (requestedEncoding == "" || requestedEncoding == "utf-8" || requestedEncoding == "text/plain;utf-8")
     {
         // plain text
+        encoding = "utf-8";
         NSString *text = [[NSString alloc] initWithData: data encoding: NSUTF8StringEncoding];
         if (text == nil)
+        {
+            encoding = "ascii";
             text = [[NSString alloc] initWithData: data encoding: NSASCIIStringEncoding];
+        }
 
         if (text != nil)
         {
@@ -414,13 +418,14 @@ bool ReadFile(String filename, JavaScript::Object options, String& result, Error
         return false;
     }
 
-    if (encoding == "image/png;base64")
+    if (requestedEncoding == "image/png;base64")
     {
         // base64-encoded PNG image
         NSImage *image = [[NSImage alloc] initWithData: data];
         if (image)
         {
             result = ImageUtil::NSImageToBase64EncodedPNG(image);
+            encoding = requestedEncoding;
             return true;
         }
         
@@ -430,7 +435,7 @@ bool ReadFile(String filename, JavaScript::Object options, String& result, Error
     }
     
     // unsupported encoding
-    err.SetError(ERR_UNKNOWN_ENCODING, "The encoding \"" + encoding + "\" is not supported.");
+    err.SetError(ERR_UNKNOWN_ENCODING, "The encoding \"" + requestedEncoding + "\" is not supported.");
     return false;
 }
 
@@ -444,15 +444,17 @@ bool ReadFileBinary(String filename, uint8_t** ppData, int& size, Error& err)
     return true;
 }
 
-bool ReadFile(String filename, JavaScript::Object options, String& result, Error& err)
+bool ReadFile(String filename, JavaScript::Object options, String& result, String& encoding, Error& err)
 {
-    String encoding = TEXT("");
+    String requestedEncoding = TEXT("");
     if (options->HasKey("encoding"))
-        encoding = options->GetString("encoding");
+        requestedEncoding = options->GetString("encoding");
 
     // text file
-    if (encoding == TEXT("") || encoding == TEXT("utf-8") || encoding == TEXT("text/plain;utf-8"))
+    if (requestedEncoding == TEXT("") || requestedEncoding == TEXT("utf-8") || requestedEncoding == TEXT("text/plain;utf-8"))
     {
+        encoding = TEXT("utf-8");
+
         uint8_t* data = NULL;
         int numBytesRead = 0;
 
@@ -484,7 +486,7 @@ bool ReadFile(String filename, JavaScript::Object options, String& result, Error
     }
 
     // image file; return as base64-encoded PNG
-    if (encoding == TEXT("image/png;base64"))
+    if (requestedEncoding == TEXT("image/png;base64"))
     {
         BYTE* pData;
         DWORD length;
@@ -492,12 +494,13 @@ bool ReadFile(String filename, JavaScript::Object options, String& result, Error
             return false;
 
         result = TEXT("data:image/png;base64,") + ImageUtil::Base64Encode(pData, length);
+        encoding = requestedEncoding;
         delete[] pData;
         return true;
     }
 
     // unknown encoding
-    err.SetError(ERR_UNKNOWN_ENCODING, TEXT("The encoding \"") + encoding + TEXT("\" is not supported."));
+    err.SetError(ERR_UNKNOWN_ENCODING, TEXT("The encoding \"") + requestedEncoding + TEXT("\" is not supported."));
 
     return false;
 }
@@ -32,6 +32,50 @@
 
 #include "native_extensions/file_watcher.h"
 #include "native_extensions/file_util.h"
+#include "util/string_util.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// FileFilter Implementation
+
+FileFilter::FileFilter(
+    const std::vector<String>& fileExtensions,
+    const std::vector<String>& includePatterns,
+    const std::vector<String>& ignorePatterns)
+  : m_fileExtensions(fileExtensions)
+{
+    m_includePatterns.SetPatterns(includePatterns);
+    m_ignorePatterns.SetPatterns(ignorePatterns);
+}
+
+bool FileFilter::IsIgnoredDirectory(const String& path) const
+{
+    return m_ignorePatterns.Matches(path, true);
+}
+
+bool FileFilter::IsWatchedFile(const String& path) const
+{
+    if (!m_fileExtensions.empty())
+    {
+        bool hasExtension = false;
+        for (const String& ext : m_fileExtensions)
+        {
+            if (path.length() > ext.length() && StringEndsWith(path, ext))
+            {
+                hasExtension = true;
+                break;
+            }
+        }
+
+        if (!hasExtension)
+            return false;
+    }
+
+    if (!m_includePatterns.IsEmpty() && !m_includePatterns.Matches(path, false))
+        return false;
+
+    return !m_ignorePatterns.Matches(path, false);
+}
 
 
 namespace Zephyros {
@@ -47,6 +91,7 @@ void FileWatcher::FireFileChanged(std::vector<String>& files)
 
         entry->SetString(TEXT("path"), file);
         entry->SetInt(TEXT("action"), FileUtil::ExistsFile(file) ? 0 : 1);
+        entry->SetInt(TEXT("handle"), m_handle);
 
         listFiles->SetDictionary(i++, entry);
     }
@@ -38,17 +38,15 @@
 #endif
 #endif
 
-#ifdef OS_LINUX
-#include <map>
-#include <pthread.h>
-#endif
-
 #include <vector>
 #include <map>
 #include <string>
 
+#include "lib/cef/include/base/cef_ref_counted.h"
+
 #include "base/types.h"
 #include "native_extensions/path.h"
+#include "util/glob_matcher.h"
 #include "util/MurmurHash3.h"
 
 
@@ -69,6 +67,9 @@
 namespace Zephyros {
 
 class FileWatcher;
+#ifdef OS_LINUX
+class FileWatcherReactor;
+#endif
 
 }
 
@@ -106,6 +107,71 @@ typedef struct {
     uint32_t value[4];
 } Hash;
 
+// Watch usage and coverage of a watcher
+typedef struct {
+    // the initial scan of the directory tree hasn't completed yet
+    bool isScanning;
+
+    // the number of directories with a native watch, and the number of
+    // directories which are polled because the watch limit has been reached
+    int numWatchedDirectories;
+    int numPolledDirectories;
+
+    // the number of watches used by all watchers and the system limit,
+    // or -1 if there is no such limit
+    int numWatches;
+    int maxWatches;
+} FileWatcherStatus;
+
+// Decides which files a watcher reports and which directories it skips.
+// Paths are relative to the watched directory. A file is reported if it has
+// one of the extensions and matches one of the include patterns (if there are
+// any), unless it is ignored. The filter doesn't change once it has been
+// created, so it can be shared with the threads scanning the tree.
+class FileFilter : public base::RefCountedThreadSafe<FileFilter>
+{
+public:
+    FileFilter(
+        const std::vector<String>& fileExtensions,
+        const std::vector<String>& includePatterns,
+        const std::vector<String>& ignorePatterns);
+
+    bool IsIgnoredDirectory(const String& path) const;
+    bool IsWatchedFile(const String& path) const;
+
+private:
+    std::vector<String> m_fileExtensions;
+    GlobMatcher m_includePatterns;
+    GlobMatcher m_ignorePatterns;
+};
+
+#ifdef OS_LINUX
+
+// Size and modification time of a watched file, used to skip hashing files
+// which haven't changed and to detect changes missed when the inotify queue
+// overflows
+typedef struct {
+    uint64_t size;
+    int64_t modificationTime;
+} FileStamp;
+
+// A path with changes that haven't been reported yet; the times are
+// monotonic times in milliseconds (TimeUtil::GetMonotonicTime)
+typedef struct {
+    double firstChangeTime;
+    double lastChangeTime;
+} PendingChange;
+
+// The content hashes of the files of a watcher. Only used on the file thread;
+// hashing tasks still running keep it alive after the watcher has been stopped.
+class FileHashes : public base::RefCountedThreadSafe<FileHashes>
+{
+public:
+    std::map<String, Hash> m_hashes;
+};
+
+#endif
+
 
 //////////////////////////////////////////////////////////////////////////
 // FileWatcher Definition
@@ -121,17 +187,17 @@ public:
     FileWatcher();
     ~FileWatcher();
 
-    void Start(Path& path, std::vector<String>& fileExtensions, double delay);
+    void Start(Path& path, FileFilter* filter, double delay);
     void Stop();
 
     void FireFileChanged(std::vector<String>& files);
+    void GetStatus(FileWatcherStatus& status);
 
 #ifdef OS_MACOSX
     void ScheduleNonEmptyFileCheck(std::vector<String>& filenames);
     void ScheduleEmptyFileCheck(std::vector<String>& filenames);
 #endif
 
-
     inline bool HasFileChanged(String filePath)
     {
         size_t len = 0;
@@ -150,6 +216,21 @@ public:
 private:
     bool ReadFile(String filePath, char** pBuf, size_t* pLen);
 
+#ifdef OS_LINUX
+    // all watchers share the inotify instance and the thread of the reactor
+    friend class FileWatcherReactor;
+
+    bool IsWatchedFile(const String& path);
+    bool IsIgnoredDirectory(const String& directory);
+    bool IsInTree(const String& path);
+    void AddPendingChange(const String& path, double now);
+    void AddPendingChanges(const String& directory, const std::map<String, FileStamp>& stamps, double now);
+    void SetFileStamps(const std::map<String, FileStamp>& stamps);
+    void Rescan(const std::map<String, FileStamp>& stamps, double now);
+    void PollDirectory(const String& directory, const std::map<String, FileStamp>& stamps, double now);
+    double FlushPendingChanges(double now, std::vector<String>& files);
+#endif
+
     bool HasFileChanged(String filePath, char* pData, size_t len)
     {
         Hash oldHash;
@@ -198,10 +279,17 @@ private:
 
 public:
     Path m_path;
-    std::vector<String> m_fileExtensions;
+    scoped_refptr<FileFilter> m_filter;
+
+    // the watched directory without a trailing slash
+    String m_directory;
+
     std::map<String, Hash> m_fileHashes;
     double m_delay;
 
+    // the handle reported with the changes to JavaScript
+    int m_handle;
+
 #ifdef OS_MACOSX
     FSEventStreamRef m_stream;
     TimerDelegateRef m_timerDelegate;
@@ -218,8 +306,14 @@ public:
     HANDLE m_hEventTerminate;
 #endif
 #ifdef OS_LINUX
+    // the id of the watcher in the reactor, or 0 if it isn't watching
+    int m_reactorId;
+    bool m_isScanning;
+
+    scoped_refptr<FileHashes> m_hashes;
 
-    pthread_t m_thread;
+    std::map<String, FileStamp> m_fileStamps;
+    std::map<String, PendingChange> m_pendingChanges;
 #endif
 };
 
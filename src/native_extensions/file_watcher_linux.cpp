@@ -26,216 +26,2072 @@
  *******************************************************************************/
 
 
-#include <vector>
+#include <algorithm>
+#include <functional>
+#include <map>
 #include <set>
 #include <unordered_map>
+#include <vector>
 
-#include <iostream>
 #include <fstream>
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 
+#include "lib/cef/include/base/cef_bind.h"
+#include "lib/cef/include/base/cef_lock.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
+
+#include "base/app.h"
 #include "util/string_util.h"
+#include "util/time_util.h"
 #include "native_extensions/file_watcher.h"
 
 
-#define EVENT_SIZE (sizeof(inotify_event))
-#define BUF_LEN (1024 * (EVENT_SIZE + 16))
+// events for watched directories; files are watched through their directory
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
 
+#define EVENT_BUF_LEN 65536
 
-//////////////////////////////////////////////////////////////////////////
-// Type Definitions
+// changes are reported at the latest after this multiple of the delay,
+// even if the files keep changing
+#define MAX_DELAY_FACTOR 5
 
-typedef struct
-{
-    Zephyros::FileWatcher* watcher;
-    Zephyros::Path* path;
-    std::vector<String>* extensions;
-    double delay;
-} FileWatchThreadData;
+// files are hashed in blocks of this size
+#define HASH_BLOCK_SIZE (1024 * 1024)
+
+// files modified less than this many seconds before their stamp was taken are
+// always hashed, since a later write might not change the (coarse) mtime
+#define RACY_STAMP_SECONDS 1
+
+// the maximum number of threads scanning a directory tree
+#define MAX_SCAN_THREADS 8
+
+// the interval in which directories are polled if they can't be watched
+// because the inotify watch limit has been reached
+#define POLL_INTERVAL_SECONDS 2
+
+// the maximum size of the events deferred while scans are running; if there
+// are more events, the trees are rescanned afterwards
+#define MAX_DEFERRED_EVENTS_SIZE (4 * 1024 * 1024)
+
+// TreeScanner results for directories which couldn't be watched
+#define WATCH_LIMIT_REACHED -1
+#define NOT_WATCHED -2
+
+// epoll user data identifying the file descriptors
+#define EPOLL_ID_INOTIFY 1
+#define EPOLL_ID_STOP 2
+#define EPOLL_ID_TIMER 3
+#define EPOLL_ID_POLL_TIMER 4
 
 
 //////////////////////////////////////////////////////////////////////////
-// FileWatcher Implementation
+// Helpers
 
-bool IsFileEmpty(String directory, String filename)
+static bool GetFileStamp(const String& path, FileStamp& stamp, bool& isDirectory)
 {
-    // TODO: implement
-    return false;
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0)
+        return false;
+
+    isDirectory = S_ISDIR(st.st_mode);
+    stamp.size = (uint64_t) st.st_size;
+    stamp.modificationTime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
 }
 
+static int64_t GetRealTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-void RecurseDir(const char *name, int level, std::unordered_map<int, String> *watchMap, int fd)
+static bool IsInDirectory(const String& path, const String& directory)
 {
-    DIR* dir = opendir(name);
-    if (!dir)
-        return;
+    return path.length() > directory.length() &&
+        path.compare(0, directory.length(), directory) == 0 &&
+        path[directory.length()] == TEXT('/');
+}
 
-    dirent* entry = readdir(dir);
-    if (!entry)
-        return;
+//
+// Computes the content hash of the file at "path" block by block, so large
+// files are never read into memory at once. Each block is hashed with its
+// index as seed, which makes the combined hash depend on the block order.
+//
+static bool ComputeFileHash(const String& path, Hash& hash)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
 
-    char path[PATH_MAX];
+    hash.length = 0;
+    memset(hash.value, 0, sizeof(hash.value));
 
-    do
+    char* buf = new char[HASH_BLOCK_SIZE];
+    bool isOk = true;
+
+    for (uint32_t blockIndex = 0; ; )
     {
-        if (entry->d_type == DT_DIR)
+        ssize_t len = read(fd, buf, HASH_BLOCK_SIZE);
+        if (len < 0)
         {
-            int len = snprintf(path, sizeof(path) - 1, TEXT("%s/%s"), name, entry->d_name);
-            path[len] = 0;
-
-            if (strcmp(entry->d_name, TEXT(".")) == 0 || strcmp(entry->d_name, TEXT("..")) == 0)
+            if (errno == EINTR)
                 continue;
-
-            int wd = inotify_add_watch(fd, path, IN_MODIFY | IN_CREATE | IN_DELETE);
-            watchMap->insert(std::pair<int, String>(wd, String(path)));
-            RecurseDir(path, level + 1, watchMap, fd);
+            isOk = false;
+            break;
         }
-    } while (entry = readdir(dir));
+        if (len == 0)
+            break;
 
-    closedir(dir);
+        uint32_t blockHash[4];
+        MurmurHash3_x64_128(buf, (int) len, 8005 + blockIndex++, blockHash);
+        for (int i = 0; i < 4; ++i)
+            hash.value[i] ^= blockHash[i];
+        hash.length += (size_t) len;
+    }
+
+    delete[] buf;
+    close(fd);
+
+    return isOk;
 }
 
 
-void ProcessEvent(char* buffer, int len, Zephyros::FileWatcher* watcher, std::unordered_map<int, String> watchMap, std::vector<String>* extensions)
+//////////////////////////////////////////////////////////////////////////
+// DirectoryTree
+
+//
+// The watched directories, interned as a tree of names: a node only stores
+// its name and the index of its parent, so the paths in large trees share
+// their common prefixes, and renaming a directory only relinks its node.
+//
+class DirectoryTree
 {
-   int i = 0;
-   std::vector<String> changes;
+public:
+    typedef struct {
+        int parent;
+        int firstChild;
+        int nextSibling;
+        int prevSibling;
+
+        // the inotify watch descriptor or -1
+        int wd;
+        bool isPolled;
+
+        // points to the name in the key of the node
+        const String* name;
+    } Node;
+
+    DirectoryTree();
+
+    inline Node& Get(int node) { return m_nodes[node]; }
+
+    int Find(const String& path);
+    int Add(const String& path);
+    int FindChild(int parent, const String& name);
+    int AddChild(int parent, const String& name);
+    String GetPath(int node);
+    void GetSubtree(int node, std::vector<int>& nodes);
+    void Move(int node, int parent, const String& name);
+    void Remove(int node);
+    void Prune(int node);
+    void Clear();
+
+private:
+    typedef struct {
+        int parent;
+        String name;
+    } Key;
 
-   while (i < len)
-   {
-        inotify_event* event = (inotify_event*) &buffer[i];
-        std::unordered_map<int, String>::const_iterator item = watchMap.find(event->wd);
-        String fileName = String(event->name);
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            return std::hash<String>()(key.name) * 31 + (size_t) key.parent;
+        }
+    };
 
-        bool isInExtensions = false;
-        for (String ext : *extensions)
+    struct KeyEqual
+    {
+        bool operator()(const Key& a, const Key& b) const
         {
-            int pos = fileName.find(ext);
-            int requiredPos = fileName.length() - ext.length();
+            return a.parent == b.parent && a.name == b.name;
+        }
+    };
 
-            if (requiredPos > 0 && pos == requiredPos)
-            {
-                isInExtensions = true;
-                break;
-            }
+    inline bool IsUnused(int node)
+    {
+        return m_nodes[node].firstChild < 0 && m_nodes[node].wd < 0 && !m_nodes[node].isPolled;
+    }
+
+    void Link(int node, int parent, const String& name);
+    void Unlink(int node);
+
+    std::vector<Node> m_nodes;
+    std::vector<int> m_freeNodes;
+    std::unordered_map<Key, int, KeyHash, KeyEqual> m_children;
+    String m_rootName;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// TreeScanner
+
+// The tree of a watcher and its filter, as used by the threads scanning it
+typedef struct {
+    String directory;
+    scoped_refptr<FileFilter> filter;
+} ScanRoot;
+
+//
+// Scans directory trees with several threads, adding inotify watches for all
+// directories which aren't ignored and collecting the states of the watched
+// files.
+//
+class TreeScanner
+{
+public:
+    TreeScanner(int inotifyFd, const std::vector<ScanRoot>& roots);
+    ~TreeScanner();
+
+    void Scan(const String& directory);
+
+    // the directories found with their watch descriptors; WATCH_LIMIT_REACHED
+    // if the directory has to be polled
+    std::vector<std::pair<String, int> > m_directories;
+    std::map<String, FileStamp> m_stamps;
+
+private:
+    static void* RunWorker(void* arg);
+    void Work();
+    int ScanDirectory(const String& directory, std::vector<String>& subdirectories, std::vector<std::pair<String, FileStamp> >& stamps);
+    bool IsScannedDirectory(const String& directory);
+    bool IsScannedFile(const String& path);
+
+    int m_inotifyFd;
+    const std::vector<ScanRoot>& m_roots;
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    std::vector<pthread_t> m_threads;
+    int m_maxThreads;
+
+    // the directories still to scan and the number of directories being scanned
+    std::vector<String> m_queue;
+    int m_numBusy;
+};
+
+
+namespace Zephyros {
+
+//////////////////////////////////////////////////////////////////////////
+// FileWatcherReactor Definition
+
+// The initial scan of the tree of a watcher, which runs in its own thread
+typedef struct {
+    int watcherId;
+    int generation;
+
+    // a duplicate of the inotify descriptor, which stays valid if the reactor
+    // is stopped while scanning
+    int inotifyFd;
+
+    std::vector<ScanRoot> roots;
+} ScanJob;
+
+//
+// Watches the trees of all running FileWatchers with a single inotify
+// instance and a single thread. The events are dispatched by path to the
+// watchers whose tree contains the path; trees may overlap.
+//
+class FileWatcherReactor
+{
+public:
+    static FileWatcherReactor* GetInstance();
+
+    FileWatcherReactor();
+
+    bool AddWatcher(FileWatcher* watcher);
+    void RemoveWatcher(FileWatcher* watcher);
+    void FireFileChanged(int id, std::vector<String>& files);
+    void GetStatus(FileWatcher* watcher, FileWatcherStatus& status);
+
+    void Run();
+    void RunScan(ScanJob* job);
+
+private:
+    bool StartThread();
+    void StopThread();
+    void CloseDescriptors();
+
+    bool IsWatchedDirectory(const String& directory);
+    bool IsWatchedFile(const String& path);
+    void GetScanRoots(std::vector<ScanRoot>& roots);
+    void ScanPendingDirectories(double now);
+    void AddDirectories(const std::vector<std::pair<String, int> >& directories);
+    void RemoveUnusedWatches(const std::vector<std::pair<String, int> >& directories);
+    void SetWatch(int node, int wd);
+    void RemoveWatch(int node);
+    void RemoveWatches(const String& directory, bool keepWatchedDirectories);
+    void RenameWatches(const String& oldDirectory, const String& newDirectory);
+    void ProcessEvents(char* buf, ssize_t len, double now);
+    void ProcessUnpairedMoves(double now);
+    void ProcessDeferredEvents(double now);
+    void Rescan(double now);
+    void Poll(double now);
+    void PollDirectory(int node, double now);
+    void UpdatePollTimer();
+    void AddPendingChange(const String& path, double now);
+    void AddPendingChanges(const String& directory, double now);
+    void FlushPendingChanges(double now);
+    void ScheduleFlush(double dueTime, double now);
+
+private:
+    // protects the watchers and the watches; the thread holds it while processing events
+    base::Lock m_lock;
+
+    pthread_t m_thread;
+    bool m_isRunning;
+
+    // incremented whenever the descriptors are closed
+    int m_generation;
+
+    int m_inotifyFd;
+    int m_epollFd;
+    int m_stopEventFd;
+    int m_timerFd;
+    int m_pollTimerFd;
+    bool m_isPollTimerArmed;
+
+    // the running watchers by id
+    std::map<int, FileWatcher*> m_watchers;
+    int m_nextId;
+
+    // incremented whenever a watcher is added or removed
+    int m_watchersVersion;
+
+    // the directories to scan for their files and new subdirectories, and
+    // whether all trees have to be rescanned; the scans are done by the
+    // thread without holding the lock
+    std::set<String> m_pendingScans;
+    bool m_needsRescan;
+
+    // events for unknown watch descriptors are deferred while scans are
+    // running, since they might be for directories just being added
+    int m_numScans;
+    std::vector<char> m_deferredEvents;
+    bool m_hasDroppedEvents;
+
+    // the watched and polled directories, and their nodes by watch descriptor
+    DirectoryTree m_tree;
+    std::unordered_map<int, int> m_watches;
+    std::set<int> m_polledNodes;
+
+    // IN_MOVED_FROM events waiting for their IN_MOVED_TO by cookie
+    std::map<uint32_t, std::pair<String, bool> > m_pendingMoves;
+};
+
+} // namespace Zephyros
+
+
+static void FireFileChangedOnUIThread(int id, std::vector<String> files)
+{
+    Zephyros::FileWatcherReactor::GetInstance()->FireFileChanged(id, files);
+}
+
+//
+// Drops the files whose contents are the same as when they were last reported
+// (editors often write a file several times when saving it) and reports the
+// remaining ones. Runs on the file thread, so hashing doesn't hold up the
+// event processing of the watching thread.
+//
+static void HashFilesOnFileThread(int id, scoped_refptr<FileHashes> hashes, std::vector<String> files)
+{
+    std::vector<String> changedFiles;
+
+    for (String file : files)
+    {
+        Hash hash;
+        if (!ComputeFileHash(file, hash))
+        {
+            // the file has been deleted
+            hashes->m_hashes.erase(file);
+            changedFiles.push_back(file);
+            continue;
         }
 
-        if (isInExtensions)
+        std::map<String, Hash>::iterator it = hashes->m_hashes.find(file);
+        if (it != hashes->m_hashes.end() &&
+            it->second.length == hash.length &&
+            memcmp(it->second.value, hash.value, sizeof(hash.value)) == 0)
+        {
+            continue;
+        }
+
+        hashes->m_hashes[file] = hash;
+        changedFiles.push_back(file);
+    }
+
+    // onFileChanged callbacks are invoked on the UI thread
+    if (changedFiles.size() > 0)
+        CefPostTask(TID_UI, base::Bind(&FireFileChangedOnUIThread, id, changedFiles));
+}
+
+static void* StartWatchingThread(void* arg)
+{
+    ((Zephyros::FileWatcherReactor*) arg)->Run();
+    return NULL;
+}
+
+static void* StartScanThread(void* arg)
+{
+    Zephyros::ScanJob* job = (Zephyros::ScanJob*) arg;
+    Zephyros::FileWatcherReactor::GetInstance()->RunScan(job);
+    delete job;
+    return NULL;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// DirectoryTree Implementation
+
+DirectoryTree::DirectoryTree()
+{
+    Clear();
+}
+
+//
+// Returns the node of the directory at "path" or -1 if it isn't in the tree.
+//
+int DirectoryTree::Find(const String& path)
+{
+    int node = 0;
+
+    for (size_t pos = 0; node >= 0 && pos < path.length(); )
+    {
+        size_t end = path.find(TEXT('/'), pos);
+        if (end == String::npos)
+            end = path.length();
+
+        if (end > pos)
+            node = FindChild(node, path.substr(pos, end - pos));
+        pos = end + 1;
+    }
+
+    return node;
+}
+
+//
+// Returns the node of the directory at "path", adding it and its parents
+// to the tree if necessary.
+//
+int DirectoryTree::Add(const String& path)
+{
+    int node = 0;
+
+    for (size_t pos = 0; pos < path.length(); )
+    {
+        size_t end = path.find(TEXT('/'), pos);
+        if (end == String::npos)
+            end = path.length();
+
+        if (end > pos)
+            node = AddChild(node, path.substr(pos, end - pos));
+        pos = end + 1;
+    }
+
+    return node;
+}
+
+int DirectoryTree::FindChild(int parent, const String& name)
+{
+    Key key;
+    key.parent = parent;
+    key.name = name;
+
+    std::unordered_map<Key, int, KeyHash, KeyEqual>::iterator it = m_children.find(key);
+    return it == m_children.end() ? -1 : it->second;
+}
+
+int DirectoryTree::AddChild(int parent, const String& name)
+{
+    int node = FindChild(parent, name);
+    if (node >= 0)
+        return node;
+
+    if (m_freeNodes.empty())
+    {
+        node = (int) m_nodes.size();
+        m_nodes.push_back(Node());
+    }
+    else
+    {
+        node = m_freeNodes.back();
+        m_freeNodes.pop_back();
+    }
+
+    Node& n = m_nodes[node];
+    n.firstChild = -1;
+    n.wd = -1;
+    n.isPolled = false;
+
+    Link(node, parent, name);
+    return node;
+}
+
+String DirectoryTree::GetPath(int node)
+{
+    if (node == 0)
+        return TEXT("/");
+
+    std::vector<const String*> names;
+    size_t length = 0;
+    for ( ; node > 0; node = m_nodes[node].parent)
+    {
+        names.push_back(m_nodes[node].name);
+        length += m_nodes[node].name->length() + 1;
+    }
+
+    String path;
+    path.reserve(length);
+    for (std::vector<const String*>::reverse_iterator it = names.rbegin(); it != names.rend(); ++it)
+    {
+        path.append(TEXT("/"));
+        path.append(**it);
+    }
+
+    return path;
+}
+
+//
+// Collects "node" and all its descendants, parents before their children.
+//
+void DirectoryTree::GetSubtree(int node, std::vector<int>& nodes)
+{
+    size_t first = nodes.size();
+    nodes.push_back(node);
+
+    for (size_t i = first; i < nodes.size(); ++i)
+        for (int child = m_nodes[nodes[i]].firstChild; child >= 0; child = m_nodes[child].nextSibling)
+            nodes.push_back(child);
+}
+
+void DirectoryTree::Move(int node, int parent, const String& name)
+{
+    Unlink(node);
+    Link(node, parent, name);
+}
+
+//
+// Removes "node" and all its descendants.
+//
+void DirectoryTree::Remove(int node)
+{
+    if (node <= 0)
+        return;
+
+    std::vector<int> nodes;
+    GetSubtree(node, nodes);
+
+    Unlink(node);
+
+    for (int n : nodes)
+    {
+        if (n != node)
         {
-            String s = item->second;
-            s.append(TEXT("/"));
-            s.append(fileName);
-            changes.push_back(s);
+            Key key;
+            key.parent = m_nodes[n].parent;
+            key.name = *m_nodes[n].name;
+            m_children.erase(key);
         }
 
-        i += EVENT_SIZE + event->len;
+        m_nodes[n].name = NULL;
+        m_freeNodes.push_back(n);
+    }
+}
+
+//
+// Removes the nodes in the subtree of "node" and the ancestors of "node" which
+// are neither watched nor polled and have no children any more.
+//
+void DirectoryTree::Prune(int node)
+{
+    if (node <= 0 || m_nodes[node].name == NULL)
+        return;
+
+    int parent = m_nodes[node].parent;
+
+    std::vector<int> nodes;
+    GetSubtree(node, nodes);
+
+    // children first, so their parents are checked once they have become empty
+    for (std::vector<int>::reverse_iterator it = nodes.rbegin(); it != nodes.rend(); ++it)
+        if (IsUnused(*it))
+            Remove(*it);
+
+    if (m_nodes[node].name != NULL)
+        return;
+
+    while (parent > 0 && IsUnused(parent))
+    {
+        int grandparent = m_nodes[parent].parent;
+        Remove(parent);
+        parent = grandparent;
     }
+}
+
+void DirectoryTree::Clear()
+{
+    m_nodes.clear();
+    m_freeNodes.clear();
+    m_children.clear();
+
+    // the root directory
+    Node root;
+    root.parent = -1;
+    root.firstChild = -1;
+    root.nextSibling = -1;
+    root.prevSibling = -1;
+    root.wd = -1;
+    root.isPolled = false;
+    root.name = &m_rootName;
+    m_nodes.push_back(root);
+}
+
+void DirectoryTree::Link(int node, int parent, const String& name)
+{
+    Key key;
+    key.parent = parent;
+    key.name = name;
+
+    std::pair<std::unordered_map<Key, int, KeyHash, KeyEqual>::iterator, bool> result = m_children.insert(std::make_pair(key, node));
+
+    // keys don't move when the map is rehashed
+    Node& n = m_nodes[node];
+    n.name = &result.first->first.name;
+    n.parent = parent;
+    n.prevSibling = -1;
+    n.nextSibling = m_nodes[parent].firstChild;
+    if (n.nextSibling >= 0)
+        m_nodes[n.nextSibling].prevSibling = node;
+    m_nodes[parent].firstChild = node;
+}
+
+void DirectoryTree::Unlink(int node)
+{
+    Node& n = m_nodes[node];
+
+    Key key;
+    key.parent = n.parent;
+    key.name = *n.name;
+
+    if (n.prevSibling >= 0)
+        m_nodes[n.prevSibling].nextSibling = n.nextSibling;
+    else
+        m_nodes[n.parent].firstChild = n.nextSibling;
+    if (n.nextSibling >= 0)
+        m_nodes[n.nextSibling].prevSibling = n.prevSibling;
 
-    if (changes.size() > 0)
-        watcher->FireFileChanged(changes);
+    m_children.erase(key);
+    n.name = NULL;
 }
 
 
-void CleanupThreadData(void* arg)
+//////////////////////////////////////////////////////////////////////////
+// TreeScanner Implementation
+
+TreeScanner::TreeScanner(int inotifyFd, const std::vector<ScanRoot>& roots)
+    : m_inotifyFd(inotifyFd), m_roots(roots), m_numBusy(0)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+
+    long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    m_maxThreads = (int) std::max(1L, std::min(numProcessors, (long) MAX_SCAN_THREADS));
+}
+
+TreeScanner::~TreeScanner()
+{
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+void TreeScanner::Scan(const String& directory)
 {
-    FileWatchThreadData* data = (FileWatchThreadData*) arg;
+    if (!IsScannedDirectory(directory))
+        return;
+
+    m_queue.push_back(directory);
+
+    // the calling thread scans too; more threads are started once there are
+    // enough directories to scan
+    Work();
 
-    delete data->path;
-    delete data->extensions;
-    delete data;
+    // no more threads are started once the queue has run empty
+    for (pthread_t thread : m_threads)
+        pthread_join(thread, NULL);
+    m_threads.clear();
 }
 
+void* TreeScanner::RunWorker(void* arg)
+{
+    ((TreeScanner*) arg)->Work();
+    return NULL;
+}
 
-void* StartWatchingThread(void* arg)
+void TreeScanner::Work()
 {
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+    std::vector<String> subdirectories;
+    std::vector<std::pair<String, FileStamp> > stamps;
+
+    pthread_mutex_lock(&m_mutex);
 
-    char buffer[BUF_LEN];
-    FileWatchThreadData* data = (FileWatchThreadData*) arg;
+    for ( ; ; )
+    {
+        // wait for directories found by the other threads
+        while (m_queue.empty() && m_numBusy > 0)
+            pthread_cond_wait(&m_cond, &m_mutex);
+        if (m_queue.empty())
+            break;
+
+        String directory = m_queue.back();
+        m_queue.pop_back();
+        ++m_numBusy;
 
-    int fd = inotify_init();
-    std::unordered_map<int, String> watchMap;
+        pthread_mutex_unlock(&m_mutex);
+        int wd = ScanDirectory(directory, subdirectories, stamps);
+        pthread_mutex_lock(&m_mutex);
 
-    int wd = inotify_add_watch(fd, data->path->GetPath().c_str(), IN_MODIFY | IN_CREATE | IN_DELETE);
-    watchMap.insert(std::pair<int, String>(wd, data->path->GetPath()));
+        --m_numBusy;
+        if (wd != NOT_WATCHED)
+            m_directories.push_back(std::make_pair(directory, wd));
+        m_stamps.insert(stamps.begin(), stamps.end());
+        m_queue.insert(m_queue.end(), subdirectories.begin(), subdirectories.end());
+        subdirectories.clear();
+        stamps.clear();
 
-    // recursively add all directories below root dir to the watch
-    RecurseDir(data->path->GetPath().c_str(), 0, &watchMap, fd);
+        if (m_queue.size() > 1 && (int) m_threads.size() + 1 < m_maxThreads)
+        {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, RunWorker, this) == 0)
+                m_threads.push_back(thread);
+        }
 
-    timespec waitTime;
-    waitTime.tv_sec = 60;
-    waitTime.tv_nsec = 0;
+        pthread_cond_broadcast(&m_cond);
+    }
 
-    fd_set descriptors;
+    pthread_mutex_unlock(&m_mutex);
+}
 
-    FD_ZERO(&descriptors);
-    FD_SET(fd, &descriptors);
-    int ret_val;
+//
+// Adds a watch for "directory" and lists its subdirectories and the states of
+// its files. Symbolic links aren't followed.
+// Returns the watch descriptor, WATCH_LIMIT_REACHED or NOT_WATCHED.
+//
+int TreeScanner::ScanDirectory(const String& directory, std::vector<String>& subdirectories, std::vector<std::pair<String, FileStamp> >& stamps)
+{
+    int wd = inotify_add_watch(m_inotifyFd, directory.c_str(), WATCH_MASK);
+    if (wd < 0)
+        wd = errno == ENOSPC ? WATCH_LIMIT_REACHED : NOT_WATCHED;
 
-    pthread_cleanup_push(CleanupThreadData, arg);
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+        return wd;
 
-    while (true)
+    while (dirent* entry = readdir(dir))
     {
-        ret_val = pselect(fd + 1, &descriptors, NULL, NULL, &waitTime, NULL);
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
 
-        if( ret_val < 0)
+        String path = directory + TEXT("/") + String(entry->d_name);
+
+        if (entry->d_type == DT_DIR)
         {
-            //cout << "ERROR: " << ret_val << endl;
+            if (IsScannedDirectory(path))
+                subdirectories.push_back(path);
         }
-        else if (!ret_val)
+        else if (entry->d_type == DT_UNKNOWN)
         {
-            //cout << "Timeout occured." << endl;
+            FileStamp stamp;
+            bool isDirectory = false;
+            if (GetFileStamp(path, stamp, isDirectory))
+            {
+                if (isDirectory)
+                {
+                    if (IsScannedDirectory(path))
+                        subdirectories.push_back(path);
+                }
+                else if (IsScannedFile(path))
+                    stamps.push_back(std::make_pair(path, stamp));
+            }
         }
-        else if (FD_ISSET(fd, &descriptors))
+        else if (entry->d_type == DT_REG && IsScannedFile(path))
         {
-            int len = read(fd, buffer, BUF_LEN);
-            ProcessEvent(buffer, len, data->watcher, watchMap, data->extensions);
+            FileStamp stamp;
+            bool isDirectory = false;
+            if (GetFileStamp(path, stamp, isDirectory) && !isDirectory)
+                stamps.push_back(std::make_pair(path, stamp));
         }
     }
 
-    pthread_cleanup_pop(arg);
+    closedir(dir);
+    return wd;
+}
 
-    return NULL;
+//
+// Tests whether "directory" is in one of the trees and isn't ignored. The
+// directories containing a tree are scanned too, so that trees within
+// ignored directories of other trees are found.
+//
+bool TreeScanner::IsScannedDirectory(const String& directory)
+{
+    for (const ScanRoot& root : m_roots)
+    {
+        if (directory == root.directory || IsInDirectory(root.directory, directory))
+            return true;
+
+        if (IsInDirectory(directory, root.directory) &&
+            !root.filter->IsIgnoredDirectory(directory.substr(root.directory.length() + 1)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool TreeScanner::IsScannedFile(const String& path)
+{
+    for (const ScanRoot& root : m_roots)
+        if (IsInDirectory(path, root.directory) && root.filter->IsWatchedFile(path.substr(root.directory.length() + 1)))
+            return true;
+
+    return false;
 }
 
 
 namespace Zephyros {
 
-FileWatcher::FileWatcher()
-{
+//////////////////////////////////////////////////////////////////////////
+// FileWatcherReactor Implementation
 
+FileWatcherReactor* FileWatcherReactor::GetInstance()
+{
+    // never destroyed; the thread is stopped when the last watcher is removed
+    static FileWatcherReactor* reactor = new FileWatcherReactor();
+    return reactor;
 }
 
-FileWatcher::~FileWatcher()
+FileWatcherReactor::FileWatcherReactor()
+    : m_isRunning(false), m_generation(0), m_inotifyFd(-1), m_epollFd(-1), m_stopEventFd(-1), m_timerFd(-1),
+      m_pollTimerFd(-1), m_isPollTimerArmed(false), m_nextId(0), m_watchersVersion(0), m_needsRescan(false),
+      m_numScans(0), m_hasDroppedEvents(false)
 {
-    Stop();
 }
 
-void FileWatcher::Start(Path& path, std::vector<String>& fileExtensions, double delay)
+//
+// Starts watching the tree of "watcher", starting the thread if it is the
+// first watcher. The tree is scanned in the background; changes are
+// reported from the start, but without the scan, the watcher doesn't know
+// which files have been deleted.
+//
+bool FileWatcherReactor::AddWatcher(FileWatcher* watcher)
 {
-    // prepare thread data
-    FileWatchThreadData* data = new FileWatchThreadData;
-    data->watcher = this;
-    data->path = new Path(path);
-    data->extensions = new std::vector<String>();
-    data->delay = delay;
+    ScanJob* job = new ScanJob();
 
-    for (String ext : fileExtensions)
-        data->extensions->push_back(ext);
+    {
+        base::AutoLock lock(m_lock);
 
-    // start thread
-    pthread_create(&m_thread, NULL, StartWatchingThread, data);
+        if (!m_isRunning && !StartThread())
+        {
+            App::Log(TEXT("Could not start watching ") + watcher->m_directory + TEXT(": ") + String(strerror(errno)));
+            delete job;
+            return false;
+        }
 
-}
+        watcher->m_reactorId = ++m_nextId;
+        watcher->m_isScanning = true;
+        m_watchers[watcher->m_reactorId] = watcher;
+        ++m_watchersVersion;
 
-void FileWatcher::Stop()
-{
-    // cancel thread
-    // the thread will clean up after itself
-    pthread_cancel(m_thread);
+        job->watcherId = watcher->m_reactorId;
+        job->generation = m_generation;
+        job->inotifyFd = fcntl(m_inotifyFd, F_DUPFD_CLOEXEC, 0);
+
+        ScanRoot root;
+        root.directory = watcher->m_directory;
+        root.filter = watcher->m_filter;
+        job->roots.push_back(root);
+
+        ++m_numScans;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, StartScanThread, job) == 0)
+        pthread_detach(thread);
+    else
+        StartScanThread(job);
+
+    return true;
+}
+
+//
+// Stops watching the tree of "watcher". The watches of directories which are
+// also in the tree of another watcher are kept.
+//
+void FileWatcherReactor::RemoveWatcher(FileWatcher* watcher)
+{
+    bool isEmpty = false;
+
+    {
+        base::AutoLock lock(m_lock);
+
+        m_watchers.erase(watcher->m_reactorId);
+        watcher->m_reactorId = 0;
+        watcher->m_isScanning = false;
+        ++m_watchersVersion;
+
+        RemoveWatches(watcher->m_directory, true);
+        UpdatePollTimer();
+        isEmpty = m_watchers.empty();
+    }
+
+    if (isEmpty)
+        StopThread();
+}
+
+//
+// Called on the UI thread with the changes of the watcher with the id "id".
+// The watcher might have been stopped since the changes were posted.
+//
+void FileWatcherReactor::FireFileChanged(int id, std::vector<String>& files)
+{
+    FileWatcher* watcher = NULL;
+
+    {
+        base::AutoLock lock(m_lock);
+        std::map<int, FileWatcher*>::iterator it = m_watchers.find(id);
+        if (it != m_watchers.end())
+            watcher = it->second;
+    }
+
+    // watchers are only destroyed on the UI thread
+    if (watcher)
+        watcher->FireFileChanged(files);
+}
+
+void FileWatcherReactor::GetStatus(FileWatcher* watcher, FileWatcherStatus& status)
+{
+    status.isScanning = false;
+    status.numWatchedDirectories = 0;
+    status.numPolledDirectories = 0;
+    status.numWatches = 0;
+    status.maxWatches = -1;
+
+    std::ifstream fs("/proc/sys/fs/inotify/max_user_watches");
+    if (fs.is_open())
+        fs >> status.maxWatches;
+
+    base::AutoLock lock(m_lock);
+
+    status.numWatches = (int) m_watches.size();
+    if (watcher->m_reactorId == 0)
+        return;
+
+    status.isScanning = watcher->m_isScanning;
+
+    int node = m_tree.Find(watcher->m_directory);
+    if (node < 0)
+        return;
+
+    std::vector<int> nodes;
+    m_tree.GetSubtree(node, nodes);
+    for (int n : nodes)
+    {
+        if (m_tree.Get(n).wd >= 0)
+            ++status.numWatchedDirectories;
+        else if (m_tree.Get(n).isPolled)
+            ++status.numPolledDirectories;
+    }
+}
+
+//
+// Creates the descriptors and starts the thread. Called with the lock held.
+//
+bool FileWatcherReactor::StartThread()
+{
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_stopEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    m_pollTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (m_inotifyFd < 0 || m_epollFd < 0 || m_stopEventFd < 0 || m_timerFd < 0 || m_pollTimerFd < 0)
+    {
+        int error = errno;
+        CloseDescriptors();
+        errno = error;
+        return false;
+    }
+
+    int fds[] = { m_inotifyFd, m_stopEventFd, m_timerFd, m_pollTimerFd };
+    int ids[] = { EPOLL_ID_INOTIFY, EPOLL_ID_STOP, EPOLL_ID_TIMER, EPOLL_ID_POLL_TIMER };
+    for (int i = 0; i < 4; ++i)
+    {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = ids[i];
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fds[i], &ev);
+    }
+
+    int error = pthread_create(&m_thread, NULL, StartWatchingThread, this);
+    m_isRunning = error == 0;
+    if (!m_isRunning)
+    {
+        CloseDescriptors();
+        errno = error;
+    }
+
+    return m_isRunning;
+}
+
+//
+// Stops the thread and closes the descriptors. Called without the lock held,
+// since the thread might be waiting for it.
+//
+void FileWatcherReactor::StopThread()
+{
+    pthread_t thread;
+    bool isRunning = false;
+
+    {
+        base::AutoLock lock(m_lock);
+        isRunning = m_isRunning;
+        thread = m_thread;
+
+        if (isRunning)
+        {
+            // wake up the thread
+            uint64_t one = 1;
+            ssize_t n = write(m_stopEventFd, &one, sizeof(one));
+            (void) n;
+        }
+    }
+
+    if (isRunning)
+        pthread_join(thread, NULL);
+
+    base::AutoLock lock(m_lock);
+    m_isRunning = false;
+    CloseDescriptors();
+}
+
+void FileWatcherReactor::CloseDescriptors()
+{
+    int* fds[] = { &m_inotifyFd, &m_epollFd, &m_stopEventFd, &m_timerFd, &m_pollTimerFd };
+    for (int i = 0; i < 5; ++i)
+    {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+
+    // scans still running belong to the closed inotify instance
+    ++m_generation;
+
+    m_isPollTimerArmed = false;
+    m_tree.Clear();
+    m_watches.clear();
+    m_polledNodes.clear();
+    m_deferredEvents.clear();
+    m_hasDroppedEvents = false;
+    m_pendingScans.clear();
+    m_needsRescan = false;
+    m_pendingMoves.clear();
+}
+
+//
+// The reactor loop of the watching thread.
+//
+void FileWatcherReactor::Run()
+{
+    // inotify_event contains an int, so the buffer has to be aligned accordingly
+    alignas(inotify_event) char buf[EVENT_BUF_LEN];
+    epoll_event events[4];
+
+    for ( ; ; )
+    {
+        int numEvents = epoll_wait(m_epollFd, events, 4, -1);
+        if (numEvents < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        bool hasInotifyEvents = false;
+        bool isTimerExpired = false;
+        bool isPollTimerExpired = false;
+
+        for (int i = 0; i < numEvents; ++i)
+        {
+            uint64_t numExpirations;
+            ssize_t n = 0;
+
+            switch (events[i].data.u32)
+            {
+            case EPOLL_ID_STOP:
+                return;
+
+            case EPOLL_ID_INOTIFY:
+                hasInotifyEvents = true;
+                break;
+
+            case EPOLL_ID_TIMER:
+                n = read(m_timerFd, &numExpirations, sizeof(numExpirations));
+                isTimerExpired = true;
+                break;
+
+            case EPOLL_ID_POLL_TIMER:
+                n = read(m_pollTimerFd, &numExpirations, sizeof(numExpirations));
+                isPollTimerExpired = true;
+                break;
+            }
+
+            (void) n;
+        }
+
+        base::AutoLock lock(m_lock);
+        double now = TimeUtil::GetMonotonicTime();
+
+        if (hasInotifyEvents)
+        {
+            // drain the inotify queue
+            for ( ; ; )
+            {
+                ssize_t len = read(m_inotifyFd, buf, sizeof(buf));
+                if (len <= 0)
+                {
+                    if (len < 0 && errno == EINTR)
+                        continue;
+                    break;
+                }
+
+                ProcessEvents(buf, len, now);
+            }
+
+            // moves out of the watched trees have no matching IN_MOVED_TO
+            ProcessUnpairedMoves(now);
+        }
+
+        if (m_numScans == 0)
+            ProcessDeferredEvents(now);
+
+        if (isPollTimerExpired)
+            Poll(now);
+
+        ScanPendingDirectories(now);
+
+        if (hasInotifyEvents || isTimerExpired || isPollTimerExpired)
+            FlushPendingChanges(now);
+    }
+}
+
+//
+// Scans the tree of a new watcher. Runs in its own thread, so neither the
+// caller nor the event processing has to wait for large trees.
+//
+void FileWatcherReactor::RunScan(ScanJob* job)
+{
+    TreeScanner scanner(job->inotifyFd, job->roots);
+    scanner.Scan(job->roots[0].directory);
+
+    {
+        base::AutoLock lock(m_lock);
+        --m_numScans;
+
+        if (job->generation == m_generation)
+        {
+            std::map<int, FileWatcher*>::iterator it = m_watchers.find(job->watcherId);
+            if (it != m_watchers.end())
+            {
+                AddDirectories(scanner.m_directories);
+                it->second->SetFileStamps(scanner.m_stamps);
+                it->second->m_isScanning = false;
+            }
+            else
+            {
+                // the watcher has been stopped while scanning
+                for (std::pair<String, int>& directory : scanner.m_directories)
+                    if (directory.second >= 0 && m_watches.find(directory.second) == m_watches.end())
+                        inotify_rm_watch(m_inotifyFd, directory.second);
+            }
+        }
+
+        // the deferred events are processed by the watching thread
+        if (m_numScans == 0 && m_isRunning && (m_hasDroppedEvents || !m_deferredEvents.empty()))
+        {
+            double now = TimeUtil::GetMonotonicTime();
+            ScheduleFlush(now, now);
+        }
+    }
+
+    if (job->inotifyFd >= 0)
+        close(job->inotifyFd);
+}
+
+void FileWatcherReactor::ProcessEvents(char* buf, ssize_t len, double now)
+{
+    for (char* p = buf; p < buf + len; )
+    {
+        inotify_event* event = (inotify_event*) p;
+        p += sizeof(inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW)
+        {
+            // events have been dropped; find the changes by comparing the file states
+            m_needsRescan = true;
+            continue;
+        }
+
+        std::unordered_map<int, int>::iterator itWatch = m_watches.find(event->wd);
+        if (itWatch == m_watches.end())
+        {
+            // the watch might have been added by a scan which hasn't completed yet
+            if (m_numScans > 0)
+            {
+                if (m_deferredEvents.size() < MAX_DEFERRED_EVENTS_SIZE)
+                    m_deferredEvents.insert(m_deferredEvents.end(), (char*) event, p);
+                else
+                    m_hasDroppedEvents = true;
+            }
+
+            continue;
+        }
+
+        int node = itWatch->second;
+
+        if (event->mask & IN_IGNORED)
+        {
+            // the watch was removed (the directory was deleted or unmounted)
+            m_watches.erase(itWatch);
+            m_tree.Get(node).wd = -1;
+            m_tree.Prune(node);
+            continue;
+        }
+
+        if (event->len == 0)
+            continue;
+
+        String path = m_tree.GetPath(node) + TEXT("/") + String(event->name);
+        bool isDirectory = (event->mask & IN_ISDIR) != 0;
+
+        if (event->mask & IN_MOVED_FROM)
+        {
+            // wait for the matching IN_MOVED_TO to tell renames from moves out of the trees
+            m_pendingMoves[event->cookie] = std::make_pair(path, isDirectory);
+        }
+        else if (event->mask & IN_MOVED_TO)
+        {
+            std::map<uint32_t, std::pair<String, bool> >::iterator itMove = m_pendingMoves.find(event->cookie);
+            if (itMove != m_pendingMoves.end())
+            {
+                String oldPath = itMove->second.first;
+                m_pendingMoves.erase(itMove);
+
+                if (isDirectory)
+                {
+                    // a renamed directory keeps its watches; only the paths change
+                    AddPendingChanges(oldPath, now);
+                    RenameWatches(oldPath, path);
+
+                    // unless it has been renamed to an ignored name
+                    if (!IsWatchedDirectory(path))
+                        RemoveWatches(path, true);
+                }
+                else
+                    AddPendingChange(oldPath, now);
+            }
+
+            if (isDirectory)
+                AddPendingChanges(path, now);
+            else
+                AddPendingChange(path, now);
+        }
+        else if ((event->mask & IN_CREATE) && isDirectory)
+        {
+            // watch the new directory; files might have been created in it
+            // before the watch was added, so report the ones already there
+            AddPendingChanges(path, now);
+        }
+        else if ((event->mask & IN_DELETE) && isDirectory)
+        {
+            AddPendingChanges(path, now);
+        }
+        else if (!isDirectory && (event->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE)))
+            AddPendingChange(path, now);
+    }
+}
+
+void FileWatcherReactor::ProcessUnpairedMoves(double now)
+{
+    for (std::map<uint32_t, std::pair<String, bool> >::iterator it = m_pendingMoves.begin(); it != m_pendingMoves.end(); ++it)
+    {
+        if (it->second.second)
+        {
+            AddPendingChanges(it->second.first, now);
+            RemoveWatches(it->second.first, false);
+        }
+        else
+            AddPendingChange(it->second.first, now);
+    }
+
+    m_pendingMoves.clear();
+}
+
+//
+// Processes the events deferred while scans were running, now that all
+// scanned directories are known.
+//
+void FileWatcherReactor::ProcessDeferredEvents(double now)
+{
+    if (m_hasDroppedEvents)
+    {
+        m_deferredEvents.clear();
+        m_hasDroppedEvents = false;
+        m_needsRescan = true;
+    }
+    else if (!m_deferredEvents.empty())
+    {
+        std::vector<char> events;
+        events.swap(m_deferredEvents);
+        ProcessEvents(&events[0], (ssize_t) events.size(), now);
+        ProcessUnpairedMoves(now);
+    }
+}
+
+//
+// Re-adds the watches for all trees and marks all files whose state differs
+// from the last known state as changed. Called like ScanPendingDirectories.
+//
+void FileWatcherReactor::Rescan(double now)
+{
+    for ( ; ; )
+    {
+        // each tree is scanned separately, since each watcher compares the states of its own files
+        std::vector<int> ids;
+        std::vector<std::vector<ScanRoot> > roots;
+        for (std::map<int, FileWatcher*>::iterator it = m_watchers.begin(); it != m_watchers.end(); ++it)
+        {
+            ScanRoot root;
+            root.directory = it->second->m_directory;
+            root.filter = it->second->m_filter;
+
+            ids.push_back(it->first);
+            roots.push_back(std::vector<ScanRoot>(1, root));
+        }
+
+        int watchersVersion = m_watchersVersion;
+        std::vector<std::vector<std::pair<String, int> > > directories(ids.size());
+        std::vector<std::map<String, FileStamp> > stamps(ids.size());
+
+        {
+            base::AutoUnlock unlock(m_lock);
+
+            for (size_t i = 0; i < ids.size(); ++i)
+            {
+                TreeScanner scanner(m_inotifyFd, roots[i]);
+                scanner.Scan(roots[i][0].directory);
+                directories[i].swap(scanner.m_directories);
+                stamps[i].swap(scanner.m_stamps);
+            }
+        }
+
+        if (m_watchersVersion != watchersVersion)
+        {
+            // watchers have been added or removed while scanning; scan the current trees
+            for (size_t i = 0; i < ids.size(); ++i)
+                RemoveUnusedWatches(directories[i]);
+            continue;
+        }
+
+        // directories might have been moved or deleted without us noticing;
+        // remove the watches that don't belong to any tree any more
+        std::unordered_map<int, int> oldWatches;
+        oldWatches.swap(m_watches);
+        m_polledNodes.clear();
+        m_tree.Clear();
+
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            AddDirectories(directories[i]);
+
+            // the initial scan of the watcher will provide its file states
+            FileWatcher* watcher = m_watchers[ids[i]];
+            if (!watcher->m_isScanning)
+                watcher->Rescan(stamps[i], now);
+        }
+
+        for (std::unordered_map<int, int>::iterator it = oldWatches.begin(); it != oldWatches.end(); ++it)
+            if (m_watches.find(it->first) == m_watches.end())
+                inotify_rm_watch(m_inotifyFd, it->first);
+
+        m_pendingMoves.clear();
+        break;
+    }
+}
+
+//
+// Checks the polled directories for changes. Directories are polled if the
+// inotify watch limit has been reached.
+//
+void FileWatcherReactor::Poll(double now)
+{
+    std::vector<int> nodes(m_polledNodes.begin(), m_polledNodes.end());
+    for (int node : nodes)
+        if (m_polledNodes.find(node) != m_polledNodes.end())
+            PollDirectory(node, now);
+
+    UpdatePollTimer();
+}
+
+void FileWatcherReactor::PollDirectory(int node, double now)
+{
+    String directory = m_tree.GetPath(node);
+
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+    {
+        // the directory has been deleted or moved away
+        AddPendingChanges(directory, now);
+        RemoveWatches(directory, false);
+        return;
+    }
+
+    std::map<String, FileStamp> stamps;
+    std::vector<String> newSubdirectories;
+
+    while (dirent* entry = readdir(dir))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        String name(entry->d_name);
+        String path = directory + TEXT("/") + name;
+        bool isDirectory = entry->d_type == DT_DIR;
+        FileStamp stamp;
+
+        if (entry->d_type == DT_UNKNOWN && !GetFileStamp(path, stamp, isDirectory))
+            continue;
+
+        if (isDirectory)
+        {
+            int child = m_tree.FindChild(node, name);
+            if ((child < 0 || (m_tree.Get(child).wd < 0 && !m_tree.Get(child).isPolled)) && IsWatchedDirectory(path))
+                newSubdirectories.push_back(path);
+        }
+        else if ((entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN) && IsWatchedFile(path) && GetFileStamp(path, stamp, isDirectory))
+            stamps[path] = stamp;
+    }
+
+    closedir(dir);
+
+    for (std::map<int, FileWatcher*>::iterator it = m_watchers.begin(); it != m_watchers.end(); ++it)
+        it->second->PollDirectory(directory, stamps, now);
+
+    // this adds watches for the new subdirectories if possible
+    for (String subdirectory : newSubdirectories)
+        AddPendingChanges(subdirectory, now);
+}
+
+//
+// Arms the poll timer if there are directories to poll, and disarms it otherwise.
+//
+void FileWatcherReactor::UpdatePollTimer()
+{
+    bool needsPolling = !m_polledNodes.empty();
+    if (needsPolling == m_isPollTimerArmed || m_pollTimerFd < 0)
+        return;
+
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (needsPolling)
+    {
+        spec.it_value.tv_sec = POLL_INTERVAL_SECONDS;
+        spec.it_interval.tv_sec = POLL_INTERVAL_SECONDS;
+    }
+
+    timerfd_settime(m_pollTimerFd, 0, &spec, NULL);
+    m_isPollTimerArmed = needsPolling;
+}
+
+bool FileWatcherReactor::IsWatchedDirectory(const String& directory)
+{
+    for (std::map<int, FileWatcher*>::iterator it = m_watchers.begin(); it != m_watchers.end(); ++it)
+        if (it->second->IsInTree(directory) && !it->second->IsIgnoredDirectory(directory))
+            return true;
+
+    return false;
+}
+
+bool FileWatcherReactor::IsWatchedFile(const String& path)
+{
+    for (std::map<int, FileWatcher*>::iterator it = m_watchers.begin(); it != m_watchers.end(); ++it)
+        if (it->second->IsInTree(path) && it->second->IsWatchedFile(path))
+            return true;
+
+    return false;
+}
+
+void FileWatcherReactor::GetScanRoots(std::vector<ScanRoot>& roots)
+{
+    roots.resize(m_watchers.size());
+
+    int i = 0;
+    for (std::map<int, FileWatcher*>::iterator it = m_watchers.begin(); it != m_watchers.end(); ++it, ++i)
+    {
+        roots[i].directory = it->second->m_directory;
+        roots[i].filter = it->second->m_filter;
+    }
+}
+
+//
+// Scans the directories queued while processing events, or all trees if
+// events have been dropped: adds watches for the directories and their
+// subdirectories which aren't ignored by all watchers and reports the files
+// found. The lock is released while scanning, so the UI thread doesn't have
+// to wait for large trees. Called by the watching thread with the lock held.
+//
+void FileWatcherReactor::ScanPendingDirectories(double now)
+{
+    while (m_needsRescan || !m_pendingScans.empty())
+    {
+        if (m_needsRescan)
+        {
+            // the rescan finds the changes in the queued directories too
+            m_needsRescan = false;
+            m_pendingScans.clear();
+            Rescan(now);
+            continue;
+        }
+
+        std::vector<String> directories(m_pendingScans.begin(), m_pendingScans.end());
+        m_pendingScans.clear();
+
+        std::vector<ScanRoot> roots;
+        GetScanRoots(roots);
+        int watchersVersion = m_watchersVersion;
+
+        std::vector<std::pair<String, int> > foundDirectories;
+        std::vector<std::map<String, FileStamp> > stamps(directories.size());
+
+        {
+            base::AutoUnlock unlock(m_lock);
+
+            for (size_t i = 0; i < directories.size(); ++i)
+            {
+                TreeScanner scanner(m_inotifyFd, roots);
+                scanner.Scan(directories[i]);
+                foundDirectories.insert(foundDirectories.end(), scanner.m_directories.begin(), scanner.m_directories.end());
+                stamps[i].swap(scanner.m_stamps);
+            }
+        }
+
+        if (m_watchersVersion != watchersVersion)
+        {
+            // watchers have been added or removed while scanning; scan the current trees
+            RemoveUnusedWatches(foundDirectories);
+            m_pendingScans.insert(directories.begin(), directories.end());
+            continue;
+        }
+
+        AddDirectories(foundDirectories);
+
+        for (size_t i = 0; i < directories.size(); ++i)
+            for (std::map<int, FileWatcher*>::iterator it = m_watchers.begin(); it != m_watchers.end(); ++it)
+                it->second->AddPendingChanges(directories[i], stamps[i], now);
+    }
+}
+
+//
+// Adds the directories found by a TreeScanner to the tree.
+//
+void FileWatcherReactor::AddDirectories(const std::vector<std::pair<String, int> >& directories)
+{
+    int numPolled = 0;
+
+    for (const std::pair<String, int>& directory : directories)
+    {
+        int node = m_tree.Add(directory.first);
+
+        if (directory.second >= 0)
+            SetWatch(node, directory.second);
+        else if (!m_tree.Get(node).isPolled)
+        {
+            m_tree.Get(node).isPolled = true;
+            m_polledNodes.insert(node);
+            ++numPolled;
+        }
+    }
+
+    if (numPolled > 0)
+    {
+        StringStream ss;
+        ss << TEXT("The inotify watch limit (fs.inotify.max_user_watches) has been reached; polling ") <<
+            numPolled << TEXT(" more directories");
+        App::Log(ss.str());
+    }
+
+    UpdatePollTimer();
+}
+
+//
+// Removes the watches a scan has added for directories which aren't in the
+// tree. Other scans might be adding the same directories, so the watches are
+// only removed if no other scans are running.
+//
+void FileWatcherReactor::RemoveUnusedWatches(const std::vector<std::pair<String, int> >& directories)
+{
+    if (m_numScans > 0)
+        return;
+
+    for (const std::pair<String, int>& directory : directories)
+        if (directory.second >= 0 && m_watches.find(directory.second) == m_watches.end())
+            inotify_rm_watch(m_inotifyFd, directory.second);
+}
+
+void FileWatcherReactor::SetWatch(int node, int wd)
+{
+    DirectoryTree::Node& n = m_tree.Get(node);
+    if (n.wd == wd)
+        return;
+
+    // the directory at this path has been replaced
+    if (n.wd >= 0)
+        m_watches.erase(n.wd);
+
+    // inotify returns the existing descriptor for a directory watched already
+    // (under a path which is outdated now)
+    std::unordered_map<int, int>::iterator it = m_watches.find(wd);
+    if (it != m_watches.end())
+        m_tree.Get(it->second).wd = -1;
+
+    n.wd = wd;
+    m_watches[wd] = node;
+
+    if (n.isPolled)
+    {
+        n.isPolled = false;
+        m_polledNodes.erase(node);
+    }
+}
+
+void FileWatcherReactor::RemoveWatch(int node)
+{
+    DirectoryTree::Node& n = m_tree.Get(node);
+
+    if (n.wd >= 0)
+    {
+        inotify_rm_watch(m_inotifyFd, n.wd);
+        m_watches.erase(n.wd);
+        n.wd = -1;
+    }
+
+    if (n.isPolled)
+    {
+        n.isPolled = false;
+        m_polledNodes.erase(node);
+    }
+}
+
+//
+// Removes the watches of "directory" and its subdirectories. If
+// "keepWatchedDirectories" is set, the directories still in the tree of
+// a watcher remain watched.
+//
+void FileWatcherReactor::RemoveWatches(const String& directory, bool keepWatchedDirectories)
+{
+    int node = m_tree.Find(directory);
+    if (node < 0)
+        return;
+
+    std::vector<int> nodes;
+    m_tree.GetSubtree(node, nodes);
+
+    for (int n : nodes)
+        if (!keepWatchedDirectories || !IsWatchedDirectory(m_tree.GetPath(n)))
+            RemoveWatch(n);
+
+    m_tree.Prune(node);
+}
+
+void FileWatcherReactor::RenameWatches(const String& oldDirectory, const String& newDirectory)
+{
+    int node = m_tree.Find(oldDirectory);
+    size_t pos = newDirectory.rfind(TEXT('/'));
+    if (node <= 0 || pos == String::npos)
+        return;
+
+    int parent = m_tree.Add(newDirectory.substr(0, pos));
+    String name = newDirectory.substr(pos + 1);
+    int oldParent = m_tree.Get(node).parent;
+
+    // a directory replaced by the rename; its watches are gone
+    int replaced = m_tree.FindChild(parent, name);
+    if (replaced >= 0 && replaced != node)
+    {
+        std::vector<int> nodes;
+        m_tree.GetSubtree(replaced, nodes);
+        for (int n : nodes)
+        {
+            if (m_tree.Get(n).wd >= 0)
+                m_watches.erase(m_tree.Get(n).wd);
+            m_polledNodes.erase(n);
+        }
+
+        m_tree.Remove(replaced);
+    }
+
+    m_tree.Move(node, parent, name);
+    m_tree.Prune(oldParent);
+}
+
+void FileWatcherReactor::AddPendingChange(const String& path, double now)
+{
+    for (std::map<int, FileWatcher*>::iterator it = m_watchers.begin(); it != m_watchers.end(); ++it)
+        it->second->AddPendingChange(path, now);
+}
+
+//
+// Marks all known files in "directory" as changed for all watchers whose
+// tree overlaps with "directory". The directory is scanned for the files
+// currently in it and for new subdirectories by ScanPendingDirectories.
+//
+void FileWatcherReactor::AddPendingChanges(const String& directory, double now)
+{
+    std::map<String, FileStamp> stamps;
+    for (std::map<int, FileWatcher*>::iterator it = m_watchers.begin(); it != m_watchers.end(); ++it)
+        it->second->AddPendingChanges(directory, stamps, now);
+
+    m_pendingScans.insert(directory);
+}
+
+void FileWatcherReactor::FlushPendingChanges(double now)
+{
+    double nextDueTime = -1;
+
+    for (std::map<int, FileWatcher*>::iterator it = m_watchers.begin(); it != m_watchers.end(); ++it)
+    {
+        std::vector<String> files;
+        double dueTime = it->second->FlushPendingChanges(now, files);
+
+        if (files.size() > 0)
+            CefPostTask(TID_FILE, base::Bind(&HashFilesOnFileThread, it->first, it->second->m_hashes, files));
+
+        if (dueTime >= 0 && (nextDueTime < 0 || dueTime < nextDueTime))
+            nextDueTime = dueTime;
+    }
+
+    ScheduleFlush(nextDueTime, now);
+}
+
+//
+// Arms the timer for "dueTime" or disarms it if "dueTime" is negative.
+//
+void FileWatcherReactor::ScheduleFlush(double dueTime, double now)
+{
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+
+    if (dueTime >= 0)
+    {
+        // at least 1ms; a zero value would disarm the timer
+        int64_t timeout = (int64_t) std::max(ceil(dueTime - now), 1.0);
+        spec.it_value.tv_sec = (time_t) (timeout / 1000);
+        spec.it_value.tv_nsec = (long) (timeout % 1000) * 1000000;
+    }
+
+    timerfd_settime(m_timerFd, 0, &spec, NULL);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// FileWatcher Implementation
+
+FileWatcher::FileWatcher()
+    : m_delay(0), m_handle(0), m_reactorId(0), m_isScanning(false)
+{
+}
+
+FileWatcher::~FileWatcher()
+{
+    Stop();
+}
+
+void FileWatcher::Start(Path& path, FileFilter* filter, double delay)
+{
+    // if watching is already running, turn it off first
+    Stop();
+
+    m_path = path;
+    m_delay = std::max(delay, 0.0);
+    m_filter = filter;
+
+    m_directory = m_path.GetPath();
+    while (m_directory.length() > 1 && m_directory[m_directory.length() - 1] == TEXT('/'))
+        m_directory.erase(m_directory.length() - 1);
+
+    // hashing tasks of a previous run might still be pending
+    m_hashes = new FileHashes();
+
+    FileWatcherReactor::GetInstance()->AddWatcher(this);
+}
+
+void FileWatcher::Stop()
+{
+    if (m_reactorId != 0)
+        FileWatcherReactor::GetInstance()->RemoveWatcher(this);
+
+    m_fileStamps.clear();
+    m_pendingChanges.clear();
+}
+
+void FileWatcher::GetStatus(FileWatcherStatus& status)
+{
+    FileWatcherReactor::GetInstance()->GetStatus(this, status);
+}
+
+//
+// Tests whether "path", which must be in the tree, is reported. This takes
+// time linear in the length of the path, independently of the number of
+// extensions and patterns.
+//
+bool FileWatcher::IsWatchedFile(const String& path)
+{
+    return path.length() > m_directory.length() && m_filter->IsWatchedFile(path.substr(m_directory.length() + 1));
+}
+
+//
+// Tests whether "directory", which must be in the tree, is ignored.
+// Ignored directories aren't watched.
+//
+bool FileWatcher::IsIgnoredDirectory(const String& directory)
+{
+    return directory.length() > m_directory.length() && m_filter->IsIgnoredDirectory(directory.substr(m_directory.length() + 1));
+}
+
+bool FileWatcher::IsInTree(const String& path)
+{
+    return path == m_directory || IsInDirectory(path, m_directory);
+}
+
+void FileWatcher::AddPendingChange(const String& path, double now)
+{
+    if (!IsInTree(path) || !IsWatchedFile(path))
+        return;
+
+    std::map<String, PendingChange>::iterator it = m_pendingChanges.find(path);
+    if (it == m_pendingChanges.end())
+    {
+        PendingChange change;
+        change.firstChangeTime = now;
+        change.lastChangeTime = now;
+        m_pendingChanges[path] = change;
+    }
+    else
+        it->second.lastChangeTime = now;
+}
+
+//
+// Marks all known files in "directory" and the files in "stamps", which
+// have been found in "directory", as changed.
+//
+void FileWatcher::AddPendingChanges(const String& directory, const std::map<String, FileStamp>& stamps, double now)
+{
+    // only the part of the directory within the tree is relevant; the
+    // watched directory itself might have been moved by its parent
+    String top = directory;
+    if (IsInDirectory(m_directory, directory))
+        top = m_directory;
+    else if (!IsInTree(directory))
+        return;
+
+    for (std::map<String, FileStamp>::iterator it = m_fileStamps.lower_bound(top + TEXT("/"));
+        it != m_fileStamps.end() && IsInDirectory(it->first, top); ++it)
+    {
+        AddPendingChange(it->first, now);
+    }
+
+    for (std::map<String, FileStamp>::const_iterator it = stamps.lower_bound(top + TEXT("/"));
+        it != stamps.end() && IsInDirectory(it->first, top); ++it)
+    {
+        AddPendingChange(it->first, now);
+    }
+}
+
+//
+// Remembers the states of the files in "stamps" which are watched.
+//
+void FileWatcher::SetFileStamps(const std::map<String, FileStamp>& stamps)
+{
+    m_fileStamps.clear();
+    for (std::map<String, FileStamp>::const_iterator it = stamps.begin(); it != stamps.end(); ++it)
+        if (IsInTree(it->first) && IsWatchedFile(it->first))
+            m_fileStamps.insert(*it);
+}
+
+//
+// Marks all files whose state in "stamps" differs from the last known state
+// as changed.
+//
+void FileWatcher::Rescan(const std::map<String, FileStamp>& stamps, double now)
+{
+    for (std::map<String, FileStamp>::const_iterator it = stamps.begin(); it != stamps.end(); ++it)
+    {
+        std::map<String, FileStamp>::iterator itOld = m_fileStamps.find(it->first);
+        if (itOld == m_fileStamps.end() ||
+            itOld->second.size != it->second.size ||
+            itOld->second.modificationTime != it->second.modificationTime)
+        {
+            AddPendingChange(it->first, now);
+        }
+    }
+
+    // deleted files
+    for (std::map<String, FileStamp>::iterator it = m_fileStamps.begin(); it != m_fileStamps.end(); ++it)
+        if (stamps.find(it->first) == stamps.end())
+            AddPendingChange(it->first, now);
+}
+
+//
+// Marks the files directly in "directory" whose state in "stamps" differs from
+// the last known state as changed. Used for directories which can't be watched.
+//
+void FileWatcher::PollDirectory(const String& directory, const std::map<String, FileStamp>& stamps, double now)
+{
+    // the file states aren't known before the initial scan has completed
+    if (m_isScanning || !IsInTree(directory))
+        return;
+
+    for (std::map<String, FileStamp>::const_iterator it = stamps.begin(); it != stamps.end(); ++it)
+    {
+        if (!IsWatchedFile(it->first) || m_pendingChanges.find(it->first) != m_pendingChanges.end())
+            continue;
+
+        std::map<String, FileStamp>::iterator itOld = m_fileStamps.find(it->first);
+        if (itOld == m_fileStamps.end() ||
+            itOld->second.size != it->second.size ||
+            itOld->second.modificationTime != it->second.modificationTime)
+        {
+            AddPendingChange(it->first, now);
+        }
+    }
+
+    // deleted files; files in subdirectories are checked when polling those
+    for (std::map<String, FileStamp>::iterator it = m_fileStamps.lower_bound(directory + TEXT("/"));
+        it != m_fileStamps.end() && IsInDirectory(it->first, directory); ++it)
+    {
+        if (it->first.find(TEXT('/'), directory.length() + 1) == String::npos &&
+            stamps.find(it->first) == stamps.end() &&
+            m_pendingChanges.find(it->first) == m_pendingChanges.end())
+        {
+            AddPendingChange(it->first, now);
+        }
+    }
+}
+
+//
+// Collects the pending changes to report in "files" once there haven't been
+// any changes for the configured delay, so that bulk operations are reported
+// in few batches. Changes to empty files are held back for
+// WAIT_FOR_EMPTY_FILES_TIMEOUT_SECONDS, since many programs truncate files
+// before writing the new contents. Files whose size and modification time
+// haven't changed are dropped without hashing them.
+// Returns the time when the remaining changes are due, or -1 if there are none.
+//
+double FileWatcher::FlushPendingChanges(double now, std::vector<String>& files)
+{
+    if (m_pendingChanges.empty())
+        return -1;
+
+    double firstChangeTime = now;
+    double lastChangeTime = 0;
+    for (std::map<String, PendingChange>::iterator it = m_pendingChanges.begin(); it != m_pendingChanges.end(); ++it)
+    {
+        firstChangeTime = std::min(firstChangeTime, it->second.firstChangeTime);
+        lastChangeTime = std::max(lastChangeTime, it->second.lastChangeTime);
+    }
+
+    // debounce; but don't hold back changes while files keep changing forever
+    // (times are in milliseconds, the delay in seconds)
+    double delay = m_delay * 1000;
+    double batchDueTime = std::min(lastChangeTime + delay, firstChangeTime + delay * MAX_DELAY_FACTOR);
+    if (now < batchDueTime)
+    {
+        // no file is due yet; don't stat them while changes keep coming in
+        return batchDueTime;
+    }
+
+    double nextDueTime = -1;
+    int64_t racyTime = GetRealTime() - (int64_t) RACY_STAMP_SECONDS * 1000000000;
+
+    for (std::map<String, PendingChange>::iterator it = m_pendingChanges.begin(); it != m_pendingChanges.end(); )
+    {
+        FileStamp stamp;
+        bool isDirectory = false;
+        bool exists = GetFileStamp(it->first, stamp, isDirectory) && !isDirectory;
+
+        double dueTime = batchDueTime;
+        if (exists && stamp.size == 0)
+            dueTime = std::max(dueTime, it->second.lastChangeTime + WAIT_FOR_EMPTY_FILES_TIMEOUT_SECONDS * 1000);
+
+        if (now < dueTime)
+        {
+            if (nextDueTime < 0 || dueTime < nextDueTime)
+                nextDueTime = dueTime;
+            ++it;
+            continue;
+        }
+
+        if (exists)
+        {
+            std::map<String, FileStamp>::iterator itStamp = m_fileStamps.find(it->first);
+            bool isUnchanged = itStamp != m_fileStamps.end() &&
+                itStamp->second.size == stamp.size &&
+                itStamp->second.modificationTime == stamp.modificationTime &&
+                stamp.modificationTime < racyTime;
+
+            m_fileStamps[it->first] = stamp;
+
+            if (isUnchanged)
+            {
+                m_pendingChanges.erase(it++);
+                continue;
+            }
+        }
+        else
+            m_fileStamps.erase(it->first);
+
+        files.push_back(it->first);
+        m_pendingChanges.erase(it++);
+    }
+
+    return nextDueTime;
 }
 
 bool FileWatcher::ReadFile(String filePath, char** pBuf, size_t* pLen)
@@ -62,40 +62,24 @@ void fsevents_callback(
         NSString *fileName = (NSString*) CFArrayGetValueAtIndex((CFArrayRef) eventPaths, i);
         std::string strFileName = [fileName UTF8String];
         
-        // if no file extensions have been defined, send the event to the delegate every time
-        if (me->m_fileExtensions.empty())
+        // check the path relative to the watched directory against the filter
+        String relativePath = strFileName;
+        if (relativePath.length() > me->m_directory.length() && relativePath.compare(0, me->m_directory.length(), me->m_directory) == 0 &&
+            relativePath[me->m_directory.length()] == '/')
+        {
+            relativePath = relativePath.substr(me->m_directory.length() + 1);
+        }
+
+        if (me->m_filter->IsWatchedFile(relativePath))
         {
             if (isFileEmpty(fileName))
                 checkAgainLaterFilenames.push_back(strFileName);
             else
                 changedFilenames.push_back(strFileName);
         }
-        else
-        {
-            // otherwise check for the file extension
-            for (String extension : me->m_fileExtensions)
-            {
-                NSString *ext = [NSString stringWithUTF8String: extension.c_str()];
-                if ([fileName hasSuffix: ext])
-                {
-                    if (isFileEmpty(fileName))
-                    {
-                        checkAgainLaterFilenames.push_back(strFileName);
-                        //DEBUG_LOG(@"-- CheckAgainLater: %@", fileName);
-                    }
-                    else
-                    {
-                        changedFilenames.push_back(strFileName);
-                        //DEBUG_LOG(@"-- Changed: %@", fileName);
-                    }
-                    
-                    break;
-                }
-            }
-        }
     }
     
-    // send the event to the delegate if the a file with extension in _fileExtensions has changed
+    // send the event to the delegate if a watched file has changed
     std::vector<std::string> allChangedFilenames;
     allChangedFilenames.insert(allChangedFilenames.end(), checkAgainLaterFilenames.begin(), checkAgainLaterFilenames.end());
     allChangedFilenames.insert(allChangedFilenames.end(), changedFilenames.begin(), changedFilenames.end());
@@ -156,7 +140,8 @@ void fsevents_callback(
 namespace Zephyros {
 
 FileWatcher::FileWatcher()
-  : m_stream(nil),
+  : m_handle(0),
+    m_stream(nil),
     m_nonemptyFileTimeout(nil),
     m_emptyFileTimeoutCanceled(NO),
     m_activity(nil)
@@ -168,7 +153,7 @@ FileWatcher::~FileWatcher()
 {
 }
 
-void FileWatcher::Start(Path& path, std::vector<std::string>& fileExtensions, double delay)
+void FileWatcher::Start(Path& path, FileFilter* filter, double delay)
 {
     if (m_stream != nil)
         Stop();
@@ -185,8 +170,10 @@ void FileWatcher::Start(Path& path, std::vector<std::string>& fileExtensions, do
     if (!isDirectory)
         return;
     
-    m_fileExtensions.clear();
-    m_fileExtensions.insert(m_fileExtensions.end(), fileExtensions.begin(), fileExtensions.end());
+    m_filter = filter;
+    m_directory = [dir UTF8String];
+    while (m_directory.length() > 1 && m_directory[m_directory.length() - 1] == '/')
+        m_directory.erase(m_directory.length() - 1);
         
     // start watching...
     if (m_path.HasSecurityAccessData())
@@ -228,6 +215,16 @@ void FileWatcher::Stop()
     m_fileHashes.clear();
 }
 
+void FileWatcher::GetStatus(FileWatcherStatus& status)
+{
+    // an FSEventStream watches the entire tree
+    status.isScanning = false;
+    status.numWatchedDirectories = m_stream == nil ? 0 : 1;
+    status.numPolledDirectories = 0;
+    status.numWatches = status.numWatchedDirectories;
+    status.maxWatches = -1;
+}
+
 void FileWatcher::ScheduleNonEmptyFileCheck(std::vector<std::string>& filenames)
 {
     if (m_nonemptyFileTimeout == nil || !m_nonemptyFileTimeout.isValid)
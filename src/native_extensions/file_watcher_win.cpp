@@ -81,9 +81,8 @@ String GetAbsoluteFilename(Zephyros::FileWatcher* pWatcher, String filename)
 }
 
 //
-// Check the changed files. Add them to the change set if the file extension matches
-// one of the entries in the file watcher's extensions vector or if the vector is empty
-// (which means that all files are to be watched).
+// Check the changed files. Add them to the change set if they pass the file watcher's
+// filter, i.e. have one of its extensions and aren't ignored.
 // For non-empty files, fire a change event only if during a certain period of time
 // (WAIT_FOR_NONEMPTY_FILES_TIMEOUT_SECONDS) no further changes have occurred.
 // For empty files, fire a change event after a fixed amout of time
@@ -107,30 +106,14 @@ void ProcessChangedFiles(Zephyros::FileWatcher* pWatcher, BYTE* buf, std::set<St
         {
             String filename = String(pInfo->FileName, (String::size_type) pInfo->FileNameLength / sizeof(TCHAR));
 
-            if (pWatcher->m_fileExtensions.empty())
+            // the file name is relative to the watched directory
+            if (pWatcher->m_filter->IsWatchedFile(filename))
             {
-                // if no file extensions have been defined, send the event to the delegate every time
                 if (isFileEmpty(pWatcher->m_path.GetPath(), filename))
                     checkAgainLaterFilenames.push_back(filename);
                 else
                     changedFilenames.push_back(filename);
             }
-            else
-            {
-                // otherwise check for the file extension
-                for (String fileext : pWatcher->m_fileExtensions)
-                {
-                    if (StringEndsWith(filename, fileext))
-                    {
-                        if (isFileEmpty(pWatcher->m_path.GetPath(), filename))
-                            checkAgainLaterFilenames.push_back(filename);
-                        else
-                            changedFilenames.push_back(filename);
-
-                        break;
-                    }
-                }
-            }
         }
 
         if (pInfo->NextEntryOffset == 0)
@@ -339,7 +322,8 @@ DWORD WINAPI WatchDirectory(LPVOID param)
 namespace Zephyros {
 
 FileWatcher::FileWatcher()
-  : m_hDirectory(INVALID_HANDLE_VALUE),
+  : m_handle(0),
+    m_hDirectory(INVALID_HANDLE_VALUE),
     m_hFileWatcherThread(INVALID_HANDLE_VALUE)
 {
     m_hEventTerminate = CreateEvent(NULL, FALSE, FALSE, NULL);
@@ -351,7 +335,7 @@ FileWatcher::~FileWatcher()
     CloseHandle(m_hEventTerminate);
 }
 
-void FileWatcher::Start(Path& path, std::vector<String>& fileExtensions, double delay)
+void FileWatcher::Start(Path& path, FileFilter* filter, double delay)
 {
     // if watching is already running, turn it off first
     if (m_hDirectory != INVALID_HANDLE_VALUE)
@@ -360,8 +344,8 @@ void FileWatcher::Start(Path& path, std::vector<String>& fileExtensions, double
     // set new configuration
     m_path = path;
     m_delay = delay;
-    m_fileExtensions.clear();
-    m_fileExtensions.insert(m_fileExtensions.end(), fileExtensions.begin(), fileExtensions.end());
+    m_filter = filter;
+    m_directory = m_path.GetPath();
         
     m_hDirectory = CreateFile(
         m_path.GetPath().c_str(),
@@ -418,6 +402,16 @@ void FileWatcher::Stop()
     CloseHandle(m_overlapped.hEvent);
 }
 
+void FileWatcher::GetStatus(FileWatcherStatus& status)
+{
+    // ReadDirectoryChangesW watches the entire tree with a single handle
+    status.isScanning = false;
+    status.numWatchedDirectories = m_hDirectory == INVALID_HANDLE_VALUE ? 0 : 1;
+    status.numPolledDirectories = 0;
+    status.numWatches = status.numWatchedDirectories;
+    status.maxWatches = -1;
+}
+
 bool FileWatcher::ReadFile(String filePath, char** pBuf, size_t* pLen)
 {
     HANDLE hFile = CreateFile(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
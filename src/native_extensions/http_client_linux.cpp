@@ -0,0 +1,454 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "native_extensions/error.h"
+#include "native_extensions/http_client_linux.h"
+
+
+// The maximum number of connections to a single host, and the number of
+// connections kept open for reuse
+#define HTTP_MAX_HOST_CONNECTIONS 6
+#define HTTP_MAX_CACHED_CONNECTIONS 32
+
+#define HTTP_CONNECT_TIMEOUT_MS 30000
+
+// Requests are aborted if less than HTTP_LOW_SPEED_LIMIT bytes per second
+// are transferred for HTTP_LOW_SPEED_TIME seconds
+#define HTTP_LOW_SPEED_LIMIT 1
+#define HTTP_LOW_SPEED_TIME 60
+
+// The network thread wakes up at least this often
+#define HTTP_POLL_TIMEOUT_MS 1000
+
+
+namespace Zephyros {
+
+HttpClient* g_httpClient = NULL;
+
+
+//
+// Maps a libcurl result code to an error.
+//
+static void SetCurlError(Error& error, CURLcode result)
+{
+    int code = ERR_UNKNOWN;
+
+    switch (result)
+    {
+    case CURLE_UNSUPPORTED_PROTOCOL:
+    case CURLE_URL_MALFORMAT:
+        code = ERR_INVALID_ARGUMENT;
+        break;
+    case CURLE_COULDNT_RESOLVE_PROXY:
+    case CURLE_COULDNT_RESOLVE_HOST:
+        code = ERR_ADDRESS_NOT_AVAILABLE;
+        break;
+    case CURLE_COULDNT_CONNECT:
+        code = ERR_CONNECTION_REFUSED;
+        break;
+    case CURLE_OPERATION_TIMEDOUT:
+        code = ERR_TIMED_OUT;
+        break;
+    case CURLE_OUT_OF_MEMORY:
+        code = ERR_INSUFFICIENT_MEMORY;
+        break;
+    case CURLE_PARTIAL_FILE:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        code = ERR_CONNECTION_RESET;
+        break;
+    default:
+        break;
+    }
+
+    error.SetError(code, curl_easy_strerror(result));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// HttpRequest Implementation
+
+HttpRequest::HttpRequest(String method, String url)
+: m_method(method), m_url(url), m_timeout(0), m_id(0), m_curl(NULL), m_headerList(NULL), m_isAborted(false)
+{
+    std::transform(m_method.begin(), m_method.end(), m_method.begin(), ::toupper);
+}
+
+void HttpRequest::SetBody(const std::string& body, String contentType)
+{
+    m_body = body;
+    if (contentType.length() > 0)
+        AddHeader(TEXT("Content-Type"), contentType);
+}
+
+void HttpRequest::AddHeader(String name, String value)
+{
+    m_headers.push_back(name + TEXT(": ") + value);
+}
+
+void HttpRequest::SetRange(long long start, long long end)
+{
+    m_range = std::to_string(start) + TEXT("-") + (end >= 0 ? std::to_string(end) : TEXT(""));
+}
+
+void HttpRequest::SetTimeout(long timeout)
+{
+    m_timeout = timeout;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// HttpClient Implementation
+
+HttpClient::HttpClient()
+: m_isRunning(false), m_nextRequestId(1)
+{
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    // all requests share the connection cache of the multi handle, so
+    // connections are kept alive and reused, and HTTP/2 streams to the
+    // same host are multiplexed over a single connection
+    m_multi = curl_multi_init();
+    curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(m_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) HTTP_MAX_HOST_CONNECTIONS);
+    curl_multi_setopt(m_multi, CURLMOPT_MAXCONNECTS, (long) HTTP_MAX_CACHED_CONNECTIONS);
+
+#if LIBCURL_VERSION_NUM < 0x074400
+    if (pipe2(m_wakeupPipe, O_NONBLOCK | O_CLOEXEC) != 0)
+        m_wakeupPipe[0] = m_wakeupPipe[1] = -1;
+#endif
+}
+
+int HttpClient::Start(HttpRequest* request)
+{
+    int requestId;
+
+    {
+        base::AutoLock lock(m_lock);
+
+        requestId = m_nextRequestId++;
+        request->m_id = requestId;
+        m_pendingRequests.push_back(request);
+
+        if (!m_isRunning)
+        {
+            pthread_t thread;
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            m_isRunning = pthread_create(&thread, &attr, HttpClient::RunNetworkThread, this) == 0;
+            pthread_attr_destroy(&attr);
+        }
+    }
+
+    Wakeup();
+    return requestId;
+}
+
+void HttpClient::Cancel(int requestId)
+{
+    {
+        base::AutoLock lock(m_lock);
+        m_cancelledRequests.insert(requestId);
+    }
+
+    Wakeup();
+}
+
+void* HttpClient::RunNetworkThread(void* arg)
+{
+    ((HttpClient*) arg)->Run();
+    return NULL;
+}
+
+//
+// The event loop of the network thread. The thread keeps running so that
+// idle connections stay open for reuse.
+//
+void HttpClient::Run()
+{
+    while (true)
+    {
+        std::deque<HttpRequest*> pendingRequests;
+        std::set<int> cancelledRequests;
+
+        {
+            base::AutoLock lock(m_lock);
+            pendingRequests.swap(m_pendingRequests);
+            cancelledRequests.swap(m_cancelledRequests);
+        }
+
+        for (HttpRequest* request : pendingRequests)
+            AddRequest(request);
+
+        for (int requestId : cancelledRequests)
+        {
+            std::map<int, HttpRequest*>::iterator it = m_activeRequests.find(requestId);
+            if (it != m_activeRequests.end())
+            {
+                it->second->m_isAborted = true;
+                FinishRequest(it->second, CURLE_OK);
+            }
+        }
+
+        int numRunning = 0;
+        curl_multi_perform(m_multi, &numRunning);
+
+        CURLMsg* msg;
+        int numMessages;
+        while ((msg = curl_multi_info_read(m_multi, &numMessages)) != NULL)
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            HttpRequest* request = NULL;
+            CURLcode result = msg->data.result;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &request);
+            FinishRequest(request, result);
+        }
+
+        Wait();
+    }
+}
+
+//
+// Interrupts Wait on the network thread.
+//
+void HttpClient::Wakeup()
+{
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_wakeup(m_multi);
+#else
+    char c = 0;
+    if (write(m_wakeupPipe[1], &c, 1) < 0)
+    {
+        // the pipe is full, so the network thread will wake up anyway
+    }
+#endif
+}
+
+//
+// Waits for activity on the requests' connections, for a wakeup, or until
+// HTTP_POLL_TIMEOUT_MS have passed.
+//
+void HttpClient::Wait()
+{
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_poll(m_multi, NULL, 0, HTTP_POLL_TIMEOUT_MS, NULL);
+#else
+    // curl_multi_poll is only available since libcurl 7.68; curl_multi_wait
+    // also watches the pipe Wakeup writes to
+    struct curl_waitfd waitFd;
+    waitFd.fd = m_wakeupPipe[0];
+    waitFd.events = CURL_WAIT_POLLIN;
+    waitFd.revents = 0;
+    curl_multi_wait(m_multi, &waitFd, m_wakeupPipe[0] >= 0 ? 1 : 0, HTTP_POLL_TIMEOUT_MS, NULL);
+
+    char buf[64];
+    while (read(m_wakeupPipe[0], buf, sizeof(buf)) > 0)
+        ;
+#endif
+}
+
+void HttpClient::AddRequest(HttpRequest* request)
+{
+    m_activeRequests[request->m_id] = request;
+
+    CURL* curl = curl_easy_init();
+    if (curl == NULL)
+    {
+        FinishRequest(request, CURLE_OUT_OF_MEMORY);
+        return;
+    }
+
+    request->m_curl = curl;
+
+    curl_easy_setopt(curl, CURLOPT_URL, request->m_url.c_str());
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, request);
+#if LIBCURL_VERSION_NUM >= 0x075500
+    curl_easy_setopt(curl, CURLOPT_PROTOCOLS_STR, "http,https");
+    curl_easy_setopt(curl, CURLOPT_REDIR_PROTOCOLS_STR, "http,https");
+#else
+    curl_easy_setopt(curl, CURLOPT_PROTOCOLS, (long) (CURLPROTO_HTTP | CURLPROTO_HTTPS));
+    curl_easy_setopt(curl, CURLOPT_REDIR_PROTOCOLS, (long) (CURLPROTO_HTTP | CURLPROTO_HTTPS));
+#endif
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
+    // use HTTP/2 for HTTPS if the server supports it, and rather wait for a
+    // connection that can be multiplexed than open a new one
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long) HTTP_CONNECT_TIMEOUT_MS);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long) HTTP_LOW_SPEED_LIMIT);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long) HTTP_LOW_SPEED_TIME);
+    if (request->m_timeout > 0)
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, request->m_timeout);
+
+    if (request->m_method == TEXT("HEAD"))
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    else if (request->m_method != TEXT("GET") || request->m_body.length() > 0)
+    {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) request->m_body.length());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->m_body.c_str());
+        if (request->m_method != TEXT("POST"))
+            curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request->m_method.c_str());
+
+        // don't wait for a "100 Continue" response before sending the body
+        request->m_headerList = curl_slist_append(request->m_headerList, "Expect:");
+    }
+
+    for (String header : request->m_headers)
+        request->m_headerList = curl_slist_append(request->m_headerList, header.c_str());
+    if (request->m_headerList != NULL)
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->m_headerList);
+
+    if (request->m_range.length() > 0)
+        curl_easy_setopt(curl, CURLOPT_RANGE, request->m_range.c_str());
+
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HttpClient::OnHeader);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, request);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, HttpClient::OnData);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, request);
+
+    CURLMcode result = curl_multi_add_handle(m_multi, curl);
+    if (result != CURLM_OK)
+        FinishRequest(request, result == CURLM_OUT_OF_MEMORY ? CURLE_OUT_OF_MEMORY : CURLE_FAILED_INIT);
+}
+
+void HttpClient::FinishRequest(HttpRequest* request, CURLcode result)
+{
+    long status = 0;
+
+    if (request->m_curl != NULL)
+    {
+        curl_easy_getinfo(request->m_curl, CURLINFO_RESPONSE_CODE, &status);
+        curl_multi_remove_handle(m_multi, request->m_curl);
+        curl_easy_cleanup(request->m_curl);
+        request->m_curl = NULL;
+    }
+
+    if (request->m_headerList != NULL)
+    {
+        curl_slist_free_all(request->m_headerList);
+        request->m_headerList = NULL;
+    }
+
+    Error error;
+    if (request->m_isAborted && request->m_error.GetCode() != ERR_OK)
+        error = request->m_error;
+    else if (request->m_isAborted)
+        error.SetError(ERR_CANCELLED, TEXT("The request has been cancelled"));
+    else if (result != CURLE_OK)
+        SetCurlError(error, result);
+
+    m_activeRequests.erase(request->m_id);
+
+    request->OnFinished(error, status);
+    delete request;
+}
+
+size_t HttpClient::OnHeader(char* buffer, size_t size, size_t count, void* userData)
+{
+    HttpRequest* request = (HttpRequest*) userData;
+    size_t length = size * count;
+    String line(buffer, length);
+
+    // a new response (after a redirect or an interim response) starts with the status line
+    if (line.compare(0, 5, TEXT("HTTP/")) == 0)
+    {
+        request->m_responseHeaders.clear();
+        return length;
+    }
+
+    size_t end = line.find_last_not_of(TEXT("\r\n"));
+    if (end == String::npos)
+    {
+        // an empty line terminates the headers; skip interim responses and
+        // redirects, which libcurl follows
+        long status = 0;
+        curl_easy_getinfo(request->m_curl, CURLINFO_RESPONSE_CODE, &status);
+
+        bool isRedirect = status >= 300 && status < 400 && request->m_responseHeaders.find(TEXT("location")) != request->m_responseHeaders.end();
+        if (status < 200 || isRedirect)
+            return length;
+
+        if (!request->OnResponse(status, request->m_responseHeaders))
+        {
+            request->m_isAborted = true;
+            return 0;
+        }
+
+        return length;
+    }
+
+    size_t colon = line.find(TEXT(':'));
+    if (colon != String::npos && colon < end)
+    {
+        String name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        size_t start = line.find_first_not_of(TEXT(" \t"), colon + 1);
+        request->m_responseHeaders[name] = start == String::npos || start > end ? TEXT("") : line.substr(start, end - start + 1);
+    }
+
+    return length;
+}
+
+size_t HttpClient::OnData(char* buffer, size_t size, size_t count, void* userData)
+{
+    HttpRequest* request = (HttpRequest*) userData;
+    if (!request->OnData(buffer, size * count))
+    {
+        request->m_isAborted = true;
+        return 0;
+    }
+
+    return size * count;
+}
+
+HttpClient* GetHttpClient()
+{
+    if (g_httpClient == NULL)
+        g_httpClient = new HttpClient();
+    return g_httpClient;
+}
+
+} // namespace Zephyros
@@ -0,0 +1,157 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+
+#ifndef Zephyros_HttpClientLinux_h
+#define Zephyros_HttpClientLinux_h
+#pragma once
+
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "lib/cef/include/base/cef_lock.h"
+
+#include "base/types.h"
+#include "native_extensions/error.h"
+
+
+namespace Zephyros {
+
+//
+// A HTTP request executed by the HttpClient. The callbacks are invoked on
+// the network thread. Once the request has been started, the client owns it
+// and deletes it after OnFinished has been called.
+//
+class HttpRequest
+{
+public:
+    HttpRequest(String method, String url);
+    virtual ~HttpRequest() {}
+
+    void SetBody(const std::string& body, String contentType);
+    void AddHeader(String name, String value);
+
+    // Requests a range of bytes; the end is inclusive, or -1 for the end of the resource.
+    void SetRange(long long start, long long end);
+
+    // Aborts the request if it hasn't completed after the timeout (in milliseconds); 0 for no timeout.
+    void SetTimeout(long timeout);
+
+    // Called when the status and the headers (with lower-case names) of the
+    // final response have been received. Returning false aborts the request.
+    virtual bool OnResponse(long status, const std::map<String, String>& headers) { return true; }
+
+    // Called for each chunk of the response body. Returning false aborts the request.
+    virtual bool OnData(const char* data, size_t length) = 0;
+
+    // Called when the request has completed or failed.
+    virtual void OnFinished(const Error& error, long status) = 0;
+
+protected:
+    // Records why OnResponse or OnData is about to abort the request;
+    // OnFinished is then called with this error instead of ERR_CANCELLED.
+    void SetError(const Error& error) { m_error = error; }
+
+private:
+    friend class HttpClient;
+
+    String m_method;
+    String m_url;
+    std::string m_body;
+    std::vector<String> m_headers;
+    String m_range;
+    long m_timeout;
+
+    int m_id;
+    CURL* m_curl;
+    struct curl_slist* m_headerList;
+    std::map<String, String> m_responseHeaders;
+    bool m_isAborted;
+    Error m_error;
+};
+
+
+//
+// Executes HTTP requests on a single network thread using the libcurl multi
+// interface. Connections are kept alive and reused across requests, and
+// requests to the same HTTPS host are multiplexed over one HTTP/2
+// connection if the server supports it.
+//
+class HttpClient
+{
+public:
+    HttpClient();
+
+    // Starts a request, taking ownership of it, and returns its ID.
+    int Start(HttpRequest* request);
+
+    // Aborts a request; OnFinished is called with ERR_CANCELLED.
+    void Cancel(int requestId);
+
+private:
+    static void* RunNetworkThread(void* arg);
+    void Run();
+    void Wakeup();
+    void Wait();
+
+    void AddRequest(HttpRequest* request);
+    void FinishRequest(HttpRequest* request, CURLcode result);
+
+    static size_t OnHeader(char* buffer, size_t size, size_t count, void* userData);
+    static size_t OnData(char* buffer, size_t size, size_t count, void* userData);
+
+private:
+    CURLM* m_multi;
+    bool m_isRunning;
+
+#if LIBCURL_VERSION_NUM < 0x074400
+    // wakes up the network thread if curl_multi_wakeup isn't available
+    int m_wakeupPipe[2];
+#endif
+
+    // requests to add and cancel, passed to the network thread
+    base::Lock m_lock;
+    std::deque<HttpRequest*> m_pendingRequests;
+    std::set<int> m_cancelledRequests;
+    int m_nextRequestId;
+
+    // the requests being executed; only used on the network thread
+    std::map<int, HttpRequest*> m_activeRequests;
+};
+
+HttpClient* GetHttpClient();
+
+} // namespace Zephyros
+
+
+#endif // Zephyros_HttpClientLinux_h
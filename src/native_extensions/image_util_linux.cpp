@@ -25,10 +25,482 @@
  *******************************************************************************/
 
 
+#include <deque>
+#include <fstream>
+#include <set>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "lib/cef/include/base/cef_bind.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
+
+#include "base/cef/client_handler.h"
+#include "base/cef/extension_handler.h"
+
 #include "util/base64.h"
+#include "util/image_processing.h"
+
+#include "native_extensions/error.h"
 #include "native_extensions/image_util_linux.h"
 
 
+// The zlib compression level of the PNGs created
+#define IMAGE_PNG_COMPRESSION_LEVEL 6
+
+// Images are converted by at most this many threads (and not more than
+// there are processors); a thread exits when it has been idle for
+// IMAGE_CONVERSION_IDLE_TIMEOUT seconds
+#define IMAGE_CONVERSION_MAX_THREADS 8
+#define IMAGE_CONVERSION_IDLE_TIMEOUT 30
+
+
+extern CefRefPtr<Zephyros::ClientHandler> g_handler;
+
+
+//////////////////////////////////////////////////////////////////////////
+// Image Conversion
+
+typedef struct
+{
+    // the source: a file, or base64-encoded data
+    String path;
+    String base64Data;
+
+    // the file the converted image is written to, or empty
+    String outputPath;
+
+    Zephyros::Error error;
+    int width;
+    int height;
+    String dataURL;
+} ConversionJob;
+
+typedef struct
+{
+    CallbackId callback;
+
+    // convertImage passes only the data URL to the callback
+    bool isSingleImage;
+
+    ImageUtil::ImageConversionOptions options;
+    std::vector<ConversionJob> jobs;
+
+    // the number of jobs not finished yet; guarded by g_conversionMutex
+    size_t numPending;
+} ConversionBatch;
+
+
+// An item of the conversion queue: a job of a batch, or a task posted with
+// ImageUtil::PostConversionTask if "batch" is NULL
+typedef struct
+{
+    ConversionBatch* batch;
+    size_t index;
+    base::Closure task;
+} ConversionQueueItem;
+
+
+static pthread_mutex_t g_conversionMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_conversionCond = PTHREAD_COND_INITIALIZER;
+static std::deque<ConversionQueueItem> g_conversionQueue;
+static int g_numConversionThreads = 0;
+static int g_numIdleConversionThreads = 0;
+
+
+static void SetDecodingError(ConversionJob& job, GError* error)
+{
+    int code = ERR_DECODING_FAILED;
+    if (error != NULL && error->domain == G_FILE_ERROR)
+    {
+        if (error->code == G_FILE_ERROR_NOENT)
+            code = ERR_FILE_NOT_FOUND;
+        else if (error->code == G_FILE_ERROR_ACCES)
+            code = ERR_FILE_NO_READ_PERMISSION;
+        else if (error->code == G_FILE_ERROR_ISDIR)
+            code = ERR_IS_DIRECTORY;
+    }
+
+    job.error.SetError(code, error != NULL ? error->message : TEXT("The image couldn't be decoded"));
+}
+
+//
+// Decodes the source of the job with gdk-pixbuf, which supports PNG, JPEG,
+// GIF, BMP, ICO and whatever other loaders are installed.
+//
+static GdkPixbuf* DecodeImage(ConversionJob& job)
+{
+    GError* error = NULL;
+    GdkPixbuf* pixbuf = NULL;
+
+    if (job.path.length() > 0)
+        pixbuf = gdk_pixbuf_new_from_file(job.path.c_str(), &error);
+    else
+    {
+        // accept data URLs as well as plain base64 data
+        size_t start = 0;
+        if (job.base64Data.compare(0, 5, TEXT("data:")) == 0)
+        {
+            size_t comma = job.base64Data.find(TEXT(','));
+            start = comma == String::npos ? job.base64Data.length() : comma + 1;
+        }
+
+        size_t length = 0;
+        void* data = NewBase64Decode(job.base64Data.c_str() + start, job.base64Data.length() - start, &length);
+
+        GdkPixbufLoader* loader = gdk_pixbuf_loader_new();
+        bool isWritten = data != NULL && length > 0 && gdk_pixbuf_loader_write(loader, (const guchar*) data, length, &error);
+
+        // the loader has to be closed even if writing has failed
+        if (gdk_pixbuf_loader_close(loader, isWritten ? &error : NULL) && isWritten)
+        {
+            pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+            if (pixbuf != NULL)
+                g_object_ref(pixbuf);
+        }
+
+        g_object_unref(loader);
+        free(data);
+    }
+
+    if (pixbuf == NULL)
+    {
+        SetDecodingError(job, error);
+        if (error != NULL)
+            g_error_free(error);
+        return NULL;
+    }
+
+    // photos are often stored rotated, with the orientation in the EXIF data
+    GdkPixbuf* orientedPixbuf = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+    g_object_unref(pixbuf);
+
+    return orientedPixbuf;
+}
+
+static bool EncodeJPEG(const std::vector<unsigned char>& image, int width, int height, bool isPremultiplied, int quality, std::vector<unsigned char>& jpeg)
+{
+    // JPEGs have no alpha channel; transparent areas become white
+    std::vector<unsigned char> rgb((size_t) width * height * 3);
+    for (size_t i = 0; i < (size_t) width * height; ++i)
+    {
+        int alpha = image[i * 4 + 3];
+        for (int c = 0; c < 3; ++c)
+        {
+            int value = isPremultiplied ? image[i * 4 + c] : (image[i * 4 + c] * alpha + 127) / 255;
+            rgb[i * 3 + c] = (unsigned char) std::min(255, value + 255 - alpha);
+        }
+    }
+
+    GdkPixbuf* pixbuf = gdk_pixbuf_new_from_data(&rgb[0], GDK_COLORSPACE_RGB, FALSE, 8, width, height, width * 3, NULL, NULL);
+    if (pixbuf == NULL)
+        return false;
+
+    char strQuality[16];
+    snprintf(strQuality, sizeof(strQuality), "%d", std::max(0, std::min(quality, 100)));
+
+    gchar* buffer = NULL;
+    gsize length = 0;
+    gboolean success = gdk_pixbuf_save_to_buffer(pixbuf, &buffer, &length, "jpeg", NULL, "quality", strQuality, NULL);
+    g_object_unref(pixbuf);
+
+    if (!success)
+        return false;
+
+    jpeg.assign((unsigned char*) buffer, (unsigned char*) buffer + length);
+    g_free(buffer);
+
+    return true;
+}
+
+//
+// Decodes, scales and encodes an image. Called on a conversion thread.
+//
+static void ConvertImageJob(ConversionJob& job, const ImageUtil::ImageConversionOptions& options)
+{
+    bool isJPEG = options.format == TEXT("jpeg") || options.format == TEXT("jpg");
+    if (!isJPEG && options.format != TEXT("png"))
+    {
+        job.error.SetError(ERR_INVALID_ARGUMENT, TEXT("Unsupported image format: ") + options.format);
+        return;
+    }
+
+    GdkPixbuf* pixbuf = DecodeImage(job);
+    if (pixbuf == NULL)
+        return;
+
+    int width = gdk_pixbuf_get_width(pixbuf);
+    int height = gdk_pixbuf_get_height(pixbuf);
+    bool hasAlpha = gdk_pixbuf_get_has_alpha(pixbuf) != FALSE;
+
+    double scale = 1;
+    if (options.maxWidth > 0 && width > options.maxWidth)
+        scale = (double) options.maxWidth / width;
+    if (options.maxHeight > 0 && height * scale > options.maxHeight)
+        scale = (double) options.maxHeight / height;
+
+    int targetWidth = std::max(1, (int) (width * scale + 0.5));
+    int targetHeight = std::max(1, (int) (height * scale + 0.5));
+    bool isScaled = targetWidth != width || targetHeight != height;
+
+    // the alpha is premultiplied for scaling, so the colors of transparent
+    // pixels don't bleed into their neighbors
+    bool isPremultiplied = hasAlpha && isScaled;
+
+    std::vector<unsigned char> image((size_t) width * height * 4);
+    int numChannels = gdk_pixbuf_get_n_channels(pixbuf);
+    int stride = gdk_pixbuf_get_rowstride(pixbuf);
+    const guchar* pixels = gdk_pixbuf_get_pixels(pixbuf);
+
+    for (int y = 0; y < height; ++y)
+    {
+        const guchar* src = pixels + (size_t) y * stride;
+        unsigned char* dst = &image[(size_t) y * width * 4];
+
+        for (int x = 0; x < width; ++x, src += numChannels, dst += 4)
+        {
+            int alpha = hasAlpha ? src[3] : 255;
+            for (int c = 0; c < 3; ++c)
+                dst[c] = isPremultiplied ? (unsigned char) ((src[c] * alpha + 127) / 255) : src[c];
+            dst[3] = (unsigned char) alpha;
+        }
+    }
+
+    g_object_unref(pixbuf);
+
+    if (isScaled)
+    {
+        std::vector<unsigned char> scaledImage((size_t) targetWidth * targetHeight * 4);
+        ImageUtil::Resample(&image[0], width, height, &scaledImage[0], targetWidth, targetHeight, ImageUtil::RESAMPLE_LANCZOS3);
+        image.swap(scaledImage);
+    }
+
+    job.width = targetWidth;
+    job.height = targetHeight;
+
+    std::vector<unsigned char> encoded;
+    bool success;
+    if (isJPEG)
+        success = EncodeJPEG(image, targetWidth, targetHeight, isPremultiplied, options.quality, encoded);
+    else
+    {
+        if (isPremultiplied)
+        {
+            for (size_t i = 0; i < image.size(); i += 4)
+            {
+                int alpha = image[i + 3];
+                for (int c = 0; c < 3; ++c)
+                    image[i + c] = alpha == 0 ? 0 : (unsigned char) std::min(255, (image[i + c] * 255 + alpha / 2) / alpha);
+            }
+        }
+
+        success = ImageUtil::EncodePNG(&image[0], targetWidth, targetHeight, hasAlpha, IMAGE_PNG_COMPRESSION_LEVEL, ImageUtil::PNG_FILTER_ADAPTIVE, encoded);
+    }
+
+    if (!success || encoded.size() == 0)
+    {
+        job.error.SetError(ERR_UNKNOWN, TEXT("The image couldn't be encoded"));
+        return;
+    }
+
+    if (job.outputPath.length() > 0)
+    {
+        errno = 0;
+        bool isWritten = false;
+
+        std::ofstream file(job.outputPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (file.is_open())
+        {
+            file.write((const char*) &encoded[0], encoded.size());
+            file.close();
+            isWritten = !file.fail();
+        }
+
+        if (!isWritten)
+        {
+            job.error.FromErrno();
+            if (job.error.GetCode() == ERR_OK)
+                job.error.SetError(ERR_UNKNOWN, TEXT("The image couldn't be written"));
+        }
+    }
+    else
+    {
+        job.dataURL = String(isJPEG ? TEXT("data:image/jpeg;base64,") : TEXT("data:image/png;base64,")) +
+            ImageUtil::Base64Encode((char*) &encoded[0], encoded.size());
+    }
+}
+
+//
+// Passes the results of a batch to its callback. Called on the UI thread.
+//
+static void FinishConversionBatch(ConversionBatch* batch)
+{
+    Zephyros::JavaScript::Array args = Zephyros::JavaScript::CreateArray();
+
+    if (batch->isSingleImage)
+        args->SetString(0, batch->jobs[0].dataURL);
+    else
+    {
+        Zephyros::JavaScript::Array results = Zephyros::JavaScript::CreateArray();
+        for (size_t i = 0; i < batch->jobs.size(); ++i)
+        {
+            ConversionJob& job = batch->jobs[i];
+            Zephyros::JavaScript::Object result = Zephyros::JavaScript::CreateObject();
+
+            result->SetString(TEXT("path"), job.path);
+            if (job.error.GetCode() != ERR_OK)
+                result->SetDictionary(TEXT("error"), job.error.CreateJSRepresentation());
+            else
+                result->SetNull(TEXT("error"));
+            result->SetInt(TEXT("width"), job.width);
+            result->SetInt(TEXT("height"), job.height);
+            result->SetString(TEXT("data"), job.dataURL);
+            result->SetString(TEXT("outputPath"), job.error.GetCode() == ERR_OK ? job.outputPath : TEXT(""));
+
+            results->SetDictionary((int) i, result);
+        }
+
+        args->SetList(0, results);
+    }
+
+    g_handler->GetClientExtensionHandler()->InvokeCallback(batch->callback, args);
+    delete batch;
+}
+
+static void* RunConversionThread(void* arg)
+{
+    pthread_mutex_lock(&g_conversionMutex);
+
+    for ( ; ; )
+    {
+        if (g_conversionQueue.empty())
+        {
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += IMAGE_CONVERSION_IDLE_TIMEOUT;
+
+            int ret = 0;
+            g_numIdleConversionThreads++;
+            while (g_conversionQueue.empty() && ret != ETIMEDOUT)
+                ret = pthread_cond_timedwait(&g_conversionCond, &g_conversionMutex, &deadline);
+            g_numIdleConversionThreads--;
+
+            if (g_conversionQueue.empty())
+                break;
+        }
+
+        ConversionQueueItem item = g_conversionQueue.front();
+        g_conversionQueue.pop_front();
+        pthread_mutex_unlock(&g_conversionMutex);
+
+        ConversionBatch* batch = item.batch;
+        if (batch == NULL)
+        {
+            item.task.Run();
+            item.task.Reset();
+
+            pthread_mutex_lock(&g_conversionMutex);
+            continue;
+        }
+
+        ConvertImageJob(batch->jobs[item.index], batch->options);
+
+        pthread_mutex_lock(&g_conversionMutex);
+        if (--batch->numPending == 0)
+            CefPostTask(TID_UI, base::Bind(&FinishConversionBatch, batch));
+    }
+
+    g_numConversionThreads--;
+    pthread_mutex_unlock(&g_conversionMutex);
+
+    return NULL;
+}
+
+//
+// Starts conversion threads unless enough of them are idle to process the
+// queue. Returns false if no thread is running. Called with
+// g_conversionMutex held.
+//
+static bool StartConversionThreads()
+{
+    long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = (int) std::max(1L, std::min(numProcessors, (long) IMAGE_CONVERSION_MAX_THREADS));
+
+    int numThreadsNeeded = (int) g_conversionQueue.size() - g_numIdleConversionThreads;
+    while (numThreadsNeeded > 0 && g_numConversionThreads < maxThreads)
+    {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int ret = pthread_create(&thread, &attr, RunConversionThread, NULL);
+        pthread_attr_destroy(&attr);
+
+        if (ret != 0)
+            break;
+
+        g_numConversionThreads++;
+        numThreadsNeeded--;
+    }
+
+    pthread_cond_broadcast(&g_conversionCond);
+    return g_numConversionThreads > 0;
+}
+
+//
+// Queues the jobs of a batch and starts conversion threads unless enough
+// of them are idle.
+//
+static void StartConversionBatch(ConversionBatch* batch)
+{
+    batch->numPending = batch->jobs.size();
+    if (batch->numPending == 0)
+    {
+        FinishConversionBatch(batch);
+        return;
+    }
+
+    pthread_mutex_lock(&g_conversionMutex);
+
+    for (size_t i = 0; i < batch->jobs.size(); ++i)
+    {
+        ConversionQueueItem item;
+        item.batch = batch;
+        item.index = i;
+        g_conversionQueue.push_back(item);
+    }
+
+    if (!StartConversionThreads())
+    {
+        // no thread could be created; without any running threads, the
+        // queue only holds this batch, so convert the images here
+        g_conversionQueue.clear();
+        pthread_mutex_unlock(&g_conversionMutex);
+
+        for (size_t i = 0; i < batch->jobs.size(); ++i)
+            ConvertImageJob(batch->jobs[i], batch->options);
+
+        FinishConversionBatch(batch);
+        return;
+    }
+
+    pthread_mutex_unlock(&g_conversionMutex);
+}
+
+static ConversionJob CreateConversionJob()
+{
+    ConversionJob job;
+    job.width = 0;
+    job.height = 0;
+    return job;
+}
+
+
 namespace ImageUtil {
 
 /**
@@ -47,5 +519,127 @@ String Base64Encode(char* data, size_t length)
     return res;
 }
 
+/**
+ * Scales a BGRA image and encodes it as a PNG.
+ */
+bool BGRAToPNG(const unsigned char* pixels, int width, int height, int targetWidth, int targetHeight, std::vector<unsigned char>& png)
+{
+    png.clear();
+    if (width <= 0 || height <= 0 || targetWidth <= 0 || targetHeight <= 0)
+        return false;
+
+    std::vector<unsigned char> image((size_t) targetWidth * targetHeight * 4);
+    if (!Resample(pixels, width, height, &image[0], targetWidth, targetHeight, RESAMPLE_LANCZOS3))
+        return false;
+    SwizzleBGRAToRGBA(&image[0], &image[0], (size_t) targetWidth * targetHeight);
+
+    // the alpha channel is dropped, pages are opaque
+    return EncodePNG(&image[0], targetWidth, targetHeight, false, IMAGE_PNG_COMPRESSION_LEVEL, PNG_FILTER_ADAPTIVE, png);
+}
+
+/**
+ * Scales a BGRA image and encodes it as a PNG data URL.
+ */
+String BGRAToPNGDataURL(const unsigned char* pixels, int width, int height, int targetWidth, int targetHeight)
+{
+    std::vector<unsigned char> png;
+    if (!BGRAToPNG(pixels, width, height, targetWidth, targetHeight, png))
+        return "";
+
+    return "data:image/png;base64," + Base64Encode((char*) &png[0], png.size());
+}
+
+/**
+ * Converts base64-encoded image data to a PNG data URL asynchronously.
+ */
+void ConvertImage(CallbackId callback, String imageData)
+{
+    ConversionBatch* batch = new ConversionBatch;
+    batch->callback = callback;
+    batch->isSingleImage = true;
+    batch->options.format = TEXT("png");
+    batch->options.maxWidth = 0;
+    batch->options.maxHeight = 0;
+    batch->options.quality = 0;
+
+    ConversionJob job = CreateConversionJob();
+    job.base64Data = imageData;
+    batch->jobs.push_back(job);
+
+    StartConversionBatch(batch);
+}
+
+/**
+ * Converts image files on the conversion threads. If the images are written
+ * to an output directory, they are named after the source files.
+ */
+void ConvertImages(CallbackId callback, std::vector<String> paths, const ImageConversionOptions& options)
+{
+    ConversionBatch* batch = new ConversionBatch;
+    batch->callback = callback;
+    batch->isSingleImage = false;
+    batch->options = options;
+
+    String extension = options.format == TEXT("jpeg") || options.format == TEXT("jpg") ? TEXT(".jpg") : TEXT(".png");
+    std::set<String> outputNames;
+
+    for (String path : paths)
+    {
+        ConversionJob job = CreateConversionJob();
+        job.path = path;
+
+        if (options.outputDirectory.length() > 0)
+        {
+            size_t pos = path.find_last_of(TEXT('/'));
+            String name = pos == String::npos ? path : path.substr(pos + 1);
+            pos = name.find_last_of(TEXT('.'));
+            if (pos != String::npos && pos > 0)
+                name = name.substr(0, pos);
+
+            // don't let images with the same name overwrite each other
+            String outputName = name;
+            for (int i = 1; outputNames.find(outputName) != outputNames.end(); ++i)
+            {
+                StringStream ss;
+                ss << name << TEXT("-") << i;
+                outputName = ss.str();
+            }
+            outputNames.insert(outputName);
+
+            job.outputPath = options.outputDirectory + TEXT("/") + outputName + extension;
+        }
+
+        batch->jobs.push_back(job);
+    }
+
+    StartConversionBatch(batch);
+}
+
+/**
+ * Runs a task on one of the conversion threads, or on the calling thread
+ * if no conversion thread can be created.
+ */
+void PostConversionTask(const base::Closure& task)
+{
+    pthread_mutex_lock(&g_conversionMutex);
+
+    ConversionQueueItem item;
+    item.batch = NULL;
+    item.index = 0;
+    item.task = task;
+    g_conversionQueue.push_back(item);
+
+    if (!StartConversionThreads())
+    {
+        g_conversionQueue.clear();
+        pthread_mutex_unlock(&g_conversionMutex);
+
+        task.Run();
+        return;
+    }
+
+    pthread_mutex_unlock(&g_conversionMutex);
+}
+
 
 } // namespace ImageUtil
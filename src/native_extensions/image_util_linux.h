@@ -29,7 +29,10 @@
 #define Zephyros_ImageUtilLinux_h
 
 
+#include <vector>
+
 #include "include/cef_base.h"
+#include "include/base/cef_callback.h"
 #include "base/types.h"
 
 
@@ -37,6 +40,43 @@ namespace ImageUtil {
 
 String Base64Encode(char* data, size_t length);
 
+// Scales a BGRA image to targetWidth x targetHeight and encodes it as an RGB PNG
+bool BGRAToPNG(const unsigned char* pixels, int width, int height, int targetWidth, int targetHeight, std::vector<unsigned char>& png);
+
+// Scales a BGRA image to targetWidth x targetHeight and returns it as
+// a PNG data URL, or an empty string if it couldn't be encoded
+String BGRAToPNGDataURL(const unsigned char* pixels, int width, int height, int targetWidth, int targetHeight);
+
+// How images are converted (cf. IImageConversionOptions)
+typedef struct
+{
+    // "png" or "jpeg"
+    String format;
+
+    // the maximum size of the converted images, or 0; the aspect ratio is kept
+    int maxWidth;
+    int maxHeight;
+
+    // the quality of JPEG images, from 0 to 100
+    int quality;
+
+    // if not empty, the images are written to files in this directory
+    // instead of being returned as data URLs
+    String outputDirectory;
+} ImageConversionOptions;
+
+// Converts base64-encoded image data (or a data URL) to a PNG data URL and
+// passes it to "callback", or an empty string if the image couldn't be decoded.
+void ConvertImage(CallbackId callback, String imageData);
+
+// Converts the image files "paths" in parallel and passes the results
+// (cf. IConvertedImage) to "callback".
+void ConvertImages(CallbackId callback, std::vector<String> paths, const ImageConversionOptions& options);
+
+// Runs "task" on one of the image conversion threads, e.g. to encode images
+// without blocking the UI thread.
+void PostConversionTask(const base::Closure& task);
+
 } // namespace ImageUtil
 
 
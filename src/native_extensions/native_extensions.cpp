@@ -32,11 +32,13 @@
 #include "base/types.h"
 
 #ifdef USE_CEF
+#include "base/cef/api_scheme_handler.h"
 #include "base/cef/client_handler.h"
 #include "base/cef/extension_handler.h"
 #endif
 
 #include "native_extensions/browser.h"
+#include "native_extensions/child_process.h"
 #include "native_extensions/custom_url_manager.h"
 #include "native_extensions/file_util.h"
 #include "native_extensions/file_watcher.h"
@@ -44,11 +46,17 @@
 #include "native_extensions/os_util.h"
 #include "native_extensions/pageimage.h"
 #include "native_extensions/path.h"
+#include "native_extensions/process_pool.h"
 
 #ifdef OS_MACOSX
 #include "native_extensions/image_util_mac.h"
 #endif
 
+#ifdef OS_LINUX
+#include "native_extensions/download_linux.h"
+#include "native_extensions/image_util_linux.h"
+#endif
+
 #ifndef APPSTORE
 #include "native_extensions/updater.h"
 #endif
@@ -75,15 +83,19 @@ void NativeExtensions::SetClientExtensionHandler(ClientExtensionHandlerPtr e)
 
 
 DefaultNativeExtensions::DefaultNativeExtensions()
-    : m_pBrowsers(NULL)
+    : m_nextFileWatcherHandle(0), m_nextProcessHandle(0), m_nextProcessPoolHandle(0), m_pBrowsers(NULL)
 {
-    m_fileWatcher = new FileWatcher();
     m_customURLManager = new CustomURLManager();
 }
 
 DefaultNativeExtensions::~DefaultNativeExtensions()
 {
-    delete m_fileWatcher;
+    for (std::map<int, FileWatcher*>::iterator it = m_fileWatchers.begin(); it != m_fileWatchers.end(); ++it)
+        delete it->second;
+    for (std::map<int, ChildProcess*>::iterator it = m_processes.begin(); it != m_processes.end(); ++it)
+        delete it->second;
+    for (std::map<int, ProcessPool*>::iterator it = m_processPools.begin(); it != m_processPools.end(); ++it)
+        delete it->second;
     delete m_customURLManager;
 
     if (m_pBrowsers)
@@ -156,6 +168,24 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
         }
     ));
     
+    // onProcessEvent: (callback: (events: IProcessEvent[]) => void) => void
+    e->AddNativeJavaScriptCallback(
+        TEXT("onProcessEvent"),
+        FUNC({
+            // only register callback
+            return NO_ERROR;
+        }
+    ));
+
+    // onDownloadEvent: (callback: (events: IDownloadEvent[]) => void) => void
+    e->AddNativeJavaScriptCallback(
+        TEXT("onDownloadEvent"),
+        FUNC({
+            // only register callback
+            return NO_ERROR;
+        }
+    ));
+
     // onLicenseChanged: (callback: (data: ILicenseData) => void) => void
     e->AddNativeJavaScriptCallback(
         TEXT("onLicenseChanged"),
@@ -269,6 +299,13 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
     // getBrowsers: (callback: (browsers: IBrowser[]) => void) => void
     e->AddNativeJavaScriptFunction(
         TEXT("getBrowsers"),
+#ifdef OS_LINUX
+        FUNC({
+            // the browsers' versions are probed on the file thread
+            Zephyros::BrowserUtil::FindBrowsersAsync(&((DefaultNativeExtensions*) Zephyros::GetNativeExtensions())->m_pBrowsers, callback, false);
+            return RET_DELAYED_CALLBACK;
+        })
+#else
         FUNC({
             JavaScript::Array browsers = JavaScript::CreateArray();
             int i = 0;
@@ -277,21 +314,31 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
                 browsers->SetDictionary(i++, pBrowser->CreateJSRepresentation());
             ret->SetList(0, browsers);
             return NO_ERROR;
-        }
-    ));
+        })
+#endif
+    );
 
     // getDefaultBrowser: (callback: (browser: IBrowser) => void) => void
     e->AddNativeJavaScriptFunction(
         TEXT("getDefaultBrowser"),
+#ifdef OS_LINUX
+        FUNC({
+            Zephyros::BrowserUtil::FindBrowsersAsync(&((DefaultNativeExtensions*) Zephyros::GetNativeExtensions())->m_pBrowsers, callback, true);
+            return RET_DELAYED_CALLBACK;
+        })
+#else
         FUNC({
+            // find the browsers once, not on every call
+            Zephyros::BrowserUtil::FindBrowsers(&((DefaultNativeExtensions*) Zephyros::GetNativeExtensions())->m_pBrowsers);
             Browser* defaultBrowser = Zephyros::BrowserUtil::GetDefaultBrowser(((DefaultNativeExtensions*) Zephyros::GetNativeExtensions())->m_pBrowsers);
             if (defaultBrowser != NULL)
                 ret->SetDictionary(0, defaultBrowser->CreateJSRepresentation());
             else
                 ret->SetNull(0);
             return NO_ERROR;
-        }
-    ));
+        })
+#endif
+    );
 
     // getBrowserForUserAgent: (userAgent: IUserAgent, callback: (browser: IBrowser) => void) => void
     e->AddNativeJavaScriptFunction(
@@ -516,7 +563,7 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
         ARG(VTYPE_DICTIONARY, "path")
     ));
 
-    // readFile: (path: IPath, options: IReadFileOptions, callback: (err: Error, contents: string) => void) => void
+    // readFile: (path: IPath, options: IReadFileOptions, callback: (err: Error, contents: string, encoding: string) => void) => void
     e->AddNativeJavaScriptFunction(
         TEXT("readFile"),
         FUNC({
@@ -526,17 +573,20 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
             if (FileUtil::StartAccessingPath(path, errStartAccessingPath))
             {
                 String result;
+                String encoding;
                 Error errReadFile;
                 
-                if (FileUtil::ReadFile(path.GetPath(), args->GetDictionary(1), result, errReadFile))
+                if (FileUtil::ReadFile(path.GetPath(), args->GetDictionary(1), result, encoding, errReadFile))
                 {
                     ret->SetNull(0);
                     ret->SetString(1, result);
+                    ret->SetString(2, encoding);
                 }
                 else
                 {
                     ret->SetDictionary(0, errReadFile.CreateJSRepresentation());
                     ret->SetNull(1);
+                    ret->SetNull(2);
                 }
 
                 FileUtil::StopAccessingPath(path);
@@ -545,6 +595,7 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
             {
                 ret->SetDictionary(0, errStartAccessingPath.CreateJSRepresentation());
                 ret->SetNull(1);
+                ret->SetNull(2);
             }
 
             return NO_ERROR;
@@ -553,6 +604,32 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
         ARG(VTYPE_DICTIONARY, "options")
     ));
 
+#ifdef USE_CEF
+    // GET zephyros://api/readFile?path=<IPath JSON>: streams the raw contents of the file
+    e->AddNativeDataFunction(
+        TEXT("readFile"),
+        DATA_FUNC({
+            if (args->GetType(0) != VTYPE_DICTIONARY)
+            {
+                err.SetError(ERR_INVALID_ARGUMENT, TEXT("Missing argument path"));
+                return false;
+            }
+
+            Path path(args->GetDictionary(0));
+            if (!FileUtil::StartAccessingPath(path, err))
+                return false;
+
+            CefRefPtr<FileDataStream> stream = new FileDataStream();
+            bool ret = stream->Open(path.GetPath(), err);
+            if (ret)
+                response = stream.get();
+
+            FileUtil::StopAccessingPath(path);
+            return ret;
+        })
+    );
+#endif
+
     // writeFile: (path: IPath, contents: String, options: IWriteFileOptions, callback(err: Error) => void) => void
     e->AddNativeJavaScriptFunction(
         TEXT("writeFile"),
@@ -581,6 +658,28 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
         ARG(VTYPE_DICTIONARY, "options")
     ));
 
+#ifdef USE_CEF
+    // POST zephyros://api/writeFile?path=<IPath JSON>: writes the request body to the file
+    e->AddNativeDataFunction(
+        TEXT("writeFile"),
+        DATA_FUNC({
+            if (args->GetType(0) != VTYPE_DICTIONARY)
+            {
+                err.SetError(ERR_INVALID_ARGUMENT, TEXT("Missing argument path"));
+                return false;
+            }
+
+            Path path(args->GetDictionary(0));
+            if (!FileUtil::StartAccessingPath(path, err))
+                return false;
+
+            bool ret = WriteRequestBody(body, path.GetPath(), err);
+            FileUtil::StopAccessingPath(path);
+            return ret;
+        })
+    );
+#endif
+
     // existsFile: (path: IPath, callback(exists: boolean) => void) => void
     e->AddNativeJavaScriptFunction(
         TEXT("existsFile"),
@@ -808,8 +907,8 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
     ));
 
 
-    // startWatchingFiles: (path: string, fileExtensions: string[]) => void
-    e->AddNativeJavaScriptProcedure(
+    // startWatchingFiles: (path: string, fileExtensions: string[], delay: number, options?: IFileWatcherOptions, callback?: (handle: number) => void) => void
+    e->AddNativeJavaScriptFunction(
         TEXT("startWatchingFiles"),
         FUNC({
             std::vector<String> fileExtensions;
@@ -817,21 +916,92 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
             for (size_t i = 0; i < listFileExtensions->GetSize(); ++i)
                 fileExtensions.push_back(listFileExtensions->GetString((int) i));
             Path path(args->GetDictionary(0));
-            ((DefaultNativeExtensions*) Zephyros::GetNativeExtensions())->m_fileWatcher->Start(path, fileExtensions, args->GetDouble(2));
+
+            // gitignore-style glob patterns
+            std::vector<String> includePatterns;
+            std::vector<String> ignorePatterns;
+            JavaScript::Object options = args->GetDictionary(3);
+            if (options->HasKey(TEXT("include")))
+            {
+                JavaScript::Array listPatterns = options->GetList(TEXT("include"));
+                for (size_t i = 0; i < listPatterns->GetSize(); ++i)
+                    includePatterns.push_back(listPatterns->GetString((int) i));
+            }
+            if (options->HasKey(TEXT("ignore")))
+            {
+                JavaScript::Array listPatterns = options->GetList(TEXT("ignore"));
+                for (size_t i = 0; i < listPatterns->GetSize(); ++i)
+                    ignorePatterns.push_back(listPatterns->GetString((int) i));
+            }
+
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            FileWatcher* fileWatcher = new FileWatcher();
+            fileWatcher->m_handle = ++extensions->m_nextFileWatcherHandle;
+            extensions->m_fileWatchers[fileWatcher->m_handle] = fileWatcher;
+            fileWatcher->Start(path, new FileFilter(fileExtensions, includePatterns, ignorePatterns), args->GetDouble(2));
+
+            ret->SetInt(0, fileWatcher->m_handle);
             return NO_ERROR;
         },
         ARG(VTYPE_DICTIONARY, "path")
         ARG(VTYPE_LIST, "fileExtensions")
         ARG(VTYPE_DOUBLE, "delay")
-    ));
+        ARG(VTYPE_DICTIONARY, "options")),
+        true, false,
+        TEXT("if (typeof options === 'function') { callback = options; options = undefined; } return callback ? startWatchingFiles(path, fileExtensions, delay, options || {}, callback) : startWatchingFiles(path, fileExtensions, delay, options || {});")
+    );
 
-    // stopWatchingFiles: () => void
+    // stopWatchingFiles: (handle?: number) => void
     e->AddNativeJavaScriptProcedure(
         TEXT("stopWatchingFiles"),
         FUNC({
-            ((DefaultNativeExtensions*) Zephyros::GetNativeExtensions())->m_fileWatcher->Stop();
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            int handle = (int) args->GetDouble(0);
+
+            // a negative handle stops all watchers
+            for (std::map<int, FileWatcher*>::iterator it = extensions->m_fileWatchers.begin(); it != extensions->m_fileWatchers.end(); )
+            {
+                if (handle < 0 || it->first == handle)
+                {
+                    delete it->second;
+                    extensions->m_fileWatchers.erase(it++);
+                }
+                else
+                    ++it;
+            }
+
             return NO_ERROR;
-        }
+        },
+        ARG(VTYPE_DOUBLE, "handle")),
+        TEXT("return stopWatchingFiles(handle === undefined ? -1 : handle);")
+    );
+
+    // getFileWatcherStatus: (handle: number, callback: (status: IFileWatcherStatus) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("getFileWatcherStatus"),
+        FUNC({
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            int handle = (int) args->GetDouble(0);
+
+            if (extensions->m_fileWatchers.find(handle) != extensions->m_fileWatchers.end())
+            {
+                FileWatcherStatus status;
+                extensions->m_fileWatchers[handle]->GetStatus(status);
+
+                JavaScript::Object info = JavaScript::CreateObject();
+                info->SetBool(TEXT("isScanning"), status.isScanning);
+                info->SetInt(TEXT("watchedDirectories"), status.numWatchedDirectories);
+                info->SetInt(TEXT("polledDirectories"), status.numPolledDirectories);
+                info->SetInt(TEXT("watches"), status.numWatches);
+                info->SetInt(TEXT("maxWatches"), status.maxWatches);
+                ret->SetDictionary(0, info);
+            }
+            else
+                ret->SetNull(0);
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_DOUBLE, "handle")
     ));
 
     // getApplicationResourcesDirectory: (callback: (path: IPath) => void) => void
@@ -845,7 +1015,7 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
         }
     ));
 
-    // startProcess: (executablePath: string, arguments: string[], cwd: string, callback: (exitCode: number, output: IOutputStreamData[]) => void) => void
+    // startProcess: (executablePath: string, arguments: string[], cwd: string, options?: IProcessOptions, callback: (err: IError, exitCode: number, output: IOutputStreamData[], usage: IProcessUsage) => void) => void
     e->AddNativeJavaScriptFunction(
         TEXT("startProcess"),
         FUNC({
@@ -856,19 +1026,223 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
                 arguments.push_back(listArgs->GetString((int) i));
 
             Error err;
-            if (OSUtil::StartProcess(callback, args->GetString(0), arguments, args->GetString(2), err))
+            if (OSUtil::StartProcess(callback, args->GetString(0), arguments, args->GetString(2), ProcessOptions(args->GetDictionary(3)), err))
                 return RET_DELAYED_CALLBACK;
         
             // process couldn't be started, set the error and invoke the callback immediately
             ret->SetDictionary(0, err.CreateJSRepresentation());
             ret->SetNull(1);
             ret->SetNull(2);
+            ret->SetNull(3);
 
             return NO_ERROR;
         }
         ARG(VTYPE_STRING, "executablePath")
         ARG(VTYPE_LIST, "arguments")
         ARG(VTYPE_STRING, "cwd")
+        ARG(VTYPE_DICTIONARY, "options")),
+        true, false,
+        TEXT("if (typeof options === 'function') { callback = options; options = undefined; } return startProcess(executablePath, arguments, cwd, options || {}, callback);")
+    );
+
+    // spawnProcess: (executablePath: string, arguments: string[], cwd: string, options?: IProcessOptions, callback: (err: IError, handle: number) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("spawnProcess"),
+        FUNC({
+            std::vector<String> arguments;
+            JavaScript::Array listArgs = args->GetList(1);
+
+            for (size_t i = 0; i < listArgs->GetSize(); ++i)
+                arguments.push_back(listArgs->GetString((int) i));
+
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            ChildProcess* process = new ChildProcess();
+            process->m_handle = ++extensions->m_nextProcessHandle;
+
+            Error err;
+            if (!process->Start(args->GetString(0), arguments, args->GetString(2), ProcessOptions(args->GetDictionary(3)), err))
+            {
+                delete process;
+                ret->SetDictionary(0, err.CreateJSRepresentation());
+                ret->SetNull(1);
+                return NO_ERROR;
+            }
+
+            // the output and the exit code are reported to the "onProcessEvent" callbacks
+            extensions->m_processes[process->m_handle] = process;
+            ret->SetNull(0);
+            ret->SetInt(1, process->m_handle);
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_STRING, "executablePath")
+        ARG(VTYPE_LIST, "arguments")
+        ARG(VTYPE_STRING, "cwd")
+        ARG(VTYPE_DICTIONARY, "options")),
+        true, false,
+        TEXT("if (typeof options === 'function') { callback = options; options = undefined; } return spawnProcess(executablePath, arguments, cwd, options || {}, callback);")
+    );
+
+    // writeProcessInput: (handle: number, data: string) => void
+    e->AddNativeJavaScriptProcedure(
+        TEXT("writeProcessInput"),
+        FUNC({
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            int handle = (int) args->GetDouble(0);
+
+            if (extensions->m_processes.find(handle) != extensions->m_processes.end())
+                extensions->m_processes[handle]->WriteInput(args->GetString(1));
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_DOUBLE, "handle")
+        ARG(VTYPE_STRING, "data")
+    ));
+
+    // closeProcessInput: (handle: number) => void
+    e->AddNativeJavaScriptProcedure(
+        TEXT("closeProcessInput"),
+        FUNC({
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            int handle = (int) args->GetDouble(0);
+
+            if (extensions->m_processes.find(handle) != extensions->m_processes.end())
+                extensions->m_processes[handle]->CloseInput();
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_DOUBLE, "handle")
+    ));
+
+    // killProcess: (handle: number, signal?: string) => void
+    e->AddNativeJavaScriptProcedure(
+        TEXT("killProcess"),
+        FUNC({
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            int handle = (int) args->GetDouble(0);
+
+            // the exit is reported to the "onProcessEvent" callbacks
+            if (extensions->m_processes.find(handle) != extensions->m_processes.end())
+                extensions->m_processes[handle]->Kill(args->GetString(1));
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_DOUBLE, "handle")
+        ARG(VTYPE_STRING, "signal")),
+        TEXT("return killProcess(handle, signal || 'SIGTERM');")
+    );
+
+    // createProcessPool: (executablePath: string, arguments: string[], cwd: string, numWorkers: number, callback: (err: IError, handle: number) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("createProcessPool"),
+        FUNC({
+            std::vector<String> arguments;
+            JavaScript::Array listArgs = args->GetList(1);
+
+            for (size_t i = 0; i < listArgs->GetSize(); ++i)
+                arguments.push_back(listArgs->GetString((int) i));
+
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            ProcessPool* pool = new ProcessPool(args->GetString(0), arguments, args->GetString(2), (int) args->GetDouble(3));
+            pool->m_handle = ++extensions->m_nextProcessPoolHandle;
+            extensions->m_processPools[pool->m_handle] = pool;
+
+            Error err;
+            if (!pool->Start(err))
+            {
+                extensions->m_processPools.erase(pool->m_handle);
+                delete pool;
+
+                ret->SetDictionary(0, err.CreateJSRepresentation());
+                ret->SetNull(1);
+                return NO_ERROR;
+            }
+
+            ret->SetNull(0);
+            ret->SetInt(1, pool->m_handle);
+            return NO_ERROR;
+        },
+        ARG(VTYPE_STRING, "executablePath")
+        ARG(VTYPE_LIST, "arguments")
+        ARG(VTYPE_STRING, "cwd")
+        ARG(VTYPE_DOUBLE, "numWorkers")
+    ));
+
+    // sendToProcessPool: (handle: number, data: string, callback: (err: IError, response: string) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("sendToProcessPool"),
+        FUNC({
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            int handle = (int) args->GetDouble(0);
+
+            if (extensions->m_processPools.find(handle) != extensions->m_processPools.end())
+            {
+                // the callback is invoked when a worker has responded
+                extensions->m_processPools[handle]->Send(callback, args->GetString(1));
+                return RET_DELAYED_CALLBACK;
+            }
+
+            Error err;
+            err.SetError(ERR_INVALID_ARGUMENT, TEXT("There is no process pool with this handle"));
+            ret->SetDictionary(0, err.CreateJSRepresentation());
+            ret->SetNull(1);
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_DOUBLE, "handle")
+        ARG(VTYPE_STRING, "data")
+    ));
+
+    // getProcessPoolStatus: (handle: number, callback: (status: IProcessPoolStatus) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("getProcessPoolStatus"),
+        FUNC({
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            int handle = (int) args->GetDouble(0);
+
+            if (extensions->m_processPools.find(handle) != extensions->m_processPools.end())
+            {
+                ProcessPoolStatus status;
+                extensions->m_processPools[handle]->GetStatus(status);
+
+                JavaScript::Object info = JavaScript::CreateObject();
+                info->SetInt(TEXT("workers"), status.numWorkers);
+                info->SetInt(TEXT("runningWorkers"), status.numRunningWorkers);
+                info->SetInt(TEXT("busyWorkers"), status.numBusyWorkers);
+                info->SetInt(TEXT("queuedRequests"), status.numQueuedRequests);
+                info->SetInt(TEXT("maxQueuedRequests"), status.maxQueuedRequests);
+                info->SetInt(TEXT("completedRequests"), status.numCompletedRequests);
+                info->SetInt(TEXT("failedRequests"), status.numFailedRequests);
+                info->SetInt(TEXT("restarts"), status.numRestarts);
+                info->SetDouble(TEXT("averageQueueTime"), status.averageQueueTime);
+                info->SetDouble(TEXT("averageLatency"), status.averageLatency);
+                info->SetDouble(TEXT("maxLatency"), status.maxLatency);
+                ret->SetDictionary(0, info);
+            }
+            else
+                ret->SetNull(0);
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_DOUBLE, "handle")
+    ));
+
+    // destroyProcessPool: (handle: number) => void
+    e->AddNativeJavaScriptProcedure(
+        TEXT("destroyProcessPool"),
+        FUNC({
+            DefaultNativeExtensions* extensions = (DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+            int handle = (int) args->GetDouble(0);
+
+            if (extensions->m_processPools.find(handle) != extensions->m_processPools.end())
+            {
+                delete extensions->m_processPools[handle];
+                extensions->m_processPools.erase(handle);
+            }
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_DOUBLE, "handle")
     ));
 
 
@@ -988,7 +1362,7 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
         ARG(VTYPE_STRING, "url")
     ));
 
-#ifdef USE_WEBVIEW
+#if defined(USE_WEBVIEW) || defined(OS_LINUX)
     // mimicks the Zepto ajax function
     // Syntax:
     // app.ajax(options),
@@ -1031,6 +1405,44 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
     );
 #endif
 
+#ifdef OS_LINUX
+    // download: (url: string, destPath: string, options?: IDownloadOptions, callback: (err: Error, handle: number) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("download"),
+        FUNC({
+            Error err;
+            int handle = DownloadManager::Start(args->GetString(0), args->GetString(1), DownloadOptions(args->GetDictionary(2)), err);
+            if (handle == 0)
+            {
+                ret->SetDictionary(0, err.CreateJSRepresentation());
+                ret->SetNull(1);
+                return NO_ERROR;
+            }
+
+            // the progress and the completion are reported to the "onDownloadEvent" callbacks
+            ret->SetNull(0);
+            ret->SetInt(1, handle);
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_STRING, "url")
+        ARG(VTYPE_STRING, "destPath")
+        ARG(VTYPE_DICTIONARY, "options")),
+        true, false,
+        TEXT("if (typeof options === 'function') { callback = options; options = undefined; } return download(url, destPath, options || {}, callback);")
+    );
+
+    // cancelDownload: (handle: number) => void
+    e->AddNativeJavaScriptProcedure(
+        TEXT("cancelDownload"),
+        FUNC({
+            DownloadManager::Cancel((int) args->GetDouble(0));
+            return NO_ERROR;
+        },
+        ARG(VTYPE_DOUBLE, "handle")
+    ));
+#endif
+
 #ifdef OS_MACOSX
     // convertImage: (base64ImageData: string, callback: (base64PNG: string) => void) => void
     e->AddNativeJavaScriptFunction(
@@ -1041,8 +1453,62 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
         },
         ARG(VTYPE_STRING, "imageData")
     ));
+#elif defined(OS_LINUX)
+    // convertImage: (base64ImageData: string, callback: (base64PNG: string) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("convertImage"),
+        FUNC({
+            ImageUtil::ConvertImage(callback, args->GetString(0));
+            return RET_DELAYED_CALLBACK;
+        },
+        ARG(VTYPE_STRING, "imageData")
+    ));
+
+    // convertImages: (paths: string[], options?: IImageConversionOptions, callback: (results: IConvertedImage[]) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("convertImages"),
+        FUNC({
+            std::vector<String> paths;
+            JavaScript::Array listPaths = args->GetList(0);
+            for (size_t i = 0; i < listPaths->GetSize(); ++i)
+                paths.push_back(listPaths->GetString((int) i));
+
+            JavaScript::Object options = args->GetDictionary(1);
+            ImageUtil::ImageConversionOptions conversionOptions;
+            conversionOptions.format = options->HasKey(TEXT("format")) ? options->GetString(TEXT("format")) : TEXT("png");
+            conversionOptions.maxWidth = options->HasKey(TEXT("maxWidth")) ? (int) options->GetDouble(TEXT("maxWidth")) : 0;
+            conversionOptions.maxHeight = options->HasKey(TEXT("maxHeight")) ? (int) options->GetDouble(TEXT("maxHeight")) : 0;
+            conversionOptions.quality = options->HasKey(TEXT("quality")) ? (int) options->GetDouble(TEXT("quality")) : 90;
+            conversionOptions.outputDirectory = options->HasKey(TEXT("outputDirectory")) ? options->GetString(TEXT("outputDirectory")) : TEXT("");
+
+            ImageUtil::ConvertImages(callback, paths, conversionOptions);
+            return RET_DELAYED_CALLBACK;
+        }
+        ARG(VTYPE_LIST, "paths")
+        ARG(VTYPE_DICTIONARY, "options")),
+        true, false,
+        TEXT("if (typeof options === 'function') { callback = options; options = undefined; } return convertImages(paths, options || {}, callback);")
+    );
 #endif
 
+#ifdef OS_LINUX
+    // getPageImageForURL: (url: string, width: number, options?: IPageImageRequestOptions, callback: (imageData: string) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("getPageImageForURL"),
+        FUNC({
+            JavaScript::Object options = args->GetDictionary(2);
+            String version = options->HasKey(TEXT("version")) ? options->GetString(TEXT("version")) : TEXT("");
+
+            PageImage::GetPageImageForURL(callback, args->GetString(0), args->GetInt(1), version);
+            return RET_DELAYED_CALLBACK;
+        },
+        ARG(VTYPE_STRING, "url")
+        ARG(VTYPE_INT, "width")
+        ARG(VTYPE_DICTIONARY, "options")),
+        true, false,
+        TEXT("if (typeof options === 'function') { callback = options; options = undefined; } return getPageImageForURL(url, width, options || {}, callback);")
+    );
+#else
     e->AddNativeJavaScriptFunction(
         TEXT("getPageImageForURL"),
         FUNC({
@@ -1052,6 +1518,73 @@ void DefaultNativeExtensions::AddNativeExtensions(NativeJavaScriptFunctionAdder*
         ARG(VTYPE_STRING, "url")
         ARG(VTYPE_INT, "width")
     ));
+#endif
+
+#ifdef OS_LINUX
+    // getPageImageStatistics: (callback: (stats: IPageImageStatistics) => void) => void
+    e->AddNativeJavaScriptFunction(
+        TEXT("getPageImageStatistics"),
+        FUNC({
+            PageImage::PageImageStatistics stats;
+            PageImage::GetStatistics(stats);
+
+            JavaScript::Object obj = JavaScript::CreateObject();
+            obj->SetInt(TEXT("requests"), stats.numRequests);
+            obj->SetInt(TEXT("pending"), stats.numPending);
+            obj->SetInt(TEXT("succeeded"), stats.numSucceeded);
+            obj->SetInt(TEXT("failed"), stats.numFailed);
+            obj->SetInt(TEXT("timedOut"), stats.numTimedOut);
+            obj->SetInt(TEXT("cancelled"), stats.numCancelled);
+            obj->SetInt(TEXT("cacheHits"), stats.numCacheHits);
+            obj->SetInt(TEXT("renderers"), stats.numRenderers);
+            obj->SetDouble(TEXT("averageLatency"), stats.averageLatency);
+            obj->SetDouble(TEXT("maxLatency"), stats.maxLatency);
+            ret->SetDictionary(0, obj);
+
+            return NO_ERROR;
+        }
+    ));
+
+    // setPageImageOptions: (options: IPageImageOptions) => void
+    e->AddNativeJavaScriptProcedure(
+        TEXT("setPageImageOptions"),
+        FUNC({
+            JavaScript::Object options = args->GetDictionary(0);
+
+            PageImage::SetOptions(
+                options->HasKey(TEXT("maxRenderers")) ? (int) options->GetDouble(TEXT("maxRenderers")) : 0,
+                options->HasKey(TEXT("jobsPerRenderer")) ? (int) options->GetDouble(TEXT("jobsPerRenderer")) : 0,
+                options->HasKey(TEXT("timeout")) ? (int) options->GetDouble(TEXT("timeout")) : 0,
+                options->HasKey(TEXT("maxCacheSize")) ? options->GetDouble(TEXT("maxCacheSize")) : -1
+            );
+
+            return NO_ERROR;
+        },
+        ARG(VTYPE_DICTIONARY, "options")
+    ));
+
+    // cancelPageImages: (url?: string) => void
+    e->AddNativeJavaScriptProcedure(
+        TEXT("cancelPageImages"),
+        FUNC({
+            PageImage::Cancel(args->GetString(0));
+            return NO_ERROR;
+        },
+        ARG(VTYPE_STRING, "url")),
+        TEXT("return cancelPageImages(url || '');")
+    );
+
+    // invalidatePageImageCache: (url?: string) => void
+    e->AddNativeJavaScriptProcedure(
+        TEXT("invalidatePageImageCache"),
+        FUNC({
+            PageImage::InvalidateCache(args->GetString(0));
+            return NO_ERROR;
+        },
+        ARG(VTYPE_STRING, "url")),
+        TEXT("return invalidatePageImageCache(url || '');")
+    );
+#endif
 
 
     //////////////////////////////////////////////////////////////////////
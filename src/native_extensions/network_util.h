@@ -49,6 +49,9 @@ bool GetProxyForURL(String url, String& proxyType, String& host, int& port, Stri
 #ifdef USE_WEBVIEW
 // For Mac/WebView: Make a HTTP request
 void MakeRequest(JSObjectRef callback, String httpMethod, String url, String postData, String postDataContentType, String responseDataType);
+#elif defined(OS_LINUX)
+// For Linux/CEF: Make a HTTP request on the network thread
+void MakeRequest(CallbackId callback, String httpMethod, String url, String postData, String postDataContentType, String responseDataType);
 #endif
 
 } // namespace NetworkUtil
@@ -37,19 +37,90 @@
 
 #include "base/app.h"
 #include "base/cef/client_handler.h"
+#include "base/cef/extension_handler.h"
 
+#include "native_extensions/error.h"
+#include "native_extensions/http_client_linux.h"
 #include "native_extensions/network_util.h"
 #include "native_extensions/os_util.h"
+#include "util/base64.h"
 #include "util/string_util.h"
 
 #include "lib/cef/include/cef_parser.h"
+#include "lib/cef/include/base/cef_bind.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
 
 #include <iostream>
 
 
+extern CefRefPtr<Zephyros::ClientHandler> g_handler;
+
+
 namespace Zephyros {
 namespace NetworkUtil {
 
+static void FireAjaxCallback(CallbackId callback, String data, String contentType, bool isSuccess)
+{
+    JavaScript::Array args = JavaScript::CreateArray();
+    args->SetString(0, data);
+    args->SetString(1, contentType);
+    args->SetBool(2, isSuccess);
+    g_handler->GetClientExtensionHandler()->InvokeCallback(callback, args);
+}
+
+//
+// Collects the response of an ajax request and passes it to the JavaScript
+// callback on the UI thread.
+//
+class AjaxRequest : public HttpRequest
+{
+public:
+    AjaxRequest(CallbackId callback, String httpMethod, String url, String responseDataType)
+    : HttpRequest(httpMethod, url), m_callback(callback), m_responseDataType(responseDataType)
+    {
+    }
+
+    virtual bool OnResponse(long status, const std::map<String, String>& headers)
+    {
+        // report the MIME type without parameters like the charset
+        std::map<String, String>::const_iterator it = headers.find(TEXT("content-type"));
+        m_contentType = it == headers.end() ? TEXT("") : it->second.substr(0, it->second.find(TEXT(';')));
+        m_data.clear();
+        return true;
+    }
+
+    virtual bool OnData(const char* data, size_t length)
+    {
+        m_data.append(data, length);
+        return true;
+    }
+
+    virtual void OnFinished(const Error& error, long status)
+    {
+        bool isSuccess = error.GetCode() == ERR_OK && status >= 200 && status < 300;
+
+        String data;
+        if (isSuccess && m_responseDataType == TEXT("base64"))
+        {
+            size_t length = 0;
+            char* buf = NewBase64Encode(m_data.data(), m_data.length(), false, &length);
+            data = String(buf, buf + length);
+            free(buf);
+        }
+        else if (isSuccess)
+            data = m_data;
+
+        CefPostTask(TID_UI, base::Bind(&FireAjaxCallback, m_callback, data, isSuccess ? m_contentType : TEXT(""), isSuccess));
+    }
+
+private:
+    CallbackId m_callback;
+    String m_responseDataType;
+    String m_contentType;
+    std::string m_data;
+};
+
+
 /**
  * Returns an array of network IP addresses.
  */
@@ -196,5 +267,18 @@ bool GetProxyForURL(String url, String& proxyType, String& host, int& port, Stri
     return true;
 }
 
+/**
+ * Makes a HTTP request on the network thread and passes the response to the
+ * callback. Proxies are taken from the environment variables by libcurl.
+ */
+void MakeRequest(CallbackId callback, String httpMethod, String url, String postData, String postDataContentType, String responseDataType)
+{
+    AjaxRequest* request = new AjaxRequest(callback, httpMethod, url, responseDataType);
+    if (postData != "")
+        request->SetBody(postData, postDataContentType);
+
+    GetHttpClient()->Start(request);
+}
+
 } // namespace NetworkUtil
 } // namespace Zephyros
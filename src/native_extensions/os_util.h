@@ -40,6 +40,7 @@
 #endif
 
 #include "native_extensions.h"
+#include "native_extensions/child_process.h"
 
 
 #ifdef OS_WIN
@@ -64,11 +65,23 @@ String GetComputerName();
 String GetUserName();
 String GetHomeDirectory();
 
-bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, Error& err);
+bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err);
 
 #ifdef OS_LINUX
 String GetConfigDirectory();
-String Exec(String command);
+
+// Returns the path of the executable "name" in $PATH like "which" does,
+// or an empty string if there is none
+String FindExecutable(String name);
+
+// Runs the executable (arguments[0], resolved in $PATH) without a shell,
+// and returns what it has written to stdout; the process is killed if it
+// hasn't terminated after "timeout" milliseconds (unless "timeout" is -1)
+String RunProcess(std::vector<String> arguments, int timeout = -1);
+
+// Starts the executable (arguments[0], resolved in $PATH) without a shell
+// and without waiting for it to terminate
+bool LaunchProcess(std::vector<String> arguments);
 #endif
 
 void CreateMenu(JavaScript::Array menuItems);
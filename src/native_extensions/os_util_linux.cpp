@@ -28,12 +28,19 @@
 
 #include <vector>
 #include <map>
+#include <set>
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <pwd.h>
-#include <spawn.h> // see manpages-posix-dev
-#include <poll.h>
-#include <glob.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -51,30 +58,14 @@
 #include "base/cef/extension_handler.h"
 
 #include "util/string_util.h"
+#include "util/time_util.h"
 
+#include "native_extensions/child_process.h"
 #include "native_extensions/os_util.h"
 
 #include <iostream>
 
 
-#define BUFSIZE 1024
-
-
-typedef struct
-{
-    int type;
-    String text;
-} StreamDataEntry;
-
-typedef struct
-{
-    CallbackId callback;
-    String executableFileName;
-    std::vector<String>* arguments;
-    String cwd;
-    Zephyros::Error* err;
-} StartProcessThreadData;
-
 typedef struct
 {
     char* cmd;
@@ -94,154 +85,138 @@ GtkAccelGroup* g_pAccelGroup = NULL;
 std::map<String, MenuItemData*> g_mapMenuItems;
 
 
-void CleanupStartProcessThreadData(void* arg)
-{
-    StartProcessThreadData* data = (StartProcessThreadData*) arg;
-    delete data->arguments;
-    delete data;
-}
+//////////////////////////////////////////////////////////////////////////
+// Executable Resolution
 
+// A directory in $PATH and the names of its entries which might be
+// executables, as of the modification time of the directory
+typedef struct
+{
+    String path;
+    bool exists;
+    timespec mtime;
+    std::set<String> names;
+} ExecutableDirectory;
+
+// The directories in $PATH; rescanned when $PATH or their modification
+// times change, so resolving an executable doesn't fork a "which" shell
+static base::Lock g_executableDirectoriesLock;
+static String g_executableSearchPath;
+static std::vector<ExecutableDirectory> g_executableDirectories;
+
+static void ScanExecutableDirectory(ExecutableDirectory& dir)
+{
+    struct stat st;
+    bool exists = stat(dir.path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
 
-/**
- * Starts a new process and reads from its output streams.
- *
- * cf. http://stackoverflow.com/questions/13893085/posix-spawnp-and-piping-child-output-to-a-string
- */
-void* StartProcessThread(void* arg)
-{
-    StartProcessThreadData* data = (StartProcessThreadData*) arg;
-    pthread_cleanup_push(CleanupStartProcessThreadData, arg);
-
-    int outPipe[2];
-    int errPipe[2];
-    if (pipe(outPipe) || pipe(errPipe))
-        std::cout << "pipe returned an error.\n";
-
-    // prepare spawning of pipes
-    posix_spawn_file_actions_t action;
-    posix_spawn_file_actions_init(&action);
-    posix_spawn_file_actions_addclose(&action, outPipe[0]);
-    posix_spawn_file_actions_addclose(&action, errPipe[0]);
-    posix_spawn_file_actions_adddup2(&action, outPipe[1], 1);
-    posix_spawn_file_actions_adddup2(&action, errPipe[1], 2);
-
-    posix_spawn_file_actions_addclose(&action, outPipe[1]);
-    posix_spawn_file_actions_addclose(&action, errPipe[1]);
-
-    // build spawn arguments
-    char** args = new char*[data->arguments->size() + 2];
-
-    // the first argument is the path to the executable
-    // glob the executable path
-    // (e.g., '~/.gem/ruby/*/bin/sass' will be resolved to something like '/Users/christen/.gem/ruby/2.0.0/bin/sass')
-    glob_t g;
-    const char* executablePath = data->executableFileName.c_str();
-    if (glob(executablePath, GLOB_TILDE, NULL, &g) == 0 && g.gl_pathc > 0)
-        executablePath = g.gl_pathv[0];
-    args[0] = new char[strlen(executablePath) + 1];
-    strcpy(args[0], executablePath);
-    globfree(&g);
-
-    int i = 1;
-    for (String arg : *(data->arguments))
+    if (exists == dir.exists && (!exists ||
+        (st.st_mtim.tv_sec == dir.mtime.tv_sec && st.st_mtim.tv_nsec == dir.mtime.tv_nsec)))
     {
-        args[i] = new char[arg.length() + 1];
-        strcpy(args[i], arg.c_str());
-        ++i;
+        return;
     }
 
-    args[i] = 0;
-
-    // change to indicated working directory and spawn process
-    if (data->cwd.length() > 0)
-    {
-        const char* cwd = data->cwd.c_str();
-        if (glob(cwd, GLOB_TILDE, NULL, &g) == 0 && g.gl_pathc > 0)
-            cwd = g.gl_pathv[0];
+    dir.exists = exists;
+    dir.names.clear();
+    if (!exists)
+        return;
 
-        chdir(cwd);
+    dir.mtime = st.st_mtim;
 
-        globfree(&g);
-    }
+    DIR* d = opendir(dir.path.c_str());
+    if (d == NULL)
+        return;
 
-    pid_t pid;
-    bool success = true;
-    if (posix_spawnp(&pid, args[0], &action, NULL, &args[0], NULL) != 0)
+    // whether an entry is executable is only checked when it is looked up
+    for (dirent* entry = readdir(d); entry != NULL; entry = readdir(d))
     {
-        data->err->FromErrno();
-        std::cout << "posix_spawnp failed with error: " << strerror(errno) << "\n";
-        success = false;
-
-        // fire JavaScript callback
-        Zephyros::JavaScript::Array callbackArgs = Zephyros::JavaScript::CreateArray();
-        callbackArgs->SetDictionary(0, data->err->CreateJSRepresentation());
-        callbackArgs->SetNull(1);
-        callbackArgs->SetNull(2);
-        g_handler->GetClientExtensionHandler()->InvokeCallback(data->callback, callbackArgs);
+        if (entry->d_type != DT_DIR && entry->d_name[0] != '.')
+            dir.names.insert(entry->d_name);
     }
 
-    // close child-side of pipes
-    close(outPipe[1]);
-    close(errPipe[1]);
+    closedir(d);
+}
 
-    if (success)
-    {
-        // read process output until terminated, build JS callback arguments on the go
-        Zephyros::JavaScript::Array stream = Zephyros::JavaScript::CreateArray();
-        char buffer[BUFSIZE];
+static void UpdateExecutableDirectories()
+{
+    const char* searchPath = getenv("PATH");
+    String path = searchPath != NULL ? searchPath : "/usr/local/bin:/usr/bin:/bin";
 
-        std::vector<pollfd> plist = {
-            { outPipe[0], POLLIN },
-            { errPipe[0], POLLIN }
-        };
+    if (path != g_executableSearchPath)
+    {
+        g_executableSearchPath = path;
+        g_executableDirectories.clear();
 
-        for (i = 0; poll(&plist[0], plist.size(), -1 /* infinite timeout */) > 0; )
+        for (String dirPath : Split(path, TEXT(':')))
         {
-            int j = 0;
-            bool somethingRead = false;
-
-            for (pollfd p : plist)
-            {
-                if (p.revents & POLLIN)
-                {
-                    int bytesRead = read(p.fd, buffer, BUFSIZE);
-
-                    Zephyros::JavaScript::Object streamEntry = Zephyros::JavaScript::CreateObject();
-                    streamEntry->SetString(TEXT("text"), String(buffer, static_cast<size_t>(bytesRead)));
-                    streamEntry->SetInt(TEXT("fd"), j);
-                    stream->SetDictionary(i++, streamEntry);
-
-                    somethingRead = true;
-                    break;
-                }
+            ExecutableDirectory dir;
+            dir.path = dirPath.length() > 0 ? dirPath : TEXT(".");
+            dir.exists = false;
+            dir.mtime.tv_sec = 0;
+            dir.mtime.tv_nsec = 0;
+            g_executableDirectories.push_back(dir);
+        }
+    }
 
-                ++j;
-            }
+    for (ExecutableDirectory& dir : g_executableDirectories)
+        ScanExecutableDirectory(dir);
+}
 
-            if (!somethingRead)
-                break;
-        }
+static bool IsExecutableFile(const String& path)
+{
+    struct stat st;
+    return access(path.c_str(), X_OK) == 0 && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
 
-        // wait for process to terminate
-        int exitCode;
-        waitpid(pid, &exitCode, 0);
+//
+// Spawns the executable arguments[0] with stdin connected to /dev/null and
+// stdout to outputFd (or /dev/null if outputFd is -1).
+//
+static pid_t SpawnExecutable(std::vector<String>& arguments, int outputFd)
+{
+    if (arguments.size() == 0)
+        return -1;
+
+    String executablePath = Zephyros::OSUtil::FindExecutable(arguments[0]);
+    if (executablePath.length() == 0)
+        return -1;
+
+    std::vector<char*> args;
+    for (String& arg : arguments)
+        args.push_back(const_cast<char*>(arg.c_str()));
+    args.push_back(NULL);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    if (outputFd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, outputFd, 1);
+    else
+        posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+
+    // the process gets the default handlers instead of the app's ignored SIGPIPE
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
 
-        // fire JavaScript callback
-        Zephyros::JavaScript::Array callbackArgs = Zephyros::JavaScript::CreateArray();
-        callbackArgs->SetNull(0);
-        callbackArgs->SetInt(1, exitCode);
-        callbackArgs->SetList(2, stream);
-        g_handler->GetClientExtensionHandler()->InvokeCallback(data->callback, callbackArgs);
-    }
+    pid_t pid;
+    int ret = posix_spawn(&pid, executablePath.c_str(), &actions, &attr, &args[0], environ);
 
-    // clean up
-    for (i = 0; i < data->arguments->size() + 1; ++i)
-        delete[] args[i];
-    delete[] args;
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
 
-    posix_spawn_file_actions_destroy(&action);
-    pthread_cleanup_pop(arg);
+    return ret == 0 ? pid : -1;
+}
 
+static void* WaitForLaunchedProcess(void* arg)
+{
+    pid_t pid = (pid_t) (intptr_t) arg;
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+        ;
     return NULL;
 }
 
@@ -378,40 +353,107 @@ String GetComputerName()
     return String(name);
 }
 
-bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, Error& err)
+bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err)
 {
-    StartProcessThreadData* data = new StartProcessThreadData;
-    data->callback = callback;
-    data->executableFileName = executableFileName;
-    data->cwd = cwd;
-    data->err = &err;
-    data->arguments = new std::vector<String>();
+    // the output is read by the process reactor, which serves all child processes
+    return ChildProcess::StartCollectingOutput(callback, executableFileName, arguments, cwd, options, err);
+}
 
-    for (String arg : arguments)
-        data->arguments->push_back(arg);
+String FindExecutable(String name)
+{
+    if (name.length() == 0)
+        return TEXT("");
 
-    // start thread
-    pthread_t thread;
-    pthread_create(&thread, NULL, StartProcessThread, data);
+    // paths aren't looked up
+    if (name.find(TEXT('/')) != String::npos)
+        return IsExecutableFile(name) ? name : TEXT("");
 
-    return true;
+    base::AutoLock lock(g_executableDirectoriesLock);
+    UpdateExecutableDirectories();
+
+    for (ExecutableDirectory& dir : g_executableDirectories)
+    {
+        if (dir.names.find(name) == dir.names.end())
+            continue;
+
+        String path = dir.path + TEXT("/") + name;
+        if (IsExecutableFile(path))
+            return path;
+    }
+
+    return TEXT("");
 }
 
-String Exec(String command)
+String RunProcess(std::vector<String> arguments, int timeout)
 {
-    FILE* pipe = popen(command.c_str(), TEXT("r"));
-    if (!pipe)
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
         return TEXT("");
 
-    char buffer[128];
-    StringStream result;
+    pid_t pid = SpawnExecutable(arguments, fds[1]);
+    close(fds[1]);
 
-    while (!feof(pipe))
-        if (fgets(buffer, 128, pipe) != NULL)
-            result << buffer;
+    std::string result;
+    if (pid > 0)
+    {
+        double start = TimeUtil::GetMonotonicTime();
 
-    pclose(pipe);
-    return result.str();
+        char buffer[4096];
+        for ( ; ; )
+        {
+            int remaining = -1;
+            if (timeout >= 0)
+            {
+                remaining = timeout - (int) (TimeUtil::GetMonotonicTime() - start);
+                if (remaining < 0)
+                    remaining = 0;
+            }
+
+            pollfd pfd;
+            pfd.fd = fds[0];
+            pfd.events = POLLIN;
+            int ret = poll(&pfd, 1, remaining);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret == 0)
+            {
+                kill(pid, SIGKILL);
+                break;
+            }
+
+            ssize_t bytesRead = read(fds[0], buffer, sizeof(buffer));
+            if (bytesRead < 0 && errno == EINTR)
+                continue;
+            if (bytesRead <= 0)
+                break;
+
+            result.append(buffer, (size_t) bytesRead);
+        }
+
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+            ;
+    }
+
+    close(fds[0]);
+    return result;
+}
+
+bool LaunchProcess(std::vector<String> arguments)
+{
+    pid_t pid = SpawnExecutable(arguments, -1);
+    if (pid <= 0)
+        return false;
+
+    // reap the process when it terminates; the thread is only blocked in waitpid
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    pthread_create(&thread, &attr, WaitForLaunchedProcess, (void*) (intptr_t) pid);
+    pthread_attr_destroy(&attr);
+
+    return true;
 }
 
 int CreateMenuRecursive(GtkWidget* pMenu, JavaScript::Array menuItems, bool bIsInDemoMode)
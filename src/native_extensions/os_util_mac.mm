@@ -585,8 +585,9 @@ String GetComputerName()
     return ret;
 }
  
-bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, Error& err)
+bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err)
 {
+    // the limits in "options" are only supported on Linux
     ProcessManager *processManager = [[ProcessManager alloc] init: callback withError: &err];
     
     NSMutableArray *args = [[NSMutableArray alloc] init];
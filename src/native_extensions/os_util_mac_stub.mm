@@ -53,7 +53,7 @@ String GetComputerName()
     return "";
 }
  
-bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, Error& err)
+bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err)
 {
     return false;
 }
@@ -163,9 +163,9 @@ String GetComputerName()
     return szComputerName;
 }
 
-bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, Error& err)
+bool StartProcess(CallbackId callback, String executableFileName, std::vector<String> arguments, String cwd, const ProcessOptions& options, Error& err)
 {
-    // create and start a new process
+    // create and start a new process (the limits in "options" are only supported on Linux)
     // the process manager deletes itself once the process has terminated
     ProcessManager* pMgr = new ProcessManager(callback, executableFileName, arguments, cwd, err);
     return pMgr->Start();
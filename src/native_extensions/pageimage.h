@@ -40,6 +40,46 @@ static const int ImageHeight = 768;
 
 void GetPageImageForURL(CallbackId callback, String url, int width);
 
+#ifdef OS_LINUX
+// Like GetPageImageForURL, but the image is cached for "version", an
+// arbitrary string identifying the content of the page.
+void GetPageImageForURL(CallbackId callback, String url, int width, String version);
+
+// The outcome of the page captures so far (cf. IPageImageStatistics)
+typedef struct {
+    int numRequests;
+    int numPending;
+    int numSucceeded;
+    int numFailed;
+    int numTimedOut;
+    int numCancelled;
+
+    // the requests answered from the cache, without rendering the page
+    int numCacheHits;
+
+    // the number of windowless browsers rendering pages
+    int numRenderers;
+
+    // in milliseconds, from the request until the image has been returned
+    double averageLatency;
+    double maxLatency;
+} PageImageStatistics;
+
+// Configures the pool of windowless browsers rendering the pages and the
+// size of the image cache in bytes (0 disables the cache). Values less than
+// or equal to 0, or less than 0 for the cache size, leave the respective
+// option unchanged.
+void SetOptions(int maxRenderers, int jobsPerRenderer, int timeout, double maxCacheSize);
+
+// Removes the cached images for "url", or all cached images if "url" is empty.
+void InvalidateCache(String url);
+
+// Cancels the requests for "url", or all requests if "url" is empty.
+void Cancel(String url);
+
+void GetStatistics(PageImageStatistics& stats);
+#endif
+
 } // namespace PageImage
 } // namespace Zephyros
 
@@ -25,26 +25,69 @@
  *******************************************************************************/
 
 
-#include <queue>
+#include <deque>
+#include <vector>
 #include <algorithm>
 
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib/cef/include/base/cef_bind.h"
 #include "lib/cef/include/cef_browser.h"
 #include "lib/cef/include/cef_client.h"
+#include "lib/cef/include/cef_load_handler.h"
 #include "lib/cef/include/cef_render_handler.h"
+#include "lib/cef/include/cef_request_handler.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
 
 #include "base/cef/client_handler.h"
 #include "base/cef/extension_handler.h"
 
+#include "util/time_util.h"
+
 #include "native_extensions/image_util_linux.h"
+#include "native_extensions/os_util.h"
 #include "native_extensions/pageimage.h"
+#include "native_extensions/thumbnail_cache_linux.h"
+
+
+// The page is considered rendered when it has finished loading and hasn't
+// painted anything for this many milliseconds
+#define PAGE_IMAGE_QUIET_PERIOD_MS 300
+
+// The image is taken as it is if the page hasn't settled after this many
+// milliseconds (can be changed with setPageImageOptions)
+#define PAGE_IMAGE_DEFAULT_TIMEOUT_MS 15000
+
+// The default and maximum number of windowless browsers rendering pages in parallel
+#define PAGE_IMAGE_DEFAULT_MAX_RENDERERS 4
+#define PAGE_IMAGE_MAX_RENDERERS 16
+
+// A browser is closed and replaced by a new one after it has rendered this
+// many pages, so memory leaked by the pages doesn't accumulate
+#define PAGE_IMAGE_DEFAULT_JOBS_PER_RENDERER 50
 
+// The images are cached in this subdirectory of the config directory, up to
+// this many bytes (can be changed with setPageImageOptions); the most
+// recently used ones are also kept in memory
+#define PAGE_IMAGE_CACHE_DIRECTORY TEXT("thumbnails")
+#define PAGE_IMAGE_DEFAULT_CACHE_SIZE (64 * 1024 * 1024)
+#define PAGE_IMAGE_MEMORY_CACHE_SIZE (16 * 1024 * 1024)
 
-//void CALLBACK PaintComplete(HWND, UINT, UINT_PTR, DWORD);
-class OffscreenClientHandler;
+// The outcome of a job
+#define PAGE_IMAGE_SUCCEEDED 0
+#define PAGE_IMAGE_FAILED 1
+#define PAGE_IMAGE_TIMED_OUT 2
+#define PAGE_IMAGE_CANCELLED 3
+
+
+class OffscreenRenderer;
+class PageImagePool;
 
 
 extern CefRefPtr<Zephyros::ClientHandler> g_handler;
-CefRefPtr<OffscreenClientHandler> g_offscreenHandler = NULL;
+PageImagePool* g_pageImagePool = NULL;
 
 
 typedef struct
@@ -52,102 +95,198 @@ typedef struct
     CallbackId callbackId;
     String url;
     int width;
-} QueueItem;
+    String version;
+    int timeout;
+    double startTime;
+
+    // set if the job is cancelled while the cache is being looked up
+    bool isCancelled;
+} PageImageJob;
+
 
+//////////////////////////////////////////////////////////////////////////
+// PageImagePool Definition
 
-class OffscreenClientHandler : public CefClient, public CefLifeSpanHandler, public CefRenderHandler
+//
+// Distributes the page image jobs among a number of windowless browsers.
+// All methods are called on the UI thread.
+//
+class PageImagePool
+{
+public:
+    PageImagePool();
+
+    void AddJob(String url, int width, String version, CallbackId callbackId);
+    void SetOptions(int maxRenderers, int jobsPerRenderer, int timeout, double maxCacheSize);
+    void Cancel(String url);
+    void InvalidateCache(String url);
+    void GetStatistics(Zephyros::PageImage::PageImageStatistics& stats);
+
+    // called by the renderers
+    void OnJobFinished(OffscreenRenderer* renderer, PageImageJob* job, const std::vector<unsigned char>& pixels, int status);
+    void OnRendererCreated(OffscreenRenderer* renderer);
+
+private:
+    void LookUpCache(PageImageJob* job);
+    void OnCacheLookedUp(PageImageJob* job, bool isCached, String imageData);
+    void EncodeImage(PageImageJob* job, const std::vector<unsigned char>& pixels, int status);
+    void Dispatch();
+    void FinishJob(PageImageJob* job, String imageData, int status);
+    void CloseRenderer(OffscreenRenderer* renderer);
+
+private:
+    // the jobs whose images are being looked up in the cache
+    std::vector<PageImageJob*> m_cacheLookups;
+
+    std::deque<PageImageJob*> m_queue;
+    std::vector<CefRefPtr<OffscreenRenderer> > m_renderers;
+
+    int m_maxRenderers;
+    int m_jobsPerRenderer;
+    int m_timeout;
+
+    // only used on the file thread and the conversion threads
+    ThumbnailCache m_cache;
+
+    Zephyros::PageImage::PageImageStatistics m_stats;
+    double m_totalLatency;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// OffscreenRenderer Definition
+
+//
+// A windowless browser rendering one page at a time.
+//
+class OffscreenRenderer : public CefClient, public CefLifeSpanHandler, public CefLoadHandler, public CefRenderHandler, public CefRequestHandler
 {
 private:
-    std::queue<QueueItem*> m_queue;
-//  Gdiplus::Bitmap* m_image;
-//  UINT_PTR m_timerId;
-    int m_numPainted;
     CefRefPtr<CefBrowser> m_browser;
 
+    // the job being rendered, or NULL if the renderer is idle
+    PageImageJob* m_job;
+
+    // the BGRA pixels of the view, updated with each paint
+    std::vector<unsigned char> m_pixels;
+
+    // identifies the page being captured, so timers of earlier pages are ignored
+    int m_pageId;
+
+    bool m_isLoaded;
+    int m_numPainted;
+
+public:
+    // the number of jobs the renderer has finished
+    int m_numJobs;
+
+    // whether the render process has crashed; the renderer isn't reused
+    bool m_hasCrashed;
+
+    bool m_isClosing;
+
 public:
-    OffscreenClientHandler()
-//      : m_timerId(0), m_numPainted(0), m_browser(NULL)
-        : m_numPainted(0), m_browser(NULL)
+    OffscreenRenderer(PageImageJob* job)
+        : m_browser(NULL), m_job(job), m_pageId(0), m_isLoaded(false), m_numPainted(0),
+          m_numJobs(0), m_hasCrashed(false), m_isClosing(false)
     {
-//      m_image = new Gdiplus::Bitmap(Zephyros::PageImage::ImageWidth, Zephyros::PageImage::ImageHeight, PixelFormat32bppARGB);
+        m_pixels.resize(Zephyros::PageImage::ImageWidth * Zephyros::PageImage::ImageHeight * 4);
+
+        CefWindowInfo info;
+        info.SetAsWindowless(0, false);
+
+        CefBrowserSettings settings;
+
+        // the browser is created with the URL of the first job
+        CefBrowserHost::CreateBrowser(info, this, job->url, settings, NULL);
     }
 
-    ~OffscreenClientHandler()
+    ~OffscreenRenderer()
     {
     }
 
-    void AddToQueue(String url, int width, CallbackId callbackId)
+    bool IsIdle()
     {
-        QueueItem* item = new QueueItem;
+        return m_browser && m_browser.get() && m_job == NULL && !m_isClosing;
+    }
 
-        item->callbackId = callbackId;
-        item->url = url;
-        item->width = std::min(width, Zephyros::PageImage::ImageWidth);
+    PageImageJob* GetJob()
+    {
+        return m_job;
+    }
 
-        m_queue.push(item);
+    void Start(PageImageJob* job)
+    {
+        m_job = job;
+        StartCapture(true);
+    }
 
-        if (m_queue.size() == 1)
-        {
-//          m_timerId = 0;
-            m_numPainted = 0;
+    void Cancel()
+    {
+        // the pool loads the next page or the blank page into the browser
+        ReturnResult(PAGE_IMAGE_CANCELLED);
+    }
 
-            if (m_browser && m_browser.get())
-                m_browser->GetMainFrame()->LoadURL(url);
-        }
+    void Close()
+    {
+        m_isClosing = true;
+
+        // otherwise the browser is closed as soon as it has been created
+        if (m_browser && m_browser.get())
+            m_browser->GetHost()->CloseBrowser(true);
     }
 
-    void ReturnResult()
+    void LoadBlankPage()
     {
-/*
-        if (m_timerId != 0)
-            KillTimer(NULL, m_timerId);
-*/
+        if (m_browser && m_browser.get())
+            m_browser->GetMainFrame()->LoadURL(TEXT("about:blank"));
+    }
 
-        if (m_queue.size() == 0)
+    void StartCapture(bool loadURL)
+    {
+        ++m_pageId;
+        m_isLoaded = false;
+        m_numPainted = 0;
+
+        // only the dirty rects are copied; start from the opaque white
+        // background of the view, not from the previous page
+        std::fill(m_pixels.begin(), m_pixels.end(), 0xff);
+
+        if (loadURL)
+            m_browser->GetMainFrame()->LoadURL(m_job->url);
+
+        CefPostDelayedTask(TID_UI, base::Bind(&OffscreenRenderer::OnTimeout, this, m_pageId), m_job->timeout);
+    }
+
+    //
+    // Checks whether the page has painted since the check was scheduled.
+    //
+    void OnQuietPeriodEnded(int pageId, int numPainted)
+    {
+        if (pageId == m_pageId && numPainted == m_numPainted && m_job != NULL)
+            ReturnResult(PAGE_IMAGE_SUCCEEDED);
+    }
+
+    void OnTimeout(int pageId)
+    {
+        // return what has been painted so far
+        if (pageId == m_pageId && m_job != NULL)
+            ReturnResult(m_numPainted > 0 ? PAGE_IMAGE_TIMED_OUT : PAGE_IMAGE_FAILED);
+    }
+
+    void ReturnResult(int status)
+    {
+        if (m_job == NULL)
             return;
 
-        QueueItem* item = m_queue.front();
-        m_queue.pop();
+        PageImageJob* job = m_job;
+        m_job = NULL;
 
-/*
-        // resize the image if needed
-        Gdiplus::Bitmap* pImage = m_image;
-        if (item->width < Zephyros::PageImage::ImageWidth)
-        {
-            int imageHeight = (int) (((long) item->width * Zephyros::PageImage::ImageHeight) / Zephyros::PageImage::ImageWidth);
-            pImage = new Gdiplus::Bitmap(item->width, imageHeight, PixelFormat32bppARGB);
+        // invalidate the timers of the page
+        ++m_pageId;
+        ++m_numJobs;
 
-            Gdiplus::Graphics g(pImage);
-            g.SetSmoothingMode(Gdiplus::SmoothingMode::SmoothingModeHighQuality);
-            g.SetInterpolationMode(Gdiplus::InterpolationMode::InterpolationModeHighQualityBicubic);
-            g.DrawImage(m_image, 0, 0, item->width, imageHeight);
-        }
-*/
-
-        // create a PNG and base64-encode it
-/*
-        BYTE* pData = NULL;
-        DWORD length = 0;
-        ImageUtil::BitmapToPNGData(pImage, &pData, &length);
-*/
-        Zephyros::JavaScript::Array args = Zephyros::JavaScript::CreateArray();
-/*
-        args->SetString(0, TEXT("data:image/png;base64,") + ImageUtil::Base64Encode(pData, length));
-*/
-        g_handler->GetClientExtensionHandler()->InvokeCallback(item->callbackId, args);
-
-/*
-        delete[] pData;
-        if (pImage != m_image)
-            delete pImage;
-*/
-        delete item;
-
-        // process the next item in the queue
-        m_numPainted = 0;
-//      m_timerId = 0;
-        if (m_queue.size() > 0)
-            m_browser->GetMainFrame()->LoadURL(m_queue.front()->url);
+        g_pageImagePool->OnJobFinished(this, job, m_pixels, status);
     }
 
     virtual CefRefPtr<CefLifeSpanHandler> GetLifeSpanHandler() OVERRIDE
@@ -155,68 +294,384 @@ public:
         return this;
     }
 
-    virtual void OnAfterCreated(CefRefPtr<CefBrowser> browser)
+    virtual CefRefPtr<CefLoadHandler> GetLoadHandler() OVERRIDE
     {
-        m_browser = browser;
+        return this;
     }
 
-    virtual void OnBeforeClose(CefRefPtr<CefBrowser> browser)
+    virtual CefRefPtr<CefRenderHandler> GetRenderHandler() OVERRIDE
     {
-        m_browser = NULL;
-/*
-        if (m_image != NULL)
+        return this;
+    }
+
+    virtual CefRefPtr<CefRequestHandler> GetRequestHandler() OVERRIDE
+    {
+        return this;
+    }
+
+    virtual void OnAfterCreated(CefRefPtr<CefBrowser> browser) OVERRIDE
+    {
+        m_browser = browser;
+
+        if (m_isClosing)
+            m_browser->GetHost()->CloseBrowser(true);
+        else if (m_job != NULL)
+            StartCapture(false);
+        else
         {
-            delete m_image;
-            m_image = NULL;
+            // the job has been cancelled while the browser was being created
+            LoadBlankPage();
+            g_pageImagePool->OnRendererCreated(this);
         }
-*/
     }
 
-    virtual CefRefPtr<CefRenderHandler> GetRenderHandler()
+    virtual void OnBeforeClose(CefRefPtr<CefBrowser> browser) OVERRIDE
     {
-        return this;
+        m_browser = NULL;
+    }
+
+    virtual void OnLoadEnd(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame, int httpStatusCode) OVERRIDE
+    {
+        if (!frame->IsMain() || m_job == NULL)
+            return;
+
+        // the blank page loaded after the previous capture
+        if (frame->GetURL() == TEXT("about:blank") && m_job->url != TEXT("about:blank"))
+            return;
+
+        m_isLoaded = true;
+        ScheduleQuietPeriodCheck();
     }
 
-    bool GetViewRect(CefRefPtr<CefBrowser> browser, CefRect &rect)
+    virtual void OnLoadError(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+        ErrorCode errorCode, const CefString& errorText, const CefString& failedUrl) OVERRIDE
     {
-        rect = CefRect(0, 0, 1024, 768);
+        // ERR_ABORTED is reported when the next page is loaded
+        if (frame->IsMain() && errorCode != ERR_ABORTED && m_job != NULL)
+            ReturnResult(PAGE_IMAGE_FAILED);
+    }
+
+    virtual void OnRenderProcessTerminated(CefRefPtr<CefBrowser> browser, TerminationStatus status) OVERRIDE
+    {
+        m_hasCrashed = true;
+        if (m_job != NULL)
+            ReturnResult(PAGE_IMAGE_FAILED);
+    }
+
+    virtual bool GetViewRect(CefRefPtr<CefBrowser> browser, CefRect &rect) OVERRIDE
+    {
+        rect = CefRect(0, 0, Zephyros::PageImage::ImageWidth, Zephyros::PageImage::ImageHeight);
         return true;
     }
 
-    void OnPaint(CefRefPtr<CefBrowser> browser, PaintElementType type, const RectList &dirtyRects, const void *buffer, int width, int height)
+    virtual void OnPaint(CefRefPtr<CefBrowser> browser, PaintElementType type, const RectList &dirtyRects, const void *buffer, int width, int height) OVERRIDE
     {
-        if (/*m_image == NULL ||*/ m_queue.size() == 0)
+        if (type != PET_VIEW || m_job == NULL)
             return;
 
-/*
-        // copy the buffer into the bitmap
-        Gdiplus::BitmapData data;
-        Gdiplus::Rect rect(0, 0, Zephyros::PageImage::ImageWidth, Zephyros::PageImage::ImageHeight);
-        m_image->LockBits(&rect, Gdiplus::ImageLockModeWrite, PixelFormat32bppARGB, &data);
-        int w = min(Zephyros::PageImage::ImageWidth, width);
-        int h = min(Zephyros::PageImage::ImageHeight, height);
-        for (int y = 0; y < h; ++y)
-            memcpy((BYTE*) data.Scan0 + y * data.Stride, (BYTE*) buffer + y * 4 * w, 4 * w);
-        m_image->UnlockBits(&data);
-*/
+        // copy the parts which have changed
+        int w = std::min(Zephyros::PageImage::ImageWidth, width);
+        int h = std::min(Zephyros::PageImage::ImageHeight, height);
+        for (RectList::const_iterator it = dirtyRects.begin(); it != dirtyRects.end(); ++it)
+        {
+            int x0 = std::max(0, it->x);
+            int x1 = std::min(w, it->x + it->width);
+            int y1 = std::min(h, it->y + it->height);
+
+            for (int y = std::max(0, it->y); y < y1 && x0 < x1; ++y)
+            {
+                memcpy(&m_pixels[((size_t) y * Zephyros::PageImage::ImageWidth + x0) * 4],
+                    (const unsigned char*) buffer + ((size_t) y * width + x0) * 4, (size_t) (x1 - x0) * 4);
+            }
+        }
+
         m_numPainted++;
-        if (m_numPainted >= 100)
-            ReturnResult();
-//      else
-//          m_timerId = SetTimer(NULL, m_timerId, 3000, PaintComplete);
+        if (m_isLoaded)
+            ScheduleQuietPeriodCheck();
+    }
+
+private:
+    //
+    // Returns the image once the page hasn't painted for the quiet period.
+    //
+    void ScheduleQuietPeriodCheck()
+    {
+        CefPostDelayedTask(TID_UI, base::Bind(&OffscreenRenderer::OnQuietPeriodEnded, this, m_pageId, m_numPainted), PAGE_IMAGE_QUIET_PERIOD_MS);
     }
 
 public:
-    IMPLEMENT_REFCOUNTING(OffscreenClientHandler);
+    IMPLEMENT_REFCOUNTING(OffscreenRenderer);
 };
 
-/*
-void CALLBACK PaintComplete(HWND hWnd, UINT uMsg, UINT_PTR timerId, DWORD dwTime)
+
+//////////////////////////////////////////////////////////////////////////
+// PageImagePool Implementation
+
+PageImagePool::PageImagePool()
+    : m_jobsPerRenderer(PAGE_IMAGE_DEFAULT_JOBS_PER_RENDERER), m_timeout(PAGE_IMAGE_DEFAULT_TIMEOUT_MS),
+      m_cache(Zephyros::OSUtil::GetConfigDirectory() + TEXT("/") + PAGE_IMAGE_CACHE_DIRECTORY, PAGE_IMAGE_DEFAULT_CACHE_SIZE, PAGE_IMAGE_MEMORY_CACHE_SIZE),
+      m_totalLatency(0)
+{
+    // rendering is mostly CPU-bound, so there's no point in more browsers than cores
+    long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    m_maxRenderers = std::max(1, std::min((int) numProcessors, PAGE_IMAGE_DEFAULT_MAX_RENDERERS));
+
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void PageImagePool::AddJob(String url, int width, String version, CallbackId callbackId)
+{
+    width = std::max(1, std::min(width, Zephyros::PageImage::ImageWidth));
+
+    PageImageJob* job = new PageImageJob;
+
+    job->callbackId = callbackId;
+    job->url = url;
+    job->width = width;
+    job->version = version;
+    job->timeout = m_timeout;
+    job->startTime = TimeUtil::GetMonotonicTime();
+    job->isCancelled = false;
+
+    m_cacheLookups.push_back(job);
+    m_stats.numRequests++;
+    m_stats.numPending++;
+
+    // the page is only rendered if the image isn't cached
+    CefPostTask(TID_FILE, base::Bind(&PageImagePool::LookUpCache, base::Unretained(this), job));
+}
+
+//
+// Reads the image of a job from the cache. Called on the file thread.
+//
+void PageImagePool::LookUpCache(PageImageJob* job)
+{
+    String imageData;
+    bool isCached = m_cache.Get(job->url, job->width, job->version, imageData);
+    CefPostTask(TID_UI, base::Bind(&PageImagePool::OnCacheLookedUp, base::Unretained(this), job, isCached, imageData));
+}
+
+void PageImagePool::OnCacheLookedUp(PageImageJob* job, bool isCached, String imageData)
+{
+    m_cacheLookups.erase(std::find(m_cacheLookups.begin(), m_cacheLookups.end(), job));
+
+    if (job->isCancelled)
+        FinishJob(job, TEXT(""), PAGE_IMAGE_CANCELLED);
+    else if (isCached)
+    {
+        // return the cached image without rendering the page
+        m_stats.numPending--;
+        m_stats.numCacheHits++;
+
+        Zephyros::JavaScript::Array args = Zephyros::JavaScript::CreateArray();
+        args->SetString(0, imageData);
+        g_handler->GetClientExtensionHandler()->InvokeCallback(job->callbackId, args);
+
+        delete job;
+    }
+    else
+    {
+        m_queue.push_back(job);
+        Dispatch();
+    }
+}
+
+void PageImagePool::SetOptions(int maxRenderers, int jobsPerRenderer, int timeout, double maxCacheSize)
+{
+    if (maxRenderers > 0)
+        m_maxRenderers = std::min(maxRenderers, PAGE_IMAGE_MAX_RENDERERS);
+    if (jobsPerRenderer > 0)
+        m_jobsPerRenderer = jobsPerRenderer;
+    if (timeout > 0)
+        m_timeout = timeout;
+    if (maxCacheSize >= 0)
+        CefPostTask(TID_FILE, base::Bind(&ThumbnailCache::SetMaxSize, base::Unretained(&m_cache), (size_t) maxCacheSize));
+
+    // close the idle renderers exceeding the new maximum; busy ones are
+    // closed when they have finished their jobs
+    std::vector<CefRefPtr<OffscreenRenderer> > renderers(m_renderers);
+    for (std::vector<CefRefPtr<OffscreenRenderer> >::iterator it = renderers.begin(); it != renderers.end(); ++it)
+    {
+        if ((int) m_renderers.size() <= m_maxRenderers)
+            break;
+        if ((*it)->IsIdle())
+            CloseRenderer(it->get());
+    }
+
+    Dispatch();
+}
+
+//
+// Cancels the jobs for the URL "url", or all jobs if "url" is empty.
+// The callbacks of the cancelled jobs are invoked with an empty string.
+//
+void PageImagePool::Cancel(String url)
+{
+    // finished when the cache lookup returns
+    for (std::vector<PageImageJob*>::iterator it = m_cacheLookups.begin(); it != m_cacheLookups.end(); ++it)
+        if (url.length() == 0 || (*it)->url == url)
+            (*it)->isCancelled = true;
+
+    std::deque<PageImageJob*> queue;
+    queue.swap(m_queue);
+
+    for (std::deque<PageImageJob*>::iterator it = queue.begin(); it != queue.end(); ++it)
+    {
+        if (url.length() == 0 || (*it)->url == url)
+            FinishJob(*it, TEXT(""), PAGE_IMAGE_CANCELLED);
+        else
+            m_queue.push_back(*it);
+    }
+
+    // cancelling a job modifies the list of renderers
+    std::vector<CefRefPtr<OffscreenRenderer> > renderers;
+    for (std::vector<CefRefPtr<OffscreenRenderer> >::iterator it = m_renderers.begin(); it != m_renderers.end(); ++it)
+    {
+        PageImageJob* job = (*it)->GetJob();
+        if (job != NULL && (url.length() == 0 || job->url == url))
+            renderers.push_back(*it);
+    }
+
+    for (std::vector<CefRefPtr<OffscreenRenderer> >::iterator it = renderers.begin(); it != renderers.end(); ++it)
+        (*it)->Cancel();
+}
+
+void PageImagePool::InvalidateCache(String url)
+{
+    CefPostTask(TID_FILE, base::Bind(&ThumbnailCache::Invalidate, base::Unretained(&m_cache), url));
+}
+
+void PageImagePool::GetStatistics(Zephyros::PageImage::PageImageStatistics& stats)
+{
+    int numFinished = m_stats.numSucceeded + m_stats.numFailed + m_stats.numTimedOut + m_stats.numCancelled;
+
+    stats = m_stats;
+    stats.numRenderers = (int) m_renderers.size();
+    stats.averageLatency = numFinished > 0 ? m_totalLatency / numFinished : 0;
+}
+
+//
+// Called when a renderer has captured a page. The image is encoded on a
+// conversion thread, so the renderer can take the next job in the meantime.
+//
+void PageImagePool::OnJobFinished(OffscreenRenderer* renderer, PageImageJob* job, const std::vector<unsigned char>& pixels, int status)
+{
+    if (status == PAGE_IMAGE_SUCCEEDED || status == PAGE_IMAGE_TIMED_OUT)
+        ImageUtil::PostConversionTask(base::Bind(&PageImagePool::EncodeImage, base::Unretained(this), job, pixels, status));
+    else
+        FinishJob(job, TEXT(""), status);
+
+    if (renderer->m_hasCrashed || renderer->m_numJobs >= m_jobsPerRenderer || (int) m_renderers.size() > m_maxRenderers)
+        CloseRenderer(renderer);
+    else if (m_queue.size() == 0)
+    {
+        // stop the page from running scripts
+        renderer->LoadBlankPage();
+    }
+
+    Dispatch();
+}
+
+//
+// Scales the captured pixels to the requested width, encodes them as a PNG
+// data URL and caches the image. Called on a conversion thread.
+//
+void PageImagePool::EncodeImage(PageImageJob* job, const std::vector<unsigned char>& pixels, int status)
 {
-    if (g_offscreenHandler && g_offscreenHandler.get())
-        g_offscreenHandler->ReturnResult();
+    String imageData;
+    std::vector<unsigned char> png;
+    int imageHeight = (int) (((long) job->width * Zephyros::PageImage::ImageHeight) / Zephyros::PageImage::ImageWidth);
+
+    if (ImageUtil::BGRAToPNG(&pixels[0], Zephyros::PageImage::ImageWidth, Zephyros::PageImage::ImageHeight, job->width, imageHeight, png))
+    {
+        imageData = TEXT("data:image/png;base64,") + ImageUtil::Base64Encode((char*) &png[0], png.size());
+
+        // images of pages which haven't settled in time aren't cached
+        if (status == PAGE_IMAGE_SUCCEEDED)
+            m_cache.Put(job->url, job->width, job->version, png, imageData);
+    }
+    else
+        status = PAGE_IMAGE_FAILED;
+
+    CefPostTask(TID_UI, base::Bind(&PageImagePool::FinishJob, base::Unretained(this), job, imageData, status));
+}
+
+void PageImagePool::OnRendererCreated(OffscreenRenderer* renderer)
+{
+    Dispatch();
+}
+
+//
+// Assigns the queued jobs to idle renderers, and creates new renderers
+// unless the maximum number has been reached.
+//
+void PageImagePool::Dispatch()
+{
+    while (m_queue.size() > 0)
+    {
+        OffscreenRenderer* renderer = NULL;
+        for (std::vector<CefRefPtr<OffscreenRenderer> >::iterator it = m_renderers.begin(); it != m_renderers.end(); ++it)
+        {
+            if ((*it)->IsIdle())
+            {
+                renderer = it->get();
+                break;
+            }
+        }
+
+        if (renderer == NULL && (int) m_renderers.size() >= m_maxRenderers)
+            break;
+
+        PageImageJob* job = m_queue.front();
+        m_queue.pop_front();
+
+        if (renderer != NULL)
+            renderer->Start(job);
+        else
+            m_renderers.push_back(new OffscreenRenderer(job));
+    }
+}
+
+void PageImagePool::FinishJob(PageImageJob* job, String imageData, int status)
+{
+    double latency = TimeUtil::GetMonotonicTime() - job->startTime;
+
+    m_stats.numPending--;
+    if (status == PAGE_IMAGE_SUCCEEDED)
+        m_stats.numSucceeded++;
+    else if (status == PAGE_IMAGE_TIMED_OUT)
+        m_stats.numTimedOut++;
+    else if (status == PAGE_IMAGE_CANCELLED)
+        m_stats.numCancelled++;
+    else
+        m_stats.numFailed++;
+    m_totalLatency += latency;
+    m_stats.maxLatency = std::max(m_stats.maxLatency, latency);
+
+    // an empty string if the page couldn't be captured
+    Zephyros::JavaScript::Array args = Zephyros::JavaScript::CreateArray();
+    args->SetString(0, imageData);
+    g_handler->GetClientExtensionHandler()->InvokeCallback(job->callbackId, args);
+
+    delete job;
+}
+
+void PageImagePool::CloseRenderer(OffscreenRenderer* renderer)
+{
+    // keep the renderer alive until its browser has been closed
+    CefRefPtr<OffscreenRenderer> ref(renderer);
+
+    for (std::vector<CefRefPtr<OffscreenRenderer> >::iterator it = m_renderers.begin(); it != m_renderers.end(); ++it)
+    {
+        if (it->get() == renderer)
+        {
+            m_renderers.erase(it);
+            break;
+        }
+    }
+
+    renderer->Close();
 }
-*/
 
 
 namespace Zephyros {
@@ -224,19 +679,48 @@ namespace PageImage {
 
 void GetPageImageForURL(CallbackId callback, String url, int width)
 {
-    if (g_offscreenHandler == NULL)
-    {
-        g_offscreenHandler = new OffscreenClientHandler();
+    GetPageImageForURL(callback, url, width, TEXT(""));
+}
 
-        CefWindowInfo info;
-        info.SetAsWindowless(NULL, false);
+void GetPageImageForURL(CallbackId callback, String url, int width, String version)
+{
+    if (g_pageImagePool == NULL)
+        g_pageImagePool = new PageImagePool();
 
-        CefBrowserSettings settings;
+    g_pageImagePool->AddJob(url, width, version, callback);
+}
 
-        CefBrowserHost::CreateBrowser(info, g_offscreenHandler.get(), url, settings, NULL);
+void SetOptions(int maxRenderers, int jobsPerRenderer, int timeout, double maxCacheSize)
+{
+    if (g_pageImagePool == NULL)
+        g_pageImagePool = new PageImagePool();
+
+    g_pageImagePool->SetOptions(maxRenderers, jobsPerRenderer, timeout, maxCacheSize);
+}
+
+void InvalidateCache(String url)
+{
+    if (g_pageImagePool == NULL)
+        g_pageImagePool = new PageImagePool();
+
+    g_pageImagePool->InvalidateCache(url);
+}
+
+void Cancel(String url)
+{
+    if (g_pageImagePool != NULL)
+        g_pageImagePool->Cancel(url);
+}
+
+void GetStatistics(PageImageStatistics& stats)
+{
+    if (g_pageImagePool == NULL)
+    {
+        memset(&stats, 0, sizeof(stats));
+        return;
     }
 
-    g_offscreenHandler->AddToQueue(url, width, callback);
+    g_pageImagePool->GetStatistics(stats);
 }
 
 } // namespace PageImage
@@ -0,0 +1,178 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#ifndef Zephyros_ProcessPool_h
+#define Zephyros_ProcessPool_h
+#pragma once
+
+
+#include <deque>
+#include <vector>
+#include <string>
+
+#include "base/types.h"
+#include "native_extensions/child_process.h"
+#include "native_extensions/error.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// Constants
+
+// The maximum number of workers of a pool
+#define MAX_POOL_WORKERS 64
+
+// A worker terminating earlier than this many milliseconds after it has been
+// started is restarted with a growing delay, so a worker which can't start
+// doesn't keep the machine busy
+#define POOL_WORKER_MIN_UPTIME_MS 1000
+#define POOL_WORKER_MIN_RESTART_DELAY_MS 100
+#define POOL_WORKER_MAX_RESTART_DELAY_MS 5000
+
+// The length of the header of a message: the length of the payload in bytes
+// as a 32 bit big-endian integer
+#define POOL_MESSAGE_HEADER_LEN 4
+
+// A worker announcing a longer response is considered broken and restarted
+#define POOL_MAX_MESSAGE_LEN (256 * 1024 * 1024)
+
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+
+// A request waiting for a worker or being processed by one
+typedef struct {
+    CallbackId callback;
+    std::string data;
+    double enqueueTime;
+} PoolRequest;
+
+typedef struct {
+#ifdef OS_LINUX
+    scoped_refptr<ProcessPipes> pipes;
+#endif
+
+    // the output which hasn't been parsed into responses yet
+    std::string output;
+
+    bool isRunning;
+    bool isBusy;
+    PoolRequest request;
+
+    double startTime;
+    int restartDelay;
+} PoolWorker;
+
+// Queueing and latency metrics of a pool; times are in milliseconds
+typedef struct {
+    int numWorkers;
+    int numRunningWorkers;
+    int numBusyWorkers;
+
+    int numQueuedRequests;
+    int maxQueuedRequests;
+
+    int numCompletedRequests;
+    int numFailedRequests;
+    int numRestarts;
+
+    double averageQueueTime;
+    double averageLatency;
+    double maxLatency;
+} ProcessPoolStatus;
+
+
+//////////////////////////////////////////////////////////////////////////
+// ProcessPool Definition
+
+namespace Zephyros {
+
+// Keeps a number of long-lived workers running the same executable, and
+// dispatches requests to idle workers. Requests and responses are framed as
+// messages on the workers' stdin and stdout: a header containing the length
+// of the payload, followed by the payload. Workers are expected to respond
+// to each request with exactly one message, and to terminate when their
+// stdin is closed.
+class ProcessPool
+{
+    //////////////////////////////////////////////////////////////////////
+    // Public Methods
+
+public:
+    ProcessPool(String executableFileName, std::vector<String> arguments, String cwd, int numWorkers);
+    ~ProcessPool();
+
+    bool Start(Error& err);
+
+    void Send(CallbackId callback, const String& data);
+    void GetStatus(ProcessPoolStatus& status);
+
+#ifdef OS_LINUX
+    static void FireWorkerOutputOnUIThread(int handle, scoped_refptr<ProcessPipes> pipes);
+    static void RestartWorkerOnUIThread(int handle, int index);
+#endif
+
+private:
+#ifdef OS_LINUX
+    bool StartWorker(int index, Error& err);
+    void OnWorkerOutput(ProcessPipes* pipes);
+    void ScheduleRestart(int index);
+    void Dispatch();
+    void Complete(PoolWorker& worker, const std::string& response);
+    void Fail(PoolRequest& request, const String& message);
+#endif
+
+
+    //////////////////////////////////////////////////////////////////////
+    // Member Variables
+
+public:
+    // the handle passed to JavaScript
+    int m_handle;
+
+private:
+    String m_executableFileName;
+    std::vector<String> m_arguments;
+    String m_cwd;
+
+    std::vector<PoolWorker> m_workers;
+    std::deque<PoolRequest> m_queue;
+
+    // metrics; times are in milliseconds
+    int m_maxQueuedRequests;
+    int m_numDispatchedRequests;
+    int m_numCompletedRequests;
+    int m_numFailedRequests;
+    int m_numRestarts;
+    double m_totalQueueTime;
+    double m_totalLatency;
+    double m_maxLatency;
+};
+
+} // namespace Zephyros
+
+
+#endif // Zephyros_ProcessPool_h
@@ -0,0 +1,371 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#include <algorithm>
+#include <map>
+
+#include <signal.h>
+#include <time.h>
+
+#include "lib/cef/include/base/cef_bind.h"
+#include "lib/cef/include/wrapper/cef_closure_task.h"
+
+#include "base/app.h"
+#include "base/cef/client_handler.h"
+#include "base/cef/extension_handler.h"
+
+#include "util/time_util.h"
+
+#include "native_extensions/process_pool.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+
+static Zephyros::ProcessPool* FindProcessPool(int handle)
+{
+    Zephyros::DefaultNativeExtensions* extensions = (Zephyros::DefaultNativeExtensions*) Zephyros::GetNativeExtensions();
+    std::map<int, Zephyros::ProcessPool*>::iterator it = extensions->m_processPools.find(handle);
+    return it == extensions->m_processPools.end() ? NULL : it->second;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ProcessPool Implementation
+
+namespace Zephyros {
+
+ProcessPool::ProcessPool(String executableFileName, std::vector<String> arguments, String cwd, int numWorkers)
+  : m_handle(0),
+    m_executableFileName(executableFileName),
+    m_arguments(arguments),
+    m_cwd(cwd),
+    m_maxQueuedRequests(0),
+    m_numDispatchedRequests(0),
+    m_numCompletedRequests(0),
+    m_numFailedRequests(0),
+    m_numRestarts(0),
+    m_totalQueueTime(0),
+    m_totalLatency(0),
+    m_maxLatency(0)
+{
+    PoolWorker worker;
+    worker.isRunning = false;
+    worker.isBusy = false;
+    worker.startTime = 0;
+    worker.restartDelay = 0;
+
+    m_workers.resize((size_t) std::max(1, std::min(numWorkers, MAX_POOL_WORKERS)), worker);
+}
+
+ProcessPool::~ProcessPool()
+{
+    // the workers are expected to terminate when their stdin is closed,
+    // and are killed if they don't
+    for (PoolWorker& worker : m_workers)
+    {
+        if (worker.isRunning)
+            worker.pipes->Shutdown();
+        if (worker.isBusy)
+            Fail(worker.request, TEXT("The process pool has been destroyed"));
+    }
+
+    while (m_queue.size() > 0)
+    {
+        Fail(m_queue.front(), TEXT("The process pool has been destroyed"));
+        m_queue.pop_front();
+    }
+}
+
+//
+// Starts all workers. Fails if the first worker can't be started; workers
+// which fail later are retried.
+//
+bool ProcessPool::Start(Error& err)
+{
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        if (!StartWorker((int) i, err))
+        {
+            if (i == 0)
+                return false;
+            ScheduleRestart((int) i);
+        }
+    }
+
+    return true;
+}
+
+void ProcessPool::Send(CallbackId callback, const String& data)
+{
+    PoolRequest request;
+    request.callback = callback;
+    request.data = data;
+    request.enqueueTime = TimeUtil::GetMonotonicTime();
+    m_queue.push_back(request);
+
+    m_maxQueuedRequests = std::max(m_maxQueuedRequests, (int) m_queue.size());
+    Dispatch();
+}
+
+void ProcessPool::GetStatus(ProcessPoolStatus& status)
+{
+    status.numWorkers = (int) m_workers.size();
+    status.numRunningWorkers = 0;
+    status.numBusyWorkers = 0;
+    for (PoolWorker& worker : m_workers)
+    {
+        if (worker.isRunning)
+            ++status.numRunningWorkers;
+        if (worker.isBusy)
+            ++status.numBusyWorkers;
+    }
+
+    status.numQueuedRequests = (int) m_queue.size();
+    status.maxQueuedRequests = m_maxQueuedRequests;
+    status.numCompletedRequests = m_numCompletedRequests;
+    status.numFailedRequests = m_numFailedRequests;
+    status.numRestarts = m_numRestarts;
+
+    status.averageQueueTime = m_numDispatchedRequests > 0 ? m_totalQueueTime / m_numDispatchedRequests : 0;
+    status.averageLatency = m_numCompletedRequests > 0 ? m_totalLatency / m_numCompletedRequests : 0;
+    status.maxLatency = m_maxLatency;
+}
+
+void ProcessPool::FireWorkerOutputOnUIThread(int handle, scoped_refptr<ProcessPipes> pipes)
+{
+    ProcessPool* pool = FindProcessPool(handle);
+    if (pool)
+        pool->OnWorkerOutput(pipes.get());
+}
+
+void ProcessPool::RestartWorkerOnUIThread(int handle, int index)
+{
+    ProcessPool* pool = FindProcessPool(handle);
+    if (pool == NULL)
+        return;
+
+    Error err;
+    if (pool->StartWorker(index, err))
+        pool->Dispatch();
+    else
+        pool->ScheduleRestart(index);
+}
+
+bool ProcessPool::StartWorker(int index, Error& err)
+{
+    PoolWorker& worker = m_workers[index];
+    worker.startTime = TimeUtil::GetMonotonicTime();
+    worker.output.clear();
+
+    // the executable path and the working directory are handled like in startProcess
+    worker.isRunning = ChildProcess::StartWorker(m_handle, m_executableFileName, m_arguments, m_cwd, worker.pipes, err);
+    return worker.isRunning;
+}
+
+//
+// Restarts a worker which has terminated or couldn't be started. Workers
+// which terminate right after they have been started are restarted with
+// a growing delay.
+//
+void ProcessPool::ScheduleRestart(int index)
+{
+    PoolWorker& worker = m_workers[index];
+
+    if (TimeUtil::GetMonotonicTime() - worker.startTime >= POOL_WORKER_MIN_UPTIME_MS)
+        worker.restartDelay = 0;
+    else if (worker.restartDelay == 0)
+        worker.restartDelay = POOL_WORKER_MIN_RESTART_DELAY_MS;
+    else
+        worker.restartDelay = std::min(worker.restartDelay * 2, POOL_WORKER_MAX_RESTART_DELAY_MS);
+
+    ++m_numRestarts;
+    CefPostDelayedTask(TID_UI, base::Bind(&ProcessPool::RestartWorkerOnUIThread, m_handle, index), worker.restartDelay);
+
+    // don't keep requests waiting if no worker can run them
+    bool hasRunningWorkers = false;
+    for (PoolWorker& w : m_workers)
+    {
+        if (w.isRunning)
+            hasRunningWorkers = true;
+    }
+
+    if (!hasRunningWorkers && worker.restartDelay >= POOL_WORKER_MAX_RESTART_DELAY_MS)
+    {
+        while (m_queue.size() > 0)
+        {
+            Fail(m_queue.front(), TEXT("No worker of the process pool is running"));
+            m_queue.pop_front();
+        }
+    }
+}
+
+//
+// Parses the output of a worker into responses.
+//
+void ProcessPool::OnWorkerOutput(ProcessPipes* pipes)
+{
+    int index = -1;
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        if (m_workers[i].pipes.get() == pipes)
+        {
+            index = (int) i;
+            break;
+        }
+    }
+
+    // output of a worker which has been replaced
+    if (index < 0)
+        return;
+
+    PoolWorker& worker = m_workers[index];
+
+    std::vector<ProcessOutputChunk> chunks;
+    int exitCode = -1;
+    bool hasExited = pipes->TakeOutput(chunks, exitCode);
+
+    for (ProcessOutputChunk& chunk : chunks)
+    {
+        if (chunk.stream == STREAM_STDOUT)
+            worker.output.append(chunk.text);
+        else
+            App::Log(m_executableFileName + TEXT(": ") + chunk.text);
+    }
+
+    // a message is a header containing the length of the payload, followed by the payload
+    size_t pos = 0;
+    while (worker.output.length() - pos >= POOL_MESSAGE_HEADER_LEN)
+    {
+        const unsigned char* header = (const unsigned char*) worker.output.c_str() + pos;
+        size_t len = ((size_t) header[0] << 24) | ((size_t) header[1] << 16) | ((size_t) header[2] << 8) | (size_t) header[3];
+        if (len > POOL_MAX_MESSAGE_LEN)
+        {
+            // don't buffer an unbounded amount of garbage
+            App::Log(m_executableFileName + TEXT(": invalid message length ") + TO_STRING(len));
+            worker.output.clear();
+            worker.pipes->Kill(SIGKILL);
+            worker.isRunning = false;
+            worker.pipes = NULL;
+
+            if (worker.isBusy)
+            {
+                worker.isBusy = false;
+                Fail(worker.request, TEXT("The worker has sent an invalid response"));
+            }
+
+            ScheduleRestart(index);
+            Dispatch();
+            return;
+        }
+
+        if (worker.output.length() - pos - POOL_MESSAGE_HEADER_LEN < len)
+            break;
+
+        Complete(worker, worker.output.substr(pos + POOL_MESSAGE_HEADER_LEN, len));
+        pos += POOL_MESSAGE_HEADER_LEN + len;
+    }
+    worker.output.erase(0, pos);
+
+    if (hasExited)
+    {
+        worker.isRunning = false;
+        worker.pipes = NULL;
+
+        if (worker.isBusy)
+        {
+            worker.isBusy = false;
+            Fail(worker.request, TEXT("The worker has terminated with exit code ") + TO_STRING(exitCode));
+        }
+
+        ScheduleRestart(index);
+    }
+
+    Dispatch();
+}
+
+//
+// Passes the queued requests to the idle workers.
+//
+void ProcessPool::Dispatch()
+{
+    for (PoolWorker& worker : m_workers)
+    {
+        if (m_queue.size() == 0)
+            break;
+        if (!worker.isRunning || worker.isBusy)
+            continue;
+
+        worker.request = m_queue.front();
+        worker.isBusy = true;
+        m_queue.pop_front();
+
+        ++m_numDispatchedRequests;
+        m_totalQueueTime += TimeUtil::GetMonotonicTime() - worker.request.enqueueTime;
+
+        size_t len = worker.request.data.length();
+        char header[POOL_MESSAGE_HEADER_LEN] = {
+            (char) ((len >> 24) & 0xff), (char) ((len >> 16) & 0xff), (char) ((len >> 8) & 0xff), (char) (len & 0xff)
+        };
+
+        worker.pipes->WriteInput(std::string(header, POOL_MESSAGE_HEADER_LEN) + worker.request.data);
+    }
+}
+
+void ProcessPool::Complete(PoolWorker& worker, const std::string& response)
+{
+    // unsolicited responses are dropped
+    if (!worker.isBusy)
+        return;
+
+    worker.isBusy = false;
+
+    double latency = TimeUtil::GetMonotonicTime() - worker.request.enqueueTime;
+    ++m_numCompletedRequests;
+    m_totalLatency += latency;
+    m_maxLatency = std::max(m_maxLatency, latency);
+
+    JavaScript::Array args = JavaScript::CreateArray();
+    args->SetNull(0);
+    args->SetString(1, response);
+    Zephyros::GetNativeExtensions()->GetClientExtensionHandler()->InvokeCallback(worker.request.callback, args);
+}
+
+void ProcessPool::Fail(PoolRequest& request, const String& message)
+{
+    ++m_numFailedRequests;
+
+    Error err;
+    err.SetError(ERR_UNKNOWN, message);
+
+    JavaScript::Array args = JavaScript::CreateArray();
+    args->SetDictionary(0, err.CreateJSRepresentation());
+    args->SetNull(1);
+    Zephyros::GetNativeExtensions()->GetClientExtensionHandler()->InvokeCallback(request.callback, args);
+}
+
+} // namespace Zephyros
@@ -0,0 +1,347 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util/MurmurHash3.h"
+#include "util/string_util.h"
+
+#include "native_extensions/image_util_linux.h"
+#include "native_extensions/thumbnail_cache_linux.h"
+
+
+// The images are stored as "<hash of the URL>-<width>-<hash of the version>.png"
+#define THUMBNAIL_EXTENSION TEXT(".png")
+
+// The modification time of a file, which records its last access, is
+// updated at most once in this many seconds
+#define THUMBNAIL_TOUCH_INTERVAL 60
+
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+
+static double GetCurrentTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static String GetURLPrefix(const String& url)
+{
+    uint64_t hash[2];
+    MurmurHash3_x64_128(url.c_str(), (int) url.length(), 0, hash);
+
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "%016llx-", (unsigned long long) hash[0]);
+    return prefix;
+}
+
+static String GetWidthPrefix(const String& url, int width)
+{
+    StringStream ss;
+    ss << GetURLPrefix(url) << width << TEXT("-");
+    return ss.str();
+}
+
+static String GetEntryName(const String& url, int width, const String& version)
+{
+    uint32_t hash;
+    MurmurHash3_x86_32(version.c_str(), (int) version.length(), 0, &hash);
+
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "%08x", hash);
+    return GetWidthPrefix(url, width) + suffix + THUMBNAIL_EXTENSION;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ThumbnailCache Implementation
+
+ThumbnailCache::ThumbnailCache(String directory, size_t maxSize, size_t maxMemorySize)
+    : m_directory(directory), m_isLoaded(false), m_size(0), m_maxSize(maxSize), m_memorySize(0), m_maxMemorySize(maxMemorySize)
+{
+}
+
+bool ThumbnailCache::Get(const String& url, int width, const String& version, String& dataURL)
+{
+    base::AutoLock lock(m_lock);
+
+    if (!IsEnabled())
+        return false;
+
+    Load();
+    String name = GetEntryName(url, width, version);
+
+    std::map<String, std::pair<String, std::list<String>::iterator> >::iterator itMemory = m_memory.find(name);
+    if (itMemory != m_memory.end())
+    {
+        dataURL = itMemory->second.first;
+        m_memoryLRU.splice(m_memoryLRU.begin(), m_memoryLRU, itMemory->second.second);
+        Touch(name);
+        return true;
+    }
+
+    if (m_entries.find(name) == m_entries.end())
+        return false;
+
+    std::ifstream file((m_directory + TEXT("/") + name).c_str(), std::ios::in | std::ios::binary);
+    std::stringstream ss;
+    if (file.is_open())
+        ss << file.rdbuf();
+
+    // the file has been removed by another instance of the app
+    std::string png = ss.str();
+    if (png.length() == 0)
+    {
+        Remove(name);
+        return false;
+    }
+
+    dataURL = TEXT("data:image/png;base64,") + ImageUtil::Base64Encode(&png[0], png.length());
+    AddToMemory(name, dataURL);
+    Touch(name);
+
+    return true;
+}
+
+void ThumbnailCache::Put(const String& url, int width, const String& version, const std::vector<unsigned char>& png, const String& dataURL)
+{
+    base::AutoLock lock(m_lock);
+
+    if (!IsEnabled() || png.size() == 0)
+        return;
+
+    Load();
+
+    // the images of other versions are outdated
+    std::vector<String> names;
+    String prefix = GetWidthPrefix(url, width);
+    for (std::map<String, Entry>::iterator it = m_entries.lower_bound(prefix); it != m_entries.end() && StringStartsWith(it->first, prefix); ++it)
+        names.push_back(it->first);
+    for (std::vector<String>::iterator it = names.begin(); it != names.end(); ++it)
+        Remove(*it);
+
+    // write the file atomically, so another instance never reads a partial image
+    String name = GetEntryName(url, width, version);
+    String filename = m_directory + TEXT("/") + name;
+    String tmpFilename = filename + TEXT(".tmp");
+
+    std::ofstream file(tmpFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return;
+
+    file.write((const char*) &png[0], png.size());
+    file.close();
+
+    if (file.fail() || rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        unlink(tmpFilename.c_str());
+        return;
+    }
+
+    Entry entry;
+    entry.size = png.size();
+    entry.lastAccess = GetCurrentTime();
+    m_entries[name] = entry;
+    m_lru.insert(std::make_pair(entry.lastAccess, name));
+    m_size += entry.size;
+
+    AddToMemory(name, dataURL);
+    Evict();
+}
+
+void ThumbnailCache::Invalidate(const String& url)
+{
+    base::AutoLock lock(m_lock);
+
+    Load();
+
+    String prefix = url.length() > 0 ? GetURLPrefix(url) : TEXT("");
+    std::vector<String> names;
+
+    for (std::map<String, Entry>::iterator it = m_entries.lower_bound(prefix); it != m_entries.end() && StringStartsWith(it->first, prefix); ++it)
+        names.push_back(it->first);
+    for (std::vector<String>::iterator it = names.begin(); it != names.end(); ++it)
+        Remove(*it);
+
+    names.clear();
+    for (std::map<String, std::pair<String, std::list<String>::iterator> >::iterator it = m_memory.lower_bound(prefix); it != m_memory.end() && StringStartsWith(it->first, prefix); ++it)
+        names.push_back(it->first);
+    for (std::vector<String>::iterator it = names.begin(); it != names.end(); ++it)
+        RemoveFromMemory(*it);
+}
+
+void ThumbnailCache::SetMaxSize(size_t maxSize)
+{
+    base::AutoLock lock(m_lock);
+
+    m_maxSize = maxSize;
+
+    if (m_maxSize == 0)
+    {
+        m_memory.clear();
+        m_memoryLRU.clear();
+        m_memorySize = 0;
+    }
+
+    Load();
+    Evict();
+}
+
+//
+// Reads the names, sizes and modification times of the files in the directory.
+//
+void ThumbnailCache::Load()
+{
+    if (m_isLoaded)
+        return;
+    m_isLoaded = true;
+
+    mkdir(m_directory.c_str(), S_IRWXU);
+
+    DIR* dir = opendir(m_directory.c_str());
+    if (dir == NULL)
+        return;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        String name = entry->d_name;
+        String filename = m_directory + TEXT("/") + name;
+
+        // left behind by an instance which has crashed while writing an image
+        if (StringEndsWith(name, TEXT(".tmp")))
+        {
+            unlink(filename.c_str());
+            continue;
+        }
+
+        struct stat st;
+        if (!StringEndsWith(name, THUMBNAIL_EXTENSION) || stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        Entry e;
+        e.size = (size_t) st.st_size;
+        e.lastAccess = st.st_mtim.tv_sec + st.st_mtim.tv_nsec / 1000000000.0;
+        m_entries[name] = e;
+        m_lru.insert(std::make_pair(e.lastAccess, name));
+        m_size += e.size;
+    }
+
+    closedir(dir);
+    Evict();
+}
+
+//
+// Records an access to an image; the time is persisted as the modification
+// time of the file, so the order of the entries survives restarts.
+//
+void ThumbnailCache::Touch(const String& name)
+{
+    std::map<String, Entry>::iterator it = m_entries.find(name);
+    if (it == m_entries.end())
+        return;
+
+    double now = GetCurrentTime();
+    if (now - it->second.lastAccess < THUMBNAIL_TOUCH_INTERVAL)
+        return;
+
+    m_lru.erase(std::make_pair(it->second.lastAccess, name));
+    it->second.lastAccess = now;
+    m_lru.insert(std::make_pair(now, name));
+
+    utimensat(AT_FDCWD, (m_directory + TEXT("/") + name).c_str(), NULL, 0);
+}
+
+void ThumbnailCache::Remove(const String& name)
+{
+    std::map<String, Entry>::iterator it = m_entries.find(name);
+    if (it != m_entries.end())
+    {
+        m_lru.erase(std::make_pair(it->second.lastAccess, name));
+        m_size -= it->second.size;
+        m_entries.erase(it);
+
+        unlink((m_directory + TEXT("/") + name).c_str());
+    }
+
+    RemoveFromMemory(name);
+}
+
+//
+// Removes the least recently used images until the files fit into the maximum size.
+//
+void ThumbnailCache::Evict()
+{
+    while (m_size > m_maxSize && m_lru.size() > 0)
+    {
+        String name = m_lru.begin()->second;
+        Remove(name);
+    }
+}
+
+void ThumbnailCache::AddToMemory(const String& name, const String& dataURL)
+{
+    RemoveFromMemory(name);
+
+    // don't let a single huge image flush all the others
+    if (dataURL.length() > m_maxMemorySize / 4)
+        return;
+
+    m_memoryLRU.push_front(name);
+    m_memory[name] = std::make_pair(dataURL, m_memoryLRU.begin());
+    m_memorySize += dataURL.length();
+
+    while (m_memorySize > m_maxMemorySize && m_memoryLRU.size() > 0)
+    {
+        String oldest = m_memoryLRU.back();
+        RemoveFromMemory(oldest);
+    }
+}
+
+void ThumbnailCache::RemoveFromMemory(const String& name)
+{
+    std::map<String, std::pair<String, std::list<String>::iterator> >::iterator it = m_memory.find(name);
+    if (it == m_memory.end())
+        return;
+
+    m_memorySize -= it->second.first.length();
+    m_memoryLRU.erase(it->second.second);
+    m_memory.erase(it);
+}
@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+
+#ifndef Zephyros_ThumbnailCacheLinux_h
+#define Zephyros_ThumbnailCacheLinux_h
+#pragma once
+
+
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "lib/cef/include/base/cef_lock.h"
+
+#include "base/types.h"
+#include "zephyros.h"
+
+
+//
+// Caches page images as PNG files in a directory, keyed by the URL, the
+// width and an optional version of the content. When the files exceed the
+// maximum size, the least recently used ones are removed. The most recently
+// used images are also kept in memory as data URLs.
+// Thread-safe; since the methods do file I/O, they shouldn't be called on
+// the UI thread.
+//
+class ThumbnailCache
+{
+public:
+    ThumbnailCache(String directory, size_t maxSize, size_t maxMemorySize);
+
+    // Retrieves the data URL of a cached image.
+    bool Get(const String& url, int width, const String& version, String& dataURL);
+
+    // Stores an image, replacing the images of other versions for the URL and width.
+    void Put(const String& url, int width, const String& version, const std::vector<unsigned char>& png, const String& dataURL);
+
+    // Removes the images for a URL, or all images if the URL is empty.
+    void Invalidate(const String& url);
+
+    // Changes the maximum size of the files; 0 disables the cache.
+    void SetMaxSize(size_t maxSize);
+
+private:
+    typedef struct
+    {
+        size_t size;
+        double lastAccess;
+    } Entry;
+
+    bool IsEnabled() const { return m_maxSize > 0; }
+
+    void Load();
+    void Touch(const String& name);
+    void Remove(const String& name);
+    void Evict();
+
+    void AddToMemory(const String& name, const String& dataURL);
+    void RemoveFromMemory(const String& name);
+
+private:
+    base::Lock m_lock;
+
+    String m_directory;
+    bool m_isLoaded;
+
+    // the files in the directory, and their names ordered by the time of the last access
+    std::map<String, Entry> m_entries;
+    std::set<std::pair<double, String> > m_lru;
+    size_t m_size;
+    size_t m_maxSize;
+
+    // the data URLs of the most recently used images, most recent first
+    std::list<String> m_memoryLRU;
+    std::map<String, std::pair<String, std::list<String>::iterator> > m_memory;
+    size_t m_memorySize;
+    size_t m_maxMemorySize;
+};
+
+
+#endif // Zephyros_ThumbnailCacheLinux_h
@@ -0,0 +1,501 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+
+#include <algorithm>
+#include <map>
+#include <type_traits>
+
+#include "util/glob_matcher.h"
+
+
+// The maximum number of states of the deterministic automaton. Beyond that,
+// the nondeterministic automaton is simulated when matching.
+#define MAX_AUTOMATON_STATES 2048
+
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+
+static unsigned int ToCodePoint(TCHAR c)
+{
+    return (unsigned int) (std::make_unsigned<String::value_type>::type) c;
+}
+
+static bool IsInCharClass(const std::vector<std::pair<unsigned int, unsigned int> >& ranges, unsigned int c)
+{
+    for (const std::pair<unsigned int, unsigned int>& range : ranges)
+        if (range.first <= c && c <= range.second)
+            return true;
+
+    return false;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// GlobMatcher Implementation
+
+GlobMatcher::GlobMatcher()
+    : m_isDeterministic(false), m_numSymbols(0)
+{
+    for (int i = 0; i < 128; ++i)
+        m_asciiSymbols[i] = 0;
+}
+
+void GlobMatcher::SetPatterns(const std::vector<String>& patterns)
+{
+    m_patterns.clear();
+    m_charClasses.clear();
+    m_tokens.clear();
+    m_startStates.clear();
+
+    for (const String& pattern : patterns)
+        ParsePattern(pattern);
+
+    for (size_t i = 0; i < m_tokens.size(); ++i)
+        if (i == 0 || m_tokens[i - 1].type == TOKEN_ACCEPT)
+            AddState(m_startStates, (int) i);
+
+    BuildAlphabet();
+    BuildAutomaton();
+}
+
+bool GlobMatcher::Matches(const String& path, bool isDirectory) const
+{
+    if (m_patterns.empty())
+        return false;
+
+    if (m_isDeterministic)
+    {
+        int state = 0;
+
+        for (size_t i = 0; i < path.length(); ++i)
+        {
+            unsigned int c = ToCodePoint(path[i]);
+#ifdef OS_WIN
+            if (c == '\\')
+                c = '/';
+#endif
+
+            // the path up to here is a parent directory; if it is matched,
+            // so is everything in it
+            if (c == '/' && i > 0 && IsPositiveMatch(m_directoryMatches[state]))
+                return true;
+
+            state = m_transitions[state * m_numSymbols + GetSymbol(c)];
+            if (state < 0)
+                return false;
+        }
+
+        return IsPositiveMatch(isDirectory ? m_directoryMatches[state] : m_fileMatches[state]);
+    }
+
+    StateSet states = m_startStates;
+    StateSet next;
+
+    for (size_t i = 0; i < path.length(); ++i)
+    {
+        unsigned int c = ToCodePoint(path[i]);
+#ifdef OS_WIN
+        if (c == '\\')
+            c = '/';
+#endif
+
+        if (c == '/' && i > 0 && IsPositiveMatch(GetMatch(states, true)))
+            return true;
+
+        Step(states, c, next);
+        if (next.empty())
+            return false;
+        states.swap(next);
+    }
+
+    return IsPositiveMatch(GetMatch(states, isDirectory));
+}
+
+//
+// Translates a pattern into tokens. Returns false if the line doesn't contain
+// a pattern.
+//
+bool GlobMatcher::ParsePattern(String pattern)
+{
+    // trailing whitespace is ignored unless it is escaped
+    while (!pattern.empty())
+    {
+        TCHAR c = pattern[pattern.length() - 1];
+        if ((c != TEXT(' ') && c != TEXT('\t') && c != TEXT('\r') && c != TEXT('\n')) ||
+            (pattern.length() > 1 && pattern[pattern.length() - 2] == TEXT('\\')))
+        {
+            break;
+        }
+
+        pattern.erase(pattern.length() - 1);
+    }
+
+    if (pattern.empty() || pattern[0] == TEXT('#'))
+        return false;
+
+    Pattern p;
+    p.isNegated = pattern[0] == TEXT('!');
+    p.isDirectoryOnly = false;
+
+    size_t start = p.isNegated ? 1 : 0;
+
+    // a trailing slash restricts the pattern to directories
+    while (pattern.length() > start && pattern[pattern.length() - 1] == TEXT('/'))
+    {
+        pattern.erase(pattern.length() - 1);
+        p.isDirectoryOnly = true;
+    }
+
+    // patterns containing a slash are relative to the root, the others match
+    // the name of a file or directory at any depth
+    bool isAnchored = pattern.find(TEXT('/'), start) != String::npos;
+    if (pattern.length() > start && pattern[start] == TEXT('/'))
+        ++start;
+    if (pattern.length() <= start)
+        return false;
+
+    if (!isAnchored)
+        AddGlobstarSlash();
+
+    for (size_t pos = start; pos < pattern.length(); )
+    {
+        TCHAR c = pattern[pos];
+
+        if (c == TEXT('\\') && pos + 1 < pattern.length())
+        {
+            Token token = { TOKEN_CHAR, ToCodePoint(pattern[pos + 1]) };
+            m_tokens.push_back(token);
+            pos += 2;
+        }
+        else if (c == TEXT('*'))
+        {
+            size_t end = pos;
+            while (end < pattern.length() && pattern[end] == TEXT('*'))
+                ++end;
+
+            // "**" only has its special meaning if it is a whole path component
+            bool isComponent = (pos == start || pattern[pos - 1] == TEXT('/')) &&
+                (end == pattern.length() || pattern[end] == TEXT('/'));
+
+            if (end - pos >= 2 && isComponent && end == pattern.length())
+            {
+                Token token = { TOKEN_GLOBSTAR, 0 };
+                m_tokens.push_back(token);
+                pos = end;
+            }
+            else if (end - pos >= 2 && isComponent)
+            {
+                AddGlobstarSlash();
+                pos = end + 1;
+            }
+            else
+            {
+                Token token = { TOKEN_STAR, 0 };
+                m_tokens.push_back(token);
+                pos = end;
+            }
+        }
+        else if (c == TEXT('?'))
+        {
+            Token token = { TOKEN_ANY, 0 };
+            m_tokens.push_back(token);
+            ++pos;
+        }
+        else if (c != TEXT('[') || !ParseCharClass(pattern, pos))
+        {
+            // an unterminated "[" is taken literally
+            Token token = { TOKEN_CHAR, ToCodePoint(c) };
+            m_tokens.push_back(token);
+            ++pos;
+        }
+    }
+
+    Token token = { TOKEN_ACCEPT, (unsigned int) m_patterns.size() };
+    m_tokens.push_back(token);
+    m_patterns.push_back(p);
+
+    return true;
+}
+
+//
+// Adds the tokens for "**/", which matches any number of directories. The
+// first token is entered at the start of a path component, the second one
+// while in the name of a directory.
+//
+void GlobMatcher::AddGlobstarSlash()
+{
+    Token token = { TOKEN_GLOBSTAR_SLASH, 0 };
+    m_tokens.push_back(token);
+    token.type = TOKEN_GLOBSTAR_NAME;
+    m_tokens.push_back(token);
+}
+
+//
+// Parses the character class starting at "pattern[pos]" ("[a-z]", "[!0-9]")
+// and advances "pos" past it. Returns false if the class isn't terminated.
+//
+bool GlobMatcher::ParseCharClass(const String& pattern, size_t& pos)
+{
+    CharClass charClass;
+    size_t i = pos + 1;
+
+    charClass.isNegated = i < pattern.length() && (pattern[i] == TEXT('!') || pattern[i] == TEXT('^'));
+    if (charClass.isNegated)
+        ++i;
+
+    // a "]" at the start is part of the class
+    size_t first = i;
+    for ( ; i < pattern.length() && (pattern[i] != TEXT(']') || i == first); ++i)
+    {
+        if (pattern[i] == TEXT('\\') && i + 1 < pattern.length())
+            ++i;
+
+        unsigned int lo = ToCodePoint(pattern[i]);
+        unsigned int hi = lo;
+
+        if (i + 2 < pattern.length() && pattern[i + 1] == TEXT('-') && pattern[i + 2] != TEXT(']'))
+        {
+            i += 2;
+            if (pattern[i] == TEXT('\\') && i + 1 < pattern.length())
+                ++i;
+            hi = ToCodePoint(pattern[i]);
+        }
+
+        if (lo <= hi)
+            charClass.ranges.push_back(std::make_pair(lo, hi));
+    }
+
+    if (i >= pattern.length())
+        return false;
+
+    Token token = { TOKEN_CLASS, (unsigned int) m_charClasses.size() };
+    m_tokens.push_back(token);
+    m_charClasses.push_back(charClass);
+    pos = i + 1;
+
+    return true;
+}
+
+//
+// Partitions the characters into symbols, such that the characters of a
+// symbol are treated the same by all tokens. This keeps the transition table
+// small even for wide characters.
+//
+void GlobMatcher::BuildAlphabet()
+{
+    m_boundaries.clear();
+    m_boundaries.push_back(0);
+    m_boundaries.push_back('/');
+    m_boundaries.push_back('/' + 1);
+
+    for (const Token& token : m_tokens)
+    {
+        if (token.type == TOKEN_CHAR)
+        {
+            m_boundaries.push_back(token.value);
+            m_boundaries.push_back(token.value + 1);
+        }
+        else if (token.type == TOKEN_CLASS)
+        {
+            for (const std::pair<unsigned int, unsigned int>& range : m_charClasses[token.value].ranges)
+            {
+                m_boundaries.push_back(range.first);
+                m_boundaries.push_back(range.second + 1);
+            }
+        }
+    }
+
+    std::sort(m_boundaries.begin(), m_boundaries.end());
+    m_boundaries.erase(std::unique(m_boundaries.begin(), m_boundaries.end()), m_boundaries.end());
+    m_numSymbols = (int) m_boundaries.size();
+
+    for (unsigned int c = 0; c < 128; ++c)
+        m_asciiSymbols[c] = (int) (std::upper_bound(m_boundaries.begin(), m_boundaries.end(), c) - m_boundaries.begin()) - 1;
+}
+
+//
+// Builds the deterministic automaton by subset construction. State 0 is the
+// start state; transitions to -1 mean that no pattern can match any more.
+//
+void GlobMatcher::BuildAutomaton()
+{
+    m_transitions.clear();
+    m_directoryMatches.clear();
+    m_fileMatches.clear();
+    m_isDeterministic = true;
+
+    std::map<StateSet, int> ids;
+    std::vector<StateSet> sets;
+    StateSet next;
+
+    sets.push_back(m_startStates);
+    ids[m_startStates] = 0;
+
+    for (size_t i = 0; i < sets.size(); ++i)
+    {
+        StateSet states = sets[i];
+
+        m_directoryMatches.push_back(GetMatch(states, true));
+        m_fileMatches.push_back(GetMatch(states, false));
+
+        for (int symbol = 0; symbol < m_numSymbols; ++symbol)
+        {
+            Step(states, m_boundaries[symbol], next);
+            if (next.empty())
+            {
+                m_transitions.push_back(-1);
+                continue;
+            }
+
+            std::sort(next.begin(), next.end());
+            std::map<StateSet, int>::iterator it = ids.find(next);
+            if (it != ids.end())
+            {
+                m_transitions.push_back(it->second);
+                continue;
+            }
+
+            if (sets.size() >= MAX_AUTOMATON_STATES)
+            {
+                m_isDeterministic = false;
+                m_transitions.clear();
+                m_directoryMatches.clear();
+                m_fileMatches.clear();
+                return;
+            }
+
+            ids[next] = (int) sets.size();
+            m_transitions.push_back((int) sets.size());
+            sets.push_back(next);
+        }
+    }
+}
+
+int GlobMatcher::GetSymbol(unsigned int c) const
+{
+    if (c < 128)
+        return m_asciiSymbols[c];
+
+    return (int) (std::upper_bound(m_boundaries.begin(), m_boundaries.end(), c) - m_boundaries.begin()) - 1;
+}
+
+//
+// Adds "state" and the states reachable from it without consuming a character.
+//
+void GlobMatcher::AddState(StateSet& states, int state) const
+{
+    if (std::find(states.begin(), states.end(), state) != states.end())
+        return;
+
+    states.push_back(state);
+
+    TokenType type = m_tokens[state].type;
+    if (type == TOKEN_STAR || type == TOKEN_GLOBSTAR)
+        AddState(states, state + 1);
+    else if (type == TOKEN_GLOBSTAR_SLASH)
+        AddState(states, state + 2);
+}
+
+//
+// Computes the states reached from "states" by consuming "c".
+//
+void GlobMatcher::Step(const StateSet& states, unsigned int c, StateSet& next) const
+{
+    next.clear();
+
+    for (int state : states)
+    {
+        const Token& token = m_tokens[state];
+
+        switch (token.type)
+        {
+        case TOKEN_CHAR:
+            if (c == token.value)
+                AddState(next, state + 1);
+            break;
+
+        case TOKEN_ANY:
+            if (c != '/')
+                AddState(next, state + 1);
+            break;
+
+        case TOKEN_CLASS:
+            if (c != '/' && IsInCharClass(m_charClasses[token.value].ranges, c) != m_charClasses[token.value].isNegated)
+                AddState(next, state + 1);
+            break;
+
+        case TOKEN_STAR:
+            if (c != '/')
+                AddState(next, state);
+            break;
+
+        case TOKEN_GLOBSTAR:
+            AddState(next, state);
+            break;
+
+        case TOKEN_GLOBSTAR_SLASH:
+            if (c != '/')
+                AddState(next, state + 1);
+            break;
+
+        case TOKEN_GLOBSTAR_NAME:
+            // the end of the directory name; another one or the rest of the pattern may follow
+            AddState(next, c == '/' ? state - 1 : state);
+            break;
+
+        case TOKEN_ACCEPT:
+            break;
+        }
+    }
+}
+
+//
+// Returns the index of the last pattern accepted in "states", or -1.
+//
+int GlobMatcher::GetMatch(const StateSet& states, bool isDirectory) const
+{
+    int match = -1;
+
+    for (int state : states)
+    {
+        const Token& token = m_tokens[state];
+        if (token.type == TOKEN_ACCEPT && (int) token.value > match &&
+            (isDirectory || !m_patterns[token.value].isDirectoryOnly))
+        {
+            match = (int) token.value;
+        }
+    }
+
+    return match;
+}
+
+bool GlobMatcher::IsPositiveMatch(int pattern) const
+{
+    return pattern >= 0 && !m_patterns[pattern].isNegated;
+}
@@ -0,0 +1,141 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+
+#ifndef Zephyros_GlobMatcher_h
+#define Zephyros_GlobMatcher_h
+#pragma once
+
+
+#include <vector>
+
+#include "base/types.h"
+#include "zephyros.h"
+
+
+//
+// Matches relative paths against a list of gitignore-style patterns:
+//
+//   *, ?, [a-z], [!a-z]   match within a path component
+//   **                     matches any number of directories ("**/x", "a/**/x", "a/**")
+//   !pattern               re-includes paths matched by earlier patterns
+//   pattern/               only matches directories
+//   /pattern, a/pattern    are anchored at the root; other patterns match at any depth
+//
+// As with .gitignore, the last matching pattern decides, and everything in a
+// matched directory is matched as well.
+// The patterns are compiled into a single deterministic automaton, so a path
+// is matched in one pass, independently of the number of patterns.
+// Matching doesn't modify the matcher and can be done from several threads.
+//
+class GlobMatcher
+{
+public:
+    GlobMatcher();
+
+    // Compiles |patterns|, replacing the current ones. Empty lines and lines
+    // starting with "#" are ignored.
+    void SetPatterns(const std::vector<String>& patterns);
+
+    bool IsEmpty() const { return m_patterns.empty(); }
+
+    // Tests whether |path| (relative to the root, separated by "/") or one of
+    // its parent directories is matched.
+    bool Matches(const String& path, bool isDirectory) const;
+
+private:
+    enum TokenType
+    {
+        TOKEN_CHAR,
+        TOKEN_ANY,
+        TOKEN_CLASS,
+        TOKEN_STAR,
+        TOKEN_GLOBSTAR,
+        TOKEN_GLOBSTAR_SLASH,
+        TOKEN_GLOBSTAR_NAME,
+        TOKEN_ACCEPT
+    };
+
+    typedef struct {
+        TokenType type;
+
+        // the character of TOKEN_CHAR, the index of the character class of
+        // TOKEN_CLASS, or the index of the pattern of TOKEN_ACCEPT
+        unsigned int value;
+    } Token;
+
+    typedef struct {
+        std::vector<std::pair<unsigned int, unsigned int> > ranges;
+        bool isNegated;
+    } CharClass;
+
+    typedef struct {
+        bool isNegated;
+        bool isDirectoryOnly;
+    } Pattern;
+
+    typedef std::vector<int> StateSet;
+
+    bool ParsePattern(String pattern);
+    void AddGlobstarSlash();
+    bool ParseCharClass(const String& pattern, size_t& pos);
+    void BuildAlphabet();
+    void BuildAutomaton();
+
+    int GetSymbol(unsigned int c) const;
+    void AddState(StateSet& states, int state) const;
+    void Step(const StateSet& states, unsigned int c, StateSet& next) const;
+    int GetMatch(const StateSet& states, bool isDirectory) const;
+    bool IsPositiveMatch(int pattern) const;
+
+    std::vector<Pattern> m_patterns;
+    std::vector<CharClass> m_charClasses;
+
+    // the tokens of all patterns, each terminated by a TOKEN_ACCEPT; the
+    // states of the nondeterministic automaton are the token indices
+    std::vector<Token> m_tokens;
+    StateSet m_startStates;
+
+    // characters are mapped to symbols, such that all characters of a symbol
+    // are treated the same by all tokens; m_boundaries holds the first
+    // character of each symbol
+    std::vector<unsigned int> m_boundaries;
+    int m_asciiSymbols[128];
+
+    // the deterministic automaton: the next state for each state and symbol,
+    // and the last pattern matching a directory or a file in each state (or
+    // -1). It's not built if it gets too large; the nondeterministic one is
+    // simulated instead.
+    bool m_isDeterministic;
+    int m_numSymbols;
+    std::vector<int> m_transitions;
+    std::vector<int> m_directoryMatches;
+    std::vector<int> m_fileMatches;
+};
+
+
+#endif // Zephyros_GlobMatcher_h
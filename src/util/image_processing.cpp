@@ -0,0 +1,747 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+
+#include <algorithm>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#if !defined(IMAGE_PROCESSING_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGE_PROCESSING_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "util/image_processing.h"
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// The size of the IDAT chunks written by the PNG encoder
+#define PNG_IDAT_CHUNK_SIZE (64 * 1024)
+
+#define CPU_SSE2 1
+#define CPU_SSSE3 2
+#define CPU_AVX2 4
+
+
+namespace ImageUtil {
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+
+static int DetectCPUFeatures()
+{
+    int features = 0;
+
+#ifdef IMAGE_PROCESSING_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2"))
+        features |= CPU_SSE2;
+    if (__builtin_cpu_supports("ssse3"))
+        features |= CPU_SSSE3;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        features |= CPU_AVX2;
+#endif
+
+    return features;
+}
+
+static int GetCPUFeatures()
+{
+    static const int features = DetectCPUFeatures();
+    return features;
+}
+
+//
+// The taps of a one-dimensional resampling filter. Each target pixel is
+// computed from "numTaps" consecutive source pixels starting at "first";
+// all target pixels have the same number of taps (padded with zero
+// weights), so the kernels don't need to deal with ragged rows.
+//
+typedef struct
+{
+    int numTaps;
+    std::vector<int> first;
+    std::vector<float> weights;
+
+    // each weight repeated 4 times, one for each channel (for the SIMD kernels)
+    std::vector<float> weights4;
+} ResampleWeights;
+
+static double Sinc(double x)
+{
+    if (x == 0)
+        return 1;
+
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static double Lanczos3(double x)
+{
+    return x > -3 && x < 3 ? Sinc(x) * Sinc(x / 3) : 0;
+}
+
+static void GetTapRange(int i, int srcSize, double scale, ResampleFilter filter, int& lo, int& hi)
+{
+    if (filter == RESAMPLE_AREA_AVERAGE)
+    {
+        lo = (int) floor(i * scale);
+        hi = (int) ceil((i + 1) * scale);
+    }
+    else
+    {
+        // the filter is stretched when downscaling to avoid aliasing
+        double support = 3.0 * std::max(scale, 1.0);
+        double center = (i + 0.5) * scale;
+        lo = (int) floor(center - support - 0.5);
+        hi = (int) ceil(center + support - 0.5) + 1;
+    }
+
+    lo = std::max(0, std::min(lo, srcSize - 1));
+    hi = std::max(lo + 1, std::min(hi, srcSize));
+}
+
+static void ComputeWeights(int srcSize, int dstSize, ResampleFilter filter, ResampleWeights& w)
+{
+    double scale = (double) srcSize / dstSize;
+    double filterScale = std::max(scale, 1.0);
+
+    // the AVX2 kernel processes two taps at once
+    w.numTaps = 0;
+    for (int i = 0; i < dstSize; ++i)
+    {
+        int lo, hi;
+        GetTapRange(i, srcSize, scale, filter, lo, hi);
+        w.numTaps = std::max(w.numTaps, hi - lo);
+    }
+    w.numTaps = std::min(w.numTaps + (w.numTaps & 1), srcSize);
+
+    w.first.resize(dstSize);
+    w.weights.assign((size_t) dstSize * w.numTaps, 0.0f);
+
+    std::vector<double> weights(w.numTaps);
+    for (int i = 0; i < dstSize; ++i)
+    {
+        int lo, hi;
+        GetTapRange(i, srcSize, scale, filter, lo, hi);
+
+        // move the window so it doesn't extend past the end of the source
+        int first = std::min(lo, srcSize - w.numTaps);
+        w.first[i] = first;
+
+        double sum = 0;
+        std::fill(weights.begin(), weights.end(), 0.0);
+        for (int j = lo; j < hi; ++j)
+        {
+            double weight;
+            if (filter == RESAMPLE_AREA_AVERAGE)
+                weight = std::min(j + 1.0, (i + 1) * scale) - std::max((double) j, i * scale);
+            else
+                weight = Lanczos3((j + 0.5 - (i + 0.5) * scale) / filterScale);
+
+            weights[j - first] = weight;
+            sum += weight;
+        }
+
+        for (int k = 0; k < w.numTaps; ++k)
+            w.weights[(size_t) i * w.numTaps + k] = sum != 0 ? (float) (weights[k] / sum) : 0.0f;
+    }
+
+    w.weights4.resize(w.weights.size() * 4);
+    for (size_t k = 0; k < w.weights.size(); ++k)
+        std::fill(w.weights4.begin() + k * 4, w.weights4.begin() + k * 4 + 4, w.weights[k]);
+}
+
+static inline unsigned char ClampToByte(float v)
+{
+    return v <= 0 ? 0 : (v >= 255 ? 255 : (unsigned char) (v + 0.5f));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Scalar Kernels
+
+static void SwizzleScalar(const unsigned char* src, unsigned char* dst, size_t numPixels)
+{
+    for (size_t i = 0; i < numPixels; ++i, src += 4, dst += 4)
+    {
+        unsigned char b = src[0];
+        unsigned char r = src[2];
+
+        dst[0] = r;
+        dst[1] = src[1];
+        dst[2] = b;
+        dst[3] = src[3];
+    }
+}
+
+static void ResampleHorizontalScalar(const unsigned char* src, int srcWidth, int numRows, float* dst, int dstWidth, const ResampleWeights& w)
+{
+    for (int y = 0; y < numRows; ++y)
+    {
+        const unsigned char* row = src + (size_t) y * srcWidth * 4;
+        float* out = dst + (size_t) y * dstWidth * 4;
+
+        for (int x = 0; x < dstWidth; ++x, out += 4)
+        {
+            const unsigned char* p = row + (size_t) w.first[x] * 4;
+            const float* weights = &w.weights[(size_t) x * w.numTaps];
+            float c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+            for (int k = 0; k < w.numTaps; ++k, p += 4)
+            {
+                c0 += weights[k] * p[0];
+                c1 += weights[k] * p[1];
+                c2 += weights[k] * p[2];
+                c3 += weights[k] * p[3];
+            }
+
+            out[0] = c0;
+            out[1] = c1;
+            out[2] = c2;
+            out[3] = c3;
+        }
+    }
+}
+
+static void ResampleVerticalScalar(const float* src, size_t rowLength, unsigned char* dst, int dstHeight, const ResampleWeights& w)
+{
+    std::vector<float> acc(rowLength);
+
+    for (int y = 0; y < dstHeight; ++y)
+    {
+        const float* weights = &w.weights[(size_t) y * w.numTaps];
+        std::fill(acc.begin(), acc.end(), 0.0f);
+
+        for (int k = 0; k < w.numTaps; ++k)
+        {
+            const float* row = src + (size_t) (w.first[y] + k) * rowLength;
+            for (size_t x = 0; x < rowLength; ++x)
+                acc[x] += weights[k] * row[x];
+        }
+
+        unsigned char* out = dst + (size_t) y * rowLength;
+        for (size_t x = 0; x < rowLength; ++x)
+            out[x] = ClampToByte(acc[x]);
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// SIMD Kernels
+
+#ifdef IMAGE_PROCESSING_X86_SIMD
+
+__attribute__((target("ssse3")))
+static size_t SwizzleSSSE3(const unsigned char* src, unsigned char* dst, size_t numPixels)
+{
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+    size_t i = 0;
+    for ( ; i + 4 <= numPixels; i += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*) (src + i * 4));
+        _mm_storeu_si128((__m128i*) (dst + i * 4), _mm_shuffle_epi8(p, mask));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t SwizzleAVX2(const unsigned char* src, unsigned char* dst, size_t numPixels)
+{
+    const __m256i mask = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+    size_t i = 0;
+    for ( ; i + 8 <= numPixels; i += 8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*) (src + i * 4));
+        _mm256_storeu_si256((__m256i*) (dst + i * 4), _mm256_shuffle_epi8(p, mask));
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static void ResampleHorizontalSSE2(const unsigned char* src, int srcWidth, int numRows, float* dst, int dstWidth, const ResampleWeights& w)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int y = 0; y < numRows; ++y)
+    {
+        const unsigned char* row = src + (size_t) y * srcWidth * 4;
+        float* out = dst + (size_t) y * dstWidth * 4;
+
+        for (int x = 0; x < dstWidth; ++x, out += 4)
+        {
+            const unsigned char* p = row + (size_t) w.first[x] * 4;
+            const float* weights = &w.weights4[(size_t) x * w.numTaps * 4];
+            __m128 acc = _mm_setzero_ps();
+
+            for (int k = 0; k < w.numTaps; ++k, p += 4)
+            {
+                int v;
+                memcpy(&v, p, 4);
+                __m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero), zero);
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_cvtepi32_ps(px), _mm_loadu_ps(weights + k * 4)));
+            }
+
+            _mm_storeu_ps(out, acc);
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static void ResampleVerticalSSE2(const float* src, size_t rowLength, unsigned char* dst, int dstHeight, const ResampleWeights& w)
+{
+    for (int y = 0; y < dstHeight; ++y)
+    {
+        const float* weights = &w.weights[(size_t) y * w.numTaps];
+        const float* rows = src + (size_t) w.first[y] * rowLength;
+        unsigned char* out = dst + (size_t) y * rowLength;
+
+        // 16 values (4 pixels) at a time, packed into 16 bytes
+        size_t x = 0;
+        for ( ; x + 16 <= rowLength; x += 16)
+        {
+            __m128 a0 = _mm_setzero_ps();
+            __m128 a1 = _mm_setzero_ps();
+            __m128 a2 = _mm_setzero_ps();
+            __m128 a3 = _mm_setzero_ps();
+
+            for (int k = 0; k < w.numTaps; ++k)
+            {
+                const float* r = rows + (size_t) k * rowLength + x;
+                __m128 wk = _mm_set1_ps(weights[k]);
+
+                a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(r), wk));
+                a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(r + 4), wk));
+                a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(r + 8), wk));
+                a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(r + 12), wk));
+            }
+
+            // the saturating packs clamp to [0, 255]
+            __m128i s01 = _mm_packs_epi32(_mm_cvtps_epi32(a0), _mm_cvtps_epi32(a1));
+            __m128i s23 = _mm_packs_epi32(_mm_cvtps_epi32(a2), _mm_cvtps_epi32(a3));
+            _mm_storeu_si128((__m128i*) (out + x), _mm_packus_epi16(s01, s23));
+        }
+
+        for ( ; x < rowLength; ++x)
+        {
+            float acc = 0;
+            for (int k = 0; k < w.numTaps; ++k)
+                acc += weights[k] * rows[(size_t) k * rowLength + x];
+            out[x] = ClampToByte(acc);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void ResampleHorizontalAVX2(const unsigned char* src, int srcWidth, int numRows, float* dst, int dstWidth, const ResampleWeights& w)
+{
+    for (int y = 0; y < numRows; ++y)
+    {
+        const unsigned char* row = src + (size_t) y * srcWidth * 4;
+        float* out = dst + (size_t) y * dstWidth * 4;
+
+        for (int x = 0; x < dstWidth; ++x, out += 4)
+        {
+            const unsigned char* p = row + (size_t) w.first[x] * 4;
+            const float* weights = &w.weights4[(size_t) x * w.numTaps * 4];
+            __m256 acc = _mm256_setzero_ps();
+
+            // two pixels at a time
+            int k = 0;
+            for ( ; k + 2 <= w.numTaps; k += 2)
+            {
+                __m256 px = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (p + k * 4))));
+                acc = _mm256_fmadd_ps(px, _mm256_loadu_ps(weights + k * 4), acc);
+            }
+
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+            if (k < w.numTaps)
+            {
+                int v;
+                memcpy(&v, p + k * 4, 4);
+                __m128 px = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v)));
+                sum = _mm_fmadd_ps(px, _mm_loadu_ps(weights + k * 4), sum);
+            }
+
+            _mm_storeu_ps(out, sum);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void ResampleVerticalAVX2(const float* src, size_t rowLength, unsigned char* dst, int dstHeight, const ResampleWeights& w)
+{
+    // restores the order of the values after the in-lane packs
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for (int y = 0; y < dstHeight; ++y)
+    {
+        const float* weights = &w.weights[(size_t) y * w.numTaps];
+        const float* rows = src + (size_t) w.first[y] * rowLength;
+        unsigned char* out = dst + (size_t) y * rowLength;
+
+        // 32 values (8 pixels) at a time, packed into 32 bytes
+        size_t x = 0;
+        for ( ; x + 32 <= rowLength; x += 32)
+        {
+            __m256 a0 = _mm256_setzero_ps();
+            __m256 a1 = _mm256_setzero_ps();
+            __m256 a2 = _mm256_setzero_ps();
+            __m256 a3 = _mm256_setzero_ps();
+
+            for (int k = 0; k < w.numTaps; ++k)
+            {
+                const float* r = rows + (size_t) k * rowLength + x;
+                __m256 wk = _mm256_set1_ps(weights[k]);
+
+                a0 = _mm256_fmadd_ps(_mm256_loadu_ps(r), wk, a0);
+                a1 = _mm256_fmadd_ps(_mm256_loadu_ps(r + 8), wk, a1);
+                a2 = _mm256_fmadd_ps(_mm256_loadu_ps(r + 16), wk, a2);
+                a3 = _mm256_fmadd_ps(_mm256_loadu_ps(r + 24), wk, a3);
+            }
+
+            __m256i s01 = _mm256_packs_epi32(_mm256_cvtps_epi32(a0), _mm256_cvtps_epi32(a1));
+            __m256i s23 = _mm256_packs_epi32(_mm256_cvtps_epi32(a2), _mm256_cvtps_epi32(a3));
+            __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(s01, s23), order);
+            _mm256_storeu_si256((__m256i*) (out + x), bytes);
+        }
+
+        for ( ; x < rowLength; ++x)
+        {
+            float acc = 0;
+            for (int k = 0; k < w.numTaps; ++k)
+                acc += weights[k] * rows[(size_t) k * rowLength + x];
+            out[x] = ClampToByte(acc);
+        }
+    }
+}
+
+#endif // IMAGE_PROCESSING_X86_SIMD
+
+
+//////////////////////////////////////////////////////////////////////////
+// PNG Encoding
+
+static void AppendUInt32(std::vector<unsigned char>& data, uint32_t value)
+{
+    data.push_back((unsigned char) (value >> 24));
+    data.push_back((unsigned char) (value >> 16));
+    data.push_back((unsigned char) (value >> 8));
+    data.push_back((unsigned char) value);
+}
+
+static void AppendChunk(std::vector<unsigned char>& png, const char* type, const unsigned char* data, size_t length)
+{
+    AppendUInt32(png, (uint32_t) length);
+
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    if (length > 0)
+        png.insert(png.end(), data, data + length);
+
+    AppendUInt32(png, (uint32_t) crc32(0, &png[start], (uInt) (length + 4)));
+}
+
+static inline unsigned char PaethPredictor(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return (unsigned char) a;
+    return (unsigned char) (pb <= pc ? b : c);
+}
+
+//
+// Writes the filter type followed by the filtered row to "out".
+// "prev" is the previous unfiltered row (all zeros for the first row).
+//
+static void FilterRow(int type, const unsigned char* row, const unsigned char* prev, size_t length, int bpp, unsigned char* out)
+{
+    out[0] = (unsigned char) type;
+    out++;
+
+    switch (type)
+    {
+    case PNG_FILTER_SUB:
+        for (size_t i = 0; i < length; ++i)
+            out[i] = (unsigned char) (row[i] - (i >= (size_t) bpp ? row[i - bpp] : 0));
+        break;
+
+    case PNG_FILTER_UP:
+        for (size_t i = 0; i < length; ++i)
+            out[i] = (unsigned char) (row[i] - prev[i]);
+        break;
+
+    case PNG_FILTER_AVERAGE:
+        for (size_t i = 0; i < length; ++i)
+            out[i] = (unsigned char) (row[i] - (((i >= (size_t) bpp ? row[i - bpp] : 0) + prev[i]) >> 1));
+        break;
+
+    case PNG_FILTER_PAETH:
+        for (size_t i = 0; i < length; ++i)
+        {
+            if (i >= (size_t) bpp)
+                out[i] = (unsigned char) (row[i] - PaethPredictor(row[i - bpp], prev[i], prev[i - bpp]));
+            else
+                out[i] = (unsigned char) (row[i] - prev[i]);
+        }
+        break;
+
+    default:
+        memcpy(out, row, length);
+        break;
+    }
+}
+
+//
+// The heuristic recommended by the PNG specification: the sum of the
+// filtered bytes interpreted as signed values; smaller is more compressible.
+//
+static unsigned long GetFilterCost(const unsigned char* filtered, size_t length)
+{
+    unsigned long cost = 0;
+    for (size_t i = 0; i < length; ++i)
+        cost += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+    return cost;
+}
+
+//
+// Compresses the pending input, writing an IDAT chunk whenever the output
+// buffer is full, and the rest when the stream is finished.
+//
+static bool Deflate(z_stream& stream, int flush, std::vector<unsigned char>& buffer, std::vector<unsigned char>& png)
+{
+    for ( ; ; )
+    {
+        int ret = deflate(&stream, flush);
+        if (ret == Z_STREAM_ERROR)
+            return false;
+
+        size_t length = buffer.size() - stream.avail_out;
+        if (stream.avail_out == 0 || (ret == Z_STREAM_END && length > 0))
+        {
+            AppendChunk(png, "IDAT", &buffer[0], length);
+            stream.next_out = &buffer[0];
+            stream.avail_out = (uInt) buffer.size();
+        }
+
+        if (ret == Z_STREAM_END)
+            return true;
+        if (flush != Z_FINISH && stream.avail_in == 0 && stream.avail_out > 0)
+            return true;
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Public Functions
+
+/**
+ * Converts BGRA pixels to RGBA.
+ */
+void SwizzleBGRAToRGBA(const unsigned char* src, unsigned char* dst, size_t numPixels)
+{
+    size_t i = 0;
+
+#ifdef IMAGE_PROCESSING_X86_SIMD
+    int features = GetCPUFeatures();
+    if (features & CPU_AVX2)
+        i = SwizzleAVX2(src, dst, numPixels);
+    else if (features & CPU_SSSE3)
+        i = SwizzleSSSE3(src, dst, numPixels);
+#endif
+
+    SwizzleScalar(src + i * 4, dst + i * 4, numPixels - i);
+}
+
+/**
+ * Resamples an image with a separable filter: the rows are resampled into
+ * an intermediate floating point image, whose columns are then resampled.
+ */
+bool Resample(const unsigned char* src, int width, int height,
+    unsigned char* dst, int targetWidth, int targetHeight, ResampleFilter filter)
+{
+    if (src == NULL || dst == NULL || width <= 0 || height <= 0 || targetWidth <= 0 || targetHeight <= 0)
+        return false;
+
+    if (width == targetWidth && height == targetHeight)
+    {
+        memcpy(dst, src, (size_t) width * height * 4);
+        return true;
+    }
+
+    ResampleWeights weightsX;
+    ResampleWeights weightsY;
+    ComputeWeights(width, targetWidth, filter, weightsX);
+    ComputeWeights(height, targetHeight, filter, weightsY);
+
+    std::vector<float> tmp((size_t) height * targetWidth * 4);
+    size_t rowLength = (size_t) targetWidth * 4;
+    int features = GetCPUFeatures();
+
+#ifdef IMAGE_PROCESSING_X86_SIMD
+    if (features & CPU_AVX2)
+    {
+        ResampleHorizontalAVX2(src, width, height, &tmp[0], targetWidth, weightsX);
+        ResampleVerticalAVX2(&tmp[0], rowLength, dst, targetHeight, weightsY);
+        return true;
+    }
+
+    if (features & CPU_SSE2)
+    {
+        ResampleHorizontalSSE2(src, width, height, &tmp[0], targetWidth, weightsX);
+        ResampleVerticalSSE2(&tmp[0], rowLength, dst, targetHeight, weightsY);
+        return true;
+    }
+#else
+    (void) features;
+#endif
+
+    ResampleHorizontalScalar(src, width, height, &tmp[0], targetWidth, weightsX);
+    ResampleVerticalScalar(&tmp[0], rowLength, dst, targetHeight, weightsY);
+    return true;
+}
+
+/**
+ * Encodes an 8-bit RGBA or RGB PNG. The rows are filtered and compressed one
+ * by one, so no copy of the whole image is made.
+ */
+bool EncodePNG(const unsigned char* pixels, int width, int height, bool hasAlpha,
+    int compressionLevel, PNGFilter filter, std::vector<unsigned char>& png)
+{
+    png.clear();
+    if (pixels == NULL || width <= 0 || height <= 0)
+        return false;
+
+    int bpp = hasAlpha ? 4 : 3;
+    size_t rowLength = (size_t) width * bpp;
+
+    static const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    png.insert(png.end(), signature, signature + sizeof(signature));
+
+    std::vector<unsigned char> header;
+    AppendUInt32(header, (uint32_t) width);
+    AppendUInt32(header, (uint32_t) height);
+    header.push_back(8);                    // bit depth
+    header.push_back(hasAlpha ? 6 : 2);     // color type: RGBA or RGB
+    header.push_back(0);                    // compression method
+    header.push_back(0);                    // filter method
+    header.push_back(0);                    // no interlacing
+    AppendChunk(png, "IHDR", &header[0], header.size());
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    int level = compressionLevel < 0 ? Z_DEFAULT_COMPRESSION : std::min(compressionLevel, 9);
+    int strategy = filter == PNG_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15, 8, strategy) != Z_OK)
+    {
+        png.clear();
+        return false;
+    }
+
+    std::vector<unsigned char> buffer(PNG_IDAT_CHUNK_SIZE);
+    stream.next_out = &buffer[0];
+    stream.avail_out = (uInt) buffer.size();
+
+    // the unfiltered current and previous rows, and the filtered rows
+    std::vector<unsigned char> row(rowLength);
+    std::vector<unsigned char> prev(rowLength, 0);
+    std::vector<unsigned char> filtered(rowLength + 1);
+    std::vector<unsigned char> candidate(rowLength + 1);
+
+    bool success = true;
+    for (int y = 0; y < height && success; ++y)
+    {
+        const unsigned char* p = pixels + (size_t) y * width * 4;
+        if (hasAlpha)
+            memcpy(&row[0], p, rowLength);
+        else
+        {
+            for (int x = 0; x < width; ++x, p += 4)
+            {
+                row[x * 3] = p[0];
+                row[x * 3 + 1] = p[1];
+                row[x * 3 + 2] = p[2];
+            }
+        }
+
+        if (filter == PNG_FILTER_ADAPTIVE)
+        {
+            unsigned long minCost = 0;
+            for (int type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; ++type)
+            {
+                FilterRow(type, &row[0], &prev[0], rowLength, bpp, &candidate[0]);
+                unsigned long cost = GetFilterCost(&candidate[1], rowLength);
+                if (type == PNG_FILTER_NONE || cost < minCost)
+                {
+                    minCost = cost;
+                    filtered.swap(candidate);
+                }
+            }
+        }
+        else
+            FilterRow(filter, &row[0], &prev[0], rowLength, bpp, &filtered[0]);
+
+        stream.next_in = &filtered[0];
+        stream.avail_in = (uInt) filtered.size();
+        success = Deflate(stream, y == height - 1 ? Z_FINISH : Z_NO_FLUSH, buffer, png);
+
+        row.swap(prev);
+    }
+
+    deflateEnd(&stream);
+
+    if (!success)
+    {
+        png.clear();
+        return false;
+    }
+
+    AppendChunk(png, "IEND", NULL, 0);
+    return true;
+}
+
+} // namespace ImageUtil
@@ -0,0 +1,90 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+
+#ifndef Zephyros_ImageProcessing_h
+#define Zephyros_ImageProcessing_h
+#pragma once
+
+
+#include <vector>
+#include <stddef.h>
+
+
+//
+// Portable routines for 8-bit, 4-channel images (RGBA or BGRA, rows without
+// padding): channel swizzling, resampling and PNG encoding.
+//
+// On x86 (GCC and Clang) SSE2 and AVX2 kernels are selected at runtime
+// depending on the processor; elsewhere, or if IMAGE_PROCESSING_NO_SIMD is
+// defined, the scalar implementations are used.
+//
+namespace ImageUtil {
+
+enum ResampleFilter
+{
+    // averages the source pixels covered by a target pixel; fast and good
+    // for large reduction factors
+    RESAMPLE_AREA_AVERAGE,
+
+    // windowed sinc with 3 lobes; sharper, but slower
+    RESAMPLE_LANCZOS3
+};
+
+// The PNG row filters (cf. the PNG specification, section 9) and the
+// heuristic choosing the filter for each row
+enum PNGFilter
+{
+    PNG_FILTER_NONE = 0,
+    PNG_FILTER_SUB = 1,
+    PNG_FILTER_UP = 2,
+    PNG_FILTER_AVERAGE = 3,
+    PNG_FILTER_PAETH = 4,
+
+    // the filter yielding the minimum sum of absolute differences, per row
+    PNG_FILTER_ADAPTIVE = 5
+};
+
+// Converts BGRA pixels to RGBA (or vice versa). |src| and |dst| may be the same.
+void SwizzleBGRAToRGBA(const unsigned char* src, unsigned char* dst, size_t numPixels);
+
+// Resamples a 4-channel image of |width| x |height| pixels into |dst|,
+// which must hold |targetWidth| x |targetHeight| pixels. The channels are
+// processed independently, so the channel order doesn't matter.
+bool Resample(const unsigned char* src, int width, int height,
+    unsigned char* dst, int targetWidth, int targetHeight, ResampleFilter filter);
+
+// Encodes RGBA pixels as a PNG. If |hasAlpha| is false, the alpha channel is
+// dropped and an RGB image is written. |compressionLevel| is the zlib level
+// from 0 (store) to 9 (smallest), or -1 for zlib's default.
+bool EncodePNG(const unsigned char* pixels, int width, int height, bool hasAlpha,
+    int compressionLevel, PNGFilter filter, std::vector<unsigned char>& png);
+
+} // namespace ImageUtil
+
+
+#endif // Zephyros_ImageProcessing_h
@@ -72,6 +72,22 @@ void DumpRequestContents(CefRefPtr<CefRequest> request, String& str)
 
     str = ss.str();
 }
+
+String GetRequestHeader(CefRefPtr<CefRequest> request, const String& name)
+{
+    CefRequest::HeaderMap headerMap;
+    request->GetHeaderMap(headerMap);
+
+    String lowerName = ToLower(name);
+    CefRequest::HeaderMap::const_iterator it = headerMap.begin();
+    for (; it != headerMap.end(); ++it)
+    {
+        if (ToLower((*it).first) == lowerName)
+            return (*it).second;
+    }
+
+    return TEXT("");
+}
 #endif
 
 
@@ -105,6 +121,11 @@ bool StringEndsWith(const String& str, const String& suffix)
     return str.compare(lenStr - lenSuffix, lenSuffix, suffix) == 0;
 }
 
+bool StringStartsWith(const String& str, const String& prefix)
+{
+    return str.compare(0, prefix.length(), prefix) == 0;
+}
+
 std::vector<String>& Split(const String &s, TCHAR delim, std::vector<String> &elems)
 {
     StringStream ss(s);
@@ -218,3 +239,18 @@ String DecodeURL(String url)
     
     return out.str();
 }
+
+bool MatchesETag(const String& headerValue, const String& etag)
+{
+    std::vector<String> tags = Split(headerValue, TEXT(','));
+    for (std::vector<String>::iterator it = tags.begin(); it != tags.end(); ++it)
+    {
+        String tag = Trim(*it);
+        if (tag.substr(0, 2) == TEXT("W/"))
+            tag = tag.substr(2);
+        if (tag == TEXT("*") || tag == etag)
+            return true;
+    }
+
+    return false;
+}
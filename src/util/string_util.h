@@ -22,6 +22,10 @@ class CefRequest;
 
 // Dump the contents of the request into a string.
 void DumpRequestContents(CefRefPtr<CefRequest> request, String& str);
+
+// Returns the value of the header |name| (case-insensitive) of |request|,
+// or an empty string if the request doesn't have the header.
+String GetRequestHeader(CefRefPtr<CefRequest> request, const String& name);
 #endif
 
 // Replace all instances of |from| with |to| in |str|.
@@ -30,6 +34,9 @@ String StringReplace(const String& str, const String& from, const String& to);
 // Tests whether str ends with suffix.
 bool StringEndsWith(const String& str, const String& suffix);
 
+// Tests whether str starts with prefix.
+bool StringStartsWith(const String& str, const String& prefix);
+
 std::vector<String>& Split(const String &s, TCHAR delim, std::vector<String> &elems);
 
 std::vector<String> Split(const String &s, TCHAR delim);
@@ -50,4 +57,8 @@ int HexValue(TCHAR c);
 
 String DecodeURL(String url);
 
+// Tests whether |etag| occurs in the comma-separated list of entity tags of an
+// "If-None-Match" header value. Weak tags match strong ones (weak comparison).
+bool MatchesETag(const String& headerValue, const String& etag);
+
 #endif // Zephyros_StringUtil_h
@@ -0,0 +1,426 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ZEPHYROS_TEXT_ENCODING_SSE2
+#endif
+
+#include "util/text_encoding.h"
+
+
+// number of bytes inspected to guess the encoding of data without a byte order mark
+#define DETECTION_SAMPLE_SIZE 4096
+
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+
+/**
+ * Returns the number of leading bytes in data which are ASCII characters.
+ * Uses 16-byte vector compares if available, 8-byte words otherwise.
+ */
+static size_t CountASCII(const uint8_t* data, size_t length)
+{
+    size_t i = 0;
+
+#ifdef ZEPHYROS_TEXT_ENCODING_SSE2
+    for ( ; i + 16 <= length; i += 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (data + i)));
+        if (mask != 0)
+        {
+            // index of the first byte with the high bit set
+            int n = 0;
+            while ((mask & (1 << n)) == 0)
+                ++n;
+            return i + n;
+        }
+    }
+#else
+    for ( ; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        if ((word & 0x8080808080808080ULL) != 0)
+            break;
+    }
+#endif
+
+    while (i < length && data[i] < 0x80)
+        ++i;
+
+    return i;
+}
+
+/**
+ * Appends the UTF-8 representation of the code point c to out and
+ * returns the position after the written bytes.
+ */
+static inline char* AppendUTF8(char* out, uint32_t c)
+{
+    if (c < 0x80)
+        *out++ = (char) c;
+    else if (c < 0x800)
+    {
+        *out++ = (char) (0xc0 | (c >> 6));
+        *out++ = (char) (0x80 | (c & 0x3f));
+    }
+    else if (c < 0x10000)
+    {
+        *out++ = (char) (0xe0 | (c >> 12));
+        *out++ = (char) (0x80 | ((c >> 6) & 0x3f));
+        *out++ = (char) (0x80 | (c & 0x3f));
+    }
+    else
+    {
+        *out++ = (char) (0xf0 | (c >> 18));
+        *out++ = (char) (0x80 | ((c >> 12) & 0x3f));
+        *out++ = (char) (0x80 | ((c >> 6) & 0x3f));
+        *out++ = (char) (0x80 | (c & 0x3f));
+    }
+
+    return out;
+}
+
+static inline uint32_t ReadUTF16(const uint8_t* p, bool bigEndian)
+{
+    return bigEndian ? (uint32_t) ((p[0] << 8) | p[1]) : (uint32_t) (p[0] | (p[1] << 8));
+}
+
+/**
+ * Transcodes UTF-16 to UTF-8 in a single pass.
+ * Each code unit produces at most 3 bytes of output, so the output buffer is
+ * allocated once up front and trimmed at the end.
+ */
+static void DecodeUTF16(const uint8_t* data, size_t length, bool bigEndian, std::string& result)
+{
+    size_t start = result.size();
+    result.resize(start + (length / 2) * 3 + 3);
+    char* out = &result[start];
+
+    size_t i = 0;
+    while (i + 1 < length)
+    {
+#ifdef ZEPHYROS_TEXT_ENCODING_SSE2
+        // fast path: convert 8 ASCII code units at a time
+        while (i + 16 <= length)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+            if (bigEndian)
+                v = _mm_or_si128(_mm_srli_epi16(v, 8), _mm_slli_epi16(v, 8));
+
+            // any bits above 0x7f set in one of the code units?
+            __m128i high = _mm_and_si128(v, _mm_set1_epi16((short) 0xff80));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xffff)
+                break;
+
+            _mm_storel_epi64((__m128i*) out, _mm_packus_epi16(v, v));
+            out += 8;
+            i += 16;
+        }
+
+        if (i + 1 >= length)
+            break;
+#endif
+
+        uint32_t c = ReadUTF16(data + i, bigEndian);
+        i += 2;
+
+        if (c >= 0xd800 && c <= 0xdbff)
+        {
+            // high surrogate; must be followed by a low surrogate
+            uint32_t c2 = i + 1 < length ? ReadUTF16(data + i, bigEndian) : 0;
+            if (c2 >= 0xdc00 && c2 <= 0xdfff)
+            {
+                c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+                i += 2;
+            }
+            else
+                c = 0xfffd;
+        }
+        else if (c >= 0xdc00 && c <= 0xdfff)
+            c = 0xfffd;
+
+        out = AppendUTF8(out, c);
+    }
+
+    // a dangling odd byte at the end
+    if (i < length)
+        out = AppendUTF8(out, 0xfffd);
+
+    result.resize(out - &result[0]);
+}
+
+/**
+ * Transcodes Latin-1 (ISO-8859-1) to UTF-8; ASCII runs are copied as a block.
+ */
+static void DecodeLatin1(const uint8_t* data, size_t length, std::string& result)
+{
+    size_t start = result.size();
+    result.resize(start + length * 2);
+    char* out = &result[start];
+
+    size_t i = 0;
+    while (i < length)
+    {
+        size_t n = CountASCII(data + i, length - i);
+        memcpy(out, data + i, n);
+        out += n;
+        i += n;
+
+        // non-ASCII bytes map directly to U+0080..U+00FF
+        for ( ; i < length && data[i] >= 0x80; ++i)
+        {
+            *out++ = (char) (0xc0 | (data[i] >> 6));
+            *out++ = (char) (0x80 | (data[i] & 0x3f));
+        }
+    }
+
+    result.resize(out - &result[0]);
+}
+
+/**
+ * Tests whether the byte c is a control character which usually doesn't
+ * appear in text files.
+ */
+static inline bool IsBinaryControlCharacter(uint8_t c)
+{
+    return c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != '\v' && c != 0x1b;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Public API
+
+TextEncoding GetTextEncodingFromName(std::string name)
+{
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    // accept MIME type-like names such as "text/plain;utf-8" or "text/plain; charset=utf-8"
+    size_t pos = name.find_last_of(";=");
+    if (pos != std::string::npos)
+        name = name.substr(pos + 1);
+    name.erase(std::remove(name.begin(), name.end(), ' '), name.end());
+
+    if (name == "utf-8" || name == "utf8")
+        return TEXT_ENCODING_UTF8;
+    if (name == "utf-16le" || name == "utf16le" || name == "utf-16" || name == "utf16" || name == "ucs-2")
+        return TEXT_ENCODING_UTF16LE;
+    if (name == "utf-16be" || name == "utf16be")
+        return TEXT_ENCODING_UTF16BE;
+    if (name == "latin1" || name == "latin-1" || name == "iso-8859-1" || name == "iso8859-1" || name == "us-ascii" || name == "ascii")
+        return TEXT_ENCODING_LATIN1;
+    if (name == "binary")
+        return TEXT_ENCODING_BINARY;
+
+    return TEXT_ENCODING_UNKNOWN;
+}
+
+const char* GetTextEncodingName(TextEncoding encoding)
+{
+    switch (encoding)
+    {
+    case TEXT_ENCODING_BINARY:
+        return "binary";
+    case TEXT_ENCODING_UTF8:
+        return "utf-8";
+    case TEXT_ENCODING_UTF16LE:
+        return "utf-16le";
+    case TEXT_ENCODING_UTF16BE:
+        return "utf-16be";
+    case TEXT_ENCODING_LATIN1:
+        return "latin1";
+    default:
+        return "";
+    }
+}
+
+size_t GetByteOrderMarkLength(const uint8_t* data, size_t length, TextEncoding encoding)
+{
+    switch (encoding)
+    {
+    case TEXT_ENCODING_UTF8:
+        return length >= 3 && data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf ? 3 : 0;
+    case TEXT_ENCODING_UTF16LE:
+        return length >= 2 && data[0] == 0xff && data[1] == 0xfe ? 2 : 0;
+    case TEXT_ENCODING_UTF16BE:
+        return length >= 2 && data[0] == 0xfe && data[1] == 0xff ? 2 : 0;
+    default:
+        return 0;
+    }
+}
+
+TextEncoding DetectTextEncoding(const uint8_t* data, size_t length, size_t* bomLength)
+{
+    static const TextEncoding bomEncodings[] = { TEXT_ENCODING_UTF8, TEXT_ENCODING_UTF16LE, TEXT_ENCODING_UTF16BE };
+    for (size_t i = 0; i < sizeof(bomEncodings) / sizeof(bomEncodings[0]); ++i)
+    {
+        size_t len = GetByteOrderMarkLength(data, length, bomEncodings[i]);
+        if (len > 0)
+        {
+            if (bomLength)
+                *bomLength = len;
+            return bomEncodings[i];
+        }
+    }
+
+    if (bomLength)
+        *bomLength = 0;
+
+    // look at the distribution of NUL and control characters at the beginning
+    size_t sampleLen = std::min(length, (size_t) DETECTION_SAMPLE_SIZE);
+    size_t numEvenZeros = 0;
+    size_t numOddZeros = 0;
+    size_t numControlChars = 0;
+
+    for (size_t i = 0; i < sampleLen; ++i)
+    {
+        if (data[i] == 0)
+        {
+            if (i & 1)
+                ++numOddZeros;
+            else
+                ++numEvenZeros;
+        }
+        else if (IsBinaryControlCharacter(data[i]))
+            ++numControlChars;
+    }
+
+    if (numEvenZeros + numOddZeros > 0)
+    {
+        // mostly-ASCII UTF-16 text has a zero in every other byte
+        size_t numPairs = sampleLen / 2;
+        if (numEvenZeros == 0 && numOddZeros * 4 >= numPairs && (length & 1) == 0)
+            return TEXT_ENCODING_UTF16LE;
+        if (numOddZeros == 0 && numEvenZeros * 4 >= numPairs && (length & 1) == 0)
+            return TEXT_ENCODING_UTF16BE;
+
+        return TEXT_ENCODING_BINARY;
+    }
+
+    if (IsValidUTF8(data, length))
+        return TEXT_ENCODING_UTF8;
+
+    // not UTF-8; either a single-byte encoded text or binary data
+    if (numControlChars * 10 > sampleLen)
+        return TEXT_ENCODING_BINARY;
+
+    return TEXT_ENCODING_LATIN1;
+}
+
+bool IsValidUTF8(const uint8_t* data, size_t length)
+{
+    size_t i = 0;
+
+    while (i < length)
+    {
+        // skip runs of ASCII characters
+        i += CountASCII(data + i, length - i);
+        if (i >= length)
+            break;
+
+        // validate a multi-byte sequence (cf. RFC 3629, table 3-7 of the Unicode standard)
+        uint8_t c = data[i];
+        size_t numTrailing;
+        uint8_t lo = 0x80;
+        uint8_t hi = 0xbf;
+
+        if (c >= 0xc2 && c <= 0xdf)
+            numTrailing = 1;
+        else if (c == 0xe0)
+        {
+            numTrailing = 2;
+            lo = 0xa0;
+        }
+        else if ((c >= 0xe1 && c <= 0xec) || c == 0xee || c == 0xef)
+            numTrailing = 2;
+        else if (c == 0xed)
+        {
+            // exclude surrogates
+            numTrailing = 2;
+            hi = 0x9f;
+        }
+        else if (c == 0xf0)
+        {
+            numTrailing = 3;
+            lo = 0x90;
+        }
+        else if (c >= 0xf1 && c <= 0xf3)
+            numTrailing = 3;
+        else if (c == 0xf4)
+        {
+            // exclude code points above U+10FFFF
+            numTrailing = 3;
+            hi = 0x8f;
+        }
+        else
+            return false;
+
+        if (length - i <= numTrailing)
+            return false;
+        if (data[i + 1] < lo || data[i + 1] > hi)
+            return false;
+        for (size_t k = 2; k <= numTrailing; ++k)
+            if ((data[i + k] & 0xc0) != 0x80)
+                return false;
+
+        i += numTrailing + 1;
+    }
+
+    return true;
+}
+
+bool DecodeText(const uint8_t* data, size_t length, TextEncoding encoding, std::string& result)
+{
+    switch (encoding)
+    {
+    case TEXT_ENCODING_UTF8:
+        if (!IsValidUTF8(data, length))
+            return false;
+        result.append((const char*) data, length);
+        return true;
+
+    case TEXT_ENCODING_UTF16LE:
+        DecodeUTF16(data, length, false, result);
+        return true;
+
+    case TEXT_ENCODING_UTF16BE:
+        DecodeUTF16(data, length, true, result);
+        return true;
+
+    case TEXT_ENCODING_LATIN1:
+        DecodeLatin1(data, length, result);
+        return true;
+
+    default:
+        return false;
+    }
+}
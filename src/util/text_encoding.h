@@ -0,0 +1,71 @@
+/*******************************************************************************
+ * Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+ *
+ * The MIT License (MIT)
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Contributors:
+ * Matthias Christen, Vanamco AG
+ *******************************************************************************/
+
+
+#ifndef Zephyros_TextEncoding_h
+#define Zephyros_TextEncoding_h
+#pragma once
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+
+enum TextEncoding
+{
+    TEXT_ENCODING_UNKNOWN,
+    TEXT_ENCODING_BINARY,
+    TEXT_ENCODING_UTF8,
+    TEXT_ENCODING_UTF16LE,
+    TEXT_ENCODING_UTF16BE,
+    TEXT_ENCODING_LATIN1
+};
+
+// Returns the encoding for an encoding name such as "utf-8", "utf-16le" or "latin1",
+// or TEXT_ENCODING_UNKNOWN if the name isn't recognized.
+TextEncoding GetTextEncodingFromName(std::string name);
+
+// Returns the canonical name of an encoding.
+const char* GetTextEncodingName(TextEncoding encoding);
+
+// Guesses the encoding of data from its byte order mark or, if there is none,
+// from its contents. The length of the byte order mark is stored in bomLength.
+TextEncoding DetectTextEncoding(const uint8_t* data, size_t length, size_t* bomLength);
+
+// Returns the length of the byte order mark of encoding at the start of data, or 0.
+size_t GetByteOrderMarkLength(const uint8_t* data, size_t length, TextEncoding encoding);
+
+// Tests whether data is well-formed UTF-8.
+bool IsValidUTF8(const uint8_t* data, size_t length);
+
+// Converts data in the given encoding to UTF-8 and appends it to result.
+// Returns false if the data isn't valid UTF-8 or the encoding isn't a text encoding.
+// Malformed UTF-16 is replaced by U+FFFD.
+bool DecodeText(const uint8_t* data, size_t length, TextEncoding encoding, std::string& result);
+
+
+#endif // Zephyros_TextEncoding_h
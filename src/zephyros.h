@@ -289,6 +289,23 @@ const TCHAR* GetUpdaterURL();
 void SetUpdaterURL(const TCHAR* szURL);
 #endif
 
+/**
+ * Enables the persistent (disk) HTTP cache in the directory "szCachePath".
+ * "nMaxSize" is the maximum size of the cache in bytes; if 0, Chromium's
+ * default is used. Must be called before Run.
+ * If not set, the cache is kept in memory and discarded when the app quits.
+ */
+const TCHAR* GetCachePath();
+uint64_t GetCacheSize();
+void SetCachePath(const TCHAR* szCachePath, uint64_t nMaxSize = 0);
+
+/**
+ * The build hash identifies the version of the app resources. Defaults to the
+ * content hash of the resource pack (Linux) or the app name and version.
+ */
+const TCHAR* GetBuildHash();
+void SetBuildHash(const TCHAR* szBuildHash);
+
 AbstractLicenseManager* GetLicenseManager();
 void SetLicenseManager(AbstractLicenseManager* pLicenseManager);
 
@@ -305,6 +322,15 @@ void SetResourceID(const TCHAR* szResourceName, int nID);
 #ifdef OS_LINUX
 bool GetResource(const TCHAR* szResourceName, char*& pData, int& nLen);
 void SetResource(const TCHAR* szResourceName, char* pData, int nLen);
+
+/**
+ * Sets the path of the resource pack built by tools/make_resource_pack.py.
+ * Defaults to "resources.pak" in the directory of the executable.
+ * Resources in the pack take precedence over resources set by SetResource.
+ * Must be called before the first resource is loaded; the pack stays mapped
+ * while the app is running.
+ */
+void SetResourcePackPath(const TCHAR* szPath);
 #endif
 
 bool UseLogging();
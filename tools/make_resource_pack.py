@@ -0,0 +1,295 @@
+#!/usr/bin/env python3
+# Copyright (c) 2015-2017 Vanamco AG, http://www.vanamco.com
+#
+# The MIT License (MIT)
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+"""Usage: make_resource_pack.py [options] <webapp-dir> <output.pak>
+
+Builds a resource pack from all files in |webapp-dir|, which is read by
+Zephyros::GetResource on Linux (see src/base/resource_pack.h for the format).
+
+Resource names are "<webapp-dir name>/<relative path>", where the first path
+component is lowercased, because Chromium lowercases the host part of app://
+URLs.
+
+Options:
+  --header <file>   Also write a C++ include file defining an empty
+                    SetResources() function, as expected by
+                    RUN_APPLICATION_ARGS, for apps that don't link resources
+                    into the executable any more.
+  --align <n>       Alignment of the entry data in bytes (default: 16).
+  --no-compress     Store all entries uncompressed.
+  --level <n>       gzip compression level (default: 9).
+"""
+
+import gzip
+import hashlib
+import io
+import os
+import struct
+import sys
+
+
+MAGIC = b'ZPAK'
+VERSION = 1
+DIRECT = 0x80000000
+
+COMPRESSION_NONE = 0
+COMPRESSION_GZIP = 1
+
+HEADER_FORMAT = '<4sIIIIIQ'
+ENTRY_FORMAT = '<IIQQQII'
+
+# only compress resources which usually compress well
+COMPRESSIBLE_EXTENSIONS = set([
+    '.html', '.htm', '.js', '.css', '.json', '.svg', '.txt', '.xml', '.map', '.wasm'
+])
+
+
+def murmurhash3_x86_32(data, seed):
+    """MurmurHash3_x86_32 as implemented in src/util/MurmurHash3.cpp."""
+    c1 = 0xcc9e2d51
+    c2 = 0x1b873593
+    length = len(data)
+    h1 = seed & 0xffffffff
+    rounded_end = length & ~3
+
+    for i in range(0, rounded_end, 4):
+        k1 = struct.unpack_from('<I', data, i)[0]
+        k1 = (k1 * c1) & 0xffffffff
+        k1 = ((k1 << 15) | (k1 >> 17)) & 0xffffffff
+        k1 = (k1 * c2) & 0xffffffff
+
+        h1 ^= k1
+        h1 = ((h1 << 13) | (h1 >> 19)) & 0xffffffff
+        h1 = (h1 * 5 + 0xe6546b64) & 0xffffffff
+
+    k1 = 0
+    tail = length & 3
+    if tail == 3:
+        k1 ^= data[rounded_end + 2] << 16
+    if tail >= 2:
+        k1 ^= data[rounded_end + 1] << 8
+    if tail >= 1:
+        k1 ^= data[rounded_end]
+        k1 = (k1 * c1) & 0xffffffff
+        k1 = ((k1 << 15) | (k1 >> 17)) & 0xffffffff
+        k1 = (k1 * c2) & 0xffffffff
+        h1 ^= k1
+
+    h1 ^= length
+    h1 ^= h1 >> 16
+    h1 = (h1 * 0x85ebca6b) & 0xffffffff
+    h1 ^= h1 >> 13
+    h1 = (h1 * 0xc2b2ae35) & 0xffffffff
+    h1 ^= h1 >> 16
+
+    return h1
+
+
+def build_perfect_hash(names):
+    """Computes a "hash and displace" perfect hash for |names|.
+
+    Returns (seed, displacements, slots), where slots[i] is the index into
+    |names| of the name stored at table position i.
+    """
+    n = len(names)
+    num_buckets = max(1, (n + 3) // 4)
+
+    for seed in range(1, 1000):
+        buckets = [[] for _ in range(num_buckets)]
+        for i, name in enumerate(names):
+            buckets[murmurhash3_x86_32(name, seed) % num_buckets].append(i)
+
+        displacements = [0] * num_buckets
+        slots = [None] * n
+        ok = True
+
+        # place the largest buckets first while there are many free slots
+        order = sorted(range(num_buckets), key=lambda b: -len(buckets[b]))
+        free = [i for i in range(n)]
+
+        for b in order:
+            bucket = buckets[b]
+            if len(bucket) == 0:
+                break
+
+            if len(bucket) == 1:
+                # single keys are placed directly into any free slot
+                while slots[free[-1]] is not None:
+                    free.pop()
+                slot = free.pop()
+                slots[slot] = bucket[0]
+                displacements[b] = DIRECT | slot
+                continue
+
+            for d in range(0, 1 << 20):
+                positions = [murmurhash3_x86_32(names[i], d) % n for i in bucket]
+                if len(set(positions)) == len(positions) and all(slots[p] is None for p in positions):
+                    for i, p in zip(bucket, positions):
+                        slots[p] = i
+                    displacements[b] = d
+                    break
+            else:
+                ok = False
+                break
+
+        if ok:
+            return seed, displacements, slots
+
+    raise RuntimeError('Failed to build a perfect hash for the resources')
+
+
+def collect_resources(webapp_dir):
+    webapp_dir = os.path.abspath(webapp_dir)
+    prefix = os.path.basename(webapp_dir).lower()
+    resources = []
+
+    for root, dirs, files in os.walk(webapp_dir):
+        dirs.sort()
+        for filename in sorted(files):
+            path = os.path.join(root, filename)
+            rel = os.path.relpath(path, webapp_dir).replace(os.sep, '/')
+            resources.append((prefix + '/' + rel, path))
+
+    return resources
+
+
+def gzip_data(data, level):
+    buf = io.BytesIO()
+    # mtime=0 for reproducible packs
+    with gzip.GzipFile(fileobj=buf, mode='wb', compresslevel=level, mtime=0) as f:
+        f.write(data)
+    return buf.getvalue()
+
+
+def align(offset, alignment):
+    return (offset + alignment - 1) // alignment * alignment
+
+
+def make_pack(resources, output, alignment, compress, level):
+    names = [name.encode('utf-8') for name, _ in resources]
+    n = len(names)
+
+    if n > 0:
+        seed, displacements, slots = build_perfect_hash(names)
+    else:
+        seed, displacements, slots = 0, [0], []
+
+    num_buckets = len(displacements)
+    displacements_size = ((num_buckets + 1) & ~1) * 4
+    header_size = struct.calcsize(HEADER_FORMAT)
+    entry_size = struct.calcsize(ENTRY_FORMAT)
+
+    names_offset = header_size + displacements_size + n * entry_size
+    names_blob = b''.join(names[i] for i in slots)
+    data_offset = align(names_offset + len(names_blob), alignment)
+
+    entries = []
+    blobs = []
+    name_offset = names_offset
+    offset = data_offset
+    content_hash = hashlib.sha1()
+
+    for i in slots:
+        name, path = resources[i]
+        with open(path, 'rb') as f:
+            data = f.read()
+
+        content_hash.update(names[i])
+        content_hash.update(struct.pack('<Q', len(data)))
+        content_hash.update(data)
+
+        compression = COMPRESSION_NONE
+        stored = data
+        if compress and os.path.splitext(path)[1].lower() in COMPRESSIBLE_EXTENSIONS:
+            compressed = gzip_data(data, level)
+            if len(compressed) < len(data):
+                compression = COMPRESSION_GZIP
+                stored = compressed
+
+        offset = align(offset, alignment)
+        entries.append(struct.pack(ENTRY_FORMAT,
+            name_offset, len(names[i]), offset, len(stored), len(data), compression, 0))
+        blobs.append((offset, stored))
+
+        name_offset += len(names[i])
+        offset += len(stored)
+
+    with open(output, 'wb') as f:
+        content_hash = struct.unpack('<Q', content_hash.digest()[:8])[0]
+        f.write(struct.pack(HEADER_FORMAT, MAGIC, VERSION, n, num_buckets, seed, alignment, content_hash))
+        f.write(struct.pack('<%dI' % num_buckets, *displacements))
+        if num_buckets & 1:
+            f.write(b'\0' * 4)
+        f.write(b''.join(entries))
+        f.write(names_blob)
+
+        for blob_offset, blob in blobs:
+            f.write(b'\0' * (blob_offset - f.tell()))
+            f.write(blob)
+
+
+def write_header(header):
+    with open(header, 'w') as f:
+        f.write('// App resources are loaded from the resource pack (resources.pak).\n')
+        f.write('void SetResources()\n')
+        f.write('{\n')
+        f.write('}\n')
+
+
+def main(argv):
+    args = []
+    header = None
+    alignment = 16
+    compress = True
+    level = 9
+
+    i = 0
+    while i < len(argv):
+        arg = argv[i]
+        if arg == '--header':
+            header = argv[i + 1]
+            i += 1
+        elif arg == '--align':
+            alignment = int(argv[i + 1])
+            i += 1
+        elif arg == '--no-compress':
+            compress = False
+        elif arg == '--level':
+            level = int(argv[i + 1])
+            i += 1
+        else:
+            args.append(arg)
+        i += 1
+
+    if len(args) != 2 or alignment <= 0 or (alignment & (alignment - 1)) != 0:
+        print(__doc__)
+        return 1
+
+    make_pack(collect_resources(args[0]), args[1], alignment, compress, level)
+    if header:
+        write_header(header)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))